@@ -0,0 +1,40 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// An in-memory cache of album art converted to other image formats
+// Every track of an album usually carries the same image, so each conversion is done once rather than once per output file
+@interface AlbumArtCache : NSObject
+{
+	NSMutableDictionary		*_convertedData;
+	NSMapTable				*_convertedImages;
+}
+
++ (AlbumArtCache *)		sharedCache;
+
+// Converted images are keyed by a digest of the original bytes
+- (NSData *)			dataForImageData:(NSData *)imageData ofType:(NSBitmapImageFileType)type;
+
+// Converted images are keyed by the identity of the image
+- (NSData *)			dataForImage:(NSImage *)image ofType:(NSBitmapImageFileType)type;
+
+@end
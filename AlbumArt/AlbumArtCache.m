@@ -0,0 +1,142 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "AlbumArtCache.h"
+#import "UtilityFunctions.h"
+
+#include <CommonCrypto/CommonDigest.h>
+
+// The cache is cleared when it holds more than this many distinct images
+#define MAXIMUM_CACHED_IMAGES		32
+
+static AlbumArtCache		*sSharedCache			= nil;
+
+@implementation AlbumArtCache
+
++ (AlbumArtCache *) sharedCache
+{
+	@synchronized(self) {
+		if(nil == sSharedCache)
+			sSharedCache = [[self alloc] init];
+	}
+	
+	return sSharedCache;
+}
+
+- (id) init
+{
+	if((self = [super init])) {
+		_convertedData		= [[NSMutableDictionary alloc] init];
+		_convertedImages	= [[NSMapTable mapTableWithStrongToStrongObjects] retain];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_convertedData release];		_convertedData = nil;
+	[_convertedImages release];		_convertedImages = nil;
+	
+	[super dealloc];
+}
+
+- (NSData *) dataForImageData:(NSData *)imageData ofType:(NSBitmapImageFileType)type
+{
+	NSParameterAssert(nil != imageData);
+	
+	NSMutableString			*digestString;
+	NSMutableDictionary		*conversions;
+	NSNumber				*key				= [NSNumber numberWithUnsignedInteger:type];
+	NSData					*data				= nil;
+	unsigned char			digest				[ CC_MD5_DIGEST_LENGTH ];
+	unsigned				i;
+	
+	CC_MD5([imageData bytes], (CC_LONG)[imageData length], digest);
+	
+	digestString = [NSMutableString string];
+	for(i = 0; i < CC_MD5_DIGEST_LENGTH; ++i)
+		[digestString appendFormat:@"%02x", digest[i]];
+	
+	@synchronized(self) {
+		data = [[[[_convertedData objectForKey:digestString] objectForKey:key] retain] autorelease];
+	}
+	
+	if(nil != data)
+		return data;
+	
+	// Two threads may convert the same image concurrently; the result is identical either way
+	data = [[NSBitmapImageRep imageRepWithData:imageData] representationUsingType:type properties:nil];
+	if(nil == data)
+		return nil;
+	
+	@synchronized(self) {
+		if(MAXIMUM_CACHED_IMAGES < [_convertedData count])
+			[_convertedData removeAllObjects];
+		
+		conversions = [_convertedData objectForKey:digestString];
+		if(nil == conversions) {
+			conversions = [NSMutableDictionary dictionary];
+			[_convertedData setObject:conversions forKey:digestString];
+		}
+		
+		[conversions setObject:data forKey:key];
+	}
+	
+	return data;
+}
+
+- (NSData *) dataForImage:(NSImage *)image ofType:(NSBitmapImageFileType)type
+{
+	NSParameterAssert(nil != image);
+	
+	NSMutableDictionary		*conversions;
+	NSNumber				*key				= [NSNumber numberWithUnsignedInteger:type];
+	NSData					*data				= nil;
+	
+	@synchronized(self) {
+		data = [[[[_convertedImages objectForKey:image] objectForKey:key] retain] autorelease];
+	}
+	
+	if(nil != data)
+		return data;
+	
+	data = getBitmapDataForImage(image, type);
+	if(nil == data)
+		return nil;
+	
+	@synchronized(self) {
+		if(MAXIMUM_CACHED_IMAGES < [_convertedImages count])
+			[_convertedImages removeAllItems];
+		
+		conversions = [_convertedImages objectForKey:image];
+		if(nil == conversions) {
+			conversions = [NSMutableDictionary dictionary];
+			[_convertedImages setObject:conversions forKey:image];
+		}
+		
+		[conversions setObject:data forKey:key];
+	}
+	
+	return data;
+}
+
+@end
@@ -34,6 +34,10 @@
 	NSUInteger			_leadOut;
 		
 	NSUInteger			_length;
+	
+	NSString			*_discID;
+	NSURL				*_discIDSubmissionUrl;
+	NSString			*_freeDBDiscID;
 }
 
 - (id)					initWithDeviceName:(NSString *)deviceName;
@@ -21,11 +21,17 @@
 #import "CompactDisc.h"
 
 #import "Drive.h"
+#import "DiscInfoCache.h"
 #import "LogController.h"
 
 #include <discid/discid.h>
 #include <IOKit/storage/IOCDTypes.h>
 
+@interface CompactDisc (Private)
+- (void)		calculateDiscIDs;
+- (NSArray *)	TOC;
+@end
+
 @implementation CompactDisc
 
 - (id) initWithDeviceName:(NSString *)deviceName;
@@ -37,6 +43,8 @@
 		Drive					*drive			= nil;
 		TrackDescriptor			*track			= nil;
 		NSMutableDictionary		*trackInfo		= nil;
+		NSDictionary			*cachedInfo		= nil;
+		NSMutableDictionary		*discInfo		= nil;
 		NSString				*ISRC			= nil;
 
 		_deviceName		= [deviceName retain];
@@ -58,8 +66,6 @@
 
 		_leadOut		= [drive leadOutForSession:session];
 
-		_MCN			= [[drive readMCN] retain];
-		
 		// Iterate through the tracks and get their information
 		_tracks			= [[NSMutableArray alloc] init];
 		
@@ -80,10 +86,6 @@
 			[trackInfo setObject:[NSNumber numberWithBool:[track copyPermitted]] forKey:@"allowsDigitalCopy"];
 			[trackInfo setObject:[NSNumber numberWithBool:[track dataTrack]] forKey:@"dataTrack"];
 
-			ISRC = [drive readISRC:i];
-			if(nil != ISRC)
-				[trackInfo setObject:ISRC forKey:@"ISRC"];
-
 			[_tracks addObject:trackInfo];
 		}
 		
@@ -91,6 +93,44 @@
 			discLength += [self lastSectorForTrack:i] - [self firstSectorForTrack:i] + 1;
 		_length = (NSUInteger) (60 * (discLength / (60 * 75))) + (NSUInteger)((discLength / 75) % 60);
 		
+		[self calculateDiscIDs];
+		
+		// Reading the MCN and ISRCs requires the drive to scan the Q sub-channel, so
+		// reuse the values from the last time this disc was inserted if they exist
+		cachedInfo = [[DiscInfoCache sharedCache] infoForDiscID:[self discID]];
+		
+		if(nil != cachedInfo && [[cachedInfo objectForKey:@"TOC"] isEqualToArray:[self TOC]]) {
+			_MCN = [[cachedInfo objectForKey:@"MCN"] retain];
+			
+			for(i = 0; i < [self countOfTracks]; ++i) {
+				ISRC = [[cachedInfo objectForKey:@"ISRCs"] objectAtIndex:i];
+				if(0 != [ISRC length])
+					[[_tracks objectAtIndex:i] setObject:ISRC forKey:@"ISRC"];
+			}
+		}
+		else {
+			_MCN = [[drive readMCN] retain];
+			
+			discInfo = [NSMutableDictionary dictionary];
+			[discInfo setValue:[self TOC] forKey:@"TOC"];
+			[discInfo setValue:[self MCN] forKey:@"MCN"];
+			[discInfo setValue:[self freeDBDiscID] forKey:@"freeDBDiscID"];
+			[discInfo setValue:[[self discIDSubmissionUrl] absoluteString] forKey:@"discIDSubmissionUrl"];
+			[discInfo setValue:[NSMutableArray array] forKey:@"ISRCs"];
+
+			for(i = 0; i < [self countOfTracks]; ++i) {
+				ISRC = [drive readISRC:[[[_tracks objectAtIndex:i] objectForKey:@"number"] unsignedIntegerValue]];
+				if(nil != ISRC)
+					[[_tracks objectAtIndex:i] setObject:ISRC forKey:@"ISRC"];
+				
+				// Property lists can't contain NSNull
+				[[discInfo objectForKey:@"ISRCs"] addObject:(nil != ISRC ? ISRC : @"")];
+			}
+			
+			if(nil != [self discID])
+				[[DiscInfoCache sharedCache] setInfo:discInfo forDiscID:[self discID]];
+		}
+		
 		[drive release];
 				
 		return self;
@@ -104,6 +144,10 @@
 	[_deviceName release];		_deviceName = nil;
 	[_tracks release];			_tracks = nil;
 	[_MCN release];				_MCN = nil;
+	
+	[_discID release];					_discID = nil;
+	[_discIDSubmissionUrl release];		_discIDSubmissionUrl = nil;
+	[_freeDBDiscID release];			_freeDBDiscID = nil;
 
 	[super dealloc];
 }
@@ -128,38 +172,26 @@
 
 - (NSString *)		ISRCForTrack:(NSUInteger)track			{ return [[self objectInTracksAtIndex:track] objectForKey:@"ISRC"]; }
 
-- (NSString *) discID
-{
-	NSString *musicBrainzDiscID = nil;
-	
-	DiscId *discID = discid_new();
-	if(NULL == discID)
-		return nil;
-	
-	// zero is lead out
-	int offsets[100];
-	offsets[0] = [self leadOut] + 150;
-	
-	NSUInteger i;
-	for(i = 0; i < [self countOfTracks]; ++i)
-		offsets[1 + i] = [self firstSectorForTrack:i] + 150;
+- (NSString *)		discID									{ return [[_discID retain] autorelease]; }
+- (NSURL *)			discIDSubmissionUrl						{ return [[_discIDSubmissionUrl retain] autorelease]; }
+- (NSString *)		freeDBDiscID							{ return [[_freeDBDiscID retain] autorelease]; }
 
-	int result = discid_put(discID, 1, [self countOfTracks], offsets);
-	if(result)
-		musicBrainzDiscID = [NSString stringWithCString:discid_get_id(discID) encoding:NSASCIIStringEncoding];
-		
-	discid_free(discID);
-	
-	return [[musicBrainzDiscID retain] autorelease];
-}
+- (NSUInteger)		length									{ return _length; }
+
+// KVC
+- (NSUInteger)		countOfTracks							{ return [_tracks count]; }
+- (NSDictionary *)	objectInTracksAtIndex:(NSUInteger)index	{ return [_tracks objectAtIndex:index]; }
+
+@end
 
-- (NSURL *) discIDSubmissionUrl
+@implementation CompactDisc (Private)
+
+// All three identifiers come from the same discid_put
+- (void) calculateDiscIDs
 {
-	NSURL *submissionUrl = nil;
-	
 	DiscId *discID = discid_new();
 	if(NULL == discID)
-		return nil;
+		return;
 	
 	// zero is lead out
 	int offsets[100];
@@ -170,43 +202,27 @@
 		offsets[1 + i] = [self firstSectorForTrack:i] + 150;
 	
 	int result = discid_put(discID, 1, [self countOfTracks], offsets);
-	if(result)
-		submissionUrl = [NSURL URLWithString:[NSString stringWithCString:discid_get_submission_url(discID) encoding:NSASCIIStringEncoding]];
+	if(result) {
+		_discID					= [[NSString stringWithCString:discid_get_id(discID) encoding:NSASCIIStringEncoding] retain];
+		_discIDSubmissionUrl	= [[NSURL URLWithString:[NSString stringWithCString:discid_get_submission_url(discID) encoding:NSASCIIStringEncoding]] retain];
+		_freeDBDiscID			= [[NSString stringWithCString:discid_get_freedb_id(discID) encoding:NSASCIIStringEncoding] retain];
+	}
 	
 	discid_free(discID);
-	
-	return [[submissionUrl retain] autorelease];
 }
 
-- (NSString *) freeDBDiscID
+// The first sector of each track followed by the lead out, used to validate cached information
+- (NSArray *) TOC
 {
-	NSString *freeDBDiscID = nil;
-	
-	DiscId *discID = discid_new();
-	if(NULL == discID)
-		return nil;
+	NSMutableArray	*result		= [NSMutableArray arrayWithCapacity:[self countOfTracks] + 1];
+	NSUInteger		i;
 	
-	// zero is lead out
-	int offsets[100];
-	offsets[0] = [self leadOut] + 150;
-	
-	NSUInteger i;
 	for(i = 0; i < [self countOfTracks]; ++i)
-		offsets[1 + i] = [self firstSectorForTrack:i] + 150;
+		[result addObject:[NSNumber numberWithUnsignedInteger:[self firstSectorForTrack:i]]];
 	
-	int result = discid_put(discID, 1, [self countOfTracks], offsets);
-	if(result)
-		freeDBDiscID = [NSString stringWithCString:discid_get_freedb_id(discID) encoding:NSASCIIStringEncoding];
+	[result addObject:[NSNumber numberWithUnsignedInteger:[self leadOut]]];
 	
-	discid_free(discID);
-	
-	return [[freeDBDiscID retain] autorelease];
+	return result;
 }
 
-- (NSUInteger)		length									{ return _length; }
-
-// KVC
-- (NSUInteger)		countOfTracks							{ return [_tracks count]; }
-- (NSDictionary *)	objectInTracksAtIndex:(NSUInteger)index	{ return [_tracks objectAtIndex:index]; }
-
 @end
@@ -0,0 +1,40 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// A persistent cache of the information read from audio CDs that is slow to query from the drive
+// (MCN and ISRCs), stored along with the TOC and disc identifiers and keyed by MusicBrainz disc ID
+@interface DiscInfoCache : NSObject
+{
+	NSMutableDictionary		*_discs;
+	NSString				*_filename;
+}
+
++ (DiscInfoCache *)		sharedCache;
+
+// Returns the cached information for discID, or nil if the disc hasn't been seen
+- (NSDictionary *)		infoForDiscID:(NSString *)discID;
+
+// Store the information for discID and save the cache
+- (void)				setInfo:(NSDictionary *)info forDiscID:(NSString *)discID;
+
+@end
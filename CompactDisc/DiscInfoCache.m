@@ -0,0 +1,91 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "DiscInfoCache.h"
+#import "UtilityFunctions.h"
+
+static DiscInfoCache *sharedCache = nil;
+
+@implementation DiscInfoCache
+
++ (DiscInfoCache *) sharedCache
+{
+	@synchronized(self) {
+		if(nil == sharedCache) {
+			sharedCache = [[self alloc] init];
+		}
+	}
+	return sharedCache;
+}
+
+- (id) init
+{
+	if((self = [super init])) {
+		_filename	= [[getApplicationDataDirectory() stringByAppendingPathComponent:@"DiscInfoCache.plist"] retain];
+		_discs		= [[NSMutableDictionary alloc] initWithContentsOfFile:_filename];
+		
+		if(nil == _discs) {
+			_discs = [[NSMutableDictionary alloc] init];
+		}
+		
+		return self;
+	}
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_discs release],		_discs = nil;
+	[_filename release],	_filename = nil;
+	
+	[super dealloc];
+}
+
+- (NSDictionary *) infoForDiscID:(NSString *)discID
+{
+	NSDictionary *result = nil;
+	
+	if(nil == discID) {
+		return nil;
+	}
+	
+	@synchronized(self) {
+		result = [[[_discs objectForKey:discID] retain] autorelease];
+	}
+	
+	return result;
+}
+
+- (void) setInfo:(NSDictionary *)info forDiscID:(NSString *)discID
+{
+	NSParameterAssert(nil != info);
+	NSParameterAssert(nil != discID);
+	
+	@synchronized(self) {
+		[_discs setObject:info forKey:discID];
+		
+		if(NO == [_discs writeToFile:_filename atomically:YES]) {
+			NSLog(@"Unable to save the disc information cache to %@", _filename);
+		}
+	}
+}
+
+@end
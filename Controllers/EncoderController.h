@@ -54,6 +54,10 @@ enum {
 - (void)			encodeFiles:(NSArray *)filenames metadata:(AudioMetadata *)metadata settings:(NSDictionary *)settings;
 - (void)			encodeFiles:(NSArray *)filenames metadata:(AudioMetadata *)metadata settings:(NSDictionary *)settings inputTracks:(NSArray *)inputTracks;
 
+// Rewrites the tags of a file previously encoded in format, without re-encoding it
+// The file is moved if the new tags name it differently, and its filename afterward is returned
+- (NSString *)		retagFile:(NSString *)filename metadata:(AudioMetadata *)metadata settings:(NSDictionary *)settings format:(NSDictionary *)format encoderSettingsString:(NSString *)encoderSettingsString;
+
 - (BOOL)			documentHasEncoderTasks:(CompactDiscDocument *)document;
 - (void)			stopEncoderTasksForDocument:(CompactDiscDocument *)document;
 
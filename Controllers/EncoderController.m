@@ -34,7 +34,9 @@
 #import "WavPackEncoderTask.h"
 
 #import "LogController.h"
+#import "LibraryMirror.h"
 #import "RipperController.h"
+#import "UtilityFunctions.h"
 
 #import <Growl/GrowlApplicationBridge.h>
 #include <AudioToolbox/AudioFile.h>
@@ -46,6 +48,7 @@
 static EncoderController *sharedController = nil;
 
 @interface EncoderController (Private)
+- (Class)	encoderTaskClassForFormat:(NSDictionary *)format;
 - (void)	runEncoder:(Class)encoderClass taskInfo:(TaskInfo *)taskInfo encoderSettings:(NSDictionary *)encoderSettings;
 - (void)	addTask:(EncoderTask *)task;
 - (void)	removeTask:(EncoderTask *)task;
@@ -131,6 +134,7 @@ static EncoderController *sharedController = nil;
 	TaskInfo		*taskInfo			= [TaskInfo taskInfoWithSettings:settings metadata:metadata];
 	NSArray			*outputFormats		= [settings objectForKey:@"encoders"];
 	NSDictionary	*format				= nil;
+	Class			encoderClass		= Nil;
 	NSUInteger		i					= 0;
 	
 	[taskInfo setInputFilenames:filenames];
@@ -139,50 +143,63 @@ static EncoderController *sharedController = nil;
 	for(i = 0; i < [outputFormats count]; ++i) {
 		format = [outputFormats objectAtIndex:i];
 		
-		switch([[format objectForKey:@"component"] intValue]) {
+		encoderClass = [self encoderTaskClassForFormat:format];
+		
+		if(Nil != encoderClass)
+			[self runEncoder:encoderClass taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
+	}	
+}
+
+- (NSString *) retagFile:(NSString *)filename metadata:(AudioMetadata *)metadata settings:(NSDictionary *)settings format:(NSDictionary *)format encoderSettingsString:(NSString *)encoderSettingsString
+{
+	NSParameterAssert(nil != filename);
+	NSParameterAssert(nil != format);
+	
+	Class			encoderClass		= [self encoderTaskClassForFormat:format];
+	EncoderTask		*encoderTask		= nil;
+	NSString		*basename			= nil;
+	NSString		*name				= nil;
+	NSString		*suffix				= nil;
+	NSString		*newFilename		= nil;
+	BOOL			result;
+	
+	if(Nil == encoderClass)
+		return filename;
+	
+	// The task is never run; it is only used for its naming and tag writer
+	encoderTask = [[encoderClass alloc] init];
+	
+	@try {
+		[encoderTask setTaskInfo:[TaskInfo taskInfoWithSettings:settings metadata:metadata]];
+		[encoderTask setEncoderSettings:[format objectForKey:@"settings"]];
+		
+		basename	= [encoderTask outputBasename];
+		name		= [filename stringByDeletingPathExtension];
+		suffix		= ([name hasPrefix:[basename stringByAppendingString:@"-"]] ? [name substringFromIndex:[basename length] + 1] : nil);
+		
+		// The new tags may name the file differently; a "-n" suffix from generateUniqueFilename still counts as a match
+		if(NO == [name isEqualToString:basename] 
+		   && (0 == [suffix length] || NSNotFound != [suffix rangeOfCharacterFromSet:[[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location)) {
+			createDirectoryStructure(basename);
+			
+			newFilename		= generateUniqueFilename(basename, [filename pathExtension]);
+			result			= [[NSFileManager defaultManager] moveItemAtPath:filename toPath:newFilename error:nil];
 			
-			case kComponentFLAC:
-				[self runEncoder:[FLACEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentOggFLAC:
-				[self runEncoder:[OggFLACEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentWavPack:
-				[self runEncoder:[WavPackEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentMonkeysAudio:
-				[self runEncoder:[MonkeysAudioEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentOggVorbis:
-				[self runEncoder:[OggVorbisEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentMP3:
-				[self runEncoder:[MP3EncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentOggSpeex:
-				[self runEncoder:[OggSpeexEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentCoreAudio:
-				[self runEncoder:[CoreAudioEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			case kComponentLibsndfile:
-				[self runEncoder:[LibsndfileEncoderTask class] taskInfo:taskInfo encoderSettings:[format objectForKey:@"settings"]];
-				break;
-				
-			default:
-				NSLog(@"Unknown component: %@", [format objectForKey:@"component"]);
-				break;
+			releaseUniqueFilename(newFilename);
+			releaseUniqueFilename(filename);
+			NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to rename the output file.", @"Exceptions", @""));
+			
+			filename = newFilename;
 		}
 		
-	}	
+		[encoderTask writeTagsToFile:filename encoderSettingsString:encoderSettingsString];
+	}
+	
+	@finally {
+		[encoderTask release];
+	}
+	
+	return filename;
 }
 
 - (BOOL) documentHasEncoderTasks:(CompactDiscDocument *)document
@@ -308,6 +325,9 @@ static EncoderController *sharedController = nil;
 							   notificationName:@"Encode completed" iconData:nil priority:0 isSticky:NO clickContext:nil];
 	}
 	
+	// Let the library mirror record where this file's output went
+	[[LibraryMirror sharedMirror] encoderTaskDidComplete:task];
+	
 	[task retain];
 	
 	[self removeTask:task];
@@ -353,6 +373,25 @@ static EncoderController *sharedController = nil;
 
 @implementation EncoderController (Private)
 
+- (Class) encoderTaskClassForFormat:(NSDictionary *)format
+{
+	switch([[format objectForKey:@"component"] intValue]) {
+		case kComponentFLAC:			return [FLACEncoderTask class];
+		case kComponentOggFLAC:			return [OggFLACEncoderTask class];
+		case kComponentWavPack:			return [WavPackEncoderTask class];
+		case kComponentMonkeysAudio:	return [MonkeysAudioEncoderTask class];
+		case kComponentOggVorbis:		return [OggVorbisEncoderTask class];
+		case kComponentMP3:				return [MP3EncoderTask class];
+		case kComponentOggSpeex:		return [OggSpeexEncoderTask class];
+		case kComponentCoreAudio:		return [CoreAudioEncoderTask class];
+		case kComponentLibsndfile:		return [LibsndfileEncoderTask class];
+		
+		default:
+			NSLog(@"Unknown component: %@", [format objectForKey:@"component"]);
+			return Nil;
+	}
+}
+
 - (void) runEncoder:(Class)encoderClass taskInfo:(TaskInfo *)taskInfo encoderSettings:(NSDictionary *)encoderSettings
 {
 	// Create the task
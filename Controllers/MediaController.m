@@ -22,6 +22,7 @@
 
 #import "CompactDisc.h"
 #import "CompactDiscDocument.h"
+#import "Drive.h"
 #import "RipperController.h"
 #import "EncoderController.h"
 #import "LogController.h"
@@ -213,6 +214,9 @@ static MediaController *sharedController = nil;
 		
 		[LogController logMessage:[NSString stringWithFormat:@"Found CD on device %@", deviceName]];
 		
+		// A different disc may have been in this device previously
+		[Drive discardCachedTOCForDeviceName:deviceName];
+		
 		disc		= [[[CompactDisc alloc] initWithDeviceName:deviceName] autorelease];
 		filename	= [NSString stringWithFormat:@"%@/%@.cdinfo", getApplicationDataDirectory(), [disc discID]];
 		oldFilename	= [NSString stringWithFormat:@"%@/0x%@.cdinfo", getApplicationDataDirectory(), [disc freeDBDiscID]];
@@ -274,6 +278,8 @@ static MediaController *sharedController = nil;
 	CompactDiscDocument		*document;
 	CompactDisc				*disc;
 	
+	[Drive discardCachedTOCForDeviceName:deviceName];
+	
 	while((document = [documentEnumerator nextObject])) {
 		disc = [document disc];
 		// If disc is nil, disc was unmounted by another agency (most likely user pressed eject key)
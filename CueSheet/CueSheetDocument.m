@@ -20,6 +20,7 @@
 
 #import "CueSheetDocument.h"
 #import "CueSheetDocumentToolbar.h"
+#import "CueSheetSplitter.h"
 #import "EncoderController.h"
 #import "FormatsController.h"
 #import "PreferencesController.h"
@@ -206,6 +207,9 @@
 				_MCN = [[NSString stringWithCString:value encoding:NSUTF8StringEncoding] retain];
 		}
 		
+		// Most cue sheets describe a single image, which only needs to be opened once
+		NSMutableDictionary *decoders = [NSMutableDictionary dictionary];
+		
 		// Parse each track
 		NSUInteger i;
 		for(i = 1; i <= cd_get_ntrack(cd); ++i) {
@@ -229,10 +233,15 @@
 
 			@try {
 				// TODO: Merge with AudioDecoders from Play and remove this
-				Decoder *decoder = [Decoder decoderWithFilename:[newTrack filename]];
-				
-				if(nil == decoder)
-					continue;
+				Decoder *decoder = [decoders objectForKey:[newTrack filename]];
+				if(nil == decoder) {
+					decoder = [Decoder decoderWithFilename:[newTrack filename]];
+					
+					if(nil == decoder)
+						continue;
+					
+					[decoders setObject:decoder forKey:[newTrack filename]];
+				}
 				
 				[newTrack setSampleRate:[decoder pcmFormat].mSampleRate];
 				[newTrack setStartingFrame:(track_get_start(track) / (float)75) * [decoder pcmFormat].mSampleRate];
@@ -566,6 +575,25 @@
 	}
 
 	NSArray *selectedTracks = [self selectedTracks];
+	
+	// When the tracks come from a single image, decode it once and hand each track to the encoders as it is reached
+	if(1 < [selectedTracks count] && 1 == [[NSSet setWithArray:[selectedTracks valueForKey:@"filename"]] count]) {
+		@try {
+			[CueSheetSplitter splitTracks:selectedTracks settings:settings];
+		}
+		
+		@catch(NSException *exception) {
+			NSAlert *alert = [[[NSAlert alloc] init] autorelease];
+			[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
+			[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while converting the file \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[[selectedTracks objectAtIndex:0] filename]]]];
+			[alert setInformativeText:[exception reason]];
+			[alert setAlertStyle:NSWarningAlertStyle];		
+			[alert runModal];
+		}
+		
+		return;
+	}
+	
 	for(i = 0; i < [selectedTracks count]; ++i) {
 		CueSheetTrack *currentTrack = [selectedTracks objectAtIndex:i];
 		
@@ -0,0 +1,44 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+@class Decoder;
+
+// Decodes a cue sheet's image file front to back exactly once, streaming each track's frames to the
+// encoders for that track as they are decoded
+// The encoders are queued as usual, and when one opens its track it is handed a decoder fed by the splitter
+@interface CueSheetSplitter : NSObject
+{
+	NSString		*_filename;
+	Decoder			*_decoder;
+	NSArray			*_regions;
+	NSCondition		*_condition;
+}
+
+// tracks must all reference the same file; settings are those passed to -[EncoderController encodeFile:metadata:settings:]
++ (void) splitTracks:(NSArray *)tracks settings:(NSDictionary *)settings;
+
+// A decoder for the track of filename at startingFrame that is fed by a running splitter, or nil if there is none
+// Each encoder gets its own; an encoder that starts after the splitter has begun its track reads the file itself
++ (Decoder *) decoderForFilename:(NSString *)filename startingFrame:(SInt64)startingFrame frameCount:(NSUInteger)frameCount;
+
+@end
@@ -0,0 +1,656 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "CueSheetSplitter.h"
+#import "CueSheetTrack.h"
+#import "EncoderController.h"
+#import "Decoder.h"
+#import "CircularBuffer.h"
+
+#define SPLIT_BUFFER_SIZE		(64 * 1024)
+
+// Decoded audio waiting for any one encoder is limited to this many bytes, after which the splitter waits for it
+#define MAXIMUM_QUEUED_BYTES	(2 * 1024 * 1024)
+
+// The splitters that are running, which encoders opening a track ask for a decoder
+static NSMutableArray		*sSplitters		= nil;
+
+#pragma mark CueSheetSplitterFeed
+
+// The audio of one region on its way to one encoder
+// All feeds of a splitter share its condition, which guards their state
+@interface CueSheetSplitterFeed : NSObject
+{
+	NSCondition		*_condition;
+	NSMutableArray	*_chunks;
+	NSUInteger		_queuedBytes;
+	BOOL			_finished;
+	BOOL			_closed;
+	NSException		*_exception;
+}
+
+- (id)				initWithCondition:(NSCondition *)condition;
+
+// Called by the splitter; appending waits while too much audio is queued, unless the encoder has gone
+- (void)			appendChunk:(NSData *)chunk;
+- (void)			finishWithException:(NSException *)exception;
+- (BOOL)			isClosed;
+
+// Called by the encoder; nil once the region is complete
+- (NSData *)		nextChunk;
+- (void)			close;
+
+@end
+
+@implementation CueSheetSplitterFeed
+
+- (id) initWithCondition:(NSCondition *)condition
+{
+	if((self = [super init])) {
+		_condition		= [condition retain];
+		_chunks			= [[NSMutableArray alloc] init];
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_condition release],		_condition = nil;
+	[_chunks release],			_chunks = nil;
+	[_exception release],		_exception = nil;
+	
+	[super dealloc];
+}
+
+- (void) appendChunk:(NSData *)chunk
+{
+	[_condition lock];
+	
+	while(MAXIMUM_QUEUED_BYTES <= _queuedBytes && NO == _closed)
+		[_condition wait];
+	
+	if(NO == _closed) {
+		[_chunks addObject:chunk];
+		_queuedBytes += [chunk length];
+		[_condition broadcast];
+	}
+	
+	[_condition unlock];
+}
+
+- (void) finishWithException:(NSException *)exception
+{
+	[_condition lock];
+	
+	if(NO == _finished) {
+		_finished	= YES;
+		_exception	= [exception retain];
+		[_condition broadcast];
+	}
+	
+	[_condition unlock];
+}
+
+- (BOOL) isClosed
+{
+	BOOL result;
+	
+	[_condition lock];
+	result = _closed;
+	[_condition unlock];
+	
+	return result;
+}
+
+- (NSData *) nextChunk
+{
+	NSData			*chunk			= nil;
+	NSException		*exception		= nil;
+	
+	[_condition lock];
+	
+	while(0 == [_chunks count] && NO == _finished)
+		[_condition wait];
+	
+	if(0 != [_chunks count]) {
+		chunk = [[[_chunks objectAtIndex:0] retain] autorelease];
+		[_chunks removeObjectAtIndex:0];
+		_queuedBytes -= [chunk length];
+		[_condition broadcast];
+	}
+	else
+		exception = [[_exception retain] autorelease];
+	
+	[_condition unlock];
+	
+	// The encoder fails the same way it would if it were decoding the file itself
+	if(nil != exception)
+		@throw exception;
+	
+	return chunk;
+}
+
+- (void) close
+{
+	[_condition lock];
+	
+	_closed = YES;
+	[_chunks removeAllObjects];
+	_queuedBytes = 0;
+	[_condition broadcast];
+	
+	[_condition unlock];
+}
+
+@end
+
+#pragma mark CueSheetSplitterDecoder
+
+// Supplies an encoder with one region of the image, in the image's frame numbering, as the splitter decodes it
+@interface CueSheetSplitterDecoder : Decoder
+{
+	CueSheetSplitterFeed	*_feed;
+	SInt64					_endingFrame;
+	NSString				*_sourceFormatDescription;
+}
+
+- (id) initWithFilename:(NSString *)filename decoder:(Decoder *)decoder startingFrame:(SInt64)startingFrame frameCount:(UInt32)frameCount feed:(CueSheetSplitterFeed *)feed;
+
+@end
+
+@implementation CueSheetSplitterDecoder
+
+- (id) initWithFilename:(NSString *)filename decoder:(Decoder *)decoder startingFrame:(SInt64)startingFrame frameCount:(UInt32)frameCount feed:(CueSheetSplitterFeed *)feed
+{
+	if((self = [super initWithFilename:filename])) {
+		_feed						= [feed retain];
+		_pcmFormat					= [decoder pcmFormat];
+		_sourceFormatDescription	= [[decoder sourceFormatDescription] retain];
+		_currentFrame				= startingFrame;
+		_endingFrame				= startingFrame + frameCount;
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	// Once the encoder is finished with it, the splitter no longer waits for this feed
+	[_feed close];
+	
+	[_feed release],						_feed = nil;
+	[_sourceFormatDescription release],		_sourceFormatDescription = nil;
+	
+	[super dealloc];
+}
+
+- (NSString *)		sourceFormatDescription			{ return [[_sourceFormatDescription retain] autorelease]; }
+- (SInt64)			totalFrames						{ return _endingFrame; }
+
+// The audio can only be read in order, so the only seek possible is to the current position
+- (SInt64) seekToFrame:(SInt64)frame
+{
+	return (frame == [self currentFrame] ? frame : -1);
+}
+
+- (void) fillPCMBuffer
+{
+	CircularBuffer		*buffer			= [self pcmBuffer];
+	NSData				*chunk			= [_feed nextChunk];
+	
+	if(nil == chunk)
+		return;
+	
+	if([buffer freeSpaceAvailable] < [chunk length])
+		[buffer resize:[buffer bytesAvailable] + [chunk length]];
+	
+	[buffer putData:[chunk bytes] byteCount:[chunk length]];
+}
+
+@end
+
+#pragma mark CueSheetSplitterRegion
+
+// One track of the image, and the feeds of the encoders that have asked for it
+@interface CueSheetSplitterRegion : NSObject
+{
+	NSCondition		*_condition;
+	SInt64			_startingFrame;
+	UInt32			_frameCount;
+	NSMutableArray	*_feeds;
+	BOOL			_started;
+	BOOL			_abandoned;
+}
+
+- (id)				initWithTrack:(CueSheetTrack *)track condition:(NSCondition *)condition;
+
+- (SInt64)			startingFrame;
+- (UInt32)			frameCount;
+
+// Called with the condition locked
+- (NSMutableArray *) feeds;
+- (BOOL)			started;
+- (void)			setStarted:(BOOL)started;
+- (BOOL)			abandoned;
+
+// Once every encoder for the track has gone, the splitter doesn't wait for one to ask for it
+- (void)			abandon;
+
+@end
+
+@implementation CueSheetSplitterRegion
+
+- (id) initWithTrack:(CueSheetTrack *)track condition:(NSCondition *)condition
+{
+	if((self = [super init])) {
+		_condition		= [condition retain];
+		_startingFrame	= [track startingFrame];
+		_frameCount		= [track frameCount];
+		_feeds			= [[NSMutableArray alloc] init];
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_condition release],		_condition = nil;
+	[_feeds release],			_feeds = nil;
+	
+	[super dealloc];
+}
+
+- (SInt64)				startingFrame					{ return _startingFrame; }
+- (UInt32)				frameCount						{ return _frameCount; }
+
+- (NSMutableArray *)	feeds							{ return _feeds; }
+- (BOOL)				started							{ return _started; }
+- (void)				setStarted:(BOOL)started		{ _started = started; }
+- (BOOL)				abandoned						{ return _abandoned; }
+
+- (void) abandon
+{
+	[_condition lock];
+	_abandoned = YES;
+	[_condition broadcast];
+	[_condition unlock];
+}
+
+@end
+
+#pragma mark CueSheetSplitterRegionReference
+
+// Kept in the settings of a track's encoders, so it is released along with the last of them
+@interface CueSheetSplitterRegionReference : NSObject
+{
+	CueSheetSplitterRegion		*_region;
+}
+- (id) initWithRegion:(CueSheetSplitterRegion *)region;
+@end
+
+@implementation CueSheetSplitterRegionReference
+
+- (id) initWithRegion:(CueSheetSplitterRegion *)region
+{
+	if((self = [super init])) {
+		_region = [region retain];
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_region abandon];
+	[_region release],		_region = nil;
+	
+	[super dealloc];
+}
+
+@end
+
+#pragma mark CueSheetSplitter
+
+@interface CueSheetSplitter (Private)
+- (id)			initWithTracks:(NSArray *)tracks;
+- (NSString *)	filename;
+- (CueSheetSplitterRegion *) regionForTrack:(CueSheetTrack *)track;
+- (Decoder *)	decoderForStartingFrame:(SInt64)startingFrame frameCount:(NSUInteger)frameCount;
+- (void)		split:(id)object;
+- (NSArray *)	feedsForRegion:(CueSheetSplitterRegion *)region;
+- (void)		positionDecoderAtFrame:(SInt64)frame;
+- (void)		copyFrames:(UInt32)frameCount toFeeds:(NSArray *)feeds;
+@end
+
+@implementation CueSheetSplitter
+
++ (void) initialize
+{
+	if(nil == sSplitters)
+		sSplitters = [[NSMutableArray alloc] init];
+}
+
++ (void) splitTracks:(NSArray *)tracks settings:(NSDictionary *)settings
+{
+	CueSheetSplitter					*splitter			= [[CueSheetSplitter alloc] initWithTracks:tracks];
+	NSMutableArray						*references			= [NSMutableArray array];
+	CueSheetSplitterRegionReference		*reference;
+	NSMutableDictionary					*framesToConvert;
+	NSMutableDictionary					*trackSettings;
+	CueSheetTrack						*track;
+	NSUInteger							i;
+	
+	@try {
+		// A track whose encoders can't be queued is abandoned when these are released
+		for(track in tracks) {
+			reference = [[CueSheetSplitterRegionReference alloc] initWithRegion:[splitter regionForTrack:track]];
+			[references addObject:reference];
+			[reference release];
+		}
+		
+		@synchronized(sSplitters) {
+			[sSplitters addObject:splitter];
+		}
+		
+		// The thread retains the splitter for as long as it runs
+		[NSThread detachNewThreadSelector:@selector(split:) toTarget:splitter withObject:nil];
+		
+		// The encoders are queued exactly as they would be for tracks read separately
+		for(i = 0; i < [tracks count]; ++i) {
+			track				= [tracks objectAtIndex:i];
+			framesToConvert		= [NSMutableDictionary dictionary];
+			trackSettings		= [NSMutableDictionary dictionary];
+			
+			[framesToConvert setValue:[NSNumber numberWithLongLong:[track startingFrame]] forKey:@"startingFrame"];
+			[framesToConvert setValue:[NSNumber numberWithUnsignedInt:[track frameCount]] forKey:@"frameCount"];
+			
+			[trackSettings setValue:framesToConvert forKey:@"framesToConvert"];
+			[trackSettings setValue:[references objectAtIndex:i] forKey:@"cueSheetSplitterRegion"];
+			[trackSettings addEntriesFromDictionary:settings];
+			
+			[[EncoderController sharedController] encodeFile:[track filename] metadata:[track metadata] settings:trackSettings];
+		}
+	}
+	
+	@finally {
+		[splitter release];
+	}
+}
+
++ (Decoder *) decoderForFilename:(NSString *)filename startingFrame:(SInt64)startingFrame frameCount:(NSUInteger)frameCount
+{
+	CueSheetSplitter	*splitter;
+	Decoder				*decoder		= nil;
+	
+	@synchronized(sSplitters) {
+		for(splitter in sSplitters) {
+			if([[splitter filename] isEqualToString:filename] && nil != (decoder = [splitter decoderForStartingFrame:startingFrame frameCount:frameCount]))
+				break;
+		}
+	}
+	
+	return decoder;
+}
+
+- (void) dealloc
+{
+	[_filename release];		_filename = nil;
+	[_decoder release];			_decoder = nil;
+	[_regions release];			_regions = nil;
+	[_condition release];		_condition = nil;
+	
+	[super dealloc];
+}
+
+@end
+
+@implementation CueSheetSplitter (Private)
+
+- (id) initWithTracks:(NSArray *)tracks
+{
+	NSParameterAssert(0 != [tracks count]);
+	
+	if((self = [super init])) {
+		NSMutableArray			*regions			= [NSMutableArray array];
+		CueSheetSplitterRegion	*region;
+		CueSheetTrack			*track;
+		
+		_filename	= [[[tracks objectAtIndex:0] filename] retain];
+		_condition	= [[NSCondition alloc] init];
+		
+		for(track in tracks) {
+			NSAssert([[track filename] isEqualToString:_filename], NSLocalizedStringFromTable(@"The tracks to split must all be contained in the same file.", @"Exceptions", @""));
+			
+			region = [[CueSheetSplitterRegion alloc] initWithTrack:track condition:_condition];
+			[regions addObject:region];
+			[region release];
+		}
+		
+		[regions sortUsingDescriptors:[NSArray arrayWithObject:[[[NSSortDescriptor alloc] initWithKey:@"startingFrame" ascending:YES] autorelease]]];
+		_regions = [regions retain];
+		
+		// Open the image here, so a file that can't be decoded is reported before any encoders are queued
+		_decoder = [[Decoder decoderWithFilename:_filename] retain];
+	}
+	
+	return self;
+}
+
+- (NSString *) filename			{ return [[_filename retain] autorelease]; }
+
+- (CueSheetSplitterRegion *) regionForTrack:(CueSheetTrack *)track
+{
+	CueSheetSplitterRegion *region;
+	
+	for(region in _regions) {
+		if([region startingFrame] == [track startingFrame])
+			return region;
+	}
+	
+	return nil;
+}
+
+- (Decoder *) decoderForStartingFrame:(SInt64)startingFrame frameCount:(NSUInteger)frameCount
+{
+	CueSheetSplitterRegion		*region;
+	CueSheetSplitterFeed		*feed;
+	Decoder						*decoder		= nil;
+	
+	[_condition lock];
+	
+	// Audio that has already gone by can't be supplied
+	for(region in _regions) {
+		if([region startingFrame] != startingFrame || [region frameCount] != frameCount || [region started])
+			continue;
+		
+		feed	= [[CueSheetSplitterFeed alloc] initWithCondition:_condition];
+		decoder	= [[[CueSheetSplitterDecoder alloc] initWithFilename:_filename decoder:_decoder startingFrame:[region startingFrame] frameCount:[region frameCount] feed:feed] autorelease];
+		
+		[[region feeds] addObject:feed];
+		[feed release];
+		
+		[_condition broadcast];
+		break;
+	}
+	
+	[_condition unlock];
+	
+	return decoder;
+}
+
+- (void) split:(id)object
+{
+	NSAutoreleasePool			*pool				= [[NSAutoreleasePool alloc] init];
+	NSAutoreleasePool			*regionPool			= nil;
+	NSException					*failure			= nil;
+	CueSheetSplitterRegion		*region;
+	CueSheetSplitterFeed		*feed;
+	NSArray						*feeds;
+	
+	@try {
+		for(region in _regions) {
+			regionPool	= [[NSAutoreleasePool alloc] init];
+			feeds		= [self feedsForRegion:region];
+			
+			// Tracks no encoder is waiting for are skipped
+			if(0 != [feeds count]) {
+				[self positionDecoderAtFrame:[region startingFrame]];
+				[self copyFrames:[region frameCount] toFeeds:feeds];
+			}
+			
+			for(feed in feeds)
+				[feed finishWithException:nil];
+			
+			[regionPool release], regionPool = nil;
+		}
+	}
+	
+	@catch(NSException *exception) {
+		failure = [exception retain];
+	}
+	
+	@finally {
+		[regionPool release];
+	}
+	
+	@synchronized(sSplitters) {
+		[sSplitters removeObjectIdenticalTo:self];
+	}
+	
+	// Encoders waiting for a track that will never be decoded fail with the splitter's error
+	[_condition lock];
+	for(region in _regions) {
+		[region setStarted:YES];
+		for(feed in [region feeds])
+			[feed finishWithException:failure];
+	}
+	[_condition unlock];
+	
+	// The image isn't needed any longer
+	[_decoder release], _decoder = nil;
+	
+	[failure release];
+	[pool release];
+}
+
+// Waits until an encoder asks for the region or every encoder for it is gone
+- (NSArray *) feedsForRegion:(CueSheetSplitterRegion *)region
+{
+	NSArray *feeds;
+	
+	[_condition lock];
+	
+	while(0 == [[region feeds] count] && NO == [region abandoned])
+		[_condition wait];
+	
+	// Encoders that ask from now on read the file themselves
+	[region setStarted:YES];
+	feeds = [[[region feeds] copy] autorelease];
+	
+	[_condition unlock];
+	
+	return feeds;
+}
+
+- (void) positionDecoderAtFrame:(SInt64)frame
+{
+	// Selected tracks are usually contiguous, so the decoder is normally positioned already
+	if(frame == [_decoder currentFrame])
+		return;
+	
+	if([_decoder supportsSeeking]) {
+		SInt64 result = [_decoder seekToFrame:frame];
+		NSAssert(result == frame, NSLocalizedStringFromTable(@"Unable to seek in the input file.", @"Exceptions", @""));
+	}
+	else {
+		NSAssert(frame > [_decoder currentFrame], NSLocalizedStringFromTable(@"Unable to seek in the input file.", @"Exceptions", @""));
+		[self copyFrames:(UInt32)(frame - [_decoder currentFrame]) toFeeds:nil];
+	}
+}
+
+- (void) copyFrames:(UInt32)frameCount toFeeds:(NSArray *)feeds
+{
+	AudioBufferList				bufferList;
+	UInt32						bufferFrames;
+	UInt32						framesRead;
+	UInt32						framesRemaining		= frameCount;
+	CueSheetSplitterFeed		*feed;
+	NSData						*chunk;
+	BOOL						closed;
+	
+	bufferList.mNumberBuffers				= 1;
+	bufferList.mBuffers[0].mNumberChannels	= [_decoder pcmFormat].mChannelsPerFrame;
+	bufferList.mBuffers[0].mData			= calloc(SPLIT_BUFFER_SIZE, sizeof(uint8_t));
+	NSAssert(NULL != bufferList.mBuffers[0].mData, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+	
+	@try {
+		while(0 < framesRemaining) {
+			bufferList.mBuffers[0].mDataByteSize	= SPLIT_BUFFER_SIZE;
+			bufferFrames							= SPLIT_BUFFER_SIZE / [_decoder pcmFormat].mBytesPerFrame;
+			
+			if(framesRemaining < bufferFrames)
+				bufferFrames = framesRemaining;
+			
+			framesRead = [_decoder readAudio:&bufferList frameCount:bufferFrames];
+			
+			// The final track may claim more frames than the file holds
+			if(0 == framesRead)
+				break;
+			
+			// Nil feeds discard the audio
+			if(nil != feeds) {
+				// If an exception is thrown the pool is released along with the one it is nested in
+				NSAutoreleasePool *chunkPool = [[NSAutoreleasePool alloc] init];
+				
+				// Every encoder gets the same chunk of audio, which is never modified
+				chunk	= [NSData dataWithBytes:bufferList.mBuffers[0].mData length:bufferList.mBuffers[0].mDataByteSize];
+				closed	= YES;
+				
+				for(feed in feeds) {
+					[feed appendChunk:chunk];
+					closed = closed && [feed isClosed];
+				}
+				
+				[chunkPool release];
+				
+				// There's no point continuing once every encoder for the track has stopped
+				if(closed)
+					break;
+			}
+			
+			framesRemaining -= framesRead;
+		}
+	}
+	
+	@finally {
+		free(bufferList.mBuffers[0].mData);
+	}
+}
+
+@end
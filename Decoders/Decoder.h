@@ -23,13 +23,14 @@
 
 #import "DecoderMethods.h"
 
-@class CircularBuffer;
+@class CircularBuffer, MappedFile;
 
 // A decoder reads audio data in some format and provides it as PCM:
 //   - The audio stream is converted to PCM and placed in _pcmBuffer
 @interface Decoder : NSObject <DecoderMethods>
 {
 	NSString						*_filename;		// The filename of the source
+	MappedFile						*_mappedFile;	// The source, opened (and mapped if possible) when a subclass asks for it
 
 	AudioStreamBasicDescription		_pcmFormat;		// The type of PCM data provided by this source
 	CircularBuffer					*_pcmBuffer;	// The buffer which holds the PCM audio data
@@ -38,13 +39,20 @@
 }
 
 // Create a Decoder of the correct type for the given file
+// The file's contents are checked first, and its extension only if no decoder recognizes them
 + (id) decoderWithFilename:(NSString *)filename;
 
+// Subclasses that can recognize their format from the start of a file (following any ID3v2 tag) return YES for it
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length;
+
 - (id) initWithFilename:(NSString *)filename;
 
 // The source of the raw audio stream
 - (NSString *) filename;
 
+// The source file mapped read-only, for subclasses that can read directly from memory
+- (MappedFile *) mappedFile;
+
 // The buffer which holds the PCM data
 - (CircularBuffer *) pcmBuffer;
 
@@ -23,6 +23,7 @@
 #import "CoreAudioUtilities.h"
 #import "CoreAudioDecoder.h"
 #import "CircularBuffer.h"
+#import "MappedFile.h"
 #import "FLACDecoder.h"
 #import "LibsndfileDecoder.h"
 #import "MonkeysAudioDecoder.h"
@@ -37,56 +38,125 @@
 
 #include <AudioToolbox/AudioFormat.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+// The number of bytes read from the start of the file for the decoders to examine
+#define HEADER_SIZE		4096
+
+// Decoders which recognize their format from its content, in the order they are asked
+static NSArray				*sProbingDecoders			= nil;
+
+// Decoders to use for files no decoder recognizes, keyed by extension
+static NSDictionary			*sDecodersByExtension		= nil;
+
+// Read the start of the file, skipping any ID3v2 tags
+static NSData *
+readFileHeader(NSString *filename)
+{
+	NSMutableData		*header;
+	uint8_t				tag				[ 10 ];
+	off_t				offset			= 0;
+	ssize_t				bytesRead;
+	int					fd, result;
+	
+	fd = open([filename fileSystemRepresentation], O_RDONLY);
+	NSCAssert1(-1 != fd, @"Unable to open the input file (%s).", strerror(errno));
+	
+	while(sizeof(tag) == pread(fd, tag, sizeof(tag), offset) && 0x49 == tag[0] && 0x44 == tag[1] && 0x33 == tag[2]) {
+		offset += (0x10 & tag[5] ? 20 : 10) + 
+			(((tag[6] & 0x7F) << (3 * 7)) | ((tag[7] & 0x7F) << (2 * 7)) |
+			 ((tag[8] & 0x7F) << (1 * 7)) | ((tag[9] & 0x7F) << (0 * 7)));
+	}
+	
+	header		= [NSMutableData dataWithLength:HEADER_SIZE];
+	bytesRead	= pread(fd, [header mutableBytes], HEADER_SIZE, offset);
+	
+	result = close(fd);
+	NSCAssert1(-1 != result, @"Unable to close the input file (%s).", strerror(errno));
+	
+	NSCAssert1(-1 != bytesRead, @"Unable to read from the input file (%s).", strerror(errno));
+	[header setLength:bytesRead];
+	
+	return header;
+}
+
 @implementation Decoder
 
++ (void) initialize
+{
+	NSMutableDictionary		*decodersByExtension;
+	NSEnumerator			*enumerator;
+	NSString				*extension;
+	
+	// Subclasses without their own +initialize come through here too
+	if([Decoder class] != self)
+		return;
+	
+	// MPEG audio has the weakest signature, so it is checked last
+	sProbingDecoders = [[NSArray alloc] initWithObjects:
+		[FLACDecoder class],
+		[OggVorbisDecoder class],
+		[OggFLACDecoder class],
+		[OggSpeexDecoder class],
+		[MonkeysAudioDecoder class],
+		[WavPackDecoder class],
+		[MusepackDecoder class],
+		[ShortenDecoder class],
+		[MPEGDecoder class],
+		nil];
+	
+	// Later entries take precedence
+	decodersByExtension = [NSMutableDictionary dictionary];
+	
+	enumerator = [getLibsndfileExtensions() objectEnumerator];
+	while((extension = [enumerator nextObject]))
+		[decodersByExtension setObject:[LibsndfileDecoder class] forKey:[extension lowercaseString]];
+	
+	enumerator = [getCoreAudioExtensions() objectEnumerator];
+	while((extension = [enumerator nextObject]))
+		[decodersByExtension setObject:[CoreAudioDecoder class] forKey:[extension lowercaseString]];
+	
+	[decodersByExtension setObject:[FLACDecoder class] forKey:@"flac"];
+	[decodersByExtension setObject:[OggFLACDecoder class] forKey:@"oggflac"];
+	[decodersByExtension setObject:[MonkeysAudioDecoder class] forKey:@"ape"];
+	[decodersByExtension setObject:[OggSpeexDecoder class] forKey:@"spx"];
+	[decodersByExtension setObject:[WavPackDecoder class] forKey:@"wv"];
+	[decodersByExtension setObject:[MusepackDecoder class] forKey:@"mpc"];
+	[decodersByExtension setObject:[ShortenDecoder class] forKey:@"shn"];
+	[decodersByExtension setObject:[MPEGDecoder class] forKey:@"mp3"];
+	
+	sDecodersByExtension = [decodersByExtension copy];
+}
+
 + (id) decoderWithFilename:(NSString *)filename
 {
-	Decoder *result = nil;
-		
-	// Create the source based on the file's extension
-	NSArray			*coreAudioExtensions	= getCoreAudioExtensions();
-	NSArray			*libsndfileExtensions	= getLibsndfileExtensions();
-	NSString		*extension				= [[filename pathExtension] lowercaseString];
-
-	// Determine which type of converter to use and create it
-	if([extension isEqualToString:@"ogg"] || [extension isEqualToString:@"oga"]) {
-		// Determine the content type of the ogg stream
-		OggStreamType type = oggStreamType(filename);
-		NSAssert(kOggStreamTypeInvalid != type, @"The file does not appear to be an Ogg file.");
-		NSAssert(kOggStreamTypeUnknown != type, @"The Ogg file's data format was not recognized.");
-		
-		switch(type) {
-			case kOggStreamTypeVorbis:		result = [[OggVorbisDecoder alloc] initWithFilename:filename];		break;
-			case kOggStreamTypeFLAC:		result = [[OggFLACDecoder alloc] initWithFilename:filename];		break;
-			case kOggStreamTypeSpeex:		result = [[OggSpeexDecoder alloc] initWithFilename:filename];		break;
+	NSData			*header			= readFileHeader(filename);
+	Class			decoderClass	= Nil;
+	NSEnumerator	*enumerator;
+	Class			candidate;
+	
+	// Let the decoders identify the file by its content, so mislabeled files still work
+	enumerator = [sProbingDecoders objectEnumerator];
+	while((candidate = [enumerator nextObject])) {
+		if([candidate canDecodeHeader:[header bytes] length:[header length]]) {
+			decoderClass = candidate;
+			break;
 		}
 	}
-	else if([extension isEqualToString:@"flac"])
-		result = [[FLACDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"oggflac"])
-		result = [[OggFLACDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"ape"])
-		result = [[MonkeysAudioDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"spx"])
-		result = [[OggSpeexDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"wv"])
-		result = [[WavPackDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"mpc"])
-		result = [[MusepackDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"shn"])
-		result = [[ShortenDecoder alloc] initWithFilename:filename];
-	else if([extension isEqualToString:@"mp3"])
-		result = [[MPEGDecoder alloc] initWithFilename:filename];
-	else if([coreAudioExtensions containsObject:extension])
-		result = [[CoreAudioDecoder alloc] initWithFilename:filename];
-	else if([libsndfileExtensions containsObject:extension])
-		result = [[LibsndfileDecoder alloc] initWithFilename:filename];
-	else
+	
+	// Fall back to the file's extension
+	if(Nil == decoderClass)
+		decoderClass = [sDecodersByExtension objectForKey:[[filename pathExtension] lowercaseString]];
+	
+	if(Nil == decoderClass)
 		@throw [FileFormatNotSupportedException exceptionWithReason:NSLocalizedStringFromTable(@"The file's format was not recognized.", @"Exceptions", @"") userInfo:nil];
 
-	return [result autorelease];
+	return [[[decoderClass alloc] initWithFilename:filename] autorelease];
 }
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length		{ return NO; }
+
 - (id) initWithFilename:(NSString *)filename
 {
 	NSParameterAssert(nil != filename);
@@ -102,12 +172,24 @@
 {
 	[_pcmBuffer release],		_pcmBuffer = nil;
 	[_filename release],		_filename = nil;
+	[_mappedFile release],		_mappedFile = nil;
 	
 	[super dealloc];
 }
 
 - (NSString *)						filename			{ return [[_filename retain] autorelease]; }
 
+- (MappedFile *) mappedFile
+{
+	// Decoders read from start to finish, apart from the occasional seek
+	if(nil == _mappedFile) {
+		_mappedFile = [[MappedFile alloc] initWithFilename:[self filename]];
+		[_mappedFile adviseSequentialAccess];
+	}
+	
+	return [[_mappedFile retain] autorelease];
+}
+
 - (AudioStreamBasicDescription)		pcmFormat			{ return _pcmFormat; }
 - (CircularBuffer *)				pcmBuffer			{ return [[_pcmBuffer retain] autorelease]; }
 
@@ -22,11 +22,31 @@
 #import "Decoder.h"
 
 #include <FLAC/stream_decoder.h>
+#include <CommonCrypto/CommonDigest.h>
 
 @interface FLACDecoder : Decoder
 {
 	FLAC__StreamDecoder			*_flac;
 	FLAC__uint64				_totalSamples;
+	
+	FLAC__uint64				_inputOffset;
+	FLAC__uint64				_firstFrameOffset;
+	NSMutableData				*_seekPoints;
+	unsigned					_blocksize;
+	FLAC__uint64				_skipToSample;
+	
+	// Parallel decoding
+	BOOL						_parallel;
+	unsigned					_threads;
+	NSData						*_streamInfo;
+	NSOperationQueue			*_queue;
+	NSMutableArray				*_segments;
+	FLAC__uint64				_nextSegmentOffset;
+	FLAC__uint64				_nextSample;
+	
+	FLAC__byte					_md5Sum [ 16 ];
+	CC_MD5_CTX					_md5;
+	BOOL						_verifyMD5;
 }
 
 @end
@@ -20,6 +20,15 @@
 
 #import "FLACDecoder.h"
 #import "CircularBuffer.h"
+#import "MappedFile.h"
+
+// The parallel decoder splits the file into ranges of about this many bytes, adjusted to start at a frame
+#define SEGMENT_BYTES				(4 * 1024 * 1024)
+
+// fLaC and the STREAMINFO block, which must come first
+#define STREAMINFO_HEADER_LENGTH	(4 + 4 + 34)
+
+static uint8_t		sCRC8Table		[ 256 ];
 
 @interface FLACDecoder (Private)
 
@@ -29,62 +38,73 @@
 - (void) setBitsPerChannel:(UInt32)bitsPerChannel;
 - (void) setChannelsPerFrame:(UInt32)channelsPerFrame;
 
+- (void) setBlocksize:(unsigned)blocksize;
+- (void) setMD5Sum:(const FLAC__byte *)md5sum;
+- (void) setSeekTable:(const FLAC__StreamMetadata_SeekTable *)seekTable;
+
+- (FLAC__uint64) skipToSample;
+- (void) didDecodeAudio:(const uint8_t *)audio length:(NSUInteger)length;
+- (void) checkMD5Sum;
+
+- (FLAC__StreamDecoderReadStatus) readInput:(FLAC__byte *)buffer length:(size_t *)length;
+- (FLAC__uint64) inputLength;
+- (FLAC__uint64) inputOffset;
+- (void) setInputOffset:(FLAC__uint64)inputOffset;
+
+- (BOOL) findSeekPoint:(FLAC__StreamMetadata_SeekPoint *)seekPoint forFrame:(SInt64)frame;
+
+- (void) startParallelDecoding;
+- (void) stopParallelDecoding;
+- (void) queueSegments;
+- (void) fillPCMBufferInParallel;
+- (void) fallBackToSerialDecoding;
+
 @end
 
-static FLAC__StreamDecoderWriteStatus 
-writeCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
-{
-	FLACDecoder			*source					= (FLACDecoder *)client_data;
+#pragma mark Utility functions
 
+// Interleave the samples in a frame starting at sample, converting to big endian byte order
+static void
+interleaveFrame(const FLAC__Frame *frame, const FLAC__int32 * const buffer[], unsigned firstSample, void *output)
+{
 	int8_t				*alias8					= NULL;
 	int16_t				*alias16				= NULL;
 	int32_t				*alias32				= NULL;
 	
 	unsigned			sample, channel;
 	int32_t				audioSample;
-		
-	// Calculate the number of audio data points contained in the frame (should be one for each channel)
-	unsigned spaceRequired = frame->header.blocksize * frame->header.channels * (frame->header.bits_per_sample / 8);
-
-	// Increase buffer size as required
-	if([[source pcmBuffer] freeSpaceAvailable] < spaceRequired)
-		[[source pcmBuffer] resize:([[source pcmBuffer] size] + spaceRequired)];
-
+	
 	switch(frame->header.bits_per_sample) {
 		
 		case 8:
 
 			// Interleave the audio (no need for byte swapping)
-			alias8 = [[source pcmBuffer] exposeBufferForWriting];
-			for(sample = 0; sample < frame->header.blocksize; ++sample) {
+			alias8 = output;
+			for(sample = firstSample; sample < frame->header.blocksize; ++sample) {
 				for(channel = 0; channel < frame->header.channels; ++channel) {
 					*alias8++ = (int8_t)buffer[channel][sample];
 				}
 			}
-
-			[[source pcmBuffer] wroteBytes:spaceRequired];
 			
 			break;
 			
 		case 16:
 			
 			// Interleave the audio, converting to big endian byte order 
-			alias16 = [[source pcmBuffer] exposeBufferForWriting];
-			for(sample = 0; sample < frame->header.blocksize; ++sample) {
+			alias16 = output;
+			for(sample = firstSample; sample < frame->header.blocksize; ++sample) {
 				for(channel = 0; channel < frame->header.channels; ++channel) {
 					*alias16++ = (int16_t)OSSwapHostToBigInt16((int16_t)buffer[channel][sample]);
 				}
 			}
-				
-			[[source pcmBuffer] wroteBytes:spaceRequired];
 			
 			break;
 			
 		case 24:				
 			
 			// Interleave the audio, converting to big endian byte order
-			alias8 = [[source pcmBuffer] exposeBufferForWriting];
-			for(sample = 0; sample < frame->header.blocksize; ++sample) {
+			alias8 = output;
+			for(sample = firstSample; sample < frame->header.blocksize; ++sample) {
 				for(channel = 0; channel < frame->header.channels; ++channel) {
 					audioSample	= buffer[channel][sample];
 					
@@ -95,21 +115,17 @@ writeCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, cons
 				}
 			}
 			
-			[[source pcmBuffer] wroteBytes:spaceRequired];
-			
 			break;
 			
 		case 32:
 			
 			// Interleave the audio, converting to big endian byte order 
-			alias32 = [[source pcmBuffer] exposeBufferForWriting];
-			for(sample = 0; sample < frame->header.blocksize; ++sample) {
+			alias32 = output;
+			for(sample = firstSample; sample < frame->header.blocksize; ++sample) {
 				for(channel = 0; channel < frame->header.channels; ++channel) {
 					*alias32++ = OSSwapHostToBigInt32(buffer[channel][sample]);
 				}
 			}
-				
-			[[source pcmBuffer] wroteBytes:spaceRequired];
 			
 			break;
 			
@@ -117,6 +133,203 @@ writeCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, cons
 			@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
 			break;				
 	}
+}
+
+// libFLAC converts frame numbers to sample numbers, but don't count on it
+static FLAC__uint64
+frameSampleNumber(const FLAC__Frame *frame)
+{
+	if(FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER == frame->header.number_type)
+		return frame->header.number.sample_number;
+	else
+		return (FLAC__uint64)frame->header.number.frame_number * frame->header.blocksize;
+}
+
+// FLAC's MD5 signature is calculated over the little-endian samples, but the decoded audio is big-endian
+static void
+updateMD5(CC_MD5_CTX *context, const uint8_t *audio, NSUInteger length, unsigned bytesPerSample)
+{
+	uint8_t			scratch				[ 4096 ];
+	NSUInteger		scratchUsed;
+	unsigned		i;
+	
+	while(0 < length) {
+		for(scratchUsed = 0; scratchUsed + bytesPerSample <= sizeof(scratch) && bytesPerSample <= length; scratchUsed += bytesPerSample) {
+			for(i = 0; i < bytesPerSample; ++i) {
+				scratch[scratchUsed + i] = audio[bytesPerSample - 1 - i];
+			}
+			
+			audio	+= bytesPerSample;
+			length	-= bytesPerSample;
+		}
+		
+		CC_MD5_Update(context, scratch, (CC_LONG)scratchUsed);
+	}
+}
+
+static uint8_t
+calculateCRC8(const uint8_t *data, size_t length)
+{
+	uint8_t		crc		= 0;
+	
+	while(length--) {
+		crc = sCRC8Table[crc ^ *data++];
+	}
+	
+	return crc;
+}
+
+// A frame sync code can occur by chance in the compressed audio, so check the rest of the header and its CRC too,
+// and make sure the header agrees with STREAMINFO
+static BOOL
+isFrameHeader(const uint8_t *bytes, size_t length, const AudioStreamBasicDescription *format, FLAC__uint64 totalSamples, unsigned blocksize)
+{
+	static const unsigned	sSampleRates		[ 12 ]	= { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+	static const unsigned	sSampleSizes		[ 8 ]	= { 0, 8, 12, 0, 16, 20, 24, 0 };
+	unsigned				headerLength		= 4;
+	unsigned				numberLength, i;
+	unsigned				blocksizeCode, sampleRateCode, channelCode, sampleSizeCode;
+	unsigned				sampleRate			= 0;
+	FLAC__uint64			number;
+	FLAC__uint64			firstSample;
+	
+	if(5 > length || 0xFF != bytes[0] || 0xF8 != (bytes[1] & 0xFE))
+		return NO;
+	
+	blocksizeCode	= bytes[2] >> 4;
+	sampleRateCode	= bytes[2] & 0x0F;
+	channelCode		= bytes[3] >> 4;
+	sampleSizeCode	= (bytes[3] >> 1) & 0x07;
+	
+	if(0 == blocksizeCode || 0x0F == sampleRateCode || 0x0B <= channelCode || 3 == sampleSizeCode || 7 == sampleSizeCode || (bytes[3] & 0x01))
+		return NO;
+	
+	// Codes of zero mean the value in STREAMINFO
+	if(0 != sampleSizeCode && sSampleSizes[sampleSizeCode] != format->mBitsPerChannel)
+		return NO;
+	
+	if((8 > channelCode ? channelCode + 1 : 2) != format->mChannelsPerFrame)
+		return NO;
+	
+	// Streams with a fixed block size number their frames rather than their samples
+	if(0 != blocksize && (bytes[1] & 0x01))
+		return NO;
+	
+	// The frame or sample number uses the same variable length scheme as UTF-8
+	if(0x80 > bytes[4])						numberLength = 1;
+	else if(0xC0 == (bytes[4] & 0xE0))		numberLength = 2;
+	else if(0xE0 == (bytes[4] & 0xF0))		numberLength = 3;
+	else if(0xF0 == (bytes[4] & 0xF8))		numberLength = 4;
+	else if(0xF8 == (bytes[4] & 0xFC))		numberLength = 5;
+	else if(0xFC == (bytes[4] & 0xFE))		numberLength = 6;
+	else if(0xFE == bytes[4])				numberLength = 7;
+	else									return NO;
+	
+	if(4 + numberLength > length)
+		return NO;
+	
+	number = bytes[4] & (1 == numberLength ? 0x7F : 0x7F >> numberLength);
+	for(i = 1; i < numberLength; ++i) {
+		if(0x80 != (bytes[4 + i] & 0xC0))
+			return NO;
+		
+		number = (number << 6) | (bytes[4 + i] & 0x3F);
+	}
+	
+	// The frame must start within the stream (a frame number can only be checked when the block size is fixed)
+	firstSample = ((bytes[1] & 0x01) ? number : number * blocksize);
+	if(0 != totalSamples && firstSample >= totalSamples)
+		return NO;
+	
+	headerLength += numberLength;
+	
+	if(6 == blocksizeCode)							headerLength += 1;
+	else if(7 == blocksizeCode)						headerLength += 2;
+	
+	if(12 == sampleRateCode)						headerLength += 1;
+	else if(13 == sampleRateCode || 14 == sampleRateCode)	headerLength += 2;
+	
+	if(headerLength + 1 > length)
+		return NO;
+	
+	if(12 > sampleRateCode)							sampleRate = sSampleRates[sampleRateCode];
+	else if(12 == sampleRateCode)					sampleRate = bytes[headerLength - 1] * 1000;
+	else if(13 == sampleRateCode)					sampleRate = (bytes[headerLength - 2] << 8) | bytes[headerLength - 1];
+	else if(14 == sampleRateCode)					sampleRate = ((bytes[headerLength - 2] << 8) | bytes[headerLength - 1]) * 10;
+	
+	if(0 != sampleRate && sampleRate != (unsigned)format->mSampleRate)
+		return NO;
+	
+	return (calculateCRC8(bytes, headerLength) == bytes[headerLength]);
+}
+
+#pragma mark Callbacks
+
+static FLAC__StreamDecoderReadStatus
+readCallback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+	return [(FLACDecoder *)client_data readInput:buffer length:bytes];
+}
+
+static FLAC__StreamDecoderSeekStatus
+seekCallback(const FLAC__StreamDecoder *decoder, FLAC__uint64 absolute_byte_offset, void *client_data)
+{
+	FLACDecoder		*source		= (FLACDecoder *)client_data;
+	
+	if(absolute_byte_offset > [source inputLength])
+		return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+	
+	[source setInputOffset:absolute_byte_offset];
+	return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamDecoderTellStatus
+tellCallback(const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset, void *client_data)
+{
+	*absolute_byte_offset = [(FLACDecoder *)client_data inputOffset];
+	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+static FLAC__StreamDecoderLengthStatus
+lengthCallback(const FLAC__StreamDecoder *decoder, FLAC__uint64 *stream_length, void *client_data)
+{
+	*stream_length = [(FLACDecoder *)client_data inputLength];
+	return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+static FLAC__bool
+eofCallback(const FLAC__StreamDecoder *decoder, void *client_data)
+{
+	FLACDecoder		*source		= (FLACDecoder *)client_data;
+	return ([source inputOffset] >= [source inputLength]);
+}
+
+static FLAC__StreamDecoderWriteStatus 
+writeCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	FLACDecoder			*source					= (FLACDecoder *)client_data;
+	FLAC__uint64		sampleNumber			= frameSampleNumber(frame);
+	unsigned			firstSample				= 0;
+	
+	// After a seek, discard the audio before the requested frame
+	if([source skipToSample] > sampleNumber) {
+		if([source skipToSample] >= sampleNumber + frame->header.blocksize)
+			return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+		
+		firstSample = (unsigned)([source skipToSample] - sampleNumber);
+	}
+	
+	// Calculate the number of audio data points contained in the frame (should be one for each channel)
+	unsigned spaceRequired = (frame->header.blocksize - firstSample) * frame->header.channels * (frame->header.bits_per_sample / 8);
+
+	// Increase buffer size as required
+	if([[source pcmBuffer] freeSpaceAvailable] < spaceRequired)
+		[[source pcmBuffer] resize:([[source pcmBuffer] size] + spaceRequired)];
+
+	uint8_t *output = [[source pcmBuffer] exposeBufferForWriting];
+	interleaveFrame(frame, buffer, firstSample, output);
+	[source didDecodeAudio:output length:spaceRequired];
+	[[source pcmBuffer] wroteBytes:spaceRequired];
 	
 	// Always return continue; an exception will be thrown if this isn't the case
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
@@ -137,6 +350,15 @@ metadataCallback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata
 			[source setSampleRate:metadata->data.stream_info.sample_rate];			
 			[source setBitsPerChannel:metadata->data.stream_info.bits_per_sample];
 			[source setChannelsPerFrame:metadata->data.stream_info.channels];
+			[source setMD5Sum:metadata->data.stream_info.md5sum];
+			
+			// Frames can only be skipped without decoding them when their size is known
+			if(metadata->data.stream_info.min_blocksize == metadata->data.stream_info.max_blocksize)
+				[source setBlocksize:metadata->data.stream_info.max_blocksize];
+			break;
+			
+		case FLAC__METADATA_TYPE_SEEKTABLE:
+			[source setSeekTable:&(metadata->data.seek_table)];
 			break;
 			
 			/*
@@ -168,8 +390,227 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 //	@throw [FLACException exceptionWithReason:[NSString stringWithCString:FLAC__StreamDecoderErrorStatusString[status] encoding:NSASCIIStringEncoding] userInfo:nil];
 }
 
+#pragma mark FLACDecodeSegment
+
+// A range of whole frames decoded by its own FLAC__StreamDecoder
+// The decoder is given the file's STREAMINFO followed by the frames, as if they were a complete stream
+@interface FLACDecodeSegment : NSOperation
+{
+	NSData				*_streamInfo;
+	MappedFile			*_file;
+	NSRange				_range;
+	NSUInteger			_position;
+	unsigned			_blocksize;
+	FLAC__uint64		_totalSamples;
+	
+	NSMutableData		*_audio;
+	FLAC__uint64		_firstSample;
+	FLAC__uint64		_nextSample;
+	unsigned			_lastBlocksize;
+	BOOL				_decodedFrame;
+	unsigned			_errors;
+	
+	NSException			*_exception;
+}
+
+// blocksize is zero for streams with a variable block size, and totalSamples zero if it isn't known
+- (id)					initWithStreamInfo:(NSData *)streamInfo file:(MappedFile *)file range:(NSRange)range blocksize:(unsigned)blocksize totalSamples:(FLAC__uint64)totalSamples;
+
+- (NSRange)				range;
+
+// The decoded audio, in the same format the FLACDecoder provides
+- (NSData *)			audio;
+
+// The sample number of the first frame in the range and of the first frame after it
+- (FLAC__uint64)		firstSample;
+- (FLAC__uint64)		nextSample;
+
+- (NSException *)		exception;
+
+- (FLAC__StreamDecoderReadStatus)	readBytes:(FLAC__byte *)buffer length:(size_t *)length;
+- (void)							appendFrame:(const FLAC__Frame *)frame buffer:(const FLAC__int32 * const [])buffer;
+- (void)							decodingError;
+
+@end
+
+static FLAC__StreamDecoderReadStatus
+segmentReadCallback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+	return [(FLACDecodeSegment *)client_data readBytes:buffer length:bytes];
+}
+
+static FLAC__StreamDecoderWriteStatus 
+segmentWriteCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	[(FLACDecodeSegment *)client_data appendFrame:frame buffer:buffer];
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void
+segmentErrorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	[(FLACDecodeSegment *)client_data decodingError];
+}
+
+@implementation FLACDecodeSegment
+
+- (id) initWithStreamInfo:(NSData *)streamInfo file:(MappedFile *)file range:(NSRange)range blocksize:(unsigned)blocksize totalSamples:(FLAC__uint64)totalSamples
+{
+	if((self = [super init])) {
+		_streamInfo		= [streamInfo retain];
+		_file			= [file retain];
+		_range			= range;
+		_blocksize		= blocksize;
+		_totalSamples	= totalSamples;
+		_audio			= [[NSMutableData alloc] init];
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_streamInfo release],		_streamInfo = nil;
+	[_file release],			_file = nil;
+	[_audio release],			_audio = nil;
+	[_exception release],		_exception = nil;
+	
+	[super dealloc];
+}
+
+- (NSRange)				range					{ return _range; }
+- (NSData *)			audio					{ return [[_audio retain] autorelease]; }
+
+- (FLAC__uint64)		firstSample				{ return _firstSample; }
+- (FLAC__uint64)		nextSample				{ return _nextSample; }
+
+- (NSException *)		exception				{ return [[_exception retain] autorelease]; }
+
+- (void) main
+{
+	NSAutoreleasePool				*pool			= [[NSAutoreleasePool alloc] init];
+	FLAC__StreamDecoder				*flac			= NULL;
+	FLAC__StreamDecoderInitStatus	status;
+	FLAC__bool						result;
+	
+	@try {
+		flac = FLAC__stream_decoder_new();
+		NSAssert(NULL != flac, NSLocalizedStringFromTable(@"Unable to create the FLAC decoder.", @"Exceptions", @""));
+		
+		status = FLAC__stream_decoder_init_stream(flac, segmentReadCallback, NULL, NULL, NULL, NULL, segmentWriteCallback, NULL, segmentErrorCallback, self);
+		NSAssert1(FLAC__STREAM_DECODER_INIT_STATUS_OK == status, @"FLAC__stream_decoder_init_stream failed: %s", FLAC__stream_decoder_get_resolved_state_string(flac));
+		
+		result = FLAC__stream_decoder_process_until_end_of_stream(flac);
+		NSAssert1(YES == result, @"FLAC__stream_decoder_process_until_end_of_stream failed: %s", FLAC__stream_decoder_get_resolved_state_string(flac));
+		
+		// A false frame sync at either end of the range would show up as a lost frame
+		NSAssert(0 == _errors && YES == _decodedFrame, NSLocalizedStringFromTable(@"FLAC decoding error.", @"Exceptions", @""));
+		
+		// Only the last frame in the stream may be short, so a range that ends early was cut off at a false frame header
+		if(NSMaxRange(_range) < [_file length])
+			NSAssert(0 == _blocksize || _blocksize == _lastBlocksize, NSLocalizedStringFromTable(@"FLAC decoding error.", @"Exceptions", @""));
+		else
+			NSAssert(0 == _totalSamples || _totalSamples == _nextSample, NSLocalizedStringFromTable(@"FLAC decoding error.", @"Exceptions", @""));
+	}
+	
+	@catch(NSException *exception) {
+		_exception = [exception retain];
+	}
+	
+	@finally {
+		if(NULL != flac) {
+			FLAC__stream_decoder_finish(flac);
+			FLAC__stream_decoder_delete(flac);
+		}
+		
+		[pool release];
+	}
+}
+
+- (FLAC__StreamDecoderReadStatus) readBytes:(FLAC__byte *)buffer length:(size_t *)length
+{
+	size_t		count		= 0;
+	size_t		chunk;
+	
+	// First the STREAMINFO
+	if(_position < [_streamInfo length]) {
+		chunk = MIN(*length, [_streamInfo length] - _position);
+		memcpy(buffer, (const uint8_t *)[_streamInfo bytes] + _position, chunk);
+		
+		count		+= chunk;
+		_position	+= chunk;
+	}
+	
+	// Then the frames
+	if(count < *length && _position < [_streamInfo length] + _range.length) {
+		chunk = MIN(*length - count, [_streamInfo length] + _range.length - _position);
+		memcpy(buffer + count, (const uint8_t *)[_file bytes] + _range.location + (_position - [_streamInfo length]), chunk);
+		
+		count		+= chunk;
+		_position	+= chunk;
+	}
+	
+	*length = count;
+	
+	return (0 == count ? FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM : FLAC__STREAM_DECODER_READ_STATUS_CONTINUE);
+}
+
+- (void) appendFrame:(const FLAC__Frame *)frame buffer:(const FLAC__int32 * const [])buffer
+{
+	FLAC__uint64	sampleNumber	= frameSampleNumber(frame);
+	NSUInteger		length			= [_audio length];
+	
+	if(NO == _decodedFrame) {
+		_firstSample	= sampleNumber;
+		_nextSample		= sampleNumber;
+		_decodedFrame	= YES;
+	}
+	
+	// Frames must follow one another exactly
+	if(sampleNumber != _nextSample) {
+		++_errors;
+		return;
+	}
+	
+	[_audio increaseLengthBy:frame->header.blocksize * frame->header.channels * (frame->header.bits_per_sample / 8)];
+	interleaveFrame(frame, buffer, 0, (uint8_t *)[_audio mutableBytes] + length);
+	
+	_nextSample		+= frame->header.blocksize;
+	_lastBlocksize	= frame->header.blocksize;
+}
+
+- (void) decodingError
+{
+	++_errors;
+}
+
+@end
+
+#pragma mark FLACDecoder
+
 @implementation FLACDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (4 <= length && 0 == memcmp(header, "fLaC", 4));
+}
+
++ (void) initialize
+{
+	unsigned	i, j;
+	uint8_t		crc;
+	
+	for(i = 0; i < 256; ++i) {
+		crc = (uint8_t)i;
+		for(j = 0; j < 8; ++j) {
+			crc = (crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+		}
+		sCRC8Table[i] = crc;
+	}
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
@@ -177,14 +618,25 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 		_flac = FLAC__stream_decoder_new();
 		NSAssert(NULL != _flac, NSLocalizedStringFromTable(@"Unable to create the FLAC decoder.", @"Exceptions", @""));
 		
+		// libFLAC reads through the MappedFile, which can be repositioned directly using the seek table
+		NSAssert(nil != [self mappedFile], NSLocalizedStringFromTable(@"Unable to open the input file.", @"Exceptions", @""));
+		
+		// Keep the seek table
+		FLAC__bool result = FLAC__stream_decoder_set_metadata_respond(_flac, FLAC__METADATA_TYPE_SEEKTABLE);
+		NSAssert1(YES == result, @"FLAC__stream_decoder_set_metadata_respond failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
+		
 		// Initialize decoder
-		FLAC__StreamDecoderInitStatus status = FLAC__stream_decoder_init_file(_flac, 
-																			  [[self filename] fileSystemRepresentation],
-																			  writeCallback, 
-																			  metadataCallback, 
-																			  errorCallback,
-																			  self);
-		NSAssert1(FLAC__STREAM_DECODER_INIT_STATUS_OK == status, @"FLAC__stream_decoder_init_file failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
+		FLAC__StreamDecoderInitStatus status = FLAC__stream_decoder_init_stream(_flac, 
+																				readCallback,
+																				seekCallback,
+																				tellCallback,
+																				lengthCallback,
+																				eofCallback,
+																				writeCallback, 
+																				metadataCallback, 
+																				errorCallback,
+																				self);
+		NSAssert1(FLAC__STREAM_DECODER_INIT_STATUS_OK == status, @"FLAC__stream_decoder_init_stream failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
 		
 		/*
 		 // Process cue sheets
@@ -193,9 +645,13 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 		 */
 		
 		// Process metadata
-		FLAC__bool result = FLAC__stream_decoder_process_until_end_of_metadata(_flac);
+		result = FLAC__stream_decoder_process_until_end_of_metadata(_flac);
 		NSAssert1(YES == result, @"FLAC__stream_decoder_process_until_end_of_metadata failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
 		
+		// Seek points are relative to the first frame
+		result = FLAC__stream_decoder_get_decode_position(_flac, &_firstFrameOffset);
+		NSAssert1(YES == result, @"FLAC__stream_decoder_get_decode_position failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
+		
 		// Setup input format descriptor
 		_pcmFormat.mFormatID			= kAudioFormatLinearPCM;
 		_pcmFormat.mFormatFlags			= kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsBigEndian | kAudioFormatFlagIsPacked;
@@ -211,6 +667,13 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 		// We only handle a subset of the legal bitsPerChannel for FLAC
 		NSAssert(8 == _pcmFormat.mBitsPerChannel || 16 == _pcmFormat.mBitsPerChannel || 24 == _pcmFormat.mBitsPerChannel || 32 == _pcmFormat.mBitsPerChannel, @"Sample size not supported");
 		
+		// Decode large files on multiple threads if requested
+		_threads = [[NSUserDefaults standardUserDefaults] integerForKey:@"flacDecoderThreads"];
+		if(0 == _threads)
+			_threads = (unsigned)[[NSProcessInfo processInfo] activeProcessorCount];
+		
+		if(1 < _threads)
+			[self startParallelDecoding];
 	}
 	return self;
 }
@@ -219,6 +682,13 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 {
 	FLAC__bool					result;
 	
+	[self stopParallelDecoding];
+	
+	[_queue release],				_queue = nil;
+	[_segments release],			_segments = nil;
+	[_streamInfo release],			_streamInfo = nil;
+	[_seekPoints release],			_seekPoints = nil;
+	
 	result = FLAC__stream_decoder_finish(_flac);
 	NSAssert1(YES == result, @"FLAC__stream_decoder_finish failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
 
@@ -235,11 +705,60 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 
 - (SInt64) seekToFrame:(SInt64)frame
 {
+	FLAC__StreamMetadata_SeekPoint		seekPoint;
+	BOOL								haveSeekPoint;
+	FLAC__uint64						framesToSkip;
+	
 	NSParameterAssert(0 <= frame && frame <= [self totalFrames]);
 	
-	if(FLAC__stream_decoder_seek_absolute(_flac, frame)) {
+	haveSeekPoint = [self findSeekPoint:&seekPoint forFrame:frame];
+	
+	// The MD5 signature can only be checked if all of the audio is decoded
+	_verifyMD5 = NO;
+	
+	if(_parallel) {
+		[self stopParallelDecoding];
+		
+		// Without a seek point the parallel decoder would have to start from the beginning
+		if(haveSeekPoint) {
+			[[self pcmBuffer] reset];
+			
+			_nextSegmentOffset		= _firstFrameOffset + seekPoint.stream_offset;
+			_nextSample				= seekPoint.sample_number;
+			_skipToSample			= frame;
+			_currentFrame			= frame;
+			
+			_verifyMD5				= (0 == frame);
+			if(_verifyMD5)
+				CC_MD5_Init(&_md5);
+			
+			return [self currentFrame];
+		}
+		
+		_parallel = NO;
+	}
+	
+	// Jump straight to the seek point, and skip whole frames without decoding them when possible
+	if(haveSeekPoint && FLAC__stream_decoder_flush(_flac)) {
 		[[self pcmBuffer] reset];
-		_currentFrame = frame;
+		
+		_inputOffset	= _firstFrameOffset + seekPoint.stream_offset;
+		
+		if(0 != _blocksize) {
+			for(framesToSkip = (frame - seekPoint.sample_number) / _blocksize; 0 < framesToSkip; --framesToSkip) {
+				if(NO == FLAC__stream_decoder_skip_single_frame(_flac))
+					break;
+			}
+		}
+		
+		_skipToSample	= frame;
+		_currentFrame	= frame;
+	}
+	else if(FLAC__stream_decoder_seek_absolute(_flac, frame)) {
+		[[self pcmBuffer] reset];
+		
+		_skipToSample	= 0;
+		_currentFrame	= frame;
 	}
 	
 	return [self currentFrame];
@@ -256,11 +775,16 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 	unsigned					bitsPerSample;
 	unsigned					blockByteSize;
 
+	if(_parallel) {
+		[self fillPCMBufferInParallel];
+		return;
+	}
 	
 	for(;;) {
 
 		// EOS?
 		if(FLAC__STREAM_DECODER_END_OF_STREAM == FLAC__stream_decoder_get_state(_flac)) {
+			[self checkMD5Sum];
 			break;
 		}
 				
@@ -302,4 +826,242 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 - (void)	setBitsPerChannel:(UInt32)bitsPerChannel		{ _pcmFormat.mBitsPerChannel = bitsPerChannel; }
 - (void)	setChannelsPerFrame:(UInt32)channelsPerFrame	{ _pcmFormat.mChannelsPerFrame = channelsPerFrame; }
 
+- (void)	setBlocksize:(unsigned)blocksize				{ _blocksize = blocksize; }
+- (void)	setMD5Sum:(const FLAC__byte *)md5sum			{ memcpy(_md5Sum, md5sum, sizeof(_md5Sum)); }
+
+- (FLAC__uint64) skipToSample								{ return _skipToSample; }
+
+// Audio decoded serially still counts towards the MD5 signature if decoding started in parallel from the beginning
+- (void) didDecodeAudio:(const uint8_t *)audio length:(NSUInteger)length
+{
+	if(_verifyMD5)
+		updateMD5(&_md5, audio, length, _pcmFormat.mBitsPerChannel / 8);
+}
+
+// Check the audio against the MD5 signature in STREAMINFO, if there is one
+- (void) checkMD5Sum
+{
+	unsigned char			digest			[ CC_MD5_DIGEST_LENGTH ];
+	static const FLAC__byte	sNoMD5Sum		[ 16 ]		= { 0 };
+	
+	if(NO == _verifyMD5)
+		return;
+	
+	_verifyMD5 = NO;
+	
+	CC_MD5_Final(digest, &_md5);
+	NSAssert(0 == memcmp(_md5Sum, sNoMD5Sum, sizeof(_md5Sum)) || 0 == memcmp(_md5Sum, digest, sizeof(_md5Sum)), NSLocalizedStringFromTable(@"The decoded audio does not match the FLAC file's MD5 signature.", @"Exceptions", @""));
+}
+
+- (FLAC__uint64) inputLength								{ return [_mappedFile length]; }
+- (FLAC__uint64) inputOffset								{ return _inputOffset; }
+- (void) setInputOffset:(FLAC__uint64)inputOffset			{ _inputOffset = inputOffset; }
+
+- (FLAC__StreamDecoderReadStatus) readInput:(FLAC__byte *)buffer length:(size_t *)length
+{
+	ssize_t		bytesRead;
+	
+	if(_inputOffset >= [self inputLength]) {
+		*length = 0;
+		return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+	}
+	
+	bytesRead = [_mappedFile readBytes:buffer length:*length atOffset:(off_t)_inputOffset];
+	if(-1 == bytesRead) {
+		*length = 0;
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	}
+	
+	*length			= (size_t)bytesRead;
+	_inputOffset	+= bytesRead;
+	
+	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+- (void) setSeekTable:(const FLAC__StreamMetadata_SeekTable *)seekTable
+{
+	unsigned		i;
+	
+	[_seekPoints release];
+	_seekPoints = [[NSMutableData alloc] init];
+	
+	// Placeholders are only used to reserve space
+	for(i = 0; i < seekTable->num_points; ++i) {
+		if(FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER != seekTable->points[i].sample_number)
+			[_seekPoints appendBytes:&(seekTable->points[i]) length:sizeof(FLAC__StreamMetadata_SeekPoint)];
+	}
+}
+
+// The first frame is always an implicit seek point
+- (BOOL) findSeekPoint:(FLAC__StreamMetadata_SeekPoint *)seekPoint forFrame:(SInt64)frame
+{
+	const FLAC__StreamMetadata_SeekPoint	*points		= [_seekPoints bytes];
+	NSUInteger								count		= [_seekPoints length] / sizeof(FLAC__StreamMetadata_SeekPoint);
+	NSUInteger								i;
+	BOOL									found		= NO;
+	
+	if(0 == frame) {
+		seekPoint->sample_number	= 0;
+		seekPoint->stream_offset	= 0;
+		seekPoint->frame_samples	= 0;
+		
+		return YES;
+	}
+	
+	for(i = 0; i < count && points[i].sample_number <= (FLAC__uint64)frame; ++i) {
+		*seekPoint	= points[i];
+		found		= YES;
+	}
+	
+	return found;
+}
+
+- (void) startParallelDecoding
+{
+	const uint8_t		*bytes			= [[self mappedFile] bytes];
+	
+	// The segments are found by scanning the mapped file
+	// Files with an ID3v2 tag in front, and small files, aren't worth the trouble
+	if(NULL == bytes || (2 * SEGMENT_BYTES) > [[self mappedFile] length] || STREAMINFO_HEADER_LENGTH > _firstFrameOffset)
+		return;
+	
+	if(0 != memcmp(bytes, "fLaC", 4) || FLAC__METADATA_TYPE_STREAMINFO != (bytes[4] & 0x7F))
+		return;
+	
+	// Mark STREAMINFO as the last metadata block, since it is all the segments need
+	_streamInfo = [[NSMutableData alloc] initWithBytes:bytes length:STREAMINFO_HEADER_LENGTH];
+	((uint8_t *)[(NSMutableData *)_streamInfo mutableBytes])[4] |= 0x80;
+	
+	_queue		= [[NSOperationQueue alloc] init];
+	_segments	= [[NSMutableArray alloc] init];
+	
+	[_queue setMaxConcurrentOperationCount:_threads];
+	
+	_nextSegmentOffset	= _firstFrameOffset;
+	_nextSample			= 0;
+	_verifyMD5			= YES;
+	_parallel			= YES;
+	
+	CC_MD5_Init(&_md5);
+}
+
+- (void) stopParallelDecoding
+{
+	[_queue cancelAllOperations];
+	[_queue waitUntilAllOperationsAreFinished];
+	
+	[_segments removeAllObjects];
+}
+
+- (void) queueSegments
+{
+	FLACDecodeSegment	*segment;
+	const uint8_t		*bytes			= [[self mappedFile] bytes];
+	NSUInteger			length			= (NSUInteger)[[self mappedFile] length];
+	NSUInteger			end;
+	
+	while([_segments count] < 2 * _threads && _nextSegmentOffset < length) {
+		
+		// Find the first frame after the nominal end of the range
+		end = (NSUInteger)MIN(length, _nextSegmentOffset + SEGMENT_BYTES);
+		while(end < length) {
+			const uint8_t *sync = memchr(bytes + end, 0xFF, length - end);
+			if(NULL == sync) {
+				end = length;
+				break;
+			}
+			
+			end = sync - bytes;
+			if(isFrameHeader(sync, length - end, &_pcmFormat, _totalSamples, _blocksize))
+				break;
+			
+			++end;
+		}
+		
+		segment = [[FLACDecodeSegment alloc] initWithStreamInfo:_streamInfo file:[self mappedFile] range:NSMakeRange((NSUInteger)_nextSegmentOffset, end - (NSUInteger)_nextSegmentOffset) blocksize:_blocksize totalSamples:_totalSamples];
+		[_segments addObject:segment];
+		[_queue addOperation:segment];
+		[segment release];
+		
+		_nextSegmentOffset = end;
+	}
+}
+
+- (void) fillPCMBufferInParallel
+{
+	CircularBuffer		*buffer				= [self pcmBuffer];
+	FLACDecodeSegment	*segment;
+	const uint8_t		*audio;
+	NSUInteger			length;
+	NSUInteger			skip;
+	
+	[self queueSegments];
+	
+	while(0 < [_segments count]) {
+		segment = [_segments objectAtIndex:0];
+		
+		// Anything after the last sample, such as a trailing tag, isn't audio
+		if(0 != _totalSamples && _nextSample >= _totalSamples) {
+			[self stopParallelDecoding];
+			_nextSegmentOffset = [[self mappedFile] length];
+			break;
+		}
+		
+		// Hand over whole segments, and don't wait on a segment if there is already audio to return
+		if(0 < [buffer bytesAvailable] && NO == [segment isFinished])
+			break;
+		
+		[segment waitUntilFinished];
+		
+		// A range that didn't decode cleanly, or doesn't join up exactly with the one before it, was split at something
+		// that only looked like a frame header; let the libFLAC decoder take over from the last sample handed over
+		if(nil != [segment exception] || [segment firstSample] != _nextSample) {
+			[self fallBackToSerialDecoding];
+			[self fillPCMBuffer];
+			return;
+		}
+		
+		audio	= [[segment audio] bytes];
+		length	= [[segment audio] length];
+		
+		if(_verifyMD5)
+			updateMD5(&_md5, audio, length, _pcmFormat.mBitsPerChannel / 8);
+		
+		// After a seek, discard the audio before the requested frame
+		if(_skipToSample > [segment firstSample]) {
+			skip	= (NSUInteger)MIN(_skipToSample - [segment firstSample], [segment nextSample] - [segment firstSample]) * _pcmFormat.mBytesPerFrame;
+			audio	+= skip;
+			length	-= skip;
+		}
+		
+		if([buffer freeSpaceAvailable] < length)
+			[buffer resize:[buffer bytesAvailable] + length];
+		
+		[buffer putData:audio byteCount:length];
+		
+		_nextSample = [segment nextSample];
+		[_segments removeObjectAtIndex:0];
+		
+		[self queueSegments];
+	}
+	
+	if(0 == [_segments count])
+		[self checkMD5Sum];
+}
+
+- (void) fallBackToSerialDecoding
+{
+	FLAC__bool		result;
+	
+	[self stopParallelDecoding];
+	
+	_parallel		= NO;
+	_skipToSample	= MAX(_skipToSample, _nextSample);
+	
+	// The range that failed may not start on a real frame, so let libFLAC find the first sample not yet handed over
+	// The audio it decodes from there is still added to the MD5 signature, so nothing can go missing unnoticed
+	result = FLAC__stream_decoder_seek_absolute(_flac, _nextSample);
+	NSAssert1(YES == result, @"FLAC__stream_decoder_seek_absolute failed: %s", FLAC__stream_decoder_get_resolved_state_string(_flac));
+}
+
 @end
@@ -25,7 +25,8 @@
 
 @interface MPEGDecoder : Decoder
 {
-	FILE				*_file;
+	off_t				_inputOffset;
+	off_t				_readOffset;		// The end of the data in _inputBuffer, when the file isn't mapped
 	unsigned char		*_inputBuffer;
 	
 	AudioBufferList		*_bufferList;
@@ -50,6 +51,9 @@
 	off_t				_fileBytes;
 	uint8_t				_xingTOC [100];
 	
+	NSData				*_frameIndex;
+	BOOL				_indexedFile;
+	
 	struct mad_stream	_mad_stream;
 	struct mad_frame	_mad_frame;
 	struct mad_synth	_mad_synth;
@@ -20,6 +20,7 @@
 
 #import "MPEGDecoder.h"
 #import "CircularBuffer.h"
+#import "MappedFile.h"
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -30,6 +31,12 @@
 
 #define BIT_RESOLUTION		16
 
+// Layer III main data may start up to 511 bytes before its frame; allow for the headers and side information in between
+#define RESERVOIR_BYTES		(2 * 511)
+
+// The number of frame indexes kept for files that are opened more than once, such as the tracks of a cue sheet
+#define FRAME_INDEX_CACHE_SIZE	8
+
 // From vbrheadersdk:
 // ========================================
 // A Xing header may be present in the ancillary
@@ -79,22 +86,185 @@ audio_linear_round(unsigned int bits,
 }
 // End madplay code
 
+// The byte offset and first sample of an MPEG frame; the last entry in an index marks the end of the audio
+typedef struct {
+	off_t		offset;
+	SInt64		sample;
+} MPEGFrameIndexEntry;
+
+static NSMutableDictionary		*sFrameIndexCache			= nil;
+static NSMutableArray			*sFrameIndexCacheKeys		= nil;		// Least recently used first
+
+// Bitrates in kbps, indexed by [MPEG 2/2.5][layer - 1][bitrate index]
+static const unsigned sBitrates [2][3][15] = {
+	{
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+		{ 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384 },
+		{ 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320 }
+	},
+	{
+		{ 0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256 },
+		{ 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160 },
+		{ 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160 }
+	}
+};
+
+static const unsigned sSampleRates [3] = { 44100, 48000, 32000 };
+
+// Returns the length of the frame whose header starts at bytes, or 0 if the header isn't valid
+// format receives the header fields which may not change between frames
+static unsigned
+parseMPEGHeader(const uint8_t *bytes, unsigned *sampleCount, uint32_t *format)
+{
+	unsigned	version, layer, bitrateIndex, sampleRateIndex, padding;
+	unsigned	bitrate, sampleRate;
+	BOOL		lsf;
+	
+	if(0xFF != bytes[0] || 0xE0 != (bytes[1] & 0xE0))
+		return 0;
+	
+	// 0 is MPEG 2.5, 2 is MPEG 2 and 3 is MPEG 1
+	version				= (bytes[1] >> 3) & 0x03;
+	layer				= 4 - ((bytes[1] >> 1) & 0x03);
+	bitrateIndex		= bytes[2] >> 4;
+	sampleRateIndex		= (bytes[2] >> 2) & 0x03;
+	padding				= (bytes[2] >> 1) & 0x01;
+	
+	// Free format frames can't be measured from their header alone
+	if(1 == version || 4 == layer || 0 == bitrateIndex || 15 == bitrateIndex || 3 == sampleRateIndex)
+		return 0;
+	
+	lsf			= (3 != version);
+	bitrate		= 1000 * sBitrates[lsf][layer - 1][bitrateIndex];
+	sampleRate	= sSampleRates[sampleRateIndex] >> (3 == version ? 0 : (2 == version ? 1 : 2));
+	
+	*format		= ((bytes[1] & 0xFE) << 8) | (bytes[2] & 0x0C);
+	
+	if(1 == layer) {
+		*sampleCount = 384;
+		return (12 * bitrate / sampleRate + padding) * 4;
+	}
+	else if(3 == layer && lsf) {
+		*sampleCount = 576;
+		return 72 * bitrate / sampleRate + padding;
+	}
+	else {
+		*sampleCount = 1152;
+		return 144 * bitrate / sampleRate + padding;
+	}
+}
+
+// Walk the frame headers in an MPEG audio file without decoding any audio
+static NSData *
+buildFrameIndex(const uint8_t *bytes, off_t length)
+{
+	off_t					offset			= 0;
+	NSMutableData			*index			= nil;
+	MPEGFrameIndexEntry		entry;
+	const uint8_t			*sync;
+	unsigned				frameLength, sampleCount, nextSampleCount;
+	uint32_t				format			= 0;
+	uint32_t				frameFormat, nextFormat;
+	BOOL					synced			= NO;
+	BOOL					valid;
+	
+	// Skip any ID3v2 tags at the start of the file, including their footers
+	while(offset + 10 <= length && 0x49 == bytes[offset] && 0x44 == bytes[offset + 1] && 0x33 == bytes[offset + 2]) {
+		offset += (0x10 & bytes[offset + 5] ? 20 : 10) + 
+			(((bytes[offset + 6] & 0x7F) << (3 * 7)) | ((bytes[offset + 7] & 0x7F) << (2 * 7)) |
+			 ((bytes[offset + 8] & 0x7F) << (1 * 7)) | ((bytes[offset + 9] & 0x7F) << (0 * 7)));
+	}
+	
+	// And the ID3v1 tag at the end
+	if(128 <= length && 0x54 == bytes[length - 128] && 0x41 == bytes[length - 127] && 0x47 == bytes[length - 126])
+		length -= 128;
+	
+	index			= [NSMutableData data];
+	entry.sample	= 0;
+	
+	while(offset + 4 <= length) {
+		frameLength		= parseMPEGHeader(bytes + offset, &sampleCount, &frameFormat);
+		valid			= (0 != frameLength && offset + frameLength <= length && (0 == format || frameFormat == format));
+		
+		// A sync code found after junk (or at the start) only counts if another frame follows it
+		if(valid && NO == synced && offset + frameLength + 4 <= length)
+			valid = (0 != parseMPEGHeader(bytes + offset + frameLength, &nextSampleCount, &nextFormat) && frameFormat == nextFormat);
+		
+		if(NO == valid) {
+			synced = NO;
+			
+			sync = memchr(bytes + offset + 1, 0xFF, length - offset - 1);
+			if(NULL == sync)
+				break;
+			
+			offset = sync - bytes;
+			continue;
+		}
+		
+		entry.offset = offset;
+		[index appendBytes:&entry length:sizeof(entry)];
+		
+		entry.sample	+= sampleCount;
+		offset			+= frameLength;
+		format			= frameFormat;
+		synced			= YES;
+	}
+	
+	if(0 == [index length])
+		return nil;
+	
+	entry.offset = offset;
+	[index appendBytes:&entry length:sizeof(entry)];
+	
+	return index;
+}
+
 @interface MPEGDecoder (Private)
 - (BOOL) scanFile;
+- (NSData *) frameIndex;
+- (BOOL) positionAtFrame:(SInt64)frame;
+- (void) feedStream:(struct mad_stream *)stream readEOF:(BOOL *)readEOF;
 - (SInt64) seekToFrameApproximately:(SInt64)frame;
 - (SInt64) seekToFrameAccurately:(SInt64)frame;
 @end
 
 @implementation MPEGDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	unsigned	frameLength, sampleCount, nextSampleCount;
+	uint32_t	format, nextFormat;
+	
+	if(4 > length)
+		return NO;
+	
+	// A lone sync code is too weak a signature, so check the following frame too when it was read
+	frameLength = parseMPEGHeader(header, &sampleCount, &format);
+	if(0 == frameLength)
+		return NO;
+	
+	if(frameLength + 4 <= length)
+		return (0 != parseMPEGHeader(header + frameLength, &nextSampleCount, &nextFormat) && format == nextFormat);
+	
+	return YES;
+}
+
++ (void) initialize
+{
+	if(nil == sFrameIndexCache) {
+		sFrameIndexCache		= [[NSMutableDictionary alloc] init];
+		sFrameIndexCacheKeys	= [[NSMutableArray alloc] init];
+	}
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
 		_inputBuffer = (unsigned char *)calloc(INPUT_BUFFER_SIZE + MAD_BUFFER_GUARD, sizeof(unsigned char));
 		NSAssert(NULL != _inputBuffer, @"Unable to allocate memory");
 		
-		_file = fopen([[self filename] fileSystemRepresentation], "r");
-		NSAssert(NULL != _file, NSLocalizedStringFromTable(@"Unable to create the MPEG decoder.", @"Exceptions", @""));
+		// libmad reads the file in place when it is mapped
+		NSAssert(nil != [self mappedFile], NSLocalizedStringFromTable(@"Unable to create the MPEG decoder.", @"Exceptions", @""));
 		
 		mad_stream_init(&_mad_stream);
 		mad_frame_init(&_mad_frame);
@@ -106,6 +276,10 @@ audio_linear_round(unsigned int bits,
 			return nil;
 		}
 		
+		// Without a Xing header the length can only be estimated from the first frame, so count the frames instead
+		if(NO == _foundXingHeader && nil != [self frameIndex])
+			_totalFrames = ((const MPEGFrameIndexEntry *)[_frameIndex bytes])[[_frameIndex length] / sizeof(MPEGFrameIndexEntry) - 1].sample;
+		
 		// Setup input format descriptor
 		_pcmFormat.mFormatID			= kAudioFormatLinearPCM;
 		// Unfortunately Max requires the output to be in Big Endian format
@@ -137,7 +311,8 @@ audio_linear_round(unsigned int bits,
 	mad_stream_finish(&_mad_stream);
 	
 	free(_inputBuffer), _inputBuffer = NULL;
-	fclose(_file), _file = NULL;
+	
+	[_frameIndex release],	_frameIndex = nil;
 	
 	if(_bufferList) {
 		unsigned i;
@@ -158,7 +333,7 @@ audio_linear_round(unsigned int bits,
 
 - (SInt64) seekToFrame:(SInt64)frame
 {
-	if(_foundLAMEHeader)
+	if(_foundLAMEHeader || nil != [self frameIndex])
 		return [self seekToFrameAccurately:frame];
 	else
 		return [self seekToFrameApproximately:frame];
@@ -169,10 +344,6 @@ audio_linear_round(unsigned int bits,
 	CircularBuffer		*buffer				= [self pcmBuffer];
 	UInt32				frameCount			= [buffer freeSpaceAvailable] / (_pcmFormat.mChannelsPerFrame * sizeof(int16_t));
 				
-	UInt32			bytesToRead;
-	UInt32			bytesRemaining;
-	unsigned char	*readStartPointer;
-	
 	BOOL			readEOF					= NO;
 	
 	UInt32			framesRead				= 0;
@@ -213,37 +384,7 @@ audio_linear_round(unsigned int bits,
 		
 		// Feed the input buffer if necessary
 		if(NULL == _mad_stream.buffer || MAD_ERROR_BUFLEN == _mad_stream.error) {
-			if(NULL != _mad_stream.next_frame) {
-				bytesRemaining = _mad_stream.bufend - _mad_stream.next_frame;
-				memmove(_inputBuffer, _mad_stream.next_frame, bytesRemaining);
-				
-				readStartPointer	= _inputBuffer + bytesRemaining;
-				bytesToRead			= INPUT_BUFFER_SIZE - bytesRemaining;
-			}
-			else {
-				bytesToRead			= INPUT_BUFFER_SIZE,
-				readStartPointer	= _inputBuffer,
-				bytesRemaining		= 0;
-			}
-			
-			// Read raw bytes from the MP3 file
-			size_t bytesRead = fread(readStartPointer, 1, bytesToRead, _file);
-			if(ferror(_file)) {
-#if DEBUG
-				NSLog(@"Read error: %s.", strerror(errno));
-#endif
-				break;
-			}
-			
-			// MAD_BUFFER_GUARD zeroes are required to decode the last frame of the file
-			if(feof(_file)) {
-				memset(readStartPointer + bytesRead, 0, MAD_BUFFER_GUARD);
-				bytesRead	+= MAD_BUFFER_GUARD;
-				readEOF		= YES;
-			}
-			
-			mad_stream_buffer(&_mad_stream, _inputBuffer, bytesRead + bytesRemaining);
-			_mad_stream.error = MAD_ERROR_NONE;
+			[self feedStream:&_mad_stream readEOF:&readEOF];
 		}
 		
 		// Decode the MPEG frame
@@ -339,16 +480,12 @@ audio_linear_round(unsigned int bits,
 - (BOOL) scanFile
 {
 	uint32_t			framesDecoded = 0;
-	UInt32				bytesToRead, bytesRemaining;
-	size_t				bytesRead;
-	unsigned char		*readStartPointer;
 	BOOL				readEOF;
 	
 	struct mad_stream	stream;
 	struct mad_frame	frame;
 	
 	int					result;
-	struct stat			stat;
 	uint32_t			id3_length		= 0;
 	
 	// Set up	
@@ -357,45 +494,11 @@ audio_linear_round(unsigned int bits,
 	
 	readEOF = NO;
 	
-	result = fstat(fileno(_file), &stat);
-	if(-1 == result)
-		return NO;
-	
-	_fileBytes = stat.st_size;
+	_fileBytes = [[self mappedFile] length];
 	
 	for(;;) {
 		if(NULL == stream.buffer || MAD_ERROR_BUFLEN == stream.error) {
-			if(stream.next_frame) {
-				bytesRemaining = stream.bufend - stream.next_frame;
-				memmove(_inputBuffer, stream.next_frame, bytesRemaining);
-				
-				readStartPointer	= _inputBuffer + bytesRemaining;
-				bytesToRead			= INPUT_BUFFER_SIZE - bytesRemaining;
-			}
-			else {
-				bytesToRead			= INPUT_BUFFER_SIZE,
-				readStartPointer	= _inputBuffer,
-				bytesRemaining		= 0;
-			}
-			
-			// Read raw bytes from the MP3 file
-			bytesRead = fread(readStartPointer, 1, bytesToRead, _file);
-			if(ferror(_file)) {
-#if DEBUG
-				NSLog(@"Read error: %s.", strerror(errno));
-#endif
-				break;
-			}
-			
-			// MAD_BUFFER_GUARD zeroes are required to decode the last frame of the file
-			if(feof(_file)) {
-				memset(readStartPointer + bytesRead, 0, MAD_BUFFER_GUARD);
-				bytesRead	+= MAD_BUFFER_GUARD;
-				readEOF		= YES;
-			}
-			
-			mad_stream_buffer(&stream, _inputBuffer, bytesRead + bytesRemaining);
-			stream.error = MAD_ERROR_NONE;
+			[self feedStream:&stream readEOF:&readEOF];
 		}
 		
 		result = mad_frame_decode(&frame, &stream);
@@ -585,10 +688,6 @@ audio_linear_round(unsigned int bits,
 	mad_frame_finish(&frame);
 	mad_stream_finish(&stream);
 	
-	// Rewind to the beginning of file
-	if(-1 == fseek(_file, 0, SEEK_SET))
-		return NO;
-	
 	return YES;
 }
 
@@ -617,24 +716,22 @@ audio_linear_round(unsigned int bits,
 	else
 		seekPoint = (long)_fileBytes * fraction;
 	
-	int result = fseek(_file, seekPoint, SEEK_SET);
-	if(0 == result) {
-		mad_stream_buffer(&_mad_stream, NULL, 0);
-		
-		// Reset frame count to prevent early termination of playback
-		_mpegFramesDecoded			= 0;
-		_samplesDecoded				= 0;
-		_samplesToSkipInNextFrame	= 0;
-		
-		_myCurrentFrame				= frame;
-		
-		[[self pcmBuffer] reset];
-		
-		_currentFrame				= _myCurrentFrame;
-	}
+	_inputOffset = MIN((off_t)seekPoint, _fileBytes);
+	mad_stream_buffer(&_mad_stream, NULL, 0);
+	
+	// Reset frame count to prevent early termination of playback
+	_mpegFramesDecoded			= 0;
+	_samplesDecoded				= 0;
+	_samplesToSkipInNextFrame	= 0;
+	
+	_myCurrentFrame				= frame;
+	
+	[[self pcmBuffer] reset];
+	
+	_currentFrame				= _myCurrentFrame;
 	
 	// Right now it's only possible to return an approximation of the audio frame
-	return (-1 == result ? -1 : frame);
+	return frame;
 }
 
 - (SInt64) seekToFrameAccurately:(SInt64)frame
@@ -643,16 +740,14 @@ audio_linear_round(unsigned int bits,
 	
 	// Brute force seeking is necessary since frame-accurate seeking is required
 	
-	UInt32			bytesToRead;
-	UInt32			bytesRemaining;
-	unsigned char	*readStartPointer;
-	
 	BOOL			readEOF					= NO;
 	
-	// To seek to a frame earlier in the file, rewind to the beginning
-	if([self currentFrame] > frame) {
-		if(-1 == fseek(_file, 0, SEEK_SET))
-			return -1;
+	// Jump to the MPEG frame containing the desired frame if the file is indexed
+	BOOL positioned = [self positionAtFrame:frame];
+	
+	// Otherwise to seek to a frame earlier in the file, rewind to the beginning
+	if(NO == positioned && [self currentFrame] > frame) {
+		_inputOffset				= 0;
 		
 		// Reset decoder parameters
 		_mpegFramesDecoded			= 0;
@@ -663,7 +758,7 @@ audio_linear_round(unsigned int bits,
 		mad_stream_buffer(&_mad_stream, NULL, 0);
 	}
 	// Mark any buffered audio as read
-	else
+	else if(NO == positioned)
 		_myCurrentFrame += _bufferList->mBuffers[0].mDataByteSize / sizeof(float);
 	
 	// Zero the buffers
@@ -687,37 +782,7 @@ audio_linear_round(unsigned int bits,
 		
 		// Feed the input buffer if necessary
 		if(NULL == _mad_stream.buffer || MAD_ERROR_BUFLEN == _mad_stream.error) {
-			if(NULL != _mad_stream.next_frame) {
-				bytesRemaining = _mad_stream.bufend - _mad_stream.next_frame;
-				memmove(_inputBuffer, _mad_stream.next_frame, bytesRemaining);
-				
-				readStartPointer	= _inputBuffer + bytesRemaining;
-				bytesToRead			= INPUT_BUFFER_SIZE - bytesRemaining;
-			}
-			else {
-				bytesToRead			= INPUT_BUFFER_SIZE,
-				readStartPointer	= _inputBuffer,
-				bytesRemaining		= 0;
-			}
-			
-			// Read raw bytes from the MP3 file
-			size_t bytesRead = fread(readStartPointer, 1, bytesToRead, _file);
-			if(ferror(_file)) {
-#if DEBUG
-				NSLog(@"Read error: %s.", strerror(errno));
-#endif
-				break;
-			}
-			
-			// MAD_BUFFER_GUARD zeroes are required to decode the last frame of the file
-			if(feof(_file)) {
-				memset(readStartPointer + bytesRead, 0, MAD_BUFFER_GUARD);
-				bytesRead	+= MAD_BUFFER_GUARD;
-				readEOF		= YES;
-			}
-			
-			mad_stream_buffer(&_mad_stream, _inputBuffer, bytesRead + bytesRemaining);
-			_mad_stream.error = MAD_ERROR_NONE;
+			[self feedStream:&_mad_stream readEOF:&readEOF];
 		}
 		
 		// Decode the MPEG frame
@@ -823,4 +888,174 @@ audio_linear_round(unsigned int bits,
 	return [self currentFrame];
 }
 
+- (NSData *) frameIndex
+{
+	MappedFile		*file;
+	NSString		*key;
+	
+	if(_indexedFile)
+		return _frameIndex;
+	
+	_indexedFile	= YES;
+	file			= [self mappedFile];
+	key				= [NSString stringWithFormat:@"%@ %lld %ld", [self filename], (long long)[file length], (long)[file modificationTime]];
+	
+	@synchronized(sFrameIndexCache) {
+		_frameIndex = [[sFrameIndexCache objectForKey:key] retain];
+		
+		if(nil != _frameIndex) {
+			[sFrameIndexCacheKeys removeObject:key];
+			[sFrameIndexCacheKeys addObject:key];
+		}
+	}
+	
+	// Only a mapped file can be indexed
+	if(nil == _frameIndex && NULL != [file bytes]) {
+		_frameIndex = [buildFrameIndex([file bytes], [file length]) retain];
+		
+		if(nil != _frameIndex) {
+			@synchronized(sFrameIndexCache) {
+				if(FRAME_INDEX_CACHE_SIZE <= [sFrameIndexCacheKeys count]) {
+					[sFrameIndexCache removeObjectForKey:[sFrameIndexCacheKeys objectAtIndex:0]];
+					[sFrameIndexCacheKeys removeObjectAtIndex:0];
+				}
+				
+				[sFrameIndexCacheKeys removeObject:key];
+				[sFrameIndexCacheKeys addObject:key];
+				[sFrameIndexCache setObject:_frameIndex forKey:key];
+			}
+		}
+	}
+	
+	return _frameIndex;
+}
+
+// Position the stream at the MPEG frame containing frame, after decoding the frames it depends on
+- (BOOL) positionAtFrame:(SInt64)frame
+{
+	const MPEGFrameIndexEntry	*entries;
+	NSUInteger					count, low, high, mid, target, start, i;
+	SInt64						skippedSamples, sample;
+	NSUInteger					prerollBytes;
+	
+	if(nil == [self frameIndex])
+		return NO;
+	
+	entries		= [_frameIndex bytes];
+	count		= [_frameIndex length] / sizeof(MPEGFrameIndexEntry) - 1;
+	
+	// The Xing frame is silent and the encoder delay isn't output
+	skippedSamples	= (_foundXingHeader ? entries[1].sample : 0) + (_foundLAMEHeader ? _encoderDelay : 0);
+	sample			= frame + skippedSamples;
+	
+	// Find the last MPEG frame starting at or before sample
+	low		= 0;
+	high	= count;
+	while(1 < high - low) {
+		mid = (low + high) / 2;
+		if(entries[mid].sample <= sample)
+			low = mid;
+		else
+			high = mid;
+	}
+	
+	target = low;
+	
+	// Leave the first frames, and the Xing frame and encoder delay, to the normal decoding logic
+	if(2 > target || entries[target].sample < skippedSamples)
+		return NO;
+	
+	// Decode the preceding frames to fill the bit reservoir and the overlap
+	for(start = target - 1; 0 < start && RESERVOIR_BYTES > entries[target - 1].offset - entries[start].offset; --start)
+		;
+	
+	prerollBytes = (NSUInteger)(MIN(entries[target].offset + MAD_BUFFER_GUARD, [[self mappedFile] length]) - entries[start].offset);
+	
+	mad_frame_mute(&_mad_frame);
+	mad_synth_mute(&_mad_synth);
+	
+	_mad_stream.md_len = 0;
+	mad_stream_buffer(&_mad_stream, (const unsigned char *)[[self mappedFile] bytes] + entries[start].offset, prerollBytes);
+	
+	// The frames also go through the synthesis filter, so its state matches a linear decode; their audio is discarded
+	for(i = start; i < target; ++i) {
+		if(0 == mad_frame_decode(&_mad_frame, &_mad_stream))
+			mad_synth_frame(&_mad_synth, &_mad_frame);
+	}
+	
+	// Decoding resumes at the frame itself
+	mad_stream_buffer(&_mad_stream, NULL, 0);
+	_mad_stream.error			= MAD_ERROR_NONE;
+	_inputOffset				= entries[target].offset;
+	
+	_mpegFramesDecoded			= target;
+	_samplesDecoded				= entries[target].sample - skippedSamples;
+	_samplesToSkipInNextFrame	= 0;
+	_myCurrentFrame				= _samplesDecoded;
+	
+	return YES;
+}
+
+// Hand libmad the unread part of the file
+// A mapped file is used in place, apart from the tail, which is copied so it can be followed by the
+// MAD_BUFFER_GUARD zeroes needed to decode the last frame; otherwise the file is read into the input buffer
+- (void) feedStream:(struct mad_stream *)stream readEOF:(BOOL *)readEOF
+{
+	MappedFile				*file			= [self mappedFile];
+	const unsigned char		*bytes			= [file bytes];
+	off_t					length			= [file length];
+	off_t					offset			= _inputOffset;
+	size_t					bytesRemaining	= 0;
+	ssize_t					bytesRead;
+	
+	if(NULL == bytes) {
+		
+		// Keep the part of the buffer libmad hasn't consumed
+		if(NULL != stream->buffer) {
+			bytesRemaining	= stream->bufend - stream->next_frame;
+			offset			= _readOffset;
+			memmove(_inputBuffer, stream->next_frame, bytesRemaining);
+		}
+		
+		bytesRead = [file readBytes:_inputBuffer + bytesRemaining length:INPUT_BUFFER_SIZE - bytesRemaining atOffset:offset];
+		NSAssert(-1 != bytesRead, NSLocalizedStringFromTable(@"Unable to read from the input file.", @"Exceptions", @""));
+		
+		_readOffset = offset + bytesRead;
+		
+		if(_readOffset >= length) {
+			memset(_inputBuffer + bytesRemaining + bytesRead, 0, MAD_BUFFER_GUARD);
+			bytesRead	+= MAD_BUFFER_GUARD;
+			*readEOF	= YES;
+		}
+		
+		mad_stream_buffer(stream, _inputBuffer, bytesRemaining + bytesRead);
+		stream->error = MAD_ERROR_NONE;
+		
+		return;
+	}
+	
+	// The tail was copied already
+	if(_inputBuffer == stream->buffer) {
+		*readEOF = YES;
+		return;
+	}
+	
+	// Continue after the last frame libmad consumed
+	if(NULL != stream->buffer)
+		offset = stream->next_frame - bytes;
+	
+	if(INPUT_BUFFER_SIZE < length - offset)
+		mad_stream_buffer(stream, bytes + offset, (unsigned long)(length - offset));
+	else {
+		if(offset < length)
+			memcpy(_inputBuffer, bytes + offset, (size_t)(length - offset));
+		memset(_inputBuffer + (length - offset), 0, MAD_BUFFER_GUARD);
+		
+		mad_stream_buffer(stream, _inputBuffer, (unsigned long)(length - offset) + MAD_BUFFER_GUARD);
+		*readEOF = YES;
+	}
+	
+	stream->error = MAD_ERROR_NONE;
+}
+
 @end
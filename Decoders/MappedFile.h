@@ -0,0 +1,52 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// A read-only view of a file, memory-mapped when it is on an internal local volume
+// Codec libraries can be handed pointers into the file directly, and the pages are shared with the page cache
+// Files on network, removable and external volumes are read with pread instead, since an I/O error or truncation
+// in a mapped file can only be reported with SIGBUS
+@interface MappedFile : NSObject
+{
+	int				_fd;
+	void			*_bytes;
+	off_t			_length;
+	time_t			_modificationTime;
+}
+
+- (id)				initWithFilename:(NSString *)filename;
+
+// NULL if the file isn't mapped
+- (const void *)	bytes;
+- (off_t)			length;
+
+- (time_t)			modificationTime;
+
+// Copies up to length bytes starting at offset, from the mapping if there is one
+// Returns the number of bytes copied, or -1 with errno set if the file couldn't be read
+- (ssize_t)			readBytes:(void *)buffer length:(size_t)length atOffset:(off_t)offset;
+
+// Hints for the VM system about how the file will be read
+- (void)			adviseSequentialAccess;
+- (void)			adviseRandomAccess;
+
+@end
@@ -0,0 +1,139 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "MappedFile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/param.h>		// statfs
+#include <sys/mount.h>
+
+#include <DiskArbitration/DiskArbitration.h>
+
+// Only files on local disks inside the machine are mapped
+static BOOL
+isOnInternalVolume(int fd)
+{
+	struct statfs		fs;
+	DASessionRef		session;
+	DADiskRef			disk;
+	CFDictionaryRef		description;
+	BOOL				internal		= NO;
+	
+	if(-1 == fstatfs(fd, &fs) || 0 == (MNT_LOCAL & fs.f_flags))
+		return NO;
+	
+	session = DASessionCreate(kCFAllocatorDefault);
+	if(NULL == session)
+		return NO;
+	
+	disk = DADiskCreateFromBSDName(kCFAllocatorDefault, session, fs.f_mntfromname);
+	if(NULL != disk) {
+		description = DADiskCopyDescription(disk);
+		if(NULL != description) {
+			internal = (kCFBooleanTrue == CFDictionaryGetValue(description, kDADiskDescriptionDeviceInternalKey) 
+						&& kCFBooleanTrue != CFDictionaryGetValue(description, kDADiskDescriptionMediaRemovableKey));
+			CFRelease(description);
+		}
+		CFRelease(disk);
+	}
+	
+	CFRelease(session);
+	
+	return internal;
+}
+
+@implementation MappedFile
+
+- (id) initWithFilename:(NSString *)filename
+{
+	NSParameterAssert(nil != filename);
+	
+	if((self = [super init])) {
+		struct stat		stat;
+		int				result;
+		int				error			= 0;
+		
+		_fd = open([filename fileSystemRepresentation], O_RDONLY);
+		NSAssert(-1 != _fd, NSLocalizedStringFromTable(@"Unable to open the input file.", @"Exceptions", @""));
+		
+		result = fstat(_fd, &stat);
+		if(-1 == result) {
+			error = errno;
+			close(_fd), _fd = -1;
+		}
+		NSAssert1(-1 != result, @"Unable to get information on the input file: %s", strerror(error));
+		
+		_length				= stat.st_size;
+		_modificationTime	= stat.st_mtime;
+		
+		// Empty files can't be mapped, and if the mapping fails the file is read instead
+		if(0 < _length && isOnInternalVolume(_fd)) {
+			_bytes = mmap(NULL, (size_t)_length, PROT_READ, MAP_SHARED, _fd, 0);
+			
+			// The mapping remains valid after the file is closed
+			if(MAP_FAILED == _bytes)
+				_bytes = NULL;
+			else
+				close(_fd), _fd = -1;
+		}
+	}
+	return self;
+}
+
+- (void) dealloc
+{
+	if(NULL != _bytes)
+		munmap(_bytes, (size_t)_length), _bytes = NULL;
+	
+	if(-1 != _fd)
+		close(_fd), _fd = -1;
+	
+	[super dealloc];
+}
+
+- (const void *)	bytes							{ return _bytes; }
+- (off_t)			length							{ return _length; }
+
+- (time_t)			modificationTime				{ return _modificationTime; }
+
+- (ssize_t) readBytes:(void *)buffer length:(size_t)length atOffset:(off_t)offset
+{
+	NSParameterAssert(0 <= offset);
+	
+	if(offset >= _length)
+		return 0;
+	
+	length = (size_t)MIN((off_t)length, _length - offset);
+	
+	if(NULL == _bytes)
+		return pread(_fd, buffer, length, offset);
+	
+	memcpy(buffer, (const uint8_t *)_bytes + offset, length);
+	return (ssize_t)length;
+}
+
+- (void)			adviseSequentialAccess			{ if(NULL != _bytes) madvise(_bytes, (size_t)_length, MADV_SEQUENTIAL); }
+- (void)			adviseRandomAccess				{ if(NULL != _bytes) madvise(_bytes, (size_t)_length, MADV_RANDOM); }
+
+@end
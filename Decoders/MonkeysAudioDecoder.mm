@@ -30,6 +30,11 @@
 
 @implementation MonkeysAudioDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (4 <= length && 0 == memcmp(header, "MAC ", 4));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
@@ -23,6 +23,12 @@
 
 @implementation MusepackDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	// Stream versions 7 and 8
+	return ((3 <= length && 0 == memcmp(header, "MP+", 3)) || (4 <= length && 0 == memcmp(header, "MPCK", 4)));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {		
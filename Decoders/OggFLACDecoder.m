@@ -20,6 +20,7 @@
 
 #import "OggFLACDecoder.h"
 #import "CircularBuffer.h"
+#import "UtilityFunctions.h"
 
 @interface OggFLACDecoder (Private)
 
@@ -169,6 +170,11 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 
 @implementation OggFLACDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (kOggStreamTypeFLAC == oggStreamTypeForHeader(header, length));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
@@ -228,6 +234,21 @@ errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus
 
 - (SInt64)			totalFrames						{ return _totalSamples; }
 
+- (BOOL)			supportsSeeking					{ return YES; }
+
+// Seek table offsets don't correspond to Ogg pages, so leave the search to libFLAC
+- (SInt64) seekToFrame:(SInt64)frame
+{
+	NSParameterAssert(0 <= frame && frame <= [self totalFrames]);
+	
+	if(FLAC__stream_decoder_seek_absolute(_flac, frame)) {
+		[[self pcmBuffer] reset];
+		_currentFrame = frame;
+	}
+	
+	return [self currentFrame];
+}
+
 - (void) fillPCMBuffer
 {
 	CircularBuffer				*buffer				= [self pcmBuffer];
@@ -20,6 +20,7 @@
 
 #import "OggSpeexDecoder.h"
 #import "CircularBuffer.h"
+#import "UtilityFunctions.h"
 
 #include <speex/speex.h>
 #include <speex/speex_header.h>
@@ -34,6 +35,11 @@
 
 @implementation OggSpeexDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (kOggStreamTypeSpeex == oggStreamTypeForHeader(header, length));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
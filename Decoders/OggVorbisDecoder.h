@@ -26,6 +26,7 @@
 @interface OggVorbisDecoder : Decoder
 {
 	OggVorbis_File		_vf;
+	off_t				_inputOffset;
 }
 
 @end
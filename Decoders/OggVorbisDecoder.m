@@ -20,16 +20,105 @@
 
 #import "OggVorbisDecoder.h"
 #import "CircularBuffer.h"
+#import "UtilityFunctions.h"
+#import "MappedFile.h"
+
+#include <math.h>
+#include <errno.h>
+
+@interface OggVorbisDecoder (Private)
+- (size_t) readInput:(void *)buffer length:(size_t)length;
+- (int) seekInput:(ogg_int64_t)offset whence:(int)whence;
+- (long) inputOffset;
+@end
+
+// Convert libvorbis's planar float output to interleaved, big-endian signed integers
+// The samples are clipped and rounded a channel at a time so the inner loops stay simple
+static void
+interleaveFloatSamples(float **pcm, unsigned channels, long frameCount, UInt32 bitsPerChannel, uint8_t *output)
+{
+	unsigned		bytesPerSample		= bitsPerChannel / 8;
+	unsigned		stride				= bytesPerSample * channels;
+	float			scale				= ldexpf(1.f, bitsPerChannel - 1);
+	int32_t			maxValue			= (int32_t)(((uint32_t)1 << (bitsPerChannel - 1)) - 1);
+	int32_t			minValue			= -maxValue - 1;
+	const float		*input;
+	uint8_t			*out;
+	float			sample;
+	int32_t			value;
+	unsigned		channel;
+	long			frame;
+	
+	for(channel = 0; channel < channels; ++channel) {
+		input	= pcm[channel];
+		out		= output + (channel * bytesPerSample);
+		
+		for(frame = 0; frame < frameCount; ++frame, out += stride) {
+			sample = input[frame] * scale;
+			
+			if(sample >= scale)
+				value = maxValue;
+			else if(sample <= -scale)
+				value = minValue;
+			else
+				value = (int32_t)lrintf(sample);
+			
+			switch(bytesPerSample) {
+				case 2:
+					out[0] = (uint8_t)(value >> 8);
+					out[1] = (uint8_t)value;
+					break;
+					
+				case 3:
+					out[0] = (uint8_t)(value >> 16);
+					out[1] = (uint8_t)(value >> 8);
+					out[2] = (uint8_t)value;
+					break;
+					
+				case 4:
+					*(uint32_t *)out = OSSwapHostToBigInt32((uint32_t)value);
+					break;
+			}
+		}
+	}
+}
+
+#pragma mark Callbacks
+
+static size_t
+readCallback(void *ptr, size_t size, size_t nmemb, void *datasource)
+{
+	return [(OggVorbisDecoder *)datasource readInput:ptr length:(size * nmemb)] / size;
+}
+
+static int
+seekCallback(void *datasource, ogg_int64_t offset, int whence)
+{
+	return [(OggVorbisDecoder *)datasource seekInput:offset whence:whence];
+}
+
+static long
+tellCallback(void *datasource)
+{
+	return [(OggVorbisDecoder *)datasource inputOffset];
+}
 
 @implementation OggVorbisDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (kOggStreamTypeVorbis == oggStreamTypeForHeader(header, length));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {		
-		FILE *file = fopen([[self filename] fileSystemRepresentation], "r");
-		NSAssert1(NULL != file, @"Unable to open the input file (%s).", strerror(errno));	
+		// vorbisfile reads from the mapped file, and doesn't need to close it
+		NSAssert(nil != [self mappedFile], NSLocalizedStringFromTable(@"Unable to open the input file.", @"Exceptions", @""));
+		
+		ov_callbacks callbacks = { readCallback, seekCallback, NULL, tellCallback };
 		
-		int result = ov_test(file, &_vf, NULL, 0);
+		int result = ov_test_callbacks(self, &_vf, NULL, 0, callbacks);
 		NSAssert(0 == result, NSLocalizedStringFromTable(@"The file does not appear to be a valid Ogg Vorbis file.", @"Exceptions", @""));
 		
 		result = ov_test_open(&_vf);
@@ -46,7 +135,14 @@
 		
 		_pcmFormat.mSampleRate			= ovInfo->rate;
 		_pcmFormat.mChannelsPerFrame	= ovInfo->channels;
-		_pcmFormat.mBitsPerChannel		= 16;
+		
+		// Vorbis decodes to float, so more of its precision can be kept if asked for
+		// Not every encoder handles wider samples as well as 16-bit ones, Speex in particular, so that stays the default
+		switch([[NSUserDefaults standardUserDefaults] integerForKey:@"oggVorbisDecoderBitsPerChannel"]) {
+			case 24:	_pcmFormat.mBitsPerChannel = 24;		break;
+			case 32:	_pcmFormat.mBitsPerChannel = 32;		break;
+			default:	_pcmFormat.mBitsPerChannel = 16;		break;
+		}
 		
 		_pcmFormat.mBytesPerPacket		= (_pcmFormat.mBitsPerChannel / 8) * _pcmFormat.mChannelsPerFrame;
 		_pcmFormat.mFramesPerPacket		= 1;
@@ -73,7 +169,7 @@
 
 - (SInt64) seekToFrame:(SInt64)frame
 {
-	if(ov_pcm_seek(&_vf, frame)) {
+	if(0 == ov_pcm_seek(&_vf, frame)) {
 		[[self pcmBuffer] reset];
 		_currentFrame = frame;
 	}
@@ -84,31 +180,75 @@
 - (void) fillPCMBuffer
 {
 	CircularBuffer		*buffer;
-	long				bytesRead;
-	long				totalBytes;
-	void				*rawBuffer;
-	unsigned			availableSpace;
+	uint8_t				*rawBuffer;
+	UInt32				bytesPerFrame;
+	long				framesAvailable;
+	long				framesRead;
+	long				totalFrames;
+	float				**pcm;
 	int					currentSection;
 	
 	buffer				= [self pcmBuffer];
 	rawBuffer			= [buffer exposeBufferForWriting];
-	availableSpace		= [buffer freeSpaceAvailable];
-	totalBytes			= 0;
+	bytesPerFrame		= [self pcmFormat].mBytesPerFrame;
+	framesAvailable		= [buffer freeSpaceAvailable] / bytesPerFrame;
+	totalFrames			= 0;
 	currentSection		= 0;
 	
-	for(;;) {
-		bytesRead		= ov_read(&_vf, rawBuffer + totalBytes, availableSpace - totalBytes, YES, sizeof(int16_t), YES, &currentSection);
-		
-		NSAssert(0 <= bytesRead, @"Ogg Vorbis decode error.");
+	while(totalFrames < framesAvailable) {
+		framesRead		= ov_read_float(&_vf, &pcm, (int)(framesAvailable - totalFrames), &currentSection);
 		
-		totalBytes += bytesRead;
+		NSAssert(0 <= framesRead, @"Ogg Vorbis decode error.");
 		
-		if(0 == bytesRead || totalBytes >= availableSpace) {
+		if(0 == framesRead)
 			break;
-		}
+		
+		interleaveFloatSamples(pcm, [self pcmFormat].mChannelsPerFrame, framesRead, [self pcmFormat].mBitsPerChannel, rawBuffer + (totalFrames * bytesPerFrame));
+		
+		totalFrames += framesRead;
+	}
+	
+	[buffer wroteBytes:(totalFrames * bytesPerFrame)];
+}
+
+@end
+
+@implementation OggVorbisDecoder (Private)
+
+- (long) inputOffset			{ return (long)_inputOffset; }
+
+// vorbisfile treats a short read with errno set as an error
+- (size_t) readInput:(void *)buffer length:(size_t)length
+{
+	ssize_t		bytesRead;
+	
+	errno		= 0;
+	bytesRead	= [_mappedFile readBytes:buffer length:length atOffset:_inputOffset];
+	
+	if(-1 == bytesRead)
+		return 0;
+	
+	_inputOffset += bytesRead;
+	
+	return (size_t)bytesRead;
+}
+
+- (int) seekInput:(ogg_int64_t)offset whence:(int)whence
+{
+	off_t		inputOffset;
+	
+	switch(whence) {
+		case SEEK_SET:		inputOffset = offset;							break;
+		case SEEK_CUR:		inputOffset = _inputOffset + offset;			break;
+		case SEEK_END:		inputOffset = [_mappedFile length] + offset;	break;
+		default:			return -1;
 	}
 	
-	[buffer wroteBytes:totalBytes];
+	if(0 > inputOffset || [_mappedFile length] < inputOffset)
+		return -1;
+	
+	_inputOffset = inputOffset;
+	return 0;
 }
 
 @end
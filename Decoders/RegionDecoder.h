@@ -28,6 +28,7 @@
 @interface RegionDecoder : NSObject <DecoderMethods>
 {
 	Decoder			*_decoder;
+	NSDictionary	*_fileIdentity;
 	SInt64			_startingFrame;
 	UInt32			_frameCount;
 	NSUInteger		_loopCount;
@@ -20,9 +20,50 @@
 
 #import "RegionDecoder.h"
 #import "Decoder.h"
+#import "CueSheetSplitter.h"
+
+#include <sys/stat.h>
+
+// Idle decoders are closed after this many seconds, so the files they read aren't held open
+#define IDLE_DECODER_LIFETIME		5.0
+#define MAXIMUM_IDLE_DECODERS		4
+
+// Decoders from regions that were read to the end, kept for other regions of the same file
+// Opening a file is expensive for some formats, and the next track of a cue sheet usually starts where the last one ended
+// Each decoder is kept with the identity its file had when it was opened
+static NSMutableArray		*sIdleDecoders		= nil;
+
+@interface RegionDecoder (Private)
++ (Decoder *)	decoderWithFilename:(NSString *)filename positionedAtFrame:(SInt64)frame frameCount:(NSUInteger)frameCount fileIdentity:(NSDictionary **)identity;
++ (void)		recycleDecoder:(Decoder *)decoder fileIdentity:(NSDictionary *)identity;
++ (void)		scheduleIdleDecoderPurge;
++ (void)		purgeIdleDecoders;
+@end
+
+// A file replaced or rewritten under the same name must not be read with a decoder opened on the old one
+static NSDictionary *
+fileIdentity(NSString *filename)
+{
+	struct stat		sourceStat;
+	
+	if(-1 == stat([filename fileSystemRepresentation], &sourceStat))
+		return nil;
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+		[NSNumber numberWithLongLong:sourceStat.st_size], @"size",
+		[NSNumber numberWithLong:sourceStat.st_mtime], @"modificationTime",
+		[NSNumber numberWithUnsignedLongLong:sourceStat.st_ino], @"inode",
+		nil];
+}
 
 @implementation RegionDecoder
 
++ (void) initialize
+{
+	if(nil == sIdleDecoders)
+		sIdleDecoders = [[NSMutableArray alloc] init];
+}
+
 #pragma mark Creation
 
 + (id) decoderWithFilename:(NSString *)filename startingFrame:(SInt64)startingFrame
@@ -43,7 +84,8 @@
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super init])) {
-		_decoder = [Decoder decoderWithFilename:filename];
+		_decoder = [RegionDecoder decoderWithFilename:filename positionedAtFrame:0 frameCount:0 fileIdentity:&_fileIdentity];
+		[_fileIdentity retain];
 		if(nil != _decoder)
 			[_decoder retain];
 		else {
@@ -52,6 +94,8 @@
 		}
 		
 		[self setFrameCount:[[self decoder] totalFrames]];
+		
+		[self reset];
 	}
 	return self;
 }
@@ -59,7 +103,8 @@
 - (id) initWithFilename:(NSString *)filename startingFrame:(SInt64)startingFrame
 {
 	if((self = [super init])) {
-		_decoder = [Decoder decoderWithFilename:filename];
+		_decoder = [RegionDecoder decoderWithFilename:filename positionedAtFrame:startingFrame frameCount:0 fileIdentity:&_fileIdentity];
+		[_fileIdentity retain];
 		if(nil != _decoder)
 			[_decoder retain];
 		else {
@@ -70,8 +115,7 @@
 		[self setStartingFrame:startingFrame];
 		[self setFrameCount:([[self decoder] totalFrames] - startingFrame)];
 		
-		if(0 != [self startingFrame])
-			[self reset];
+		[self reset];
 	}
 	return self;
 }
@@ -79,7 +123,8 @@
 - (id) initWithFilename:(NSString *)filename startingFrame:(SInt64)startingFrame frameCount:(NSUInteger)frameCount
 {
 	if((self = [super init])) {
-		_decoder = [Decoder decoderWithFilename:filename];
+		_decoder = [RegionDecoder decoderWithFilename:filename positionedAtFrame:startingFrame frameCount:frameCount fileIdentity:&_fileIdentity];
+		[_fileIdentity retain];
 		if(nil != _decoder)
 			[_decoder retain];
 		else {
@@ -90,8 +135,7 @@
 		[self setStartingFrame:startingFrame];
 		[self setFrameCount:frameCount];
 		
-		if(0 != [self startingFrame])
-			[self reset];
+		[self reset];
 	}
 	return self;
 }
@@ -99,7 +143,8 @@
 - (id) initWithFilename:(NSString *)filename startingFrame:(SInt64)startingFrame frameCount:(NSUInteger)frameCount loopCount:(NSUInteger)loopCount
 {
 	if((self = [super init])) {
-		_decoder = [Decoder decoderWithFilename:filename];
+		_decoder = [RegionDecoder decoderWithFilename:filename positionedAtFrame:startingFrame frameCount:(0 == loopCount ? frameCount : 0) fileIdentity:&_fileIdentity];
+		[_fileIdentity retain];
 		if(nil != _decoder)
 			[_decoder retain];
 		else {
@@ -111,15 +156,19 @@
 		[self setFrameCount:frameCount];
 		[self setLoopCount:loopCount];
 		
-		if(0 != [self startingFrame])
-			[self reset];
+		[self reset];
 	}
 	return self;
 }
 
 - (void) dealloc
 {
+	// A decoder that was read to the end of the region is in a known state
+	if(nil != _decoder && [self loopCount] < [self completedLoops])
+		[RegionDecoder recycleDecoder:_decoder fileIdentity:_fileIdentity];
+	
 	[_decoder release], _decoder = nil;
+	[_fileIdentity release], _fileIdentity = nil;
 		
 	[super dealloc];
 }
@@ -153,7 +202,9 @@
 
 - (void) reset
 {
-	[[self decoder] seekToFrame:[self startingFrame]];
+	// A recycled decoder may already be in place
+	if([[self decoder] currentFrame] != [self startingFrame])
+		[[self decoder] seekToFrame:[self startingFrame]];
 	
 	_framesReadInCurrentLoop	= 0;
 	_totalFramesRead			= 0;
@@ -215,3 +266,85 @@
 }
 
 @end
+
+@implementation RegionDecoder (Private)
+
++ (Decoder *) decoderWithFilename:(NSString *)filename positionedAtFrame:(SInt64)frame frameCount:(NSUInteger)frameCount fileIdentity:(NSDictionary **)identity
+{
+	Decoder			*decoder		= nil;
+	NSDictionary	*entry			= nil;
+	NSDictionary	*candidate;
+	NSUInteger		i;
+	
+	NSParameterAssert(NULL != identity);
+	
+	// A cue sheet splitter decoding the whole file may be able to supply a whole track as it goes; its decoders are never pooled
+	*identity = nil;
+	if(0 != frameCount) {
+		decoder = [CueSheetSplitter decoderForFilename:filename startingFrame:frame frameCount:frameCount];
+		if(nil != decoder)
+			return decoder;
+	}
+	
+	// Taken before the file is opened, so a file replaced in between is never mistaken for the one that was read
+	*identity = fileIdentity(filename);
+	
+	@synchronized(sIdleDecoders) {
+		// Prefer a decoder that is already in place, otherwise one that can get there by seeking
+		for(i = 0; nil != *identity && i < [sIdleDecoders count]; ++i) {
+			candidate = [sIdleDecoders objectAtIndex:i];
+			
+			if(NO == [[[candidate objectForKey:@"decoder"] filename] isEqualToString:filename] || NO == [[candidate objectForKey:@"fileIdentity"] isEqualToDictionary:*identity])
+				continue;
+			
+			if(frame == [[candidate objectForKey:@"decoder"] currentFrame]) {
+				entry = candidate;
+				break;
+			}
+			else if(nil == entry && [[candidate objectForKey:@"decoder"] supportsSeeking])
+				entry = candidate;
+		}
+		
+		if(nil != entry) {
+			decoder = [[[entry objectForKey:@"decoder"] retain] autorelease];
+			[sIdleDecoders removeObjectIdenticalTo:entry];
+		}
+	}
+	
+	if(nil == decoder)
+		decoder = [Decoder decoderWithFilename:filename];
+	
+	return decoder;
+}
+
++ (void) recycleDecoder:(Decoder *)decoder fileIdentity:(NSDictionary *)identity
+{
+	// Without an identity there is no telling whether the file has changed
+	if(nil == identity)
+		return;
+	
+	@synchronized(sIdleDecoders) {
+		if(MAXIMUM_IDLE_DECODERS <= [sIdleDecoders count])
+			[sIdleDecoders removeObjectAtIndex:0];
+		
+		[sIdleDecoders addObject:[NSDictionary dictionaryWithObjectsAndKeys:decoder, @"decoder", identity, @"fileIdentity", nil]];
+	}
+	
+	[self performSelectorOnMainThread:@selector(scheduleIdleDecoderPurge) withObject:nil waitUntilDone:NO];
+}
+
+// Restart the countdown each time a decoder becomes idle
++ (void) scheduleIdleDecoderPurge
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(purgeIdleDecoders) object:nil];
+	[self performSelector:@selector(purgeIdleDecoders) withObject:nil afterDelay:IDLE_DECODER_LIFETIME];
+}
+
++ (void) purgeIdleDecoders
+{
+	@synchronized(sIdleDecoders) {
+		[sIdleDecoders removeAllObjects];
+	}
+}
+
+@end
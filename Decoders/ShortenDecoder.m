@@ -25,6 +25,11 @@
 
 @implementation ShortenDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (4 <= length && 0 == memcmp(header, "ajkg", 4));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
@@ -25,6 +25,11 @@
 
 @implementation WavPackDecoder
 
++ (BOOL) canDecodeHeader:(const uint8_t *)header length:(NSUInteger)length
+{
+	return (4 <= length && 0 == memcmp(header, "wvpk", 4));
+}
+
 - (id) initWithFilename:(NSString *)filename
 {
 	if((self = [super initWithFilename:filename])) {
@@ -43,6 +43,9 @@ enum {
 	NSUInteger		_lastSession;
 }
 
+// The CDTOC is read once per device and shared by subsequent instances until discarded
++ (void)				discardCachedTOCForDeviceName:(NSString *)deviceName;
+
 // Set up to read the drive corresponding to deviceName (will open the device and read the CDTOC)
 - (id)					initWithDeviceName:(NSString *)deviceName;
 
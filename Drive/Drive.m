@@ -26,6 +26,9 @@
 
 #import "LogController.h"
 
+// Raw TOCs keyed by device name, so each Drive created for a disc doesn't have to re-read it
+static NSMutableDictionary *sCachedTOCs = nil;
+
 @interface Drive (Private)
 - (void)				logMessage:(NSString *)message;
 
@@ -46,6 +49,21 @@
 
 @implementation Drive
 
++ (void) initialize
+{
+	if(nil == sCachedTOCs)
+		sCachedTOCs = [[NSMutableDictionary alloc] init];
+}
+
++ (void) discardCachedTOCForDeviceName:(NSString *)deviceName
+{
+	NSParameterAssert(nil != deviceName);
+	
+	@synchronized(sCachedTOCs) {
+		[sCachedTOCs removeObjectForKey:deviceName];
+	}
+}
+
 - (id) initWithDeviceName:(NSString *)deviceName
 {
 	NSParameterAssert(nil != deviceName);
@@ -452,6 +470,7 @@
 	CDTOC				*toc					= NULL;
 	CDTOCDescriptor		*desc					= NULL;
 	TrackDescriptor		*track					= nil;
+	NSData				*cachedTOC				= nil;
 	NSUInteger			i, numDescriptors;
 	
 	/* formats:
@@ -464,12 +483,22 @@
 	bzero(&cd_read_toc, sizeof(cd_read_toc));
 	bzero(buffer, sizeof(buffer));
 	
-	cd_read_toc.format			= kCDTOCFormatTOC;
-	cd_read_toc.buffer			= buffer;
-	cd_read_toc.bufferLength	= sizeof(buffer);
-	
-	result = ioctl([self fileDescriptor], DKIOCCDREADTOC, &cd_read_toc);
-	NSAssert(-1 != result, NSLocalizedStringFromTable(@"Unable to read the disc's table of contents.", @"Exceptions", @""));
+	@synchronized(sCachedTOCs) {
+		cachedTOC = [sCachedTOCs objectForKey:[self deviceName]];
+		
+		if(nil != cachedTOC)
+			[cachedTOC getBytes:buffer length:sizeof(buffer)];
+		else {
+			cd_read_toc.format			= kCDTOCFormatTOC;
+			cd_read_toc.buffer			= buffer;
+			cd_read_toc.bufferLength	= sizeof(buffer);
+			
+			result = ioctl([self fileDescriptor], DKIOCCDREADTOC, &cd_read_toc);
+			NSAssert(-1 != result, NSLocalizedStringFromTable(@"Unable to read the disc's table of contents.", @"Exceptions", @""));
+			
+			[sCachedTOCs setObject:[NSData dataWithBytes:buffer length:sizeof(buffer)] forKey:[self deviceName]];
+		}
+	}
 	
 	toc				= (CDTOC*)buffer;
 	numDescriptors	= CDTOCGetDescriptorCount(toc);
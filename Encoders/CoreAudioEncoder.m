@@ -33,8 +33,6 @@
 #import "Decoder.h"
 #import "RegionDecoder.h"
 
-#import "GaplessUtilities.h"
-
 @interface CoreAudioEncoder (Private)
 
 - (AudioFileTypeID)		fileType;
@@ -240,11 +238,17 @@
 			NSAssert2(noErr == err, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"ExtAudioFileDispose", UTCreateStringForOSType(err));
 			extAudioFile	= NULL;
 		
+			// The atoms are written by the task when it tags the file, so the moov atom is only rewritten once
+			NSMutableDictionary *streamInfo = [NSMutableDictionary dictionary];
+			
 			// Snow Leopard correctly writes the SMPB atom
 			if(floor(NSAppKitVersionNumber) <= 949.0 /* Leopard */)
-				addMPEG4AACGaplessInformationAtom(filename, [decoder totalFrames]);
+				[streamInfo setObject:[NSNumber numberWithLongLong:[decoder totalFrames]] forKey:@"totalFrames"];
+			
+			[streamInfo setObject:[NSNumber numberWithUnsignedLong:bitrate] forKey:@"bitrate"];
+			[streamInfo setObject:[NSNumber numberWithInt:mode] forKey:@"bitrateMode"];
 			
-			addMPEG4AACBitrateInformationAtom(filename, bitrate, mode);
+			[[self delegate] setEncodedStreamInfo:streamInfo];
 		}
 	}
 
@@ -278,6 +282,12 @@
 	[[self delegate] setCompleted:YES];	
 }
 
+// The codecs are part of the system
++ (NSString *) libraryVersion
+{
+	return [[NSProcessInfo processInfo] operatingSystemVersionString];
+}
+
 - (NSString *) settingsString
 {
 	NSDictionary	*settings;
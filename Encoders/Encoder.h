@@ -30,4 +30,7 @@
 	NSString						*_sourceFilename;
 }
 
+// The name and version of the library that does the encoding, or nil if unknown
++ (NSString *)		libraryVersion;
+
 @end
@@ -34,6 +34,7 @@
 		pool			= [[NSAutoreleasePool alloc] init];
 		connection		= [NSConnection connectionWithReceivePort:[portArray objectAtIndex:0] sendPort:[portArray objectAtIndex:1]];
 		owner			= (EncoderTask *)[connection rootProxy];
+		[(NSDistantObject *)owner setProtocolForProxy:@protocol(EncoderTaskMethods)];
 		encoder			= [[self alloc] init];
 				
 		[encoder setDelegate:owner];
@@ -51,6 +52,8 @@
 	}
 }
 
++ (NSString *)			libraryVersion									{ return nil; }
+
 - (id <EncoderTaskMethods>)	delegate									{ return _delegate; }
 - (void)				setDelegate:(id <EncoderTaskMethods>)delegate	{ _delegate = delegate; }
 
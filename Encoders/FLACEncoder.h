@@ -40,6 +40,9 @@
 	NSString				*_apodization;
 	unsigned				_padding;
 	BOOL					_verifyEncoding;
+	unsigned				_threads;
+	
+	NSDictionary			*_tags;
 }
 
 @end
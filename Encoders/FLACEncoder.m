@@ -26,20 +26,488 @@
 #include <AudioToolbox/AudioFile.h>
 #include <AudioToolbox/ExtendedAudioFile.h>
 
+#include <CommonCrypto/CommonDigest.h>
+#include <stdio.h>
+
 #import "Decoder.h"
 #import "RegionDecoder.h"
 
+#import "LogController.h"
 #import "StopException.h"
 
 #import "UtilityFunctions.h"
 
+// libFLAC's default, made explicit so every segment of a parallel encode uses the same size
+#define FLAC_BLOCKSIZE				4096
+
+// Parallel encoding splits the input into segments of this many FLAC frames (about 24 seconds at 44.1 kHz)
+#define SEGMENT_FRAMES				256
+
+// Seek points are placed this many seconds apart
+#define SEEKPOINT_INTERVAL			30
+
+#define STREAMINFO_LENGTH			34
+#define SEEKPOINT_LENGTH			18
+
+static uint8_t		sCRC8Table		[ 256 ];
+static uint16_t		sCRC16Table		[ 256 ];
+
 @interface FLACEncoder (Private)
 - (void)	parseSettings;
+- (void)	setupStreamEncoder:(FLAC__StreamEncoder *)flac pcmFormat:(AudioStreamBasicDescription)pcmFormat;
+- (void)	encodeSerially:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime;
+- (void)	encodeInParallel:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime;
 - (void)	encodeChunk:(const AudioBufferList *)chunk frameCount:(UInt32)frameCount;
+- (void)	logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime;
+@end
+
+#pragma mark Utility functions
+
+// Split interleaved PCM data into channels, converting to the 32-bit samples FLAC expects
+static void
+deinterleaveAudio(const AudioBufferList *chunk, UInt32 frameCount, UInt32 bitsPerChannel, int32_t **buffer, UInt32 offset)
+{
+	const int8_t	*buffer8				= NULL;
+	const int16_t	*buffer16				= NULL;
+	const int32_t	*buffer32				= NULL;
+	int32_t			constructedSample;
+	unsigned		wideSample;
+	unsigned		sample, channel;
+	
+	switch(bitsPerChannel) {
+			
+		case 8:
+			buffer8 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[channel][offset + wideSample] = (int32_t)buffer8[sample];
+				}
+			}
+			break;
+			
+		case 16:
+			buffer16 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[channel][offset + wideSample] = (int32_t)(int16_t)OSSwapBigToHostInt16(buffer16[sample]);
+				}
+			}
+			break;
+			
+		case 24:
+			buffer8 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel) {
+					constructedSample = (int8_t)*buffer8++; constructedSample <<= 8;
+					constructedSample |= (uint8_t)*buffer8++; constructedSample <<= 8;
+					constructedSample |= (uint8_t)*buffer8++;
+					
+					buffer[channel][offset + wideSample] = constructedSample;
+				}
+			}
+			break;
+			
+		case 32:
+			buffer32 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[channel][offset + wideSample] = (int32_t)OSSwapBigToHostInt32(buffer32[sample]);
+				}
+			}
+			break;
+			
+		default:
+			@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
+			break;
+	}
+}
+
+// FLAC's MD5 signature is calculated over the interleaved samples, little-endian, using the smallest whole number of bytes
+static void
+updateMD5(CC_MD5_CTX *context, int32_t **buffer, unsigned channels, UInt32 frameCount, UInt32 bitsPerChannel)
+{
+	unsigned		bytesPerSample		= (bitsPerChannel + 7) / 8;
+	uint8_t			scratch				[ 4096 ];
+	unsigned		scratchUsed			= 0;
+	unsigned		wideSample, channel, i;
+	uint32_t		sample;
+	
+	for(wideSample = 0; wideSample < frameCount; ++wideSample) {
+		for(channel = 0; channel < channels; ++channel) {
+			sample = (uint32_t)buffer[channel][wideSample];
+			for(i = 0; i < bytesPerSample; ++i) {
+				scratch[scratchUsed++] = (uint8_t)(sample >> (8 * i));
+			}
+			
+			if(sizeof(scratch) - (4 * channels) < scratchUsed) {
+				CC_MD5_Update(context, scratch, scratchUsed);
+				scratchUsed = 0;
+			}
+		}
+	}
+	
+	CC_MD5_Update(context, scratch, scratchUsed);
+}
+
+static uint8_t
+calculateCRC8(const uint8_t *data, size_t length)
+{
+	uint8_t		crc		= 0;
+	
+	while(length--) {
+		crc = sCRC8Table[crc ^ *data++];
+	}
+	
+	return crc;
+}
+
+static uint16_t
+calculateCRC16(const uint8_t *data, size_t length)
+{
+	uint16_t	crc		= 0;
+	
+	while(length--) {
+		crc = (uint16_t)(crc << 8) ^ sCRC16Table[(crc >> 8) ^ *data++];
+	}
+	
+	return crc;
+}
+
+// Frame numbers are stored using the same variable length scheme as UTF-8, extended to 36 bits
+static unsigned
+encodeFrameNumber(uint64_t frameNumber, uint8_t *buffer)
+{
+	unsigned	length, i;
+	
+	if(0x80 > frameNumber) {
+		buffer[0] = (uint8_t)frameNumber;
+		return 1;
+	}
+	
+	if(0x800 > frameNumber)				length = 2;
+	else if(0x10000 > frameNumber)		length = 3;
+	else if(0x200000 > frameNumber)		length = 4;
+	else if(0x4000000 > frameNumber)	length = 5;
+	else if(0x80000000 > frameNumber)	length = 6;
+	else								length = 7;
+	
+	buffer[0] = (uint8_t)((0xFF00 >> length) & 0xFF) | (uint8_t)(frameNumber >> (6 * (length - 1)));
+	for(i = 1; i < length; ++i) {
+		buffer[i] = 0x80 | (uint8_t)((frameNumber >> (6 * (length - 1 - i))) & 0x3F);
+	}
+	
+	return length;
+}
+
+static void
+appendBigEndian(NSMutableData *data, uint64_t value, unsigned byteCount)
+{
+	uint8_t		bytes	[ 8 ];
+	unsigned	i;
+	
+	for(i = 0; i < byteCount; ++i) {
+		bytes[i] = (uint8_t)(value >> (8 * (byteCount - 1 - i)));
+	}
+	
+	[data appendBytes:bytes length:byteCount];
+}
+
+static void
+appendLittleEndian32(NSMutableData *data, uint32_t value)
+{
+	uint32_t	littleEndian	= OSSwapHostToLittleInt32(value);
+	
+	[data appendBytes:&littleEndian length:sizeof(littleEndian)];
+}
+
+// The contents of the VORBIS_COMMENT block libFLAC would write for the given "NAME=value" comments
+static NSData *
+vorbisCommentBlockData(NSArray *comments)
+{
+	NSMutableData	*data		= [NSMutableData data];
+	NSString		*comment;
+	const char		*entry;
+	
+	appendLittleEndian32(data, (uint32_t)strlen(FLAC__VENDOR_STRING));
+	[data appendBytes:FLAC__VENDOR_STRING length:strlen(FLAC__VENDOR_STRING)];
+	
+	appendLittleEndian32(data, (uint32_t)[comments count]);
+	for(comment in comments) {
+		entry = [comment UTF8String];
+		appendLittleEndian32(data, (uint32_t)strlen(entry));
+		[data appendBytes:entry length:strlen(entry)];
+	}
+	
+	NSCAssert((1 << FLAC__STREAM_METADATA_LENGTH_LEN) > [data length], NSLocalizedStringFromTable(@"The tags are too large for a FLAC file.", @"Exceptions", @""));
+	
+	return data;
+}
+
+// The contents of the PICTURE block for a front cover described as for createPictureBlock()
+static NSData *
+pictureBlockData(NSDictionary *picture)
+{
+	NSMutableData	*data		= [NSMutableData data];
+	const char		*mimeType	= [[picture objectForKey:@"mimeType"] UTF8String];
+	NSData			*imageData	= [picture objectForKey:@"data"];
+	
+	appendBigEndian(data, FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER, 4);
+	appendBigEndian(data, strlen(mimeType), 4);
+	[data appendBytes:mimeType length:strlen(mimeType)];
+	appendBigEndian(data, 0, 4);		// No description
+	appendBigEndian(data, [[picture objectForKey:@"width"] unsignedIntValue], 4);
+	appendBigEndian(data, [[picture objectForKey:@"height"] unsignedIntValue], 4);
+	appendBigEndian(data, [[picture objectForKey:@"depth"] unsignedIntValue], 4);
+	appendBigEndian(data, 0, 4);		// Not an indexed-color image
+	appendBigEndian(data, [imageData length], 4);
+	[data appendData:imageData];
+	
+	NSCAssert((1 << FLAC__STREAM_METADATA_LENGTH_LEN) > [data length], NSLocalizedStringFromTable(@"The tags are too large for a FLAC file.", @"Exceptions", @""));
+	
+	return data;
+}
+
+#pragma mark FLACSegment
+
+// A run of whole FLAC frames encoded independently of the rest of the stream
+// The frames are renumbered as they are produced so they can be written to the output as-is
+@interface FLACSegment : NSOperation
+{
+	FLACEncoder						*_encoder;
+	AudioStreamBasicDescription		_pcmFormat;
+	
+	int32_t							**_buffer;
+	UInt32							_sampleCount;
+	
+	uint64_t						_firstFrameNumber;
+	uint64_t						_framesWritten;
+	
+	NSMutableData					*_frames;
+	NSMutableArray					*_frameSizes;
+	
+	NSException						*_exception;
+}
+
+- (id)					initWithEncoder:(FLACEncoder *)encoder pcmFormat:(AudioStreamBasicDescription)pcmFormat sampleCapacity:(UInt32)sampleCapacity firstFrameNumber:(uint64_t)firstFrameNumber;
+
+// Per-channel sample buffers, to be filled before the operation is queued
+- (int32_t **)			buffer;
+
+- (UInt32)				sampleCount;
+- (void)				setSampleCount:(UInt32)sampleCount;
+
+// The encoded frames, and the size of each one
+- (NSData *)			frames;
+- (NSArray *)			frameSizes;
+
+- (NSException *)		exception;
+
+- (BOOL)				appendFrame:(const uint8_t *)frame length:(size_t)length;
+
+@end
+
+static FLAC__StreamEncoderWriteStatus
+segmentWriteCallback(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, void *client_data)
+{
+	FLACSegment *segment = (FLACSegment *)client_data;
+	
+	// Only the audio frames are kept; the stream's metadata is written separately
+	if(0 == samples) {
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+	}
+	
+	return ([segment appendFrame:buffer length:bytes] ? FLAC__STREAM_ENCODER_WRITE_STATUS_OK : FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR);
+}
+
+@implementation FLACSegment
+
+- (id) initWithEncoder:(FLACEncoder *)encoder pcmFormat:(AudioStreamBasicDescription)pcmFormat sampleCapacity:(UInt32)sampleCapacity firstFrameNumber:(uint64_t)firstFrameNumber
+{
+	unsigned		channel;
+	
+	if((self = [super init])) {
+		_encoder			= [encoder retain];
+		_pcmFormat			= pcmFormat;
+		_firstFrameNumber	= firstFrameNumber;
+		
+		_frames				= [[NSMutableData alloc] init];
+		_frameSizes			= [[NSMutableArray alloc] init];
+		
+		_buffer				= calloc(_pcmFormat.mChannelsPerFrame, sizeof(int32_t *));
+		NSAssert(NULL != _buffer, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		for(channel = 0; channel < _pcmFormat.mChannelsPerFrame; ++channel) {
+			_buffer[channel] = calloc(sampleCapacity, sizeof(int32_t));
+			NSAssert(NULL != _buffer[channel], NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		}
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	unsigned		channel;
+	
+	if(NULL != _buffer) {
+		for(channel = 0; channel < _pcmFormat.mChannelsPerFrame; ++channel) {
+			free(_buffer[channel]);
+		}
+		free(_buffer),		_buffer = NULL;
+	}
+	
+	[_encoder release],		_encoder = nil;
+	[_frames release],		_frames = nil;
+	[_frameSizes release],	_frameSizes = nil;
+	[_exception release],	_exception = nil;
+	
+	[super dealloc];
+}
+
+- (int32_t **)			buffer									{ return _buffer; }
+
+- (UInt32)				sampleCount								{ return _sampleCount; }
+- (void)				setSampleCount:(UInt32)sampleCount		{ _sampleCount = sampleCount; }
+
+- (NSData *)			frames									{ return [[_frames retain] autorelease]; }
+- (NSArray *)			frameSizes								{ return [[_frameSizes retain] autorelease]; }
+
+- (NSException *)		exception								{ return [[_exception retain] autorelease]; }
+
+- (void) main
+{
+	NSAutoreleasePool					*pool			= [[NSAutoreleasePool alloc] init];
+	FLAC__StreamEncoder					*flac			= NULL;
+	FLAC__StreamEncoderInitStatus		encoderStatus;
+	FLAC__bool							result;
+	
+	@try {
+		flac = FLAC__stream_encoder_new();
+		NSAssert(NULL != flac, NSLocalizedStringFromTable(@"Unable to create the FLAC encoder.", @"Exceptions", @""));
+		
+		[_encoder setupStreamEncoder:flac pcmFormat:_pcmFormat];
+		
+		// Segments are stitched together by frame number, so every frame must be the same size
+		result = FLAC__stream_encoder_set_blocksize(flac, FLAC_BLOCKSIZE);
+		NSAssert1(YES == result, @"FLAC__stream_encoder_set_blocksize failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+		
+		result = FLAC__stream_encoder_set_total_samples_estimate(flac, _sampleCount);
+		NSAssert1(YES == result, @"FLAC__stream_encoder_set_total_samples_estimate failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+		
+		encoderStatus = FLAC__stream_encoder_init_stream(flac, segmentWriteCallback, NULL, NULL, NULL, self);
+		NSAssert1(FLAC__STREAM_ENCODER_INIT_STATUS_OK == encoderStatus, @"FLAC__stream_encoder_init_stream failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+		
+		result = FLAC__stream_encoder_process(flac, (const FLAC__int32 * const *)_buffer, _sampleCount);
+		NSAssert1(YES == result, @"FLAC__stream_encoder_process failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+		
+		result = FLAC__stream_encoder_finish(flac);
+		NSAssert1(YES == result, @"FLAC__stream_encoder_finish failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	}
+	
+	@catch(NSException *exception) {
+		_exception = [exception retain];
+	}
+	
+	@finally {
+		if(NULL != flac) {
+			FLAC__stream_encoder_delete(flac);
+		}
+		
+		[pool release];
+	}
+}
+
+// Copy the frame, replacing the frame number in its header and recalculating both CRCs
+- (BOOL) appendFrame:(const uint8_t *)frame length:(size_t)length
+{
+	uint8_t			frameNumber		[ 7 ];
+	unsigned		frameNumberLength;
+	size_t			oldNumberLength;
+	size_t			headerLength;
+	size_t			frameStart;
+	uint8_t			crc8;
+	uint16_t		crc16;
+	
+	if(8 > length) {
+		return NO;
+	}
+	
+	// Length of the existing frame number
+	if(0x00 == (frame[4] & 0x80))		oldNumberLength = 1;
+	else if(0xC0 == (frame[4] & 0xE0))	oldNumberLength = 2;
+	else if(0xE0 == (frame[4] & 0xF0))	oldNumberLength = 3;
+	else if(0xF0 == (frame[4] & 0xF8))	oldNumberLength = 4;
+	else if(0xF8 == (frame[4] & 0xFC))	oldNumberLength = 5;
+	else if(0xFC == (frame[4] & 0xFE))	oldNumberLength = 6;
+	else								oldNumberLength = 7;
+	
+	// Uncommon block sizes and sample rates are stored at the end of the header
+	headerLength = 4 + oldNumberLength;
+	switch(frame[2] >> 4) {
+		case 6:		headerLength += 1;		break;
+		case 7:		headerLength += 2;		break;
+	}
+	switch(frame[2] & 0x0F) {
+		case 12:	headerLength += 1;		break;
+		case 13:
+		case 14:	headerLength += 2;		break;
+	}
+	
+	// The header is followed by its CRC-8 and the frame ends with a CRC-16
+	if(headerLength + 3 > length) {
+		return NO;
+	}
+	
+	frameNumberLength	= encodeFrameNumber(_firstFrameNumber + _framesWritten, frameNumber);
+	frameStart			= [_frames length];
+	
+	[_frames appendBytes:frame length:4];
+	[_frames appendBytes:frameNumber length:frameNumberLength];
+	[_frames appendBytes:frame + 4 + oldNumberLength length:headerLength - 4 - oldNumberLength];
+	
+	crc8 = calculateCRC8((const uint8_t *)[_frames bytes] + frameStart, [_frames length] - frameStart);
+	[_frames appendBytes:&crc8 length:1];
+	
+	[_frames appendBytes:frame + headerLength + 1 length:length - headerLength - 1 - 2];
+	
+	crc16 = calculateCRC16((const uint8_t *)[_frames bytes] + frameStart, [_frames length] - frameStart);
+	appendBigEndian(_frames, crc16, 2);
+	
+	[_frameSizes addObject:[NSNumber numberWithUnsignedInteger:[_frames length] - frameStart]];
+	++_framesWritten;
+	
+	return YES;
+}
+
 @end
 
+#pragma mark FLACEncoder
+
 @implementation FLACEncoder
 
++ (void) initialize
+{
+	unsigned	i, j;
+	uint16_t	crc;
+	
+	// CRC-8 (x^8 + x^2 + x^1 + x^0) for frame headers and CRC-16 (x^16 + x^15 + x^2 + x^0) for whole frames
+	for(i = 0; i < 256; ++i) {
+		crc = (uint16_t)i;
+		for(j = 0; j < 8; ++j) {
+			crc = (crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+		}
+		sCRC8Table[i] = (uint8_t)crc;
+		
+		crc = (uint16_t)(i << 8);
+		for(j = 0; j < 8; ++j) {
+			crc = (crc & 0x8000 ? (uint16_t)(crc << 1) ^ 0x8005 : (uint16_t)(crc << 1));
+		}
+		sCRC16Table[i] = crc;
+	}
+}
+
 - (id) init
 {	
 	if((self = [super init])) {
@@ -54,32 +522,29 @@
 		_exhaustiveModelSearch				= NO;
 		_minPartitionOrder					= 0;
 		_maxPartitionOrder					= 4;
+		_threads							= 1;
 	}
 	
 	return self;
 }
 
+- (void) dealloc
+{
+	[_apodization release];		_apodization = nil;
+	[_tags release];			_tags = nil;
+	
+	[super dealloc];
+}
+
 - (oneway void) encodeToFile:(NSString *)filename
 {
 	NSDate							*startTime					= [NSDate date];
-	unsigned long					iterations					= 0;
-	AudioBufferList					bufferList;
-	ssize_t							bufferLen					= 0;
-	UInt32							bufferByteSize				= 0;
-	FLAC__bool						result;
-	FLAC__StreamEncoderInitStatus	encoderStatus;
-	FLAC__StreamMetadata			*seektable					= NULL;
-	FLAC__StreamMetadata			*padding					= NULL;
-	FLAC__StreamMetadata			*metadata [2];
-	SInt64							totalFrames, framesToRead;
+	id <DecoderMethods>				decoder						= nil;
+	NSString						*sourceFilename				= nil;
+	SInt64							startingFrame;
 	UInt32							frameCount;
-	double							percentComplete;
-	NSTimeInterval					interval;
-	unsigned						secondsRemaining;
 	
 	@try {
-		bufferList.mBuffers[0].mData = NULL;
-
 		// Parse the encoder settings
 		[self parseSettings];
 
@@ -88,19 +553,148 @@
 		[[self delegate] setStarted:YES];
 		
 		// Setup the decoder
-		id <DecoderMethods> decoder = nil;
-		NSString *sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
+		sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
 
 		// Create the appropriate kind of decoder
 		if(nil != [[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"]) {
-			SInt64 startingFrame = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
-			UInt32 frameCount = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
-			decoder = [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
+			startingFrame	= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
+			frameCount		= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
+			decoder			= [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
 		}
 		else
 			decoder = [Decoder decoderWithFilename:sourceFilename];
 
 		_sourceBitsPerChannel	= [decoder pcmFormat].mBitsPerChannel;
+		
+		// Write the tags with the rest of the metadata, rather than having the task rewrite the file afterwards
+		_tags					= [[[self delegate] streamTagsWithSettingsString:[self settingsString]] retain];
+		
+		// Splitting the input isn't worthwhile unless there are at least two segments
+		if(1 < _threads && (SInt64)(SEGMENT_FRAMES * FLAC_BLOCKSIZE) < [decoder totalFrames])
+			[self encodeInParallel:decoder toFile:filename startTime:startTime];
+		else
+			[self encodeSerially:decoder toFile:filename startTime:startTime];
+
+		// Both paths have finished writing the metadata blocks by the time they return
+		if(nil != _tags)
+			[[self delegate] setTagsWrittenToStream:YES];
+	}
+	
+	@catch(StopException *exception) {
+		[[self delegate] setStopped:YES];
+	}
+	
+	@catch(NSException *exception) {
+		[[self delegate] setException:exception];
+		[[self delegate] setStopped:YES];
+	}
+	
+	[[self delegate] setEndTime:[NSDate date]];
+	[[self delegate] setCompleted:YES];
+}
+
++ (NSString *) libraryVersion
+{
+	return [NSString stringWithFormat:@"FLAC %s", FLAC__VERSION_STRING];
+}
+
+- (NSString *) settingsString
+{
+	return [NSString stringWithFormat:@"FLAC settings: exhaustiveModelSearch:%i midSideStereo:%i looseMidSideStereo:%i QLPCoeffPrecision:%i, ,enableQLPCoeffPrecisionSearch:%i, minResidualPartitionOrder:%i, maxResidualPartitionOrder:%i, maxLPCOrder:%i, apodization:%@", 
+		_exhaustiveModelSearch, _enableMidSide, _enableLooseMidSide, _QLPCoeffPrecision, _enableQLPCoeffPrecisionSearch, _minPartitionOrder, _maxPartitionOrder, _maxLPCOrder, _apodization];
+}
+
+@end
+
+@implementation FLACEncoder (Private)
+
+- (void) parseSettings
+{
+	NSDictionary *settings	= [[self delegate] encoderSettings];
+	
+	_padding				= [[settings objectForKey:@"padding"] unsignedIntValue];
+	_enableMidSide			= [[settings objectForKey:@"enableMidSide"] boolValue];
+	_enableLooseMidSide		= [[settings objectForKey:@"looseEnableMidSide"] boolValue];
+	_apodization			= [[settings objectForKey:@"apodization"] retain];
+	_maxLPCOrder			= [[settings objectForKey:@"maxLPCOrder"] intValue];
+	_QLPCoeffPrecision		= [[settings objectForKey:@"QLPCoeffPrecision"] intValue];
+	_enableQLPCoeffPrecisionSearch = [[settings objectForKey:@"enableQLPCoeffPrecisionSearch"] boolValue];
+	_exhaustiveModelSearch	= [[settings objectForKey:@"exhaustiveModelSearch"] boolValue];
+	_minPartitionOrder		= [[settings objectForKey:@"minPartitionOrder"] intValue];
+	_maxPartitionOrder		= [[settings objectForKey:@"maxPartitionOrder"] intValue];
+	_threads				= getEncoderThreadCount(settings);
+}
+
+// Called from the segment threads during a parallel encode, so this may only read the settings
+- (void) setupStreamEncoder:(FLAC__StreamEncoder *)flac pcmFormat:(AudioStreamBasicDescription)pcmFormat
+{
+	FLAC__bool		result;
+	
+	// Input information
+	result = FLAC__stream_encoder_set_sample_rate(flac, pcmFormat.mSampleRate);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_sample_rate failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+
+	result = FLAC__stream_encoder_set_bits_per_sample(flac, pcmFormat.mBitsPerChannel);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_bits_per_sample failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+
+	result = FLAC__stream_encoder_set_channels(flac, pcmFormat.mChannelsPerFrame);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_channels failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+		
+	// Encoder parameters
+	result = FLAC__stream_encoder_set_do_mid_side_stereo(flac, _enableMidSide);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_do_mid_side_stereo failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	
+	result = FLAC__stream_encoder_set_loose_mid_side_stereo(flac, _enableLooseMidSide);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_loose_mid_side_stereo failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	
+	result = FLAC__stream_encoder_set_apodization(flac, [_apodization cStringUsingEncoding:NSASCIIStringEncoding]);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_apodization failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	
+	result = FLAC__stream_encoder_set_max_lpc_order(flac, _maxLPCOrder);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_max_lpc_order failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	
+	result = FLAC__stream_encoder_set_qlp_coeff_precision(flac, _QLPCoeffPrecision);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_qlp_coeff_precision failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	
+	result = FLAC__stream_encoder_set_do_qlp_coeff_prec_search(flac, _enableQLPCoeffPrecisionSearch);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_do_qlp_coeff_prec_search failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+	
+	result = FLAC__stream_encoder_set_do_exhaustive_model_search(flac, _exhaustiveModelSearch);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_do_exhaustive_model_search failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+
+	result = FLAC__stream_encoder_set_min_residual_partition_order(flac, _minPartitionOrder);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_min_residual_partition_order failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+
+	result = FLAC__stream_encoder_set_max_residual_partition_order(flac, _maxPartitionOrder);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_max_residual_partition_order failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+
+	result = FLAC__stream_encoder_set_verify(flac, _verifyEncoding);
+	NSAssert1(YES == result, @"FLAC__stream_encoder_set_verify failed: %s", FLAC__stream_encoder_get_resolved_state_string(flac));
+}
+
+- (void) encodeSerially:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime
+{
+	unsigned long					iterations					= 0;
+	AudioBufferList					bufferList;
+	ssize_t							bufferLen					= 0;
+	UInt32							bufferByteSize				= 0;
+	FLAC__bool						result;
+	FLAC__StreamEncoderInitStatus	encoderStatus;
+	FLAC__StreamMetadata			*seektable					= NULL;
+	FLAC__StreamMetadata			*padding					= NULL;
+	FLAC__StreamMetadata			*comments					= NULL;
+	FLAC__StreamMetadata			*picture					= NULL;
+	FLAC__StreamMetadata			*metadata [4];
+	unsigned						metadataCount				= 0;
+	SInt64							totalFrames, framesToRead;
+	UInt32							frameCount;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
+	
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
+
 		totalFrames				= [decoder totalFrames];
 		framesToRead			= totalFrames;
 		
@@ -145,77 +739,44 @@
 		NSAssert(NULL != _flac, NSLocalizedStringFromTable(@"Unable to create the FLAC encoder.", @"Exceptions", @""));
 
 		// Setup FLAC encoder
-		
-		// Input information
-		result = FLAC__stream_encoder_set_sample_rate(_flac, [decoder pcmFormat].mSampleRate);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_sample_rate failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-
-		result = FLAC__stream_encoder_set_bits_per_sample(_flac, [decoder pcmFormat].mBitsPerChannel);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_bits_per_sample failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-
-		result = FLAC__stream_encoder_set_channels(_flac, [decoder pcmFormat].mChannelsPerFrame);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_channels failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-			
-		// Encoder parameters
-		result = FLAC__stream_encoder_set_do_mid_side_stereo(_flac, _enableMidSide);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_do_mid_side_stereo failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		
-		result = FLAC__stream_encoder_set_loose_mid_side_stereo(_flac, _enableLooseMidSide);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_loose_mid_side_stereo failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		
-		result = FLAC__stream_encoder_set_apodization(_flac, [_apodization cStringUsingEncoding:NSASCIIStringEncoding]);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_apodization failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		
-		result = FLAC__stream_encoder_set_max_lpc_order(_flac, _maxLPCOrder);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_max_lpc_order failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		
-		result = FLAC__stream_encoder_set_qlp_coeff_precision(_flac, _QLPCoeffPrecision);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_qlp_coeff_precision failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		
-		result = FLAC__stream_encoder_set_do_qlp_coeff_prec_search(_flac, _enableQLPCoeffPrecisionSearch);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_do_qlp_coeff_prec_search failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		
-		result = FLAC__stream_encoder_set_do_exhaustive_model_search(_flac, _exhaustiveModelSearch);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_do_exhaustive_model_search failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-
-		result = FLAC__stream_encoder_set_min_residual_partition_order(_flac, _minPartitionOrder);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_min_residual_partition_order failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-
-		result = FLAC__stream_encoder_set_max_residual_partition_order(_flac, _maxPartitionOrder);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_max_residual_partition_order failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
+		[self setupStreamEncoder:_flac pcmFormat:[decoder pcmFormat]];
 
 		// Create a seektable
 		seektable = FLAC__metadata_object_new(FLAC__METADATA_TYPE_SEEKTABLE);
 		NSAssert(NULL != seektable, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 
 		// Append seekpoints (one every 30 seconds)
-		result = FLAC__metadata_object_seektable_template_append_spaced_points_by_samples(seektable, 30 * [decoder pcmFormat].mSampleRate, totalFrames);
+		result = FLAC__metadata_object_seektable_template_append_spaced_points_by_samples(seektable, SEEKPOINT_INTERVAL * [decoder pcmFormat].mSampleRate, totalFrames);
 		NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 
 		// Sort the table
 		result = FLAC__metadata_object_seektable_template_sort(seektable, NO);
 		NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 
-		metadata[0] = seektable;
+		metadata[metadataCount++] = seektable;
+		
+		// Create the tag metadata blocks
+		if(nil != _tags) {
+			comments					= createVorbisCommentBlock([_tags objectForKey:@"comments"]);
+			metadata[metadataCount++]	= comments;
+			
+			if(nil != [_tags objectForKey:@"picture"]) {
+				picture						= createPictureBlock([_tags objectForKey:@"picture"]);
+				metadata[metadataCount++]	= picture;
+			}
+		}
 		
 		// Create the padding metadata block if desired
 		if(0 < _padding) {
 			padding = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PADDING);
 			NSAssert(NULL != padding, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 
-			padding->length		= _padding;			
-			metadata[1]			= padding;
-			
-			result = FLAC__stream_encoder_set_metadata(_flac, metadata, 2);
-			NSAssert1(YES == result, @"FLAC__stream_encoder_set_metadata failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-		}
-		else {
-			result = FLAC__stream_encoder_set_metadata(_flac, metadata, 1);
-			NSAssert1(YES == result, @"FLAC__stream_encoder_set_metadata failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
+			padding->length				= _padding;			
+			metadata[metadataCount++]	= padding;
 		}
-
-		result = FLAC__stream_encoder_set_verify(_flac, _verifyEncoding);
-		NSAssert1(YES == result, @"FLAC__stream_encoder_set_verify failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
+		
+		result = FLAC__stream_encoder_set_metadata(_flac, metadata, metadataCount);
+		NSAssert1(YES == result, @"FLAC__stream_encoder_set_metadata failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
 
 		// Initialize the FLAC encoder
 		result = FLAC__stream_encoder_set_total_samples_estimate(_flac, totalFrames);
@@ -269,62 +830,275 @@
 		// Finish up the encoding process
 		result = FLAC__stream_encoder_finish(_flac);
 		NSAssert1(YES == result, @"FLAC__stream_encoder_finish failed: %s", FLAC__stream_encoder_get_resolved_state_string(_flac));
-	}
-	
-	
-	@catch(StopException *exception) {
-		[[self delegate] setStopped:YES];
-	}
-	
-	@catch(NSException *exception) {
-		[[self delegate] setException:exception];
-		[[self delegate] setStopped:YES];
+		
+		[self logSamplesEncoded:(totalFrames - framesToRead) sampleRate:[decoder pcmFormat].mSampleRate threads:1 sinceDate:startTime];
 	}
 	
 	@finally {
 		if(NULL != _flac) {
 			FLAC__stream_encoder_delete(_flac);
+			_flac = NULL;
 		}
 		
 		if(NULL != seektable) {
 			FLAC__metadata_object_delete(seektable);			
 		}
 		
+		if(NULL != comments) {
+			FLAC__metadata_object_delete(comments);
+		}
+		
+		if(NULL != picture) {
+			FLAC__metadata_object_delete(picture);
+		}
+		
 		if(NULL != padding) {
 			FLAC__metadata_object_delete(padding);
 		}
 				
 		free(bufferList.mBuffers[0].mData);
 	}	
-
-	[[self delegate] setEndTime:[NSDate date]];
-	[[self delegate] setCompleted:YES];
-}
-
-- (NSString *) settingsString
-{
-	return [NSString stringWithFormat:@"FLAC settings: exhaustiveModelSearch:%i midSideStereo:%i looseMidSideStereo:%i QLPCoeffPrecision:%i, ,enableQLPCoeffPrecisionSearch:%i, minResidualPartitionOrder:%i, maxResidualPartitionOrder:%i, maxLPCOrder:%i, apodization:%@", 
-		_exhaustiveModelSearch, _enableMidSide, _enableLooseMidSide, _QLPCoeffPrecision, _enableQLPCoeffPrecisionSearch, _minPartitionOrder, _maxPartitionOrder, _maxLPCOrder, _apodization];
 }
 
-@end
-
-@implementation FLACEncoder (Private)
-
-- (void) parseSettings
+// The input is read and split into segments of whole frames on this thread, and the segments are encoded
+// on a pool of worker threads.  As each segment finishes (in order) its frames are written to the output, 
+// and the metadata libFLAC would normally write (STREAMINFO, with the MD5, and the seek table) is
+// constructed here and written in space reserved at the start of the file
+- (void) encodeInParallel:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime
 {
-	NSDictionary *settings	= [[self delegate] encoderSettings];
+	AudioStreamBasicDescription		pcmFormat				= [decoder pcmFormat];
+	NSOperationQueue				*queue					= nil;
+	NSMutableArray					*segments				= nil;
+	FLACSegment						*segment				= nil;
+	AudioBufferList					bufferList;
+	UInt32							bufferByteSize;
+	UInt32							segmentCapacity			= SEGMENT_FRAMES * FLAC_BLOCKSIZE;
+	UInt32							segmentSampleCount;
+	UInt32							frameCount;
+	BOOL							inputFinished			= NO;
+	uint64_t						nextFrameNumber			= 0;
+	SInt64							totalFrames				= [decoder totalFrames];
+	uint64_t						samplesEncoded			= 0;
+	uint64_t						seekpointSpacing		= (uint64_t)(SEEKPOINT_INTERVAL * pcmFormat.mSampleRate);
+	uint64_t						nextSeekpointSample		= 0;
+	NSUInteger						seekpointCount			= 0;
+	NSMutableData					*seekpoints				= nil;
+	uint64_t						frameSample;
+	UInt32							frameSamples;
+	uint64_t						frameOffset				= 0;
+	NSUInteger						frameSize;
+	NSUInteger						minFrameSize			= NSUIntegerMax;
+	NSUInteger						maxFrameSize			= 0;
+	NSNumber						*size;
+	NSMutableData					*header					= nil;
+	NSData							*comments				= nil;
+	NSData							*picture				= nil;
+	NSUInteger						lastBlock;
+	CC_MD5_CTX						md5;
+	unsigned char					digest					[ CC_MD5_DIGEST_LENGTH ];
+	FILE							*file					= NULL;
+	size_t							bytesWritten;
+	int								intResult;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
 	
-	_padding				= [[settings objectForKey:@"padding"] unsignedIntValue];
-	_enableMidSide			= [[settings objectForKey:@"enableMidSide"] boolValue];
-	_enableLooseMidSide		= [[settings objectForKey:@"looseEnableMidSide"] boolValue];
-	_apodization			= [[settings objectForKey:@"apodization"] retain];
-	_maxLPCOrder			= [[settings objectForKey:@"maxLPCOrder"] intValue];
-	_QLPCoeffPrecision		= [[settings objectForKey:@"QLPCoeffPrecision"] intValue];
-	_enableQLPCoeffPrecisionSearch = [[settings objectForKey:@"enableQLPCoeffPrecisionSearch"] boolValue];
-	_exhaustiveModelSearch	= [[settings objectForKey:@"exhaustiveModelSearch"] boolValue];
-	_minPartitionOrder		= [[settings objectForKey:@"minPartitionOrder"] intValue];
-	_maxPartitionOrder		= [[settings objectForKey:@"maxPartitionOrder"] intValue];
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
+		
+		CC_MD5_Init(&md5);
+		
+		// Read one frame's worth of audio at a time
+		bufferByteSize								= FLAC_BLOCKSIZE * pcmFormat.mBytesPerFrame;
+		bufferList.mNumberBuffers					= 1;
+		bufferList.mBuffers[0].mData				= calloc(bufferByteSize, sizeof(uint8_t));
+		NSAssert(NULL != bufferList.mBuffers[0].mData, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		// The number of seek points determines the size of the metadata, so use the same number 
+		// libFLAC would and fill any that aren't needed with placeholders
+		seekpointCount	= (NSUInteger)((totalFrames + seekpointSpacing - 1) / seekpointSpacing);
+		seekpoints		= [NSMutableData data];
+		
+		file = fopen([filename fileSystemRepresentation], "w");
+		NSAssert(NULL != file, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
+		
+		if(nil != _tags) {
+			comments = vorbisCommentBlockData([_tags objectForKey:@"comments"]);
+			
+			if(nil != [_tags objectForKey:@"picture"])
+				picture = pictureBlockData([_tags objectForKey:@"picture"]);
+		}
+		
+		// Reserve space for the metadata
+		header = [NSMutableData dataWithLength:4 + 4 + STREAMINFO_LENGTH + (0 < seekpointCount ? 4 + (SEEKPOINT_LENGTH * seekpointCount) : 0) + (nil != comments ? 4 + [comments length] : 0) + (nil != picture ? 4 + [picture length] : 0) + (0 < _padding ? 4 + _padding : 0)];
+		
+		bytesWritten = fwrite([header bytes], 1, [header length], file);
+		NSAssert([header length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		queue		= [[[NSOperationQueue alloc] init] autorelease];
+		segments	= [NSMutableArray array];
+		
+		[queue setMaxConcurrentOperationCount:_threads];
+		
+		for(;;) {
+			
+			// Keep a segment waiting for each thread
+			while(NO == inputFinished && [segments count] < 2 * _threads) {
+				segment				= [[[FLACSegment alloc] initWithEncoder:self pcmFormat:pcmFormat sampleCapacity:segmentCapacity firstFrameNumber:nextFrameNumber] autorelease];
+				segmentSampleCount	= 0;
+				
+				while(segmentSampleCount < segmentCapacity) {
+					bufferList.mBuffers[0].mNumberChannels	= pcmFormat.mChannelsPerFrame;
+					bufferList.mBuffers[0].mDataByteSize	= bufferByteSize;
+					frameCount								= MIN(FLAC_BLOCKSIZE, segmentCapacity - segmentSampleCount);
+					
+					frameCount = [decoder readAudio:&bufferList frameCount:frameCount];
+					
+					if(0 == frameCount) {
+						inputFinished = YES;
+						break;
+					}
+					
+					deinterleaveAudio(&bufferList, frameCount, _sourceBitsPerChannel, [segment buffer], segmentSampleCount);
+					segmentSampleCount += frameCount;
+				}
+				
+				if(0 == segmentSampleCount)
+					break;
+				
+				updateMD5(&md5, [segment buffer], pcmFormat.mChannelsPerFrame, segmentSampleCount, _sourceBitsPerChannel);
+				
+				[segment setSampleCount:segmentSampleCount];
+				nextFrameNumber += (segmentSampleCount + FLAC_BLOCKSIZE - 1) / FLAC_BLOCKSIZE;
+				
+				[segments addObject:segment];
+				[queue addOperation:segment];
+			}
+			
+			if(0 == [segments count])
+				break;
+			
+			// Write the oldest segment's frames
+			segment = [segments objectAtIndex:0];
+			[segment waitUntilFinished];
+			
+			if(nil != [segment exception])
+				@throw [segment exception];
+			
+			bytesWritten = fwrite([[segment frames] bytes], 1, [[segment frames] length], file);
+			NSAssert([[segment frames] length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+			
+			// Collect the statistics for STREAMINFO and the seek table
+			frameSample = samplesEncoded;
+			for(size in [segment frameSizes]) {
+				frameSize		= [size unsignedIntegerValue];
+				frameSamples	= (UInt32)MIN((uint64_t)FLAC_BLOCKSIZE, samplesEncoded + [segment sampleCount] - frameSample);
+				
+				minFrameSize	= MIN(minFrameSize, frameSize);
+				maxFrameSize	= MAX(maxFrameSize, frameSize);
+				
+				while(nextSeekpointSample < frameSample + frameSamples && [seekpoints length] < SEEKPOINT_LENGTH * seekpointCount) {
+					appendBigEndian(seekpoints, frameSample, 8);
+					appendBigEndian(seekpoints, frameOffset, 8);
+					appendBigEndian(seekpoints, frameSamples, 2);
+					
+					nextSeekpointSample += seekpointSpacing;
+				}
+				
+				frameSample		+= frameSamples;
+				frameOffset		+= frameSize;
+			}
+			
+			samplesEncoded += [segment sampleCount];
+			[segments removeObjectAtIndex:0];
+			
+			// Each segment takes a while, so there is no need to limit the Distributed Object calls
+			if([[self delegate] shouldStop])
+				@throw [StopException exceptionWithReason:@"Stop requested by user" userInfo:nil];
+			
+			percentComplete		= ((double)samplesEncoded/(double) totalFrames) * 100.0;
+			interval			= -1.0 * [startTime timeIntervalSinceNow];
+			secondsRemaining	= (unsigned) (interval / ((double)samplesEncoded/(double) totalFrames) - interval);
+			
+			[[self delegate] updateProgress:percentComplete secondsRemaining:secondsRemaining];
+		}
+		
+		// Unused seek points
+		while([seekpoints length] < SEEKPOINT_LENGTH * seekpointCount) {
+			appendBigEndian(seekpoints, FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER, 8);
+			appendBigEndian(seekpoints, 0, 8);
+			appendBigEndian(seekpoints, 0, 2);
+		}
+		
+		CC_MD5_Final(digest, &md5);
+		
+		// Now that everything is known, build the metadata
+		[header setLength:0];
+		[header appendBytes:"fLaC" length:4];
+		
+		lastBlock = [header length];
+		appendBigEndian(header, FLAC__METADATA_TYPE_STREAMINFO, 1);
+		appendBigEndian(header, STREAMINFO_LENGTH, 3);
+		appendBigEndian(header, FLAC_BLOCKSIZE, 2);
+		appendBigEndian(header, FLAC_BLOCKSIZE, 2);
+		appendBigEndian(header, minFrameSize, 3);
+		appendBigEndian(header, maxFrameSize, 3);
+		appendBigEndian(header, ((uint64_t)pcmFormat.mSampleRate << 44) | ((uint64_t)(pcmFormat.mChannelsPerFrame - 1) << 41) | ((uint64_t)(pcmFormat.mBitsPerChannel - 1) << 36) | samplesEncoded, 8);
+		[header appendBytes:digest length:CC_MD5_DIGEST_LENGTH];
+		
+		if(0 < seekpointCount) {
+			lastBlock = [header length];
+			appendBigEndian(header, FLAC__METADATA_TYPE_SEEKTABLE, 1);
+			appendBigEndian(header, [seekpoints length], 3);
+			[header appendData:seekpoints];
+		}
+		
+		if(nil != comments) {
+			lastBlock = [header length];
+			appendBigEndian(header, FLAC__METADATA_TYPE_VORBIS_COMMENT, 1);
+			appendBigEndian(header, [comments length], 3);
+			[header appendData:comments];
+		}
+		
+		if(nil != picture) {
+			lastBlock = [header length];
+			appendBigEndian(header, FLAC__METADATA_TYPE_PICTURE, 1);
+			appendBigEndian(header, [picture length], 3);
+			[header appendData:picture];
+		}
+		
+		if(0 < _padding) {
+			lastBlock = [header length];
+			appendBigEndian(header, FLAC__METADATA_TYPE_PADDING, 1);
+			appendBigEndian(header, _padding, 3);
+			[header increaseLengthBy:_padding];
+		}
+		
+		// Flag the final metadata block
+		((uint8_t *)[header mutableBytes])[lastBlock] |= 0x80;
+		
+		intResult = fseeko(file, 0, SEEK_SET);
+		NSAssert(-1 != intResult, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		bytesWritten = fwrite([header bytes], 1, [header length], file);
+		NSAssert([header length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		[self logSamplesEncoded:samplesEncoded sampleRate:pcmFormat.mSampleRate threads:_threads sinceDate:startTime];
+	}
+	
+	@finally {
+		// Don't leave any segments running
+		[queue cancelAllOperations];
+		[queue waitUntilAllOperationsAreFinished];
+		
+		if(NULL != file) {
+			intResult = fclose(file);
+			if(0 != intResult)
+				NSLog(@"Unable to close the output file: %s", strerror(errno));
+		}
+		
+		free(bufferList.mBuffers[0].mData);
+	}
 }
 
 - (void) encodeChunk:(const AudioBufferList *)chunk frameCount:(UInt32)frameCount
@@ -333,14 +1107,7 @@
 	
 	int32_t			**buffer				= NULL;
 	
-	int8_t			*buffer8				= NULL;
-	int16_t			*buffer16				= NULL;
-	int32_t			*buffer32				= NULL;
-	
-	int32_t			constructedSample;
-	
-	unsigned		wideSample;
-	unsigned		sample, channel;
+	unsigned		channel;
 	
 	@try {
 		// Allocate the FLAC buffer
@@ -359,52 +1126,7 @@
 		}
 		
 		// Split PCM data into channels and convert to 32-bit sample size for FLAC
-		switch(_sourceBitsPerChannel) {
-
-			case 8:
-				buffer8 = chunk->mBuffers[0].mData;
-				for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-					for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-						buffer[channel][wideSample] = (int32_t)buffer8[sample];
-					}
-				}
-				break;
-			
-			case 16:
-				buffer16 = chunk->mBuffers[0].mData;
-				for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-					for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-						buffer[channel][wideSample] = (int32_t)(int16_t)OSSwapBigToHostInt16(buffer16[sample]);
-					}
-				}
-				break;
-			
-			case 24:
-				buffer8 = chunk->mBuffers[0].mData;
-				for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-					for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel) {
-						constructedSample = (int8_t)*buffer8++; constructedSample <<= 8;
-						constructedSample |= (uint8_t)*buffer8++; constructedSample <<= 8;
-						constructedSample |= (uint8_t)*buffer8++;
-						
-						buffer[channel][wideSample] = constructedSample;
-					}
-				}
-				break;
-				
-			case 32:
-				buffer32 = chunk->mBuffers[0].mData;
-				for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-					for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-						buffer[channel][wideSample] = (int32_t)OSSwapBigToHostInt32(buffer32[sample]);
-					}
-				}
-				break;
-				
-			default:
-				@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
-				break;
-		}
+		deinterleaveAudio(chunk, frameCount, _sourceBitsPerChannel, buffer, 0);
 		
 		// Encode the chunk
 		result = FLAC__stream_encoder_process(_flac, (const FLAC__int32 * const *)buffer, frameCount);
@@ -419,4 +1141,17 @@
 	}
 }	
 
+// Log the encoding rate, so the effect of the thread count can be measured
+- (void) logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime
+{
+	NSTimeInterval		interval		= -1.0 * [startTime timeIntervalSinceNow];
+	NSString			*message;
+	
+	if(0 >= interval || 0 >= sampleRate)
+		return;
+	
+	message = [NSString stringWithFormat:NSLocalizedStringFromTable(@"FLAC: encoded %.2f seconds of audio in %.2f seconds using %u threads (%.1fx realtime)", @"Log", @""), samplesEncoded / sampleRate, interval, threads, (samplesEncoded / sampleRate) / interval];
+	[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
+}
+
 @end
@@ -31,6 +31,14 @@
 
 @implementation LibsndfileEncoder
 
++ (NSString *) libraryVersion
+{
+	char			buffer [128];
+	
+	sf_command(NULL, SFC_GET_LIB_VERSION, buffer, sizeof(buffer));
+	return [NSString stringWithCString:buffer encoding:NSASCIIStringEncoding];
+}
+
 - (oneway void) encodeToFile:(NSString *)filename
 {
 	NSDate							*startTime							= [NSDate date];
@@ -52,6 +52,9 @@ enum {
 	FILE					*_out;
 	lame_global_flags		*_gfp;
 	UInt32					_sourceBitsPerChannel;
+	
+	NSDictionary			*_settings;
+	unsigned				_threads;
 }
 
 @end
@@ -36,6 +36,8 @@
 
 #import "UtilityFunctions.h"
 
+#import "LogController.h"
+
 #include <fcntl.h>		// open, write
 #include <stdio.h>		// fopen, fclose
 #include <sys/stat.h>	// stat
@@ -43,14 +45,423 @@
 // Bitrates supported for 44.1 kHz audio
 static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
 
+// Parallel encoding splits the input into segments of this many MP3 frames (about 53 seconds at 44.1 kHz)
+#define SEGMENT_FRAMES			2048
+
+// Each segment after the first starts this many frames early, so the encoder's state has settled by the join
+#define JOIN_LEAD_FRAMES		8
+
+// The frames at which a join may be made, starting at the segment's nominal first frame
+#define JOIN_WINDOW_FRAMES		8
+
+// Each segment before the last continues this many frames past the join window, so the frames
+// in the window aren't affected by the end of the segment's input
+#define JOIN_TAIL_FRAMES		4
+
+// The LAME extension to the Xing/Info tag
+#define LAME_TAG_LENGTH			36
+
+static uint16_t		sCRC16Table		[ 256 ];
+
 @interface MP3Encoder (Private)
 - (void)	parseSettings;
+- (void)	applySettingsToEncoder:(lame_global_flags *)gfp;
+- (void)	encodeSerially:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime;
+- (void)	encodeInParallel:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime;
 - (void)	encodeChunk:(const AudioBufferList *)chunk frameCount:(UInt32)frameCount;
 - (void)	finishEncode;
+- (void)	logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime;
 @end
 
+#pragma mark Utility functions
+
+// Split interleaved PCM data into channels, scaled to the full 32-bit range used by lame_encode_buffer_long2
+static void
+deinterleaveAudio(const AudioBufferList *chunk, UInt32 frameCount, UInt32 bitsPerChannel, long **buffer, UInt32 offset)
+{
+	const int8_t	*buffer8				= NULL;
+	const int16_t	*buffer16				= NULL;
+	const int32_t	*buffer32				= NULL;
+	int32_t			constructedSample;
+	unsigned		wideSample;
+	unsigned		sample, channel;
+	
+	switch(bitsPerChannel) {
+			
+		case 8:
+			buffer8 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[channel][offset + wideSample] = (long)(int32_t)((uint32_t)(uint16_t)(((buffer8[sample] << 8) & 0xFF00) | (buffer8[sample] & 0xFF)) << 16);
+				}
+			}
+			break;
+			
+		case 16:
+			buffer16 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[channel][offset + wideSample] = (long)(int32_t)((uint32_t)OSSwapBigToHostInt16(buffer16[sample]) << 16);
+				}
+			}
+			break;
+			
+		case 24:
+			buffer8 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel) {
+					constructedSample = (int8_t)*buffer8++; constructedSample <<= 8;
+					constructedSample |= (uint8_t)*buffer8++; constructedSample <<= 8;
+					constructedSample |= (uint8_t)*buffer8++;
+					
+					buffer[channel][offset + wideSample] = (long)((constructedSample << 8) | (constructedSample & 0x000000ff));
+				}
+			}
+			break;
+			
+		case 32:
+			buffer32 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[channel][offset + wideSample] = (long)(int32_t)OSSwapBigToHostInt32(buffer32[sample]);
+				}
+			}
+			break;
+			
+		default:
+			@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
+			break;
+	}
+}
+
+// Returns the length of the Layer III frame whose header is at frame, or 0 if the header is invalid
+// sideInfoOffset is set to the offset of the side information, and mainDataOffset to the offset of the main data
+static unsigned
+parseFrameHeader(const uint8_t *frame, unsigned *sideInfoOffset, unsigned *mainDataOffset, BOOL *isMPEG1)
+{
+	static const unsigned	sMPEG1Bitrates		[ 16 ] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+	static const unsigned	sMPEG2Bitrates		[ 16 ] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+	static const unsigned	sMPEG1SampleRates	[ 4 ] = { 44100, 48000, 32000, 0 };
+	
+	unsigned	version, bitrate, sampleRate;
+	BOOL		mono;
+	
+	// Frame sync and Layer III
+	if(0xFF != frame[0] || 0xE0 != (frame[1] & 0xE0) || 0x02 != ((frame[1] >> 1) & 0x03)) {
+		return 0;
+	}
+	
+	// 3 is MPEG-1, 2 is MPEG-2 and 0 is MPEG-2.5
+	version		= (frame[1] >> 3) & 0x03;
+	if(1 == version) {
+		return 0;
+	}
+	
+	bitrate		= (3 == version ? sMPEG1Bitrates : sMPEG2Bitrates)[frame[2] >> 4];
+	sampleRate	= sMPEG1SampleRates[(frame[2] >> 2) & 0x03] >> (3 == version ? 0 : (2 == version ? 1 : 2));
+	mono		= (0x03 == (frame[3] >> 6));
+	
+	// Free format isn't supported
+	if(0 == bitrate || 0 == sampleRate) {
+		return 0;
+	}
+	
+	*isMPEG1			= (3 == version);
+	*sideInfoOffset		= 4 + (frame[1] & 0x01 ? 0 : 2);
+	*mainDataOffset		= *sideInfoOffset + (*isMPEG1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+	
+	return ((*isMPEG1 ? 144000 : 72000) * bitrate) / sampleRate + ((frame[2] >> 1) & 0x01);
+}
+
+// CRC-16 as used by LAME for the music and tag CRCs
+static uint16_t
+updateCRC16(uint16_t crc, const uint8_t *data, size_t length)
+{
+	while(length--) {
+		crc = (crc >> 8) ^ sCRC16Table[(crc ^ *data++) & 0xFF];
+	}
+	
+	return crc;
+}
+
+static void
+writeBigEndian(uint8_t *buffer, uint32_t value, unsigned byteCount)
+{
+	unsigned	i;
+	
+	for(i = 0; i < byteCount; ++i) {
+		buffer[i] = (uint8_t)(value >> (8 * (byteCount - 1 - i)));
+	}
+}
+
+#pragma mark MP3Segment
+
+// A run of MP3 frames encoded by its own LAME instance
+// Segments overlap, and are joined at a frame where the bit reservoir can be carried over intact
+@interface MP3Segment : NSOperation
+{
+	lame_global_flags		*_gfp;
+	unsigned				_channels;
+	
+	long					**_buffer;
+	UInt32					_sampleCapacity;
+	UInt32					_sampleCount;
+	
+	NSUInteger				_firstFrame;
+	NSUInteger				_nominalFirstFrame;
+	
+	NSMutableData			*_data;
+	NSMutableData			*_frameOffsets;
+	NSUInteger				_tagLength;
+	
+	NSException				*_exception;
+}
+
+// The segment takes ownership of gfp, which must be set up with lame_init_params before the operation is queued
+- (id)					initWithEncoder:(lame_global_flags *)gfp channels:(unsigned)channels sampleCapacity:(UInt32)sampleCapacity firstFrame:(NSUInteger)firstFrame nominalFirstFrame:(NSUInteger)nominalFirstFrame;
+
+- (lame_global_flags *)	encoder;
+
+// Per-channel sample buffers, to be filled before the operation is queued (they are freed once the segment is encoded)
+- (long **)				buffer;
+- (UInt32)				sampleCapacity;
+
+- (UInt32)				sampleCount;
+- (void)				setSampleCount:(UInt32)sampleCount;
+
+// The first frame (counted from the start of the stream) this segment produces, and the first it is responsible for
+- (NSUInteger)			firstFrame;
+- (NSUInteger)			nominalFirstFrame;
+
+- (NSException *)		exception;
+
+// Access to the encoded frames; frames are numbered from the start of the stream
+- (NSUInteger)			frameCount;
+- (const uint8_t *)		bytesForFrame:(NSUInteger)frame length:(NSUInteger *)length;
+- (unsigned)			mainDataBeginForFrame:(NSUInteger)frame;
+
+// The main data bytes preceding a frame, which are held in the frames before it
+- (void)				getMainData:(uint8_t *)buffer length:(unsigned)length beforeFrame:(NSUInteger)frame;
+- (void)				replaceMainData:(const uint8_t *)buffer length:(unsigned)length beforeFrame:(NSUInteger)frame;
+
+// The length of the Xing/Info frame written by the encoder, if any
+- (NSUInteger)			tagLength;
+
+@end
+
+@implementation MP3Segment
+
+- (id) initWithEncoder:(lame_global_flags *)gfp channels:(unsigned)channels sampleCapacity:(UInt32)sampleCapacity firstFrame:(NSUInteger)firstFrame nominalFirstFrame:(NSUInteger)nominalFirstFrame
+{
+	unsigned		channel;
+	
+	NSAssert(NULL != gfp, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+	
+	if((self = [super init])) {
+		_gfp				= gfp;
+		_channels			= channels;
+		_sampleCapacity		= sampleCapacity;
+		_firstFrame			= firstFrame;
+		_nominalFirstFrame	= nominalFirstFrame;
+		
+		_data				= [[NSMutableData alloc] init];
+		_frameOffsets		= [[NSMutableData alloc] init];
+		
+		_buffer				= calloc(_channels, sizeof(long *));
+		NSAssert(NULL != _buffer, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		for(channel = 0; channel < _channels; ++channel) {
+			_buffer[channel] = calloc(_sampleCapacity, sizeof(long));
+			NSAssert(NULL != _buffer[channel], NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		}
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	unsigned		channel;
+	
+	if(NULL != _buffer) {
+		for(channel = 0; channel < _channels; ++channel) {
+			free(_buffer[channel]);
+		}
+		free(_buffer),			_buffer = NULL;
+	}
+	
+	lame_close(_gfp),			_gfp = NULL;
+	
+	[_data release],			_data = nil;
+	[_frameOffsets release],	_frameOffsets = nil;
+	[_exception release],		_exception = nil;
+	
+	[super dealloc];
+}
+
+- (lame_global_flags *)	encoder									{ return _gfp; }
+
+- (long **)				buffer									{ return _buffer; }
+- (UInt32)				sampleCapacity							{ return _sampleCapacity; }
+
+- (UInt32)				sampleCount								{ return _sampleCount; }
+- (void)				setSampleCount:(UInt32)sampleCount		{ _sampleCount = sampleCount; }
+
+- (NSUInteger)			firstFrame								{ return _firstFrame; }
+- (NSUInteger)			nominalFirstFrame						{ return _nominalFirstFrame; }
+
+- (NSException *)		exception								{ return [[_exception retain] autorelease]; }
+
+- (NSUInteger)			frameCount								{ return [_frameOffsets length] / sizeof(NSUInteger); }
+- (NSUInteger)			tagLength								{ return _tagLength; }
+
+- (void) main
+{
+	NSAutoreleasePool		*pool			= [[NSAutoreleasePool alloc] init];
+	unsigned char			*buffer			= NULL;
+	int						bufferLen;
+	int						result;
+	const uint8_t			*frame;
+	NSUInteger				offset;
+	unsigned				frameLength, sideInfoOffset, mainDataOffset;
+	BOOL					isMPEG1;
+	unsigned				channel;
+	
+	@try {
+		// Allocate the MP3 buffer using LAME guide for size
+		bufferLen	= 1.25 * _sampleCount + 7200;
+		buffer		= (unsigned char *) calloc(bufferLen, sizeof(unsigned char));
+		NSAssert(NULL != buffer, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		result = lame_encode_buffer_long2(_gfp, _buffer[0], _buffer[1 < _channels ? 1 : 0], _sampleCount, buffer, bufferLen);
+		NSAssert(0 <= result, NSLocalizedStringFromTable(@"LAME encoding error.", @"Exceptions", @""));
+		[_data appendBytes:buffer length:result];
+		
+		result = lame_encode_flush(_gfp, buffer, bufferLen);
+		NSAssert(0 <= result, NSLocalizedStringFromTable(@"LAME was unable to flush the buffers.", @"Exceptions", @""));
+		[_data appendBytes:buffer length:result];
+		
+		// Index the frames, setting aside the Xing/Info frame if LAME wrote one
+		for(offset = 0; offset + 4 <= [_data length]; offset += frameLength) {
+			frame		= (const uint8_t *)[_data bytes] + offset;
+			frameLength	= parseFrameHeader(frame, &sideInfoOffset, &mainDataOffset, &isMPEG1);
+			NSAssert(0 != frameLength && offset + frameLength <= [_data length], NSLocalizedStringFromTable(@"LAME encoding error.", @"Exceptions", @""));
+			
+			if(0 == offset && lame_get_bWriteVbrTag(_gfp)) {
+				_tagLength = frameLength;
+				continue;
+			}
+			
+			[_frameOffsets appendBytes:&offset length:sizeof(offset)];
+		}
+	}
+	
+	@catch(NSException *exception) {
+		_exception = [exception retain];
+	}
+	
+	@finally {
+		free(buffer);
+		
+		// Only the encoded frames are needed from here on
+		for(channel = 0; channel < _channels; ++channel) {
+			free(_buffer[channel]),	_buffer[channel] = NULL;
+		}
+		
+		[pool release];
+	}
+}
+
+- (const uint8_t *) bytesForFrame:(NSUInteger)frame length:(NSUInteger *)length
+{
+	const NSUInteger	*offsets	= [_frameOffsets bytes];
+	NSUInteger			index		= frame - _firstFrame;
+	
+	NSParameterAssert(frame >= _firstFrame && index < [self frameCount]);
+	
+	*length = (index + 1 < [self frameCount] ? offsets[index + 1] : [_data length]) - offsets[index];
+	return (const uint8_t *)[_data bytes] + offsets[index];
+}
+
+- (unsigned) mainDataBeginForFrame:(NSUInteger)frame
+{
+	NSUInteger			length;
+	const uint8_t		*bytes			= [self bytesForFrame:frame length:&length];
+	unsigned			sideInfoOffset, mainDataOffset;
+	BOOL				isMPEG1;
+	
+	parseFrameHeader(bytes, &sideInfoOffset, &mainDataOffset, &isMPEG1);
+	
+	// 9 bits for MPEG-1 and 8 for MPEG-2
+	if(isMPEG1)
+		return (bytes[sideInfoOffset] << 1) | (bytes[sideInfoOffset + 1] >> 7);
+	else
+		return bytes[sideInfoOffset];
+}
+
+- (void) getMainData:(uint8_t *)buffer length:(unsigned)length beforeFrame:(NSUInteger)frame
+{
+	NSUInteger			frameLength, count;
+	const uint8_t		*bytes;
+	unsigned			sideInfoOffset, mainDataOffset;
+	BOOL				isMPEG1;
+	
+	while(0 < length) {
+		NSAssert(frame > _firstFrame, NSLocalizedStringFromTable(@"LAME encoding error.", @"Exceptions", @""));
+		
+		bytes	= [self bytesForFrame:--frame length:&frameLength];
+		parseFrameHeader(bytes, &sideInfoOffset, &mainDataOffset, &isMPEG1);
+		
+		count	= MIN(length, frameLength - mainDataOffset);
+		length	-= count;
+		
+		memcpy(buffer + length, bytes + frameLength - count, count);
+	}
+}
+
+- (void) replaceMainData:(const uint8_t *)buffer length:(unsigned)length beforeFrame:(NSUInteger)frame
+{
+	NSUInteger			frameLength, count;
+	const uint8_t		*bytes;
+	unsigned			sideInfoOffset, mainDataOffset;
+	BOOL				isMPEG1;
+	
+	while(0 < length) {
+		NSAssert(frame > _firstFrame, NSLocalizedStringFromTable(@"LAME encoding error.", @"Exceptions", @""));
+		
+		bytes	= [self bytesForFrame:--frame length:&frameLength];
+		parseFrameHeader(bytes, &sideInfoOffset, &mainDataOffset, &isMPEG1);
+		
+		count	= MIN(length, frameLength - mainDataOffset);
+		length	-= count;
+		
+		[_data replaceBytesInRange:NSMakeRange((bytes - (const uint8_t *)[_data bytes]) + frameLength - count, count) withBytes:buffer + length];
+	}
+}
+
+@end
+
+#pragma mark MP3Encoder
+
 @implementation MP3Encoder
 
++ (void) initialize
+{
+	unsigned	i, j;
+	uint16_t	crc;
+	
+	// CRC-16 with the reversed polynomial 0xA001
+	for(i = 0; i < 256; ++i) {
+		crc = (uint16_t)i;
+		for(j = 0; j < 8; ++j) {
+			crc = (crc & 0x0001 ? (crc >> 1) ^ 0xA001 : crc >> 1);
+		}
+		sCRC16Table[i] = crc;
+	}
+}
+
 - (id) init
 {
 	if((self = [super init])) {
@@ -59,6 +470,8 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 		
 		// Write the Xing VBR tag
 		lame_set_bWriteVbrTag(_gfp, 1);			
+		
+		_threads	= 1;
 	}
 	
 	return self;
@@ -68,27 +481,21 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 {
 	lame_close(_gfp);	
 	
+	[_settings release],	_settings = nil;
+	
 	[super dealloc];
 }
 
 - (oneway void) encodeToFile:(NSString *) filename
 {
 	NSDate							*startTime						= [NSDate date];
-	FILE							*file							= NULL;
-	int								result;
-	AudioBufferList					bufferList;
-	ssize_t							bufferLen						= 0;
-	UInt32							bufferByteSize					= 0;
-	SInt64							totalFrames, framesToRead;
+	id <DecoderMethods>				decoder							= nil;
+	NSString						*sourceFilename					= nil;
+	SInt64							startingFrame;
 	UInt32							frameCount;
-	unsigned long					iterations						= 0;
-	double							percentComplete;
-	NSTimeInterval					interval;
-	unsigned						secondsRemaining;	
+	int								result;
 	
 	@try {
-		bufferList.mBuffers[0].mData = NULL;
-
 		// Parse the encoder settings
 		[self parseSettings];
 
@@ -97,14 +504,13 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 		[[self delegate] setStarted:YES];
 		
 		// Setup the decoder
-		id <DecoderMethods> decoder = nil;
-		NSString *sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
+		sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
 		
 		// Create the appropriate kind of decoder
 		if(nil != [[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"]) {
-			SInt64 startingFrame = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
-			UInt32 frameCount = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
-			decoder = [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
+			startingFrame	= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
+			frameCount		= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
+			decoder			= [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
 		}
 		else
 			decoder = [Decoder decoderWithFilename:sourceFilename];
@@ -112,6 +518,147 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 		NSAssert(1 == [decoder pcmFormat].mChannelsPerFrame || 2 == [decoder pcmFormat].mChannelsPerFrame, NSLocalizedStringFromTable(@"LAME only supports one or two channel input.", @"Exceptions", @""));
 
 		_sourceBitsPerChannel	= [decoder pcmFormat].mBitsPerChannel;
+		
+		// Initialize the LAME encoder
+		lame_set_num_channels(_gfp, [decoder pcmFormat].mChannelsPerFrame);
+		lame_set_in_samplerate(_gfp, [decoder pcmFormat].mSampleRate);
+		
+		result = lame_init_params(_gfp);
+		NSAssert(-1 != result, NSLocalizedStringFromTable(@"Unable to initialize the LAME encoder.", @"Exceptions", @""));
+
+		// Segments can only be joined if their frames line up with the input, which isn't the case when
+		// LAME resamples, and the ReplayGain stored in the LAME tag can't be combined
+		if(1 < _threads 
+		   && (SInt64)(2 * SEGMENT_FRAMES * lame_get_framesize(_gfp)) < [decoder totalFrames] 
+		   && lame_get_out_samplerate(_gfp) == lame_get_in_samplerate(_gfp) 
+		   && 0 == lame_get_findReplayGain(_gfp))
+			[self encodeInParallel:decoder toFile:filename startTime:startTime];
+		else
+			[self encodeSerially:decoder toFile:filename startTime:startTime];
+	}
+
+	@catch(StopException *exception) {
+		[[self delegate] setStopped:YES];
+	}
+	
+	@catch(NSException *exception) {
+		[[self delegate] setException:exception];
+		[[self delegate] setStopped:YES];
+	}
+	
+	[[self delegate] setEndTime:[NSDate date]];
+	[[self delegate] setCompleted:YES];	
+}
+
++ (NSString *) libraryVersion
+{
+	return [NSString stringWithFormat:@"LAME %s", get_lame_version()];
+}
+
+- (NSString *) settingsString
+{
+	NSString *bitrateString;
+	NSString *qualityString;
+		
+	switch(lame_get_VBR(_gfp)) {
+		case vbr_mt:
+		case vbr_rh:
+		case vbr_mtrh:
+//			appendix = "ca. ";
+			bitrateString = [NSString stringWithFormat:@"VBR(q=%i)", lame_get_VBR_q(_gfp)];
+			break;
+		case vbr_abr:
+			bitrateString = [NSString stringWithFormat:@"average %d kbps", lame_get_VBR_mean_bitrate_kbps(_gfp)];
+			break;
+		default:
+			bitrateString = [NSString stringWithFormat:@"%3d kbps", lame_get_brate(_gfp)];
+			break;
+	}
+	
+//			0.1 * (int) (10. * lame_get_compression_ratio(_gfp) + 0.5),
+
+	qualityString = [NSString stringWithFormat:@"qval=%i", lame_get_quality(_gfp)];
+	
+	return [NSString stringWithFormat:@"LAME settings: %@ %@", bitrateString, qualityString];
+}
+
+@end
+
+@implementation MP3Encoder (Private)
+- (void) parseSettings
+{
+	// Keep a copy, since each segment of a parallel encode needs its own LAME encoder
+	[_settings release];
+	_settings	= [[NSDictionary alloc] initWithDictionary:[[self delegate] encoderSettings]];
+	
+	_threads	= getEncoderThreadCount(_settings);
+	
+	[self applySettingsToEncoder:_gfp];
+}
+
+- (void) applySettingsToEncoder:(lame_global_flags *)gfp
+{
+	int				bitrate;	
+	
+	// Set encoding properties
+	switch([[_settings objectForKey:@"stereoMode"] intValue]) {
+		case LAME_STEREO_MODE_DEFAULT:			lame_set_mode(gfp, NOT_SET);			break;
+		case LAME_STEREO_MODE_MONO:				lame_set_mode(gfp, MONO);				break;
+		case LAME_STEREO_MODE_STEREO:			lame_set_mode(gfp, STEREO);			break;
+		case LAME_STEREO_MODE_JOINT_STEREO:		lame_set_mode(gfp, JOINT_STEREO);		break;
+		default:								lame_set_mode(gfp, NOT_SET);			break;
+	}
+	
+	switch([[_settings objectForKey:@"encodingEngineQuality"] intValue]) {
+		case LAME_ENCODING_ENGINE_QUALITY_FAST:			lame_set_quality(gfp, 7);		break;
+		case LAME_ENCODING_ENGINE_QUALITY_STANDARD:		lame_set_quality(gfp, 5);		break;
+		case LAME_ENCODING_ENGINE_QUALITY_HIGH:			lame_set_quality(gfp, 2);		break;
+		default:										lame_set_quality(gfp, 5);		break;
+	}
+	
+	// Target is bitrate
+	if(LAME_TARGET_BITRATE == [[_settings objectForKey:@"target"] intValue]) {
+		bitrate = sLAMEBitrates[[[_settings objectForKey:@"bitrate"] intValue]];
+		lame_set_brate(gfp, bitrate);
+		if([[_settings objectForKey:@"useConstantBitrate"] boolValue]) {
+			lame_set_VBR(gfp, vbr_off);
+		}
+		else {
+			lame_set_VBR(gfp, vbr_default);
+			lame_set_VBR_min_bitrate_kbps(gfp, bitrate);
+		}
+	}
+	// Target is quality
+	else if(LAME_TARGET_QUALITY == [[_settings objectForKey:@"target"] intValue]) {
+		lame_set_VBR(gfp, LAME_VARIABLE_BITRATE_MODE_FAST == [[_settings objectForKey:@"variableBitrateMode"] intValue] ? vbr_mtrh : vbr_rh);
+		lame_set_VBR_q(gfp, (100 - [[_settings objectForKey:@"VBRQuality"] intValue]) / 10);
+	}
+	else {
+		@throw [NSException exceptionWithName:@"NSInternalInconsistencyException" reason:@"Unrecognized LAME target" userInfo:nil];
+	}
+	
+	if([[_settings objectForKey:@"calculateReplayGain"] boolValue]) {
+		lame_set_findReplayGain(gfp, 1);
+	}
+}
+
+- (void) encodeSerially:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime
+{
+	FILE							*file							= NULL;
+	int								result;
+	AudioBufferList					bufferList;
+	ssize_t							bufferLen						= 0;
+	UInt32							bufferByteSize					= 0;
+	SInt64							totalFrames, framesToRead;
+	UInt32							frameCount;
+	unsigned long					iterations						= 0;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;	
+	
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
+
 		totalFrames				= [decoder totalFrames];
 		framesToRead			= totalFrames;
 		
@@ -148,13 +695,6 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 		bufferByteSize = bufferList.mBuffers[0].mDataByteSize;
 		NSAssert(NULL != bufferList.mBuffers[0].mData, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		// Initialize the LAME encoder
-		lame_set_num_channels(_gfp, [decoder pcmFormat].mChannelsPerFrame);
-		lame_set_in_samplerate(_gfp, [decoder pcmFormat].mSampleRate);
-		
-		result = lame_init_params(_gfp);
-		NSAssert(-1 != result, NSLocalizedStringFromTable(@"Unable to initialize the LAME encoder.", @"Exceptions", @""));
-
 		// Open the output file
 		_out = fopen([filename fileSystemRepresentation], "w");
 		NSAssert(NULL != _out, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
@@ -213,15 +753,8 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 		NSAssert(NULL != file, NSLocalizedStringFromTable(@"Unable to open the output file.", @"Exceptions", @""));
 
 		lame_mp3_tags_fid(_gfp, file);
-	}
-
-	@catch(StopException *exception) {
-		[[self delegate] setStopped:YES];
-	}
-	
-	@catch(NSException *exception) {
-		[[self delegate] setException:exception];
-		[[self delegate] setStopped:YES];
+		
+		[self logSamplesEncoded:(totalFrames - framesToRead) sampleRate:[decoder pcmFormat].mSampleRate threads:1 sinceDate:startTime];
 	}
 	
 	@finally {
@@ -245,86 +778,332 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 
 		free(bufferList.mBuffers[0].mData);
 	}
-
-	[[self delegate] setEndTime:[NSDate date]];
-	[[self delegate] setCompleted:YES];	
 }
 
-- (NSString *) settingsString
+// Each segment is encoded by its own LAME instance, starting a few frames before the point where it takes over from
+// the previous segment so the psychoacoustic model and the bit reservoir have settled.  Because the segments share
+// frame boundaries, a frame from one segment can directly follow a frame from another; the only state that crosses 
+// the join is the bit reservoir, so the main data the new segment's first frame expects to find in the preceding 
+// frames is copied over the bytes the old segment had set aside for its own frame at that position.
+- (void) encodeInParallel:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime
 {
-	NSString *bitrateString;
-	NSString *qualityString;
-		
-	switch(lame_get_VBR(_gfp)) {
-		case vbr_mt:
-		case vbr_rh:
-		case vbr_mtrh:
-//			appendix = "ca. ";
-			bitrateString = [NSString stringWithFormat:@"VBR(q=%i)", lame_get_VBR_q(_gfp)];
-			break;
-		case vbr_abr:
-			bitrateString = [NSString stringWithFormat:@"average %d kbps", lame_get_VBR_mean_bitrate_kbps(_gfp)];
-			break;
-		default:
-			bitrateString = [NSString stringWithFormat:@"%3d kbps", lame_get_brate(_gfp)];
-			break;
-	}
-	
-//			0.1 * (int) (10. * lame_get_compression_ratio(_gfp) + 0.5),
-
-	qualityString = [NSString stringWithFormat:@"qval=%i", lame_get_quality(_gfp)];
-	
-	return [NSString stringWithFormat:@"LAME settings: %@ %@", bitrateString, qualityString];
-}
-
-@end
-
-@implementation MP3Encoder (Private)
-- (void) parseSettings
-{
-	NSDictionary	*settings	= [[self delegate] encoderSettings];
-	int				bitrate;	
-	
-	
-	// Set encoding properties
-	switch([[settings objectForKey:@"stereoMode"] intValue]) {
-		case LAME_STEREO_MODE_DEFAULT:			lame_set_mode(_gfp, NOT_SET);			break;
-		case LAME_STEREO_MODE_MONO:				lame_set_mode(_gfp, MONO);				break;
-		case LAME_STEREO_MODE_STEREO:			lame_set_mode(_gfp, STEREO);			break;
-		case LAME_STEREO_MODE_JOINT_STEREO:		lame_set_mode(_gfp, JOINT_STEREO);		break;
-		default:								lame_set_mode(_gfp, NOT_SET);			break;
-	}
-	
-	switch([[settings objectForKey:@"encodingEngineQuality"] intValue]) {
-		case LAME_ENCODING_ENGINE_QUALITY_FAST:			lame_set_quality(_gfp, 7);		break;
-		case LAME_ENCODING_ENGINE_QUALITY_STANDARD:		lame_set_quality(_gfp, 5);		break;
-		case LAME_ENCODING_ENGINE_QUALITY_HIGH:			lame_set_quality(_gfp, 2);		break;
-		default:										lame_set_quality(_gfp, 5);		break;
-	}
+	AudioStreamBasicDescription		pcmFormat				= [decoder pcmFormat];
+	UInt32							frameSize				= (UInt32)lame_get_framesize(_gfp);
+	NSOperationQueue				*queue					= nil;
+	NSMutableArray					*segments				= nil;
+	MP3Segment						*segment				= nil;
+	MP3Segment						*nextSegment			= nil;
+	long							**carry					= NULL;
+	UInt32							carryStart;
+	UInt32							carryCount				= 0;
+	AudioBufferList					bufferList;
+	UInt32							bufferByteSize;
+	UInt32							segmentLength;
+	UInt32							segmentSampleCount;
+	UInt32							overlap;
+	UInt32							frameCount;
+	unsigned						channel;
+	BOOL							inputFinished			= NO;
+	NSUInteger						segmentIndex			= 0;
+	NSUInteger						firstFrame;
+	NSUInteger						writeFrom				= 0;
+	NSUInteger						joinFrame, lastFrame, frame;
+	unsigned						mainDataBegin;
+	uint8_t							reservoir				[ 512 ];
+	unsigned						joins					= 0;
+	unsigned						mismatchedJoins			= 0;
+	unsigned						droppedBytes			= 0;
+	unsigned						maxDroppedBytes			= 0;
+	SInt64							totalFrames				= [decoder totalFrames];
+	SInt64							samplesRead				= 0;
+	SInt64							samplesEncoded;
+	NSMutableData					*tag					= nil;
+	int								encoderDelay			= 0;
+	NSMutableData					*frameOffsets			= nil;
+	const uint64_t					*offsets;
+	uint64_t						fileOffset				= 0;
+	NSUInteger						audioFrames;
+	uint16_t						musicCRC				= 0;
+	const uint8_t					*bytes;
+	uint8_t							*tagBytes;
+	NSUInteger						length;
+	unsigned						sideInfoOffset, mainDataOffset;
+	BOOL							isMPEG1;
+	uint32_t						flags;
+	NSUInteger						tagOffset;
+	SInt64							padding;
+	unsigned						i;
+	FILE							*file					= NULL;
+	size_t							bytesWritten;
+	int								intResult;
+	NSString						*message;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
 	
-	// Target is bitrate
-	if(LAME_TARGET_BITRATE == [[settings objectForKey:@"target"] intValue]) {
-		bitrate = sLAMEBitrates[[[settings objectForKey:@"bitrate"] intValue]];
-		lame_set_brate(_gfp, bitrate);
-		if([[settings objectForKey:@"useConstantBitrate"] boolValue]) {
-			lame_set_VBR(_gfp, vbr_off);
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
+		
+		// Read one MP3 frame's worth of audio at a time
+		bufferByteSize								= frameSize * pcmFormat.mBytesPerFrame;
+		bufferList.mNumberBuffers					= 1;
+		bufferList.mBuffers[0].mData				= calloc(bufferByteSize, sizeof(uint8_t));
+		NSAssert(NULL != bufferList.mBuffers[0].mData, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		// The end of each segment's input, which is also the start of the next segment's
+		carry = calloc(pcmFormat.mChannelsPerFrame, sizeof(long *));
+		NSAssert(NULL != carry, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		for(channel = 0; channel < pcmFormat.mChannelsPerFrame; ++channel) {
+			carry[channel] = calloc((JOIN_LEAD_FRAMES + JOIN_WINDOW_FRAMES + JOIN_TAIL_FRAMES) * frameSize, sizeof(long));
+			NSAssert(NULL != carry[channel], NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		}
-		else {
-			lame_set_VBR(_gfp, vbr_default);
-			lame_set_VBR_min_bitrate_kbps(_gfp, bitrate);
+		
+		frameOffsets = [NSMutableData data];
+		
+		file = fopen([filename fileSystemRepresentation], "w");
+		NSAssert(NULL != file, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
+		
+		queue		= [[[NSOperationQueue alloc] init] autorelease];
+		segments	= [NSMutableArray array];
+		
+		[queue setMaxConcurrentOperationCount:_threads];
+		
+		for(;;) {
+			
+			// Keep every thread busy, holding at most one more segment's audio than that
+			while(NO == inputFinished && [segments count] < _threads + 1) {
+				firstFrame		= (0 == segmentIndex ? 0 : segmentIndex * SEGMENT_FRAMES - JOIN_LEAD_FRAMES);
+				segmentLength	= (UInt32)(((segmentIndex + 1) * SEGMENT_FRAMES + JOIN_WINDOW_FRAMES + JOIN_TAIL_FRAMES - firstFrame) * frameSize);
+				
+				segment			= [[[MP3Segment alloc] initWithEncoder:lame_init() channels:pcmFormat.mChannelsPerFrame sampleCapacity:segmentLength firstFrame:firstFrame nominalFirstFrame:segmentIndex * SEGMENT_FRAMES] autorelease];
+				
+				[self applySettingsToEncoder:[segment encoder]];
+				
+				lame_set_num_channels([segment encoder], pcmFormat.mChannelsPerFrame);
+				lame_set_in_samplerate([segment encoder], pcmFormat.mSampleRate);
+				
+				// Only the first segment carries the Xing/Info frame
+				lame_set_bWriteVbrTag([segment encoder], 0 == segmentIndex);
+				
+				intResult = lame_init_params([segment encoder]);
+				NSAssert(-1 != intResult, NSLocalizedStringFromTable(@"Unable to initialize the LAME encoder.", @"Exceptions", @""));
+				
+				// The start of this segment's input was the end of the previous segment's
+				overlap = carryCount;
+				for(channel = 0; channel < pcmFormat.mChannelsPerFrame; ++channel) {
+					memcpy([segment buffer][channel], carry[channel], overlap * sizeof(long));
+				}
+				
+				segmentSampleCount = overlap;
+				while(segmentSampleCount < segmentLength) {
+					bufferList.mBuffers[0].mNumberChannels	= pcmFormat.mChannelsPerFrame;
+					bufferList.mBuffers[0].mDataByteSize	= bufferByteSize;
+					frameCount								= MIN(frameSize, segmentLength - segmentSampleCount);
+					
+					frameCount = [decoder readAudio:&bufferList frameCount:frameCount];
+					
+					if(0 == frameCount) {
+						inputFinished = YES;
+						break;
+					}
+					
+					deinterleaveAudio(&bufferList, frameCount, _sourceBitsPerChannel, [segment buffer], segmentSampleCount);
+					segmentSampleCount	+= frameCount;
+					samplesRead			+= frameCount;
+				}
+				
+				// Everything was already covered by the previous segment
+				if(segmentSampleCount == overlap)
+					break;
+				
+				[segment setSampleCount:segmentSampleCount];
+				
+				// The segment's audio is freed once it is encoded, so set aside what the next segment shares with it
+				carryStart	= (UInt32)(((segmentIndex + 1) * SEGMENT_FRAMES - JOIN_LEAD_FRAMES - firstFrame) * frameSize);
+				carryCount	= (carryStart < segmentSampleCount ? segmentSampleCount - carryStart : 0);
+				for(channel = 0; channel < pcmFormat.mChannelsPerFrame; ++channel) {
+					memcpy(carry[channel], [segment buffer][channel] + carryStart, carryCount * sizeof(long));
+				}
+				
+				[segments addObject:segment];
+				[queue addOperation:segment];
+				
+				++segmentIndex;
+			}
+			
+			if(0 == [segments count])
+				break;
+			
+			segment = [segments objectAtIndex:0];
+			[segment waitUntilFinished];
+			
+			if(nil != [segment exception])
+				@throw [segment exception];
+			
+			// Reserve space for the Xing/Info frame, which can't be completed until the whole stream is written
+			if(nil == tag) {
+				tag				= [NSMutableData dataWithLength:[segment tagLength]];
+				encoderDelay	= lame_get_encoder_delay([segment encoder]);
+				
+				if(0 < [tag length]) {
+					length = lame_get_lametag_frame([segment encoder], [tag mutableBytes], [tag length]);
+					NSAssert(length == [tag length], NSLocalizedStringFromTable(@"LAME encoding error.", @"Exceptions", @""));
+				}
+				
+				bytesWritten = fwrite([tag bytes], 1, [tag length], file);
+				NSAssert([tag length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+				
+				fileOffset = [tag length];
+			}
+			
+			lastFrame = [segment firstFrame] + [segment frameCount];
+			
+			// Find where the next segment takes over
+			if(1 < [segments count]) {
+				nextSegment = [segments objectAtIndex:1];
+				[nextSegment waitUntilFinished];
+				
+				if(nil != [nextSegment exception])
+					@throw [nextSegment exception];
+				
+				joinFrame = [nextSegment nominalFirstFrame];
+				NSAssert(joinFrame + JOIN_WINDOW_FRAMES <= lastFrame && joinFrame + JOIN_WINDOW_FRAMES <= [nextSegment firstFrame] + [nextSegment frameCount], NSLocalizedStringFromTable(@"LAME encoding error.", @"Exceptions", @""));
+				
+				// Join at the first frame whose reservoir fits in the space this segment set aside at that point
+				for(frame = joinFrame; frame < joinFrame + JOIN_WINDOW_FRAMES; ++frame) {
+					if([nextSegment mainDataBeginForFrame:frame] <= [segment mainDataBeginForFrame:frame])
+						break;
+				}
+				
+				// If none does, carry over as much as fits; only the start of the join frame's main data is lost
+				if(joinFrame + JOIN_WINDOW_FRAMES == frame)
+					++mismatchedJoins;
+				else
+					joinFrame = frame;
+				
+				mainDataBegin = MIN([nextSegment mainDataBeginForFrame:joinFrame], [segment mainDataBeginForFrame:joinFrame]);
+				
+				// The size of a seam is the part of the join frame's reservoir that didn't fit
+				droppedBytes	+= [nextSegment mainDataBeginForFrame:joinFrame] - mainDataBegin;
+				maxDroppedBytes	= MAX(maxDroppedBytes, [nextSegment mainDataBeginForFrame:joinFrame] - mainDataBegin);
+				
+				[nextSegment getMainData:reservoir length:mainDataBegin beforeFrame:joinFrame];
+				[segment replaceMainData:reservoir length:mainDataBegin beforeFrame:joinFrame];
+				
+				lastFrame = joinFrame;
+				++joins;
+			}
+			
+			for(frame = writeFrom; frame < lastFrame; ++frame) {
+				bytes = [segment bytesForFrame:frame length:&length];
+				
+				bytesWritten = fwrite(bytes, 1, length, file);
+				NSAssert(length == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+				
+				[frameOffsets appendBytes:&fileOffset length:sizeof(fileOffset)];
+				
+				fileOffset	+= length;
+				musicCRC	= updateCRC16(musicCRC, bytes, length);
+			}
+			
+			writeFrom = lastFrame;
+			[segments removeObjectAtIndex:0];
+			
+			// Each segment takes a while, so there is no need to limit the Distributed Object calls
+			if([[self delegate] shouldStop])
+				@throw [StopException exceptionWithReason:@"Stop requested by user" userInfo:nil];
+			
+			samplesEncoded		= MIN(totalFrames, (SInt64)writeFrom * frameSize);
+			percentComplete		= ((double)samplesEncoded/(double) totalFrames) * 100.0;
+			interval			= -1.0 * [startTime timeIntervalSinceNow];
+			secondsRemaining	= (unsigned) (interval / ((double)samplesEncoded/(double) totalFrames) - interval);
+			
+			[[self delegate] updateProgress:percentComplete secondsRemaining:secondsRemaining];
 		}
-	}
-	// Target is quality
-	else if(LAME_TARGET_QUALITY == [[settings objectForKey:@"target"] intValue]) {
-		lame_set_VBR(_gfp, LAME_VARIABLE_BITRATE_MODE_FAST == [[settings objectForKey:@"variableBitrateMode"] intValue] ? vbr_mtrh : vbr_rh);
-		lame_set_VBR_q(_gfp, (100 - [[settings objectForKey:@"VBRQuality"] intValue]) / 10);
-	}
-	else {
-		@throw [NSException exceptionWithName:@"NSInternalInconsistencyException" reason:@"Unrecognized LAME target" userInfo:nil];
+		
+		// Fill in the Xing/Info frame for the stream as a whole
+		if(0 < [tag length]) {
+			tagBytes		= [tag mutableBytes];
+			offsets			= [frameOffsets bytes];
+			audioFrames		= [frameOffsets length] / sizeof(uint64_t);
+			
+			parseFrameHeader(tagBytes, &sideInfoOffset, &mainDataOffset, &isMPEG1);
+			tagOffset		= mainDataOffset;
+			
+			if(0 == memcmp(tagBytes + tagOffset, "Xing", 4) || 0 == memcmp(tagBytes + tagOffset, "Info", 4)) {
+				flags		= OSReadBigInt32(tagBytes, tagOffset + 4);
+				tagOffset	+= 8;
+				
+				if(0x01 & flags) {
+					writeBigEndian(tagBytes + tagOffset, (uint32_t)audioFrames, 4);
+					tagOffset += 4;
+				}
+				
+				if(0x02 & flags) {
+					writeBigEndian(tagBytes + tagOffset, (uint32_t)fileOffset, 4);
+					tagOffset += 4;
+				}
+				
+				if(0x04 & flags) {
+					for(i = 0; i < 100 && 0 < audioFrames; ++i) {
+						tagBytes[tagOffset + i] = (uint8_t)MIN(255, (256 * offsets[(i * audioFrames) / 100]) / fileOffset);
+					}
+					tagOffset += 100;
+				}
+				
+				if(0x08 & flags) {
+					tagOffset += 4;
+				}
+				
+				// The LAME extension holds the encoder delay and padding used for gapless playback, and CRCs
+				if(tagOffset + LAME_TAG_LENGTH <= [tag length] && 0 == memcmp(tagBytes + tagOffset, "LAME", 4)) {
+					padding = MAX(0, MIN(0xFFF, (SInt64)audioFrames * frameSize - samplesRead - encoderDelay));
+					
+					tagBytes[tagOffset + 21]	= (uint8_t)(encoderDelay >> 4);
+					tagBytes[tagOffset + 22]	= (uint8_t)(((encoderDelay & 0x0F) << 4) | (padding >> 8));
+					tagBytes[tagOffset + 23]	= (uint8_t)(padding & 0xFF);
+					
+					writeBigEndian(tagBytes + tagOffset + 28, (uint32_t)fileOffset, 4);
+					writeBigEndian(tagBytes + tagOffset + 32, musicCRC, 2);
+					writeBigEndian(tagBytes + tagOffset + 34, updateCRC16(0, tagBytes, tagOffset + 34), 2);
+				}
+			}
+			
+			intResult = fseeko(file, 0, SEEK_SET);
+			NSAssert(-1 != intResult, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+			
+			bytesWritten = fwrite([tag bytes], 1, [tag length], file);
+			NSAssert([tag length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		}
+		
+		if(0 < mismatchedJoins) {
+			message = [NSString stringWithFormat:NSLocalizedStringFromTable(@"MP3: %u of %u segment joins could not carry over the bit reservoir (%u bytes of main data dropped, at most %u at one join)", @"Log", @""), mismatchedJoins, joins, droppedBytes, maxDroppedBytes];
+			[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
+		}
+		
+		[self logSamplesEncoded:samplesRead sampleRate:pcmFormat.mSampleRate threads:_threads sinceDate:startTime];
 	}
 	
-	if([[settings objectForKey:@"calculateReplayGain"] boolValue]) {
-		lame_set_findReplayGain(_gfp, 1);
+	@finally {
+		// Don't leave any segments running
+		[queue cancelAllOperations];
+		[queue waitUntilAllOperationsAreFinished];
+		
+		if(NULL != carry) {
+			for(channel = 0; channel < pcmFormat.mChannelsPerFrame; ++channel) {
+				free(carry[channel]);
+			}
+			free(carry),	carry = NULL;
+		}
+		
+		if(NULL != file) {
+			intResult = fclose(file);
+			if(0 != intResult)
+				NSLog(@"Unable to close the output file: %s", strerror(errno));
+		}
+		
+		free(bufferList.mBuffers[0].mData);
 	}
 }
 
@@ -502,4 +1281,16 @@ static int sLAMEBitrates [14] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192
 	}
 }
 
+- (void) logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime
+{
+	NSTimeInterval		interval		= -1.0 * [startTime timeIntervalSinceNow];
+	NSString			*message;
+	
+	if(0 >= interval || 0 >= sampleRate)
+		return;
+	
+	message = [NSString stringWithFormat:NSLocalizedStringFromTable(@"MP3: encoded %.2f seconds of audio in %.2f seconds using %u threads (%.1fx realtime)", @"Log", @""), samplesEncoded / sampleRate, interval, threads, (samplesEncoded / sampleRate) / interval];
+	[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
+}
+
 @end
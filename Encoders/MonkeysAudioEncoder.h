@@ -40,6 +40,7 @@ enum {
 	int						_compressionLevel;
 	UInt32					_sourceBitsPerChannel;
 	UInt32					_sourceBytesPerFrame;
+	unsigned				_threads;
 }
 
 @end
@@ -17,7 +17,6 @@
  *  along with this program; if not, write to the Free Software
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
-
 #import "MonkeysAudioEncoder.h"
 
 #include <mac/All.h>
@@ -31,24 +30,272 @@
 #include <AudioToolbox/AudioFile.h>
 #include <AudioToolbox/ExtendedAudioFile.h>
 
+#include <CommonCrypto/CommonDigest.h>
+
 #import "Decoder.h"
 #import "RegionDecoder.h"
 
+#import "LogController.h"
 #import "StopException.h"
 
 #import "UtilityFunctions.h"
 
+// Segments are joined using the file layout introduced in Monkey's Audio 3.98, 
+// which has a descriptor block and stores absolute offsets in the seek table
+#if defined(MAC_VERSION_NUMBER) && 3980 <= MAC_VERSION_NUMBER
+#  define PARALLEL_ENCODING_SUPPORTED	1
+#else
+#  define PARALLEL_ENCODING_SUPPORTED	0
+#endif
+
+// Parallel encoding splits the input into segments of about this many blocks (24 seconds at 44.1 kHz),
+// rounded to a whole number of frames
+#define SEGMENT_BLOCKS					(1 << 20)
+
+#define APE_DESCRIPTOR_LENGTH			52
+#define APE_HEADER_LENGTH				24
+
 @interface MonkeysAudioEncoder (Private)
 - (void)	parseSettings;
+- (void)	encodeSerially:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime;
+- (void)	encodeInParallel:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime;
 - (void)	compressChunk:(const AudioBufferList *)chunk frameCount:(UInt32)frameCount;
+- (void)	logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime;
+@end
+
+#pragma mark Utility functions
+
+// Convert MAC buffer to host endian byte order
+static void
+swapAudio(const AudioBufferList *chunk, UInt32 frameCount, UInt32 bitsPerChannel)
+{
+	uint16_t		*buffer16				= NULL;
+	uint32_t		*buffer32				= NULL;
+	unsigned		wideSample;
+	unsigned		sample, channel;
+	
+	switch(bitsPerChannel) {
+		
+		case 8:
+		case 24:
+			break;
+			
+		case 16:
+			buffer16 = (uint16_t *)chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer16[sample] = OSSwapBigToHostInt16(buffer16[sample]);
+				}
+			}
+			break;
+			
+		case 32:
+			buffer32 = (uint32_t *)chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer32[sample] = OSSwapBigToHostInt32(buffer32[sample]);
+				}
+			}
+			break;
+			
+		default:
+			@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
+			break;				
+	}
+}
+
+// The number of blocks (samples per channel) in each frame, which is fixed by the compression level
+static int
+blocksPerFrameForCompressionLevel(int compressionLevel)
+{
+	switch(compressionLevel) {
+		case COMPRESSION_LEVEL_EXTRA_HIGH:		return 73728 * 4;
+		case COMPRESSION_LEVEL_INSANE:			return 73728 * 16;
+		default:								return 73728;
+	}
+}
+
+#pragma mark MonkeysAudioSegment
+
+// A run of whole Monkey's Audio frames compressed by its own IAPECompress
+// The predictors are reset at the start of every frame, so the frames from each segment can be concatenated;
+// only the seek table and the headers describe the file as a whole
+@interface MonkeysAudioSegment : NSOperation
+{
+	WAVEFORMATEX		_format;
+	int					_compressionLevel;
+	
+	NSMutableData		*_audio;
+	
+	NSData				*_descriptor;
+	NSData				*_header;
+	NSData				*_headerData;
+	NSData				*_frameData;
+	NSMutableData		*_frameOffsets;
+	
+	NSException			*_exception;
+}
+
+- (id)					initWithFormat:(WAVEFORMATEX)format compressionLevel:(int)compressionLevel;
+
+// Host-endian PCM data, to be filled before the operation is queued
+- (NSMutableData *)		audio;
+
+// The pieces of the compressed file
+- (NSData *)			descriptor;
+- (NSData *)			header;
+- (NSData *)			headerData;
+- (NSData *)			frameData;
+
+- (uint32_t)			frameCount;
+- (uint32_t)			finalFrameBlocks;
+
+// The offset of each frame, relative to the start of the frame data
+- (const uint32_t *)	frameOffsets;
+
+- (NSException *)		exception;
+
+@end
+
+@implementation MonkeysAudioSegment
+
+- (id) initWithFormat:(WAVEFORMATEX)format compressionLevel:(int)compressionLevel
+{
+	if((self = [super init])) {
+		_format				= format;
+		_compressionLevel	= compressionLevel;
+		_audio				= [[NSMutableData alloc] init];
+		_frameOffsets		= [[NSMutableData alloc] init];
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_audio release],			_audio = nil;
+	[_descriptor release],		_descriptor = nil;
+	[_header release],			_header = nil;
+	[_headerData release],		_headerData = nil;
+	[_frameData release],		_frameData = nil;
+	[_frameOffsets release],	_frameOffsets = nil;
+	[_exception release],		_exception = nil;
+	
+	[super dealloc];
+}
+
+- (NSMutableData *)		audio						{ return [[_audio retain] autorelease]; }
+
+- (NSData *)			descriptor					{ return [[_descriptor retain] autorelease]; }
+- (NSData *)			header						{ return [[_header retain] autorelease]; }
+- (NSData *)			headerData					{ return [[_headerData retain] autorelease]; }
+- (NSData *)			frameData					{ return [[_frameData retain] autorelease]; }
+
+- (uint32_t)			frameCount					{ return OSReadLittleInt32([_header bytes], 12); }
+- (uint32_t)			finalFrameBlocks			{ return OSReadLittleInt32([_header bytes], 8); }
+
+- (const uint32_t *)	frameOffsets				{ return (const uint32_t *)[_frameOffsets bytes]; }
+
+- (NSException *)		exception					{ return [[_exception retain] autorelease]; }
+
+- (void) main
+{
+	NSAutoreleasePool		*pool				= [[NSAutoreleasePool alloc] init];
+	IAPECompress			*compressor			= NULL;
+	NSString				*filename			= nil;
+	str_utf16				*chars				= NULL;
+	NSData					*file				= nil;
+	const uint8_t			*bytes;
+	uint32_t				descriptorLength, headerLength, seekTableLength, headerDataLength, frameDataLength;
+	uint32_t				frameDataOffset, frameCount, frameOffset, i;
+	int						result;
+	
+	@try {
+		// IAPECompress builds the header and seek table in place, so it needs a real file
+		filename	= generateTemporaryFilename(nil, @"ape");
+		chars		= GetUTF16FromANSI([filename fileSystemRepresentation]);
+		NSAssert(NULL != chars, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		compressor = CreateIAPECompress();
+		NSAssert(NULL != compressor, NSLocalizedStringFromTable(@"Unable to create the Monkey's Audio compressor.", @"Exceptions", @""));
+		
+		result = compressor->Start(chars, &_format, [_audio length], _compressionLevel, NULL, 0);
+		NSAssert(ERROR_SUCCESS == result, NSLocalizedStringFromTable(@"Unable to start the Monkey's Audio compressor.", @"Exceptions", @""));
+		
+		result = compressor->AddData((unsigned char *)[_audio mutableBytes], [_audio length]);
+		NSAssert(ERROR_SUCCESS == result, NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+		
+		result = compressor->Finish(NULL, 0, 0);
+		NSAssert(ERROR_SUCCESS == result, NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+		
+		delete compressor, compressor = NULL;
+		
+		// The input isn't needed any longer
+		[_audio setLength:0];
+		
+		// Split the file into its parts
+		file	= [NSData dataWithContentsOfFile:filename];
+		bytes	= (const uint8_t *)[file bytes];
+		
+		NSAssert(APE_DESCRIPTOR_LENGTH <= [file length] && 0 == memcmp(bytes, "MAC ", 4) && 3980 <= OSReadLittleInt16(bytes, 4), NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+		
+		descriptorLength	= OSReadLittleInt32(bytes, 8);
+		headerLength		= OSReadLittleInt32(bytes, 12);
+		seekTableLength		= OSReadLittleInt32(bytes, 16);
+		headerDataLength	= OSReadLittleInt32(bytes, 20);
+		frameDataLength		= OSReadLittleInt32(bytes, 24);
+		frameDataOffset		= descriptorLength + headerLength + seekTableLength + headerDataLength;
+		
+		NSAssert(APE_HEADER_LENGTH <= headerLength && 0 == OSReadLittleInt32(bytes, 28) && frameDataOffset + frameDataLength <= [file length], NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+		
+		_descriptor		= [[file subdataWithRange:NSMakeRange(0, descriptorLength)] retain];
+		_header			= [[file subdataWithRange:NSMakeRange(descriptorLength, headerLength)] retain];
+		_headerData		= [[file subdataWithRange:NSMakeRange(descriptorLength + headerLength + seekTableLength, headerDataLength)] retain];
+		_frameData		= [[file subdataWithRange:NSMakeRange(frameDataOffset, frameDataLength)] retain];
+		
+		NSAssert((uint32_t)blocksPerFrameForCompressionLevel(_compressionLevel) == OSReadLittleInt32([_header bytes], 4), NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+		
+		frameCount = [self frameCount];
+		NSAssert(4 * frameCount <= seekTableLength, NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+		
+		for(i = 0; i < frameCount; ++i) {
+			frameOffset = OSReadLittleInt32(bytes, descriptorLength + headerLength + (4 * i)) - frameDataOffset;
+			[_frameOffsets appendBytes:&frameOffset length:sizeof(frameOffset)];
+		}
+	}
+	
+	@catch(NSException *exception) {
+		_exception = [exception retain];
+	}
+	
+	@finally {
+		if(NULL != compressor) {
+			delete compressor;
+		}
+		
+		free(chars);
+		
+		if(nil != filename) {
+			[[NSFileManager defaultManager] removeFileAtPath:filename handler:nil];
+		}
+		
+		[pool release];
+	}
+}
+
 @end
 
+#pragma mark MonkeysAudioEncoder
+
 @implementation MonkeysAudioEncoder
 
 - (id) init
 {	
 	if((self = [super init])) {
 		_compressionLevel	= COMPRESSION_LEVEL_NORMAL;
+		_threads			= 1;
 	}
 	
 	return self;
@@ -57,22 +304,12 @@
 - (oneway void) encodeToFile:(NSString *)filename
 {
 	NSDate							*startTime					= [NSDate date];
-	unsigned long					iterations					= 0;
-	AudioBufferList					bufferList;
-	ssize_t							bufferLen					= 0;
-	UInt32							bufferByteSize				= 0;
-	WAVEFORMATEX					formatDesc;
-	str_utf16						*chars						= NULL;
-	int								result;
-	SInt64							totalFrames, framesToRead;
+	id <DecoderMethods>				decoder						= nil;
+	NSString						*sourceFilename				= nil;
+	SInt64							startingFrame;
 	UInt32							frameCount;
-	double							percentComplete;
-	NSTimeInterval					interval;
-	unsigned						secondsRemaining;
 	
 	@try {
-		bufferList.mBuffers[0].mData = NULL;
-
 		// Parse the encoder settings
 		[self parseSettings];
 
@@ -81,20 +318,92 @@
 		[[self delegate] setStarted:YES];
 		
 		// Setup the decoder
-		id <DecoderMethods> decoder = nil;
-		NSString *sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
+		sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
 		
 		// Create the appropriate kind of decoder
 		if(nil != [[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"]) {
-			SInt64 startingFrame = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
-			UInt32 frameCount = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
-			decoder = [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
+			startingFrame	= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
+			frameCount		= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
+			decoder			= [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
 		}
 		else
 			decoder = [Decoder decoderWithFilename:sourceFilename];
 		
 		_sourceBitsPerChannel	= [decoder pcmFormat].mBitsPerChannel;
 		_sourceBytesPerFrame	= [decoder pcmFormat].mBytesPerFrame;
+		
+		// Frame data sizes are limited to 32 bits
+		if(PARALLEL_ENCODING_SUPPORTED && 1 < _threads 
+		   && (SInt64)(2 * SEGMENT_BLOCKS) < [decoder totalFrames] 
+		   && UINT32_MAX > [decoder totalFrames] * _sourceBytesPerFrame)
+			[self encodeInParallel:decoder toFile:filename startTime:startTime];
+		else
+			[self encodeSerially:decoder toFile:filename startTime:startTime];
+	}
+	
+	@catch(StopException *exception) {
+		[[self delegate] setStopped:YES];
+	}
+	
+	@catch(NSException *exception) {
+		[[self delegate] setException:exception];
+		[[self delegate] setStopped:YES];
+	}
+	
+	[[self delegate] setEndTime:[NSDate date]];
+	[[self delegate] setCompleted:YES];	
+}
+
++ (NSString *) libraryVersion
+{
+	return [NSString stringWithFormat:@"Monkey's Audio %s", MAC_VERSION_STRING];
+}
+
+- (NSString *) settingsString
+{
+	return [NSString stringWithFormat:@"MAC settings: compression level:%i", _compressionLevel];
+}
+
+@end
+
+@implementation MonkeysAudioEncoder (Private)
+
+- (void) parseSettings
+{
+	NSDictionary	*settings	= [[self delegate] encoderSettings];
+	int				level		= 0;
+	
+	level = [[settings objectForKey:@"compressionLevel"] intValue];
+	switch(level) {
+		case MAC_COMPRESSION_LEVEL_FAST:		_compressionLevel = COMPRESSION_LEVEL_FAST;				break;
+		case MAC_COMPRESSION_LEVEL_NORMAL:		_compressionLevel = COMPRESSION_LEVEL_NORMAL;			break;
+		case MAC_COMPRESSION_LEVEL_HIGH:		_compressionLevel = COMPRESSION_LEVEL_HIGH;				break;
+		case MAC_COMPRESSION_LEVEL_EXTRA_HIGH:	_compressionLevel = COMPRESSION_LEVEL_EXTRA_HIGH;		break;
+		case MAC_COMPRESSION_LEVEL_INSANE:		_compressionLevel = COMPRESSION_LEVEL_INSANE;			break;
+		default:								_compressionLevel = COMPRESSION_LEVEL_NORMAL;			break;
+	}
+	
+	_threads = getEncoderThreadCount(settings);
+}
+
+- (void) encodeSerially:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime
+{
+	unsigned long					iterations					= 0;
+	AudioBufferList					bufferList;
+	ssize_t							bufferLen					= 0;
+	UInt32							bufferByteSize				= 0;
+	WAVEFORMATEX					formatDesc;
+	str_utf16						*chars						= NULL;
+	int								result;
+	SInt64							totalFrames, framesToRead;
+	UInt32							frameCount;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
+	
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
+
 		totalFrames				= [decoder totalFrames];
 		framesToRead			= totalFrames;
 		
@@ -188,112 +497,249 @@
 		
 		// Finish up the compression process
 		_compressor->Finish(NULL, 0, 0);
-	}
-	
-	
-	@catch(StopException *exception) {
-		[[self delegate] setStopped:YES];
-	}
-	
-	@catch(NSException *exception) {
-		[[self delegate] setException:exception];
-		[[self delegate] setStopped:YES];
+		
+		[self logSamplesEncoded:(totalFrames - framesToRead) sampleRate:[decoder pcmFormat].mSampleRate threads:1 sinceDate:startTime];
 	}
 	
 	@finally {
 		if(NULL != _compressor) {
 			delete _compressor;
+			_compressor = NULL;
 		}
 				
 		free(bufferList.mBuffers[0].mData);
 		free(chars);
 	}	
-
-	[[self delegate] setEndTime:[NSDate date]];
-	[[self delegate] setCompleted:YES];	
 }
 
-- (NSString *) settingsString
+- (void) encodeInParallel:(id <DecoderMethods>)decoder toFile:(NSString *)filename startTime:(NSDate *)startTime
 {
-	return [NSString stringWithFormat:@"MAC settings: compression level:%i", _compressionLevel];
-}
-
-@end
-
-@implementation MonkeysAudioEncoder (Private)
-
-- (void) parseSettings
-{
-	NSDictionary	*settings	= [[self delegate] encoderSettings];
-	int				level		= 0;
-	
-	level = [[settings objectForKey:@"compressionLevel"] intValue];
-	switch(level) {
-		case MAC_COMPRESSION_LEVEL_FAST:		_compressionLevel = COMPRESSION_LEVEL_FAST;				break;
-		case MAC_COMPRESSION_LEVEL_NORMAL:		_compressionLevel = COMPRESSION_LEVEL_NORMAL;			break;
-		case MAC_COMPRESSION_LEVEL_HIGH:		_compressionLevel = COMPRESSION_LEVEL_HIGH;				break;
-		case MAC_COMPRESSION_LEVEL_EXTRA_HIGH:	_compressionLevel = COMPRESSION_LEVEL_EXTRA_HIGH;		break;
-		case MAC_COMPRESSION_LEVEL_INSANE:		_compressionLevel = COMPRESSION_LEVEL_INSANE;			break;
-		default:								_compressionLevel = COMPRESSION_LEVEL_NORMAL;			break;
-	}
-}
-
-- (void) compressChunk:(const AudioBufferList *)chunk frameCount:(UInt32)frameCount;
-{
-	//	uint8_t			*buffer8				= NULL;
-	uint16_t		*buffer16				= NULL;
-	uint32_t		*buffer32				= NULL;
-	unsigned		wideSample;
-	unsigned		sample, channel;
-	int				result;
+	AudioStreamBasicDescription		pcmFormat				= [decoder pcmFormat];
+	WAVEFORMATEX					formatDesc;
+	NSOperationQueue				*queue					= nil;
+	NSMutableArray					*segments				= nil;
+	MonkeysAudioSegment				*segment				= nil;
+	AudioBufferList					bufferList;
+	UInt32							bufferByteSize;
+	UInt32							blocksPerFrame			= blocksPerFrameForCompressionLevel(_compressionLevel);
+	UInt32							segmentBlocks			= MAX(1, SEGMENT_BLOCKS / blocksPerFrame) * blocksPerFrame;
+	UInt32							segmentBlockCount;
+	UInt32							frameCount;
+	BOOL							inputFinished			= NO;
+	SInt64							totalFrames				= [decoder totalFrames];
+	SInt64							samplesEncoded			= 0;
+	uint32_t						audioBytes				= (uint32_t)(totalFrames * pcmFormat.mBytesPerFrame);
+	NSMutableData					*descriptor				= nil;
+	NSMutableData					*header					= nil;
+	NSMutableData					*seekTable				= nil;
+	NSMutableData					*headerData				= nil;
+	uint32_t						maxFrames				= (uint32_t)((totalFrames + blocksPerFrame - 1) / blocksPerFrame) + 1;
+	uint32_t						apeFrames				= 0;
+	uint32_t						finalFrameBlocks		= 0;
+	uint32_t						frameDataOffset			= 0;
+	uint32_t						frameDataLength			= 0;
+	uint32_t						i;
+	uint8_t							padding					[ 4 ]	= { 0, 0, 0, 0 };
+	uint8_t							*riff;
+	CC_MD5_CTX						md5;
+	FILE							*file					= NULL;
+	size_t							bytesWritten;
+	int								result;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
 	
-	// Convert MAC buffer to host endian byte order
-	switch(_sourceBitsPerChannel) {
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
 		
-		case 8:
-			/*			buffer8 = (uint8_t *)chunk->mBuffers[0].mData;
-			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-					buffer8[sample] = buffer8[sample];
-				}
-			}*/
-			break;
+		result = FillWaveFormatEx(&formatDesc, (int)pcmFormat.mSampleRate, pcmFormat.mBitsPerChannel, pcmFormat.mChannelsPerFrame);
+		NSAssert(ERROR_SUCCESS == result, NSLocalizedStringFromTable(@"Unable to initialize the Monkey's Audio compressor.", @"Exceptions", @""));
+		
+		// Read 1024 frames at a time
+		bufferByteSize								= 1024 * pcmFormat.mBytesPerFrame;
+		bufferList.mNumberBuffers					= 1;
+		bufferList.mBuffers[0].mData				= calloc(bufferByteSize, sizeof(uint8_t));
+		NSAssert(NULL != bufferList.mBuffers[0].mData, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		file = fopen([filename fileSystemRepresentation], "w");
+		NSAssert(NULL != file, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
+		
+		seekTable	= [NSMutableData dataWithLength:4 * maxFrames];
+		queue		= [[[NSOperationQueue alloc] init] autorelease];
+		segments	= [NSMutableArray array];
+		
+		[queue setMaxConcurrentOperationCount:_threads];
+		
+		for(;;) {
 			
-		case 16:
-			buffer16 = (uint16_t *)chunk->mBuffers[0].mData;
-			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-					buffer16[sample] = OSSwapBigToHostInt16(buffer16[sample]);
+			// Keep a segment waiting for each thread
+			while(NO == inputFinished && [segments count] < 2 * _threads) {
+				segment				= [[[MonkeysAudioSegment alloc] initWithFormat:formatDesc compressionLevel:_compressionLevel] autorelease];
+				segmentBlockCount	= 0;
+				
+				while(segmentBlockCount < segmentBlocks) {
+					bufferList.mBuffers[0].mNumberChannels	= pcmFormat.mChannelsPerFrame;
+					bufferList.mBuffers[0].mDataByteSize	= bufferByteSize;
+					frameCount								= MIN(1024, segmentBlocks - segmentBlockCount);
+					
+					frameCount = [decoder readAudio:&bufferList frameCount:frameCount];
+					
+					if(0 == frameCount) {
+						inputFinished = YES;
+						break;
+					}
+					
+					swapAudio(&bufferList, frameCount, _sourceBitsPerChannel);
+					[[segment audio] appendBytes:bufferList.mBuffers[0].mData length:frameCount * _sourceBytesPerFrame];
+					segmentBlockCount += frameCount;
 				}
+				
+				if(0 == segmentBlockCount)
+					break;
+				
+				[segments addObject:segment];
+				[queue addOperation:segment];
 			}
+			
+			if(0 == [segments count])
 				break;
 			
-		case 24:
-			/*			buffer8 = (uint8_t *)chunk->mBuffers[0].mData;
-			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-					buffer8[sample] = buffer8[sample];
-				}
-			}*/
-			break;
+			segment = [segments objectAtIndex:0];
+			[segment waitUntilFinished];
 			
-		case 32:
-			buffer32 = (uint32_t *)chunk->mBuffers[0].mData;
-			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
-					buffer32[sample] = OSSwapBigToHostInt32(buffer32[sample]);
+			if(nil != [segment exception])
+				@throw [segment exception];
+			
+			// The first segment supplies the headers; leave room for them and the whole seek table
+			if(nil == descriptor) {
+				descriptor	= [[[segment descriptor] mutableCopy] autorelease];
+				header		= [[[segment header] mutableCopy] autorelease];
+				headerData	= [[[segment headerData] mutableCopy] autorelease];
+				
+				// Make the WAV header describe all the audio, as IAPECompress does when given the total up front
+				riff = (uint8_t *)[headerData mutableBytes];
+				if(44 <= [headerData length] && 0 == memcmp(riff, "RIFF", 4) && 0 == memcmp(riff + 36, "data", 4)) {
+					OSWriteLittleInt32(riff, 4, audioBytes + (uint32_t)[headerData length] - 8);
+					OSWriteLittleInt32(riff, 40, audioBytes);
 				}
+				
+				frameDataOffset = (uint32_t)([descriptor length] + [header length] + [seekTable length] + [headerData length]);
+				
+				result = fseeko(file, frameDataOffset - [headerData length], SEEK_SET);
+				NSAssert(-1 != result, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+				
+				bytesWritten = fwrite([headerData bytes], 1, [headerData length], file);
+				NSAssert([headerData length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+				
+				// The file's MD5 covers the WAV header, the frame data, the APE header and the seek table, in that order
+				CC_MD5_Init(&md5);
+				CC_MD5_Update(&md5, [headerData bytes], [headerData length]);
 			}
-				break;
 			
-		default:
-			@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
-			break;				
+			// Every frame but the last must be full
+			NSAssert(0 == finalFrameBlocks || blocksPerFrame == finalFrameBlocks, NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+			NSAssert(apeFrames + [segment frameCount] <= maxFrames, NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
+			
+			for(i = 0; i < [segment frameCount]; ++i) {
+				OSWriteLittleInt32([seekTable mutableBytes], 4 * (apeFrames + i), frameDataOffset + frameDataLength + [segment frameOffsets][i]);
+			}
+			
+			apeFrames			+= [segment frameCount];
+			finalFrameBlocks	= [segment finalFrameBlocks];
+			
+			bytesWritten = fwrite([[segment frameData] bytes], 1, [[segment frameData] length], file);
+			NSAssert([[segment frameData] length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+			
+			CC_MD5_Update(&md5, [[segment frameData] bytes], [[segment frameData] length]);
+			frameDataLength += [[segment frameData] length];
+			
+			// Frames are read as 32-bit words, so each segment has to start on a word boundary
+			if(0 != frameDataLength % 4 && 1 < [segments count]) {
+				bytesWritten = fwrite(padding, 1, 4 - (frameDataLength % 4), file);
+				NSAssert(4 - (frameDataLength % 4) == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+				
+				CC_MD5_Update(&md5, padding, 4 - (frameDataLength % 4));
+				frameDataLength += 4 - (frameDataLength % 4);
+			}
+			
+			samplesEncoded += ([segment frameCount] - 1) * blocksPerFrame + [segment finalFrameBlocks];
+			[segments removeObjectAtIndex:0];
+			
+			// Each segment takes a while, so there is no need to limit the Distributed Object calls
+			if([[self delegate] shouldStop])
+				@throw [StopException exceptionWithReason:@"Stop requested by user" userInfo:nil];
+			
+			percentComplete		= ((double)samplesEncoded/(double) totalFrames) * 100.0;
+			interval			= -1.0 * [startTime timeIntervalSinceNow];
+			secondsRemaining	= (unsigned) (interval / ((double)samplesEncoded/(double) totalFrames) - interval);
+			
+			[[self delegate] updateProgress:percentComplete secondsRemaining:secondsRemaining];
+		}
+		
+		// Now that everything is known, fill in the headers
+		OSWriteLittleInt32([header mutableBytes], 8, finalFrameBlocks);
+		OSWriteLittleInt32([header mutableBytes], 12, apeFrames);
+		
+		OSWriteLittleInt32([descriptor mutableBytes], 16, (uint32_t)[seekTable length]);
+		OSWriteLittleInt32([descriptor mutableBytes], 24, frameDataLength);
+		OSWriteLittleInt32([descriptor mutableBytes], 28, 0);
+		OSWriteLittleInt32([descriptor mutableBytes], 32, 0);
+		
+		CC_MD5_Update(&md5, [header bytes], [header length]);
+		CC_MD5_Update(&md5, [seekTable bytes], [seekTable length]);
+		CC_MD5_Final((unsigned char *)[descriptor mutableBytes] + 36, &md5);
+		
+		result = fseeko(file, 0, SEEK_SET);
+		NSAssert(-1 != result, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		bytesWritten = fwrite([descriptor bytes], 1, [descriptor length], file);
+		NSAssert([descriptor length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		bytesWritten = fwrite([header bytes], 1, [header length], file);
+		NSAssert([header length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		bytesWritten = fwrite([seekTable bytes], 1, [seekTable length], file);
+		NSAssert([seekTable length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+		
+		[self logSamplesEncoded:samplesEncoded sampleRate:pcmFormat.mSampleRate threads:_threads sinceDate:startTime];
+	}
+	
+	@finally {
+		// Don't leave any segments running
+		[queue cancelAllOperations];
+		[queue waitUntilAllOperationsAreFinished];
+		
+		if(NULL != file) {
+			result = fclose(file);
+			if(0 != result)
+				NSLog(@"Unable to close the output file: %s", strerror(errno));
+		}
+		
+		free(bufferList.mBuffers[0].mData);
 	}
+}
+
+- (void) compressChunk:(const AudioBufferList *)chunk frameCount:(UInt32)frameCount;
+{
+	int				result;
+	
+	swapAudio(chunk, frameCount, _sourceBitsPerChannel);
 	
 	// Compress the chunk
 	result = _compressor->AddData((unsigned char *)chunk->mBuffers[0].mData, frameCount * _sourceBytesPerFrame);
 	NSAssert(ERROR_SUCCESS == result, NSLocalizedStringFromTable(@"Monkey's Audio compressor error.", @"Exceptions", @""));
 }	
 
+- (void) logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime
+{
+	NSTimeInterval		interval		= -1.0 * [startTime timeIntervalSinceNow];
+	NSString			*message;
+	
+	if(0 >= interval || 0 >= sampleRate)
+		return;
+	
+	message = [NSString stringWithFormat:NSLocalizedStringFromTable(@"Monkey's Audio: encoded %.2f seconds of audio in %.2f seconds using %u threads (%.1fx realtime)", @"Log", @""), samplesEncoded / sampleRate, interval, threads, (samplesEncoded / sampleRate) / interval];
+	[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
+}
+
 @end
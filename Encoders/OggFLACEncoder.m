@@ -263,6 +263,11 @@
 	[[self delegate] setCompleted:YES];
 }
 
++ (NSString *) libraryVersion
+{
+	return [NSString stringWithFormat:@"FLAC %s", FLAC__VERSION_STRING];
+}
+
 - (NSString *) settingsString
 {
 	return [NSString stringWithFormat:@"FLAC settings: exhaustiveModelSearch:%i midSideStereo:%i looseMidSideStereo:%i QLPCoeffPrecision:%i, minResidualPartitionOrder:%i, maxResidualPartitionOrder:%i, maxLPCOrder:%i", 
@@ -611,6 +611,14 @@ static void comment_add(char **comments, int *length, const char *tag, const cha
 	[[self delegate] setCompleted:YES];	
 }
 
++ (NSString *) libraryVersion
+{
+	const char		*speexVersion		= NULL;
+	
+	speex_lib_ctl(SPEEX_LIB_GET_VERSION_STRING, &speexVersion);
+	return (NULL != speexVersion ? [NSString stringWithCString:speexVersion encoding:NSASCIIStringEncoding] : nil);
+}
+
 - (NSString *) settingsString
 {
 	switch(_target) {
@@ -341,6 +341,11 @@ static int sVorbisBitrates [14] = { 48, 56, 64, 80, 96, 112, 128, 160, 192, 224,
 	[[self delegate] setCompleted:YES];
 }
 
++ (NSString *) libraryVersion
+{
+	return [NSString stringWithCString:vorbis_version_string() encoding:NSASCIIStringEncoding];
+}
+
 - (NSString *) settingsString
 {
 	switch(_mode) {
@@ -43,6 +43,7 @@ enum {
 	int				_flags;
 	float			_noiseShaping;
 	float			_bitrate;
+	unsigned		_threads;
 }
 
 @end
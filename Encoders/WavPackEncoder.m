@@ -17,7 +17,6 @@
  *  along with this program; if not, write to the Free Software
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
-
 #import "WavPackEncoder.h"
 
 #include <CoreAudio/CoreAudioTypes.h>
@@ -31,57 +30,263 @@
 #import "Decoder.h"
 #import "RegionDecoder.h"
 
+#import "LogController.h"
 #import "UtilityFunctions.h"
 #import "StopException.h"
 
+// Parallel encoding splits the input into segments of this many samples (about 24 seconds at 44.1 kHz)
+#define SEGMENT_SAMPLES					(1 << 20)
+
+#define WAVPACK_BLOCK_HEADER_LENGTH		32
+
 // WavPack IO wrapper
 static int writeWavPackBlock(void *wv_id, void *data, int32_t bcount)			
 {
 	return (bcount == write((int)wv_id, data, bcount));
 }
 
+// Used by the segments, which hold their blocks in memory until they can be written in order
+static int appendWavPackBlock(void *wv_id, void *data, int32_t bcount)			
+{
+	[(NSMutableData *)wv_id appendBytes:data length:bcount];
+	return TRUE;
+}
+
 @interface WavPackEncoder (Private)
 - (void)	parseSettings;
+- (void)	setupConfiguration:(WavpackConfig *)config pcmFormat:(AudioStreamBasicDescription)pcmFormat;
+- (void)	encodeSerially:(id <DecoderMethods>)decoder outputFile:(int)fd correctionFile:(int)cfd startTime:(NSDate *)startTime;
+- (void)	encodeInParallel:(id <DecoderMethods>)decoder outputFile:(int)fd correctionFile:(int)cfd startTime:(NSDate *)startTime;
+- (void)	logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime;
 @end
 
-@implementation WavPackEncoder
+#pragma mark Utility functions
 
-- (oneway void) encodeToFile:(NSString *) filename
+// Convert big-endian PCM data to the interleaved, host-endian 32-bit samples WavPack expects
+static void
+convertAudio(const AudioBufferList *chunk, UInt32 frameCount, UInt32 bitsPerChannel, int32_t *buffer)
 {
-	NSDate							*startTime							= [NSDate date];
-
-	AudioBufferList					bufferList;
-	ssize_t							bufferLen							= 0;
-	UInt32							bufferByteSize						= 0;
+	const int8_t	*buffer8				= NULL;
+	const int16_t	*buffer16				= NULL;
+	const int32_t	*buffer32				= NULL;
+	int32_t			constructedSample;
+	unsigned		wideSample;
+	unsigned		sample, channel;
+	
+	switch(bitsPerChannel) {
+			
+		case 8:
+			buffer8 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[sample] = (int32_t)buffer8[sample];
+				}
+			}
+			break;
+			
+		case 16:
+			buffer16 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[sample] = (int32_t)(int16_t)OSSwapBigToHostInt16(buffer16[sample]);
+				}
+			}
+			break;
+			
+		case 24:
+			buffer8 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					constructedSample = (int8_t)*buffer8++; constructedSample <<= 8;
+					constructedSample |= (uint8_t)*buffer8++; constructedSample <<= 8;
+					constructedSample |= (uint8_t)*buffer8++;
+					
+					buffer[sample] = constructedSample;
+				}
+			}
+			break;
+			
+		case 32:
+			buffer32 = chunk->mBuffers[0].mData;
+			for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
+				for(channel = 0; channel < chunk->mBuffers[0].mNumberChannels; ++channel, ++sample) {
+					buffer[sample] = (int32_t)OSSwapBigToHostInt32(buffer32[sample]);
+				}
+			}
+			break;
+			
+		default:
+			@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
+			break;
+	}
+}
 
-	int8_t							*buffer8							= NULL;
-	int16_t							*buffer16							= NULL;
-	int32_t							*buffer32							= NULL;
-	int32_t							*wpBuf								= NULL;
+// Every block carries the stream's total sample count and the index of its first sample; a segment's blocks
+// are numbered from zero, so move them to the segment's position in the stream and write them out
+static void
+writeSegmentBlocks(int fd, NSMutableData *blocks, uint32_t firstSample, uint32_t totalSamples)
+{
+	uint8_t		*block		= [blocks mutableBytes];
+	uint8_t		*end		= block + [blocks length];
+	uint32_t	blockLength;
+	ssize_t		bytesWritten;
 	
-	SInt64							totalFrames, framesToRead;
-	UInt32							frameCount;
+	while(block + WAVPACK_BLOCK_HEADER_LENGTH <= end) {
+		NSCAssert(0 == memcmp(block, "wvpk", 4), NSLocalizedStringFromTable(@"WavPack encoding error.", @"Exceptions", @""));
 		
-	int								fd, cfd;
-	int								result;
-    
-	WavpackContext					*wpc								= NULL;
-	WavpackConfig					config;
+		blockLength = OSReadLittleInt32(block, 4) + 8;
+		NSCAssert(block + blockLength <= end, NSLocalizedStringFromTable(@"WavPack encoding error.", @"Exceptions", @""));
+		
+		OSWriteLittleInt32(block, 12, totalSamples);
+		OSWriteLittleInt32(block, 16, OSReadLittleInt32(block, 16) + firstSample);
+		
+		block += blockLength;
+	}
 	
-	unsigned long					iterations							= 0;
+	bytesWritten = write(fd, [blocks bytes], [blocks length]);
+	NSCAssert((ssize_t)[blocks length] == bytesWritten, NSLocalizedStringFromTable(@"Unable to write to the output file.", @"Exceptions", @""));
+}
+
+#pragma mark WavPackSegment
+
+// A run of WavPack blocks packed by its own WavpackContext
+// WavPack blocks can be decoded independently, so the blocks from each segment only need renumbering
+@interface WavPackSegment : NSOperation
+{
+	WavpackConfig		_config;
+	
+	int32_t				*_buffer;
+	UInt32				_sampleCount;
+	uint32_t			_firstSample;
+	
+	NSMutableData		*_blocks;
+	NSMutableData		*_correctionBlocks;
+	
+	NSException			*_exception;
+}
 
-	int32_t							constructedSample;
+- (id)					initWithConfiguration:(WavpackConfig)config sampleCapacity:(UInt32)sampleCapacity firstSample:(uint32_t)firstSample;
 
-	unsigned						wideSample, sample, channel;
+// Interleaved sample buffer, to be filled before the operation is queued
+- (int32_t *)			buffer;
 
-	double							percentComplete;
-	NSTimeInterval					interval;
-	unsigned						secondsRemaining;
+- (UInt32)				sampleCount;
+- (void)				setSampleCount:(UInt32)sampleCount;
+
+- (uint32_t)			firstSample;
+
+// The packed blocks for the main file and the correction file
+- (NSMutableData *)		blocks;
+- (NSMutableData *)		correctionBlocks;
+
+- (NSException *)		exception;
+
+@end
+
+@implementation WavPackSegment
+
+- (id) initWithConfiguration:(WavpackConfig)config sampleCapacity:(UInt32)sampleCapacity firstSample:(uint32_t)firstSample
+{
+	if((self = [super init])) {
+		_config				= config;
+		_firstSample		= firstSample;
+		
+		_blocks				= [[NSMutableData alloc] init];
+		_correctionBlocks	= [[NSMutableData alloc] init];
+		
+		_buffer				= calloc(sampleCapacity * _config.num_channels, sizeof(int32_t));
+		NSAssert(NULL != _buffer, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	free(_buffer),					_buffer = NULL;
 	
+	[_blocks release],				_blocks = nil;
+	[_correctionBlocks release],	_correctionBlocks = nil;
+	[_exception release],			_exception = nil;
+	
+	[super dealloc];
+}
+
+- (int32_t *)			buffer									{ return _buffer; }
+
+- (UInt32)				sampleCount								{ return _sampleCount; }
+- (void)				setSampleCount:(UInt32)sampleCount		{ _sampleCount = sampleCount; }
+
+- (uint32_t)			firstSample								{ return _firstSample; }
+
+- (NSMutableData *)		blocks									{ return [[_blocks retain] autorelease]; }
+- (NSMutableData *)		correctionBlocks						{ return [[_correctionBlocks retain] autorelease]; }
+
+- (NSException *)		exception								{ return [[_exception retain] autorelease]; }
+
+- (void) main
+{
+	NSAutoreleasePool		*pool		= [[NSAutoreleasePool alloc] init];
+	WavpackContext			*wpc		= NULL;
+	int						result;
 	
 	@try {
-		bufferList.mBuffers[0].mData = NULL;
+		wpc = WavpackOpenFileOutput(appendWavPackBlock, _blocks, (_config.flags & CONFIG_CREATE_WVC ? _correctionBlocks : NULL));
+		NSAssert(NULL != wpc, NSLocalizedStringFromTable(@"Unable to create the WavPack encoder.", @"Exceptions", @""));
+		
+		result = WavpackSetConfiguration(wpc, &_config, _sampleCount);
+		NSAssert(FALSE != result, NSLocalizedStringFromTable(@"Unable to initialize the WavPack encoder.", @"Exceptions", @""));
+		
+		WavpackPackInit(wpc);
+		
+		result = WavpackPackSamples(wpc, _buffer, _sampleCount);
+		NSAssert1(FALSE != result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"WavpackPackSamples");
+		
+		result = WavpackFlushSamples(wpc);
+		NSAssert1(FALSE != result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"WavpackFlushSamples");		
+	}
+	
+	@catch(NSException *exception) {
+		_exception = [exception retain];
+	}
+	
+	@finally {
+		if(NULL != wpc) {
+			WavpackCloseFile(wpc);
+		}
+		
+		[pool release];
+	}
+}
+
+@end
 
+#pragma mark WavPackEncoder
+
+@implementation WavPackEncoder
+
+- (id) init
+{
+	if((self = [super init])) {
+		_threads	= 1;
+	}
+	
+	return self;
+}
+
+- (oneway void) encodeToFile:(NSString *) filename
+{
+	NSDate							*startTime							= [NSDate date];
+	id <DecoderMethods>				decoder								= nil;
+	NSString						*sourceFilename						= nil;
+	SInt64							startingFrame;
+	UInt32							frameCount;
+	int								fd									= -1;
+	int								cfd									= -1;
+	
+	@try {
 		// Parse the encoder settings
 		[self parseSettings];
 
@@ -90,18 +295,173 @@ static int writeWavPackBlock(void *wv_id, void *data, int32_t bcount)
 		[[self delegate] setStarted:YES];
 		
 		// Setup the decoder
-		id <DecoderMethods> decoder = nil;
-		NSString *sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
+		sourceFilename = [[[self delegate] taskInfo] inputFilenameAtInputFileIndex];
 		
 		// Create the appropriate kind of decoder
 		if(nil != [[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"]) {
-			SInt64 startingFrame = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
-			UInt32 frameCount = [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
-			decoder = [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
+			startingFrame	= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"startingFrame"] longLongValue];
+			frameCount		= [[[[[[self delegate] taskInfo] settings] valueForKey:@"framesToConvert"] valueForKey:@"frameCount"] unsignedIntValue];
+			decoder			= [RegionDecoder decoderWithFilename:sourceFilename startingFrame:startingFrame frameCount:frameCount];
 		}
 		else
 			decoder = [Decoder decoderWithFilename:sourceFilename];
 		
+		// Open the output file
+		fd = open([filename fileSystemRepresentation], O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		NSAssert(-1 != fd, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
+
+		// Open the correction file
+		if(_flags & CONFIG_CREATE_WVC) {
+			NSString *correctionFilename = generateUniqueFilename([filename stringByDeletingPathExtension], @"wvc");
+			
+			cfd = open([correctionFilename fileSystemRepresentation], O_WRONLY | O_CREAT | O_EXCL | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+			releaseUniqueFilename(correctionFilename);
+			NSAssert(-1 != cfd, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
+		}
+		
+		// Block indexes are limited to 32 bits
+		if(1 < _threads && (SInt64)(2 * SEGMENT_SAMPLES) < [decoder totalFrames] && UINT32_MAX > [decoder totalFrames])
+			[self encodeInParallel:decoder outputFile:fd correctionFile:cfd startTime:startTime];
+		else
+			[self encodeSerially:decoder outputFile:fd correctionFile:cfd startTime:startTime];
+	}
+	
+	@catch(StopException *exception) {
+		[[self delegate] setStopped:YES];
+	}
+	
+	@catch(NSException *exception) {
+		[[self delegate] setException:exception];
+		[[self delegate] setStopped:YES];
+	}
+	
+	@finally {		
+		// Close the output file
+		close(fd);
+		close(cfd);
+	}	
+
+	[[self delegate] setEndTime:[NSDate date]];
+	[[self delegate] setCompleted:YES];
+}
+
++ (NSString *) libraryVersion
+{
+	return [NSString stringWithFormat:@"WavPack %s", WavpackGetLibraryVersionString()];
+}
+
+- (NSString *) settingsString
+{
+	return [NSString stringWithFormat:@"WavPack settings: %@%@%@%@", 
+		(_flags & CONFIG_HIGH_FLAG ? @"high " : @""),
+		(_flags & CONFIG_FAST_FLAG ? @"fast " : @""),
+		(_flags & CONFIG_HYBRID_FLAG ? @"hybrid " : @""),
+		(_flags & CONFIG_JOINT_OVERRIDE ? (_flags & CONFIG_JOINT_STEREO ? @"joint stereo " : @"stereo ") : @"")];
+}
+
+@end
+
+
+@implementation WavPackEncoder (Private)
+
+- (void) parseSettings
+{
+	NSDictionary	*settings	= [[self delegate] encoderSettings];
+	
+	// Set encoding properties
+	switch([[settings objectForKey:@"stereoMode"] intValue]) {
+		case WAVPACK_STEREO_MODE_STEREO:			
+			_flags |= CONFIG_JOINT_OVERRIDE;
+			_flags &= ~CONFIG_JOINT_STEREO;
+			break;
+		case WAVPACK_STEREO_MODE_JOINT_STEREO:
+			_flags |= (CONFIG_JOINT_OVERRIDE | CONFIG_JOINT_STEREO);
+			break;
+		case WAVPACK_STEREO_MODE_DEFAULT:			;										break;
+		default:									;										break;
+	}
+	
+	switch([[settings objectForKey:@"compressionMode"] intValue]) {
+		case WAVPACK_COMPRESSION_MODE_HIGH:			_flags |= CONFIG_HIGH_FLAG;				break;
+		case WAVPACK_COMPRESSION_MODE_VERY_HIGH:	_flags |= CONFIG_VERY_HIGH_FLAG;		break;
+		case WAVPACK_COMPRESSION_MODE_FAST:			_flags |= CONFIG_FAST_FLAG;				break;
+		case WAVPACK_COMPRESSION_MODE_DEFAULT:		;										break;
+		default:									;										break;
+	}
+	
+	// Hybrid mode
+	if([[settings objectForKey:@"enableHybridCompression"] boolValue]) {
+		
+		_flags |= CONFIG_HYBRID_FLAG;
+		
+		if([[settings objectForKey:@"createCorrectionFile"] intValue])
+			_flags |= CONFIG_CREATE_WVC;
+		
+		if([[settings objectForKey:@"maximumHybridCompression"] intValue])
+			_flags |= CONFIG_OPTIMIZE_WVC;
+		
+		switch([[settings objectForKey:@"hybridMode"] intValue]) {
+			
+			case WAVPACK_HYBRID_MODE_BITS_PER_SAMPLE:
+				_bitrate = [[settings objectForKey:@"bitsPerSample"] floatValue];
+				break;
+				
+			case WAVPACK_HYBRID_MODE_BITRATE:
+				_bitrate = [[settings objectForKey:@"bitrate"] floatValue];
+				_flags |= CONFIG_BITRATE_KBPS;
+				break;
+				
+			default:									;									break;
+		}
+		
+		_noiseShaping = [[settings objectForKey:@"noiseShaping"] floatValue];
+		if(0.0 != _noiseShaping)
+			_flags |= (CONFIG_HYBRID_SHAPE | CONFIG_SHAPE_OVERRIDE);
+	}
+	
+	_threads = getEncoderThreadCount(settings);
+}
+
+- (void) setupConfiguration:(WavpackConfig *)config pcmFormat:(AudioStreamBasicDescription)pcmFormat
+{
+	memset(config, 0, sizeof(WavpackConfig));
+	
+	config->num_channels			= pcmFormat.mChannelsPerFrame;
+	config->channel_mask			= 3;
+	config->sample_rate				= pcmFormat.mSampleRate;
+	config->bits_per_sample			= pcmFormat.mBitsPerChannel;
+	config->bytes_per_sample		= config->bits_per_sample / 8;
+	
+	config->flags					= _flags;
+	
+	if(0.f != _noiseShaping) {
+		config->shaping_weight		= _noiseShaping;
+	}
+
+	if(0.f != _bitrate) {
+		config->bitrate				= _bitrate;
+	}
+}
+
+- (void) encodeSerially:(id <DecoderMethods>)decoder outputFile:(int)fd correctionFile:(int)cfd startTime:(NSDate *)startTime
+{
+	AudioBufferList					bufferList;
+	ssize_t							bufferLen							= 0;
+	UInt32							bufferByteSize						= 0;
+	int32_t							*wpBuf								= NULL;
+	SInt64							totalFrames, framesToRead;
+	UInt32							frameCount;
+	int								result;
+	WavpackContext					*wpc								= NULL;
+	WavpackConfig					config;
+	unsigned long					iterations							= 0;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
+	
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
+
 		totalFrames			= [decoder totalFrames];
 		framesToRead		= totalFrames;
 		
@@ -141,38 +501,11 @@ static int writeWavPackBlock(void *wv_id, void *data, int32_t bcount)
 		wpBuf = (int32_t *)calloc(bufferLen, sizeof(int32_t));
 		NSAssert(NULL != wpBuf, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		// Open the output file
-		fd = open([filename fileSystemRepresentation], O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-		NSAssert(-1 != fd, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
-
-		// Open the correction file
-		cfd = -1;
-		if(_flags & CONFIG_CREATE_WVC) {
-			cfd = open([generateUniqueFilename([filename stringByDeletingPathExtension], @"wvc") fileSystemRepresentation], O_WRONLY | O_CREAT | O_EXCL | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-			NSAssert(-1 != cfd, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));
-		}
-		
 		// Setup the encoder
 		wpc = WavpackOpenFileOutput(writeWavPackBlock, (void *)fd, (-1 == cfd ? NULL : (void *)cfd));
 		NSAssert(NULL != wpc, NSLocalizedStringFromTable(@"Unable to create the WavPack encoder.", @"Exceptions", @""));
 		
-		memset(&config, 0, sizeof(config));
-		
-		config.num_channels				= [decoder pcmFormat].mChannelsPerFrame;
-		config.channel_mask				= 3;
-		config.sample_rate				= [decoder pcmFormat].mSampleRate;
-		config.bits_per_sample			= [decoder pcmFormat].mBitsPerChannel;
-		config.bytes_per_sample			= config.bits_per_sample / 8;
-		
-		config.flags					= _flags;
-		
-		if(0.f != _noiseShaping) {
-			config.shaping_weight		= _noiseShaping;
-		}
-
-		if(0.f != _bitrate) {
-			config.bitrate				= _bitrate;
-		}
+		[self setupConfiguration:&config pcmFormat:[decoder pcmFormat]];
 		
 		result = WavpackSetConfiguration(wpc, &config, totalFrames);
 		NSAssert(FALSE != result, NSLocalizedStringFromTable(@"Unable to initialize the WavPack encoder.", @"Exceptions", @""));
@@ -196,52 +529,7 @@ static int writeWavPackBlock(void *wv_id, void *data, int32_t bcount)
 			}
 			
 			// Fill WavPack buffer, converting to host endian byte order
-			switch([decoder pcmFormat].mBitsPerChannel) {
-				
-				case 8:
-					buffer8 = bufferList.mBuffers[0].mData;
-					for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-						for(channel = 0; channel < bufferList.mBuffers[0].mNumberChannels; ++channel, ++sample) {
-							wpBuf[sample] = (int32_t)buffer8[sample];
-						}
-					}
-					break;
-					
-				case 16:
-					buffer16 = bufferList.mBuffers[0].mData;
-					for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-						for(channel = 0; channel < bufferList.mBuffers[0].mNumberChannels; ++channel, ++sample) {
-							wpBuf[sample] = (int32_t)(int16_t)OSSwapBigToHostInt16(buffer16[sample]);
-						}
-					}
-					break;
-					
-				case 24:
-					buffer8 = bufferList.mBuffers[0].mData;
-					for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-						for(channel = 0; channel < bufferList.mBuffers[0].mNumberChannels; ++channel, ++sample) {
-							constructedSample = (int8_t)*buffer8++; constructedSample <<= 8;
-							constructedSample |= (uint8_t)*buffer8++; constructedSample <<= 8;
-							constructedSample |= (uint8_t)*buffer8++;
-							
-							wpBuf[(bufferList.mBuffers[0].mNumberChannels * wideSample) + channel] = constructedSample;
-						}
-					}
-					break;
-					
-				case 32:
-					buffer32 = bufferList.mBuffers[0].mData;
-					for(wideSample = sample = 0; wideSample < frameCount; ++wideSample) {
-						for(channel = 0; channel < bufferList.mBuffers[0].mNumberChannels; ++channel, ++sample) {
-							wpBuf[sample] = (int32_t)OSSwapBigToHostInt32(buffer32[sample]);
-						}
-					}
-					break;
-					
-				default:
-					@throw [NSException exceptionWithName:@"IllegalInputException" reason:@"Sample size not supported" userInfo:nil]; 
-					break;				
-			}
+			convertAudio(&bufferList, frameCount, [decoder pcmFormat].mBitsPerChannel, wpBuf);
 
 			// Write the data
 			result = WavpackPackSamples(wpc, wpBuf, frameCount);
@@ -272,101 +560,138 @@ static int writeWavPackBlock(void *wv_id, void *data, int32_t bcount)
 		// Flush any remaining samples
 		result = WavpackFlushSamples(wpc);
 		NSAssert1(FALSE != result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"WavpackFlushSamples");		
-	}
-	
-	@catch(StopException *exception) {
-		[[self delegate] setStopped:YES];
-	}
-	
-	@catch(NSException *exception) {
-		[[self delegate] setException:exception];
-		[[self delegate] setStopped:YES];
+		
+		[self logSamplesEncoded:(totalFrames - framesToRead) sampleRate:[decoder pcmFormat].mSampleRate threads:1 sinceDate:startTime];
 	}
 	
 	@finally {		
-		// Close the output file
 		if(NULL != wpc) {
 			WavpackCloseFile(wpc);
 		}
-		close(fd);
-		close(cfd);
 		
 		free(bufferList.mBuffers[0].mData);
 		free(wpBuf);
 	}	
-
-	[[self delegate] setEndTime:[NSDate date]];
-	[[self delegate] setCompleted:YES];
 }
 
-- (NSString *) settingsString
+- (void) encodeInParallel:(id <DecoderMethods>)decoder outputFile:(int)fd correctionFile:(int)cfd startTime:(NSDate *)startTime
 {
-	return [NSString stringWithFormat:@"WavPack settings: %@%@%@%@", 
-		(_flags & CONFIG_HIGH_FLAG ? @"high " : @""),
-		(_flags & CONFIG_FAST_FLAG ? @"fast " : @""),
-		(_flags & CONFIG_HYBRID_FLAG ? @"hybrid " : @""),
-		(_flags & CONFIG_JOINT_OVERRIDE ? (_flags & CONFIG_JOINT_STEREO ? @"joint stereo " : @"stereo ") : @"")];
-}
-
-@end
-
-
-@implementation WavPackEncoder (Private)
-
-- (void) parseSettings
-{
-	NSDictionary	*settings	= [[self delegate] encoderSettings];
-	
-	// Set encoding properties
-	switch([[settings objectForKey:@"stereoMode"] intValue]) {
-		case WAVPACK_STEREO_MODE_STEREO:			
-			_flags |= CONFIG_JOINT_OVERRIDE;
-			_flags &= ~CONFIG_JOINT_STEREO;
-			break;
-		case WAVPACK_STEREO_MODE_JOINT_STEREO:
-			_flags |= (CONFIG_JOINT_OVERRIDE | CONFIG_JOINT_STEREO);
-			break;
-		case WAVPACK_STEREO_MODE_DEFAULT:			;										break;
-		default:									;										break;
-	}
-	
-	switch([[settings objectForKey:@"compressionMode"] intValue]) {
-		case WAVPACK_COMPRESSION_MODE_HIGH:			_flags |= CONFIG_HIGH_FLAG;				break;
-		case WAVPACK_COMPRESSION_MODE_VERY_HIGH:	_flags |= CONFIG_VERY_HIGH_FLAG;		break;
-		case WAVPACK_COMPRESSION_MODE_FAST:			_flags |= CONFIG_FAST_FLAG;				break;
-		case WAVPACK_COMPRESSION_MODE_DEFAULT:		;										break;
-		default:									;										break;
-	}
+	AudioStreamBasicDescription		pcmFormat				= [decoder pcmFormat];
+	WavpackConfig					config;
+	NSOperationQueue				*queue					= nil;
+	NSMutableArray					*segments				= nil;
+	WavPackSegment					*segment				= nil;
+	AudioBufferList					bufferList;
+	UInt32							bufferByteSize;
+	UInt32							segmentSampleCount;
+	UInt32							frameCount;
+	BOOL							inputFinished			= NO;
+	SInt64							totalFrames				= [decoder totalFrames];
+	uint32_t						samplesRead				= 0;
+	uint32_t						samplesEncoded			= 0;
+	double							percentComplete;
+	NSTimeInterval					interval;
+	unsigned						secondsRemaining;
 	
-	// Hybrid mode
-	if([[settings objectForKey:@"enableHybridCompression"] boolValue]) {
+	@try {
+		bufferList.mBuffers[0].mData = NULL;
 		
-		_flags |= CONFIG_HYBRID_FLAG;
+		[self setupConfiguration:&config pcmFormat:pcmFormat];
 		
-		if([[settings objectForKey:@"createCorrectionFile"] intValue])
-			_flags |= CONFIG_CREATE_WVC;
+		// Read 1024 frames at a time
+		bufferByteSize								= 1024 * pcmFormat.mBytesPerFrame;
+		bufferList.mNumberBuffers					= 1;
+		bufferList.mBuffers[0].mData				= calloc(bufferByteSize, sizeof(uint8_t));
+		NSAssert(NULL != bufferList.mBuffers[0].mData, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		if([[settings objectForKey:@"maximumHybridCompression"] intValue])
-			_flags |= CONFIG_OPTIMIZE_WVC;
+		queue		= [[[NSOperationQueue alloc] init] autorelease];
+		segments	= [NSMutableArray array];
 		
-		switch([[settings objectForKey:@"hybridMode"] intValue]) {
+		[queue setMaxConcurrentOperationCount:_threads];
+		
+		for(;;) {
 			
-			case WAVPACK_HYBRID_MODE_BITS_PER_SAMPLE:
-				_bitrate = [[settings objectForKey:@"bitsPerSample"] floatValue];
-				break;
+			// Keep a segment waiting for each thread
+			while(NO == inputFinished && [segments count] < 2 * _threads) {
+				segment				= [[[WavPackSegment alloc] initWithConfiguration:config sampleCapacity:SEGMENT_SAMPLES firstSample:samplesRead] autorelease];
+				segmentSampleCount	= 0;
 				
-			case WAVPACK_HYBRID_MODE_BITRATE:
-				_bitrate = [[settings objectForKey:@"bitrate"] floatValue];
-				_flags |= CONFIG_BITRATE_KBPS;
-				break;
+				while(segmentSampleCount < SEGMENT_SAMPLES) {
+					bufferList.mBuffers[0].mNumberChannels	= pcmFormat.mChannelsPerFrame;
+					bufferList.mBuffers[0].mDataByteSize	= bufferByteSize;
+					frameCount								= MIN(1024, SEGMENT_SAMPLES - segmentSampleCount);
+					
+					frameCount = [decoder readAudio:&bufferList frameCount:frameCount];
+					
+					if(0 == frameCount) {
+						inputFinished = YES;
+						break;
+					}
+					
+					convertAudio(&bufferList, frameCount, pcmFormat.mBitsPerChannel, [segment buffer] + (segmentSampleCount * pcmFormat.mChannelsPerFrame));
+					segmentSampleCount += frameCount;
+				}
 				
-			default:									;									break;
+				if(0 == segmentSampleCount)
+					break;
+				
+				[segment setSampleCount:segmentSampleCount];
+				samplesRead += segmentSampleCount;
+				
+				[segments addObject:segment];
+				[queue addOperation:segment];
+			}
+			
+			if(0 == [segments count])
+				break;
+			
+			// Write the oldest segment's blocks
+			segment = [segments objectAtIndex:0];
+			[segment waitUntilFinished];
+			
+			if(nil != [segment exception])
+				@throw [segment exception];
+			
+			writeSegmentBlocks(fd, [segment blocks], [segment firstSample], (uint32_t)totalFrames);
+			if(-1 != cfd)
+				writeSegmentBlocks(cfd, [segment correctionBlocks], [segment firstSample], (uint32_t)totalFrames);
+			
+			samplesEncoded += [segment sampleCount];
+			[segments removeObjectAtIndex:0];
+			
+			// Each segment takes a while, so there is no need to limit the Distributed Object calls
+			if([[self delegate] shouldStop])
+				@throw [StopException exceptionWithReason:@"Stop requested by user" userInfo:nil];
+			
+			percentComplete		= ((double)samplesEncoded/(double) totalFrames) * 100.0;
+			interval			= -1.0 * [startTime timeIntervalSinceNow];
+			secondsRemaining	= (unsigned) (interval / ((double)samplesEncoded/(double) totalFrames) - interval);
+			
+			[[self delegate] updateProgress:percentComplete secondsRemaining:secondsRemaining];
 		}
 		
-		_noiseShaping = [[settings objectForKey:@"noiseShaping"] floatValue];
-		if(0.0 != _noiseShaping)
-			_flags |= (CONFIG_HYBRID_SHAPE | CONFIG_SHAPE_OVERRIDE);
+		[self logSamplesEncoded:samplesEncoded sampleRate:pcmFormat.mSampleRate threads:_threads sinceDate:startTime];
+	}
+	
+	@finally {
+		// Don't leave any segments running
+		[queue cancelAllOperations];
+		[queue waitUntilAllOperationsAreFinished];
+		
+		free(bufferList.mBuffers[0].mData);
 	}
 }
 
+- (void) logSamplesEncoded:(SInt64)samplesEncoded sampleRate:(Float64)sampleRate threads:(unsigned)threads sinceDate:(NSDate *)startTime
+{
+	NSTimeInterval		interval		= -1.0 * [startTime timeIntervalSinceNow];
+	NSString			*message;
+	
+	if(0 >= interval || 0 >= sampleRate)
+		return;
+	
+	message = [NSString stringWithFormat:NSLocalizedStringFromTable(@"WavPack: encoded %.2f seconds of audio in %.2f seconds using %u threads (%.1fx realtime)", @"Log", @""), samplesEncoded / sampleRate, interval, threads, (samplesEncoded / sampleRate) / interval];
+	[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
+}
+
 @end
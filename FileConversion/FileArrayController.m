@@ -138,25 +138,12 @@
 	else if([[[info draggingPasteboard] types] containsObject:NSFilenamesPboardType]) {
 		NSEnumerator		*enumerator;
 		NSString			*current;
-		NSMutableArray		*newFiles	= [NSMutableArray array];
-		NSDictionary		*file;
 		
+		// The files are added asynchronously and selected once they have all been inserted
 		enumerator = [[[info draggingPasteboard] propertyListForType:NSFilenamesPboardType] objectEnumerator];
 		while((current = [enumerator nextObject])) {
-			
 			success &= [[FileConversionController sharedController] addFile:current atIndex:row++];
-			
-			if(success) {
-				file = [self findFile:current];
-				if(nil != file) {
-					[newFiles addObject:file];
-				}
-			}
 		}
-		
-		if(success) {
-			[self setSelectedObjects:newFiles];
-		}		
 	}
 	
 	return success;
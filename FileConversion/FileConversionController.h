@@ -35,6 +35,23 @@
 	IBOutlet NSTextField			*_discTotalTextField;
 	
 	NSMutableArray					*_files;
+
+	NSOperationQueue				*_ingestionQueue;
+	NSMutableArray					*_ingestedFiles;
+	NSMutableArray					*_failedFiles;
+	NSMutableSet					*_ingestingFilenames;
+	NSMutableDictionary				*_insertionIndexes;
+	NSMutableArray					*_filesToSelect;
+	NSTimer							*_ingestionTimer;
+	NSString						*_ingestionStatus;
+	NSDictionary					*_firstFailure;
+	CFAbsoluteTime					_ingestionStartTime;
+	NSUInteger						_ingestionGeneration;
+	NSUInteger						_nextIngestionRequest;
+	NSUInteger						_filesQueued;
+	NSUInteger						_filesIngested;
+	NSUInteger						_filesFailed;
+	BOOL							_addingFiles;
 }
 
 + (FileConversionController *)		sharedController;
@@ -50,10 +67,17 @@
 - (IBAction)						addFiles:(id)sender;
 - (IBAction)						removeFiles:(id)sender;
 
+// Converts a folder's new and changed files, retags files whose audio is unchanged and removes the outputs of deleted files
+- (IBAction)						mirrorLibrary:(id)sender;
+
 - (IBAction)						downloadAlbumArt:(id)sender;
 - (IBAction)						selectAlbumArt:(id)sender;
 
 - (BOOL)							addFile:(NSString *)filename;
 - (BOOL)							addFile:(NSString *)filename atIndex:(NSUInteger)index;
 
+- (BOOL)							addingFiles;
+- (NSString *)						ingestionStatus;
+- (IBAction)						stopAddingFiles:(id)sender;
+
 @end
@@ -26,13 +26,25 @@
 #import "Genres.h"
 #import "AmazonAlbumArtSheet.h"
 #import "ImageAndTextCell.h"
+#import "LogController.h"
+#import "LibraryMirror.h"
 #import "UtilityFunctions.h"
 
 static FileConversionController		*sharedController						= nil;
 
 @interface FileConversionController (Private)
+- (NSMutableDictionary *)	conversionSettings;
 - (void)	addFilesPanelDidEnd:(NSOpenPanel *)panel returnCode:(int)returnCode contextInfo:(void *)contextInfo;
-- (BOOL)	addOneFile:(NSString *)filename atIndex:(NSUInteger)index;
+- (void)	mirrorLibraryPanelDidEnd:(NSOpenPanel *)panel returnCode:(int)returnCode contextInfo:(void *)contextInfo;
+- (void)	queueFile:(NSString *)filename forRequest:(NSDictionary *)request;
+- (void)	ingestDirectory:(NSDictionary *)request;
+- (void)	ingestFile:(NSDictionary *)request;
+- (BOOL)	isCurrentIngestionRequest:(NSDictionary *)request;
+- (void)	beginAddingFiles;
+- (void)	processIngestedFiles:(NSTimer *)timer;
+- (void)	finishAddingFiles;
+- (void)	setAddingFiles:(BOOL)addingFiles;
+- (void)	setIngestionStatus:(NSString *)ingestionStatus;
 - (void)	clearFileList;
 - (void)	selectAlbumArtPanelDidEnd:(NSOpenPanel *)sheet returnCode:(int)returnCode contextInfo:(void *)contextInfo;
 @end
@@ -68,6 +80,15 @@ static FileConversionController		*sharedController						= nil;
 - (id) init
 {
 	if((self = [super initWithWindowNibName:@"FileConversion"])) {
+		_ingestionQueue			= [[NSOperationQueue alloc] init];
+		_ingestedFiles			= [[NSMutableArray alloc] init];
+		_failedFiles			= [[NSMutableArray alloc] init];
+		_ingestingFilenames		= [[NSMutableSet alloc] init];
+		_insertionIndexes		= [[NSMutableDictionary alloc] init];
+		_filesToSelect			= [[NSMutableArray alloc] init];
+		
+		// Metadata parsing is mostly CPU-bound once the tags are in the page cache
+		[_ingestionQueue setMaxConcurrentOperationCount:[[NSProcessInfo processInfo] activeProcessorCount]];
 	}
 	return self;
 }
@@ -112,6 +133,9 @@ static FileConversionController		*sharedController						= nil;
 		[[[NSSortDescriptor alloc] initWithKey:@"metadata.albumArtist" ascending:YES] autorelease],
 		[[[NSSortDescriptor alloc] initWithKey:@"metadata.albumTitle" ascending:YES] autorelease],
 		nil]];
+	
+	// Added files are selected as a group once ingestion completes
+	[_filesController setSelectsInsertedObjects:NO];
 
 	// Setup the toolbar
 	FileConversionToolbar *toolbar = [[FileConversionToolbar alloc] init];
@@ -171,95 +195,11 @@ static FileConversionController		*sharedController						= nil;
 	AudioMetadata			*metadata				= nil;
 	NSArray					*filenames				= nil;
 	NSString				*filename				= nil;
-	NSMutableDictionary		*postProcessingOptions	= nil;
-	NSArray					*applicationPaths;
+	NSMutableDictionary		*settings				= [self conversionSettings];
 	unsigned				i;
 
-	// Encoders
-	NSArray *encoders = [[FormatsController sharedController] selectedFormats];
-	
-	// Verify at least one output format is selected
-	if(0 == [encoders count]) {
-		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
-		[alert addButtonWithTitle: NSLocalizedStringFromTable(@"OK", @"General", @"")];
-		[alert addButtonWithTitle: NSLocalizedStringFromTable(@"Show Preferences", @"General", @"")];
-		[alert setMessageText:NSLocalizedStringFromTable(@"No output formats are selected.", @"General", @"")];
-		[alert setInformativeText:NSLocalizedStringFromTable(@"Please select one or more output formats.", @"General", @"")];
-		[alert setAlertStyle: NSWarningAlertStyle];
-		
-		NSInteger result = [alert runModal];
-		
-		if(NSAlertFirstButtonReturn == result) {
-			// do nothing
-		}
-		else if(NSAlertSecondButtonReturn == result) {
-			[[PreferencesController sharedPreferences] selectPreferencePane:FormatsPreferencesToolbarItemIdentifier];
-			[[PreferencesController sharedPreferences] showWindow:self];
-		}
-		
+	if(nil == settings)
 		return;
-	}
-
-	NSMutableDictionary *settings = [NSMutableDictionary dictionary];
-	[settings setValue:encoders forKey:@"encoders"];
-
-	// File locations
-	[settings setValue:[[[NSUserDefaults standardUserDefaults] stringForKey:@"outputDirectory"] stringByExpandingTildeInPath] forKey:@"outputDirectory"];
-	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"convertInPlace"] forKey:@"convertInPlace"];
-	[settings setValue:[[[NSUserDefaults standardUserDefaults] stringForKey:@"temporaryDirectory"] stringByExpandingTildeInPath] forKey:@"temporaryDirectory"];
-	
-	// Conversion parameters
-	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"saveSettingsInComment"] forKey:@"saveSettingsInComment"];
-	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"deleteSourceFiles"] forKey:@"deleteSourceFiles"];
-	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"overwriteOutputFiles"] forKey:@"overwriteOutputFiles"];
-	
-	if([[NSUserDefaults standardUserDefaults] boolForKey:@"overwriteOutputFiles"]) {
-		[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"promptBeforeOverwritingOutputFiles"] forKey:@"promptBeforeOverwritingOutputFiles"];
-	}
-	
-	// Output file naming
-	if([[NSUserDefaults standardUserDefaults] boolForKey:@"useCustomOutputFileNaming"]) {
-		NSMutableDictionary		*fileNamingFormat = [NSMutableDictionary dictionary];
-				
-		[fileNamingFormat setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"fileNamingFormat"] forKey:@"formatString"];
-		[fileNamingFormat setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"useTwoDigitTrackNumbers"] forKey:@"useTwoDigitTrackNumbers"];
-		[fileNamingFormat setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"useNamingFallback"] forKey:@"useNamingFallback"];
-		
-		[settings setValue:fileNamingFormat forKey:@"outputFileNaming"];
-	}
-	
-	// Post-processing options
-	postProcessingOptions = [NSMutableDictionary dictionary];
-	
-	[postProcessingOptions setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"addToiTunes"] forKey:@"addToiTunes"];
-	if([[NSUserDefaults standardUserDefaults] boolForKey:@"addToiTunes"]) {
-
-		[postProcessingOptions setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"addToiTunesPlaylist"] forKey:@"addToiTunesPlaylist"];
-
-		if([[NSUserDefaults standardUserDefaults] boolForKey:@"addToiTunesPlaylist"]) {
-			[postProcessingOptions setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"iTunesPlaylistName"] forKey:@"iTunesPlaylistName"];
-		}		
-	}
-		
-	applicationPaths	= [[NSUserDefaults standardUserDefaults] objectForKey:@"postProcessingApplications"];
-		
-	if(0 != [applicationPaths count]) {
-		[postProcessingOptions setValue:applicationPaths forKey:@"postProcessingApplications"];
-	}
-	
-	if(0 != [postProcessingOptions count]) {
-		[settings setValue:postProcessingOptions forKey:@"postProcessingOptions"];
-	}
-	
-	// Album art
-	if([[NSUserDefaults standardUserDefaults] boolForKey:@"saveAlbumArt"]) {
-		NSMutableDictionary		*albumArt = [NSMutableDictionary dictionary];
-		
-		[albumArt setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"albumArtFileExtension"] forKey:@"extension"];
-		[albumArt setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"albumArtFileNamingFormat"] forKey:@"formatString"];
-		
-		[settings setValue:albumArt forKey:@"albumArt"];
-	}
 	
 	// Process the files
 	filenames = [_filesController arrangedObjects];
@@ -333,6 +273,19 @@ static FileConversionController		*sharedController						= nil;
 	[_filesController removeObjects:[_filesController selectedObjects]];	
 }
 
+- (IBAction) mirrorLibrary:(id)sender
+{
+	NSOpenPanel		*panel		= [NSOpenPanel openPanel];
+	
+	[panel setAllowsMultipleSelection:NO];
+	[panel setCanChooseDirectories:YES];
+	[panel setCanChooseFiles:NO];
+	[panel setPrompt:NSLocalizedStringFromTable(@"Mirror", @"FileConversion", @"")];
+	[panel setMessage:NSLocalizedStringFromTable(@"Choose a folder to mirror into the output folder using the selected output formats.", @"FileConversion", @"")];
+	
+	[panel beginSheetForDirectory:nil file:nil types:nil modalForWindow:[self window] modalDelegate:self didEndSelector:@selector(mirrorLibraryPanelDidEnd:returnCode:contextInfo:) contextInfo:NULL];	
+}
+
 #pragma mark File Management
 
 - (BOOL) addFile:(NSString *)filename
@@ -342,69 +295,65 @@ static FileConversionController		*sharedController						= nil;
 
 - (BOOL) addFile:(NSString *)filename atIndex:(NSUInteger)index
 {
-	NSAutoreleasePool	*pool				= [[NSAutoreleasePool alloc] init];
-	NSAutoreleasePool	*loopPool			= nil;
-	NSFileManager		*manager			= [NSFileManager defaultManager];
-	NSArray				*allowedTypes		= getAudioExtensions();
-	NSMutableArray		*newFiles;
-	NSDictionary		*file;
-	NSArray				*subpaths;
+	NSDictionary		*request;
 	BOOL				isDir;
-	NSString			*subpath;
-	NSString			*composedPath;
 	BOOL				result;
-	BOOL				success				= YES;
 	
-	result = [manager fileExistsAtPath:filename isDirectory:&isDir];
-	NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to locate the input file.", @"Exceptions", @""));
+	// Paths that have vanished or can't be read are refused here rather than failing on the ingestion queue
+	result = [[NSFileManager defaultManager] fileExistsAtPath:filename isDirectory:&isDir];
+	if(NO == result || NO == [[NSFileManager defaultManager] isReadableFileAtPath:filename]) {
+		return NO;
+	}
+	
+	// Only accept files with our extensions
+	if(NO == isDir && NO == [getAudioExtensions() containsObject:[[filename pathExtension] lowercaseString]]) {
+		return NO;
+	}
 	
-	newFiles = [NSMutableArray array];
+	if(NO == [self addingFiles]) {
+		[self beginAddingFiles];
+	}
+	
+	request = [NSDictionary dictionaryWithObjectsAndKeys:
+		filename, @"filename",
+		[NSNumber numberWithUnsignedInteger:_nextIngestionRequest++], @"request",
+		[NSNumber numberWithUnsignedInteger:_ingestionGeneration], @"generation",
+		nil];
 	
+	if(NSNotFound != index) {
+		[_insertionIndexes setObject:[NSNumber numberWithUnsignedInteger:index] forKey:[request objectForKey:@"request"]];
+	}
+	
+	// Directory enumeration, format probing and metadata parsing all happen on the ingestion queue
 	if(isDir) {
-		subpaths	= [manager subpathsAtPath:filename];
-		
-		for(subpath in subpaths) {
-			loopPool		= [[NSAutoreleasePool alloc] init];
-			composedPath	= [NSString stringWithFormat:@"%@/%@", filename, subpath];
-			
-			// Ignore dotfiles
-			if([[subpath lastPathComponent] hasPrefix:@"."]) {
-				continue;
-			}
-			// Ignore files that don't have our extensions
-			else if(NO == [allowedTypes containsObject:[[subpath pathExtension] lowercaseString]]) {
-				continue;
-			}
-			
-			// Ignore directories
-			if([manager fileExistsAtPath:composedPath isDirectory:&isDir] && NO == isDir) {
-				success &= [self addOneFile:composedPath atIndex:index];
-			}
-			
-			if(success) {
-				file = [_filesController findFile:composedPath];
-				if(nil != file) {
-					[newFiles addObject:file];
-				}
-			}
-			
-			[loopPool release];
-		}
-		
-		if(success) {
-			[_filesController setSelectedObjects:newFiles];
-		}
+		[_ingestionQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(ingestDirectory:) object:request] autorelease]];
 	}
 	else {
-		success &= [self addOneFile:filename atIndex:index];
-		if(success) {
-			[_filesController selectFile:filename];
-		}
+		[self queueFile:filename forRequest:request];
 	}
 	
-	[pool release];
+	return YES;
+}
+
+- (BOOL)		addingFiles								{ return _addingFiles; }
+- (NSString *)	ingestionStatus							{ return [[_ingestionStatus retain] autorelease]; }
+
+- (IBAction) stopAddingFiles:(id)sender
+{
+	if(NO == [self addingFiles]) {
+		return;
+	}
+	
+	// Results from operations that are already running will be discarded, and their files may be added again
+	@synchronized(_ingestedFiles) {
+		++_ingestionGeneration;
+		[_ingestedFiles removeAllObjects];
+		[_failedFiles removeAllObjects];
+		[_ingestingFilenames removeAllObjects];
+	}
 	
-	return success;
+	[_ingestionQueue cancelAllOperations];
+	[self finishAddingFiles];
 }
 
 #pragma mark Miscellaneous
@@ -475,6 +424,100 @@ static FileConversionController		*sharedController						= nil;
 
 @implementation FileConversionController (Private)
 
+- (NSMutableDictionary *) conversionSettings
+{
+	NSMutableDictionary		*postProcessingOptions	= nil;
+	NSArray					*applicationPaths;
+
+	// Encoders
+	NSArray *encoders = [[FormatsController sharedController] selectedFormats];
+	
+	// Verify at least one output format is selected
+	if(0 == [encoders count]) {
+		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
+		[alert addButtonWithTitle: NSLocalizedStringFromTable(@"OK", @"General", @"")];
+		[alert addButtonWithTitle: NSLocalizedStringFromTable(@"Show Preferences", @"General", @"")];
+		[alert setMessageText:NSLocalizedStringFromTable(@"No output formats are selected.", @"General", @"")];
+		[alert setInformativeText:NSLocalizedStringFromTable(@"Please select one or more output formats.", @"General", @"")];
+		[alert setAlertStyle: NSWarningAlertStyle];
+		
+		NSInteger result = [alert runModal];
+		
+		if(NSAlertFirstButtonReturn == result) {
+			// do nothing
+		}
+		else if(NSAlertSecondButtonReturn == result) {
+			[[PreferencesController sharedPreferences] selectPreferencePane:FormatsPreferencesToolbarItemIdentifier];
+			[[PreferencesController sharedPreferences] showWindow:self];
+		}
+		
+		return nil;
+	}
+
+	NSMutableDictionary *settings = [NSMutableDictionary dictionary];
+	[settings setValue:encoders forKey:@"encoders"];
+
+	// File locations
+	[settings setValue:[[[NSUserDefaults standardUserDefaults] stringForKey:@"outputDirectory"] stringByExpandingTildeInPath] forKey:@"outputDirectory"];
+	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"convertInPlace"] forKey:@"convertInPlace"];
+	[settings setValue:[[[NSUserDefaults standardUserDefaults] stringForKey:@"temporaryDirectory"] stringByExpandingTildeInPath] forKey:@"temporaryDirectory"];
+	
+	// Conversion parameters
+	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"saveSettingsInComment"] forKey:@"saveSettingsInComment"];
+	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"deleteSourceFiles"] forKey:@"deleteSourceFiles"];
+	[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"overwriteOutputFiles"] forKey:@"overwriteOutputFiles"];
+	
+	if([[NSUserDefaults standardUserDefaults] boolForKey:@"overwriteOutputFiles"]) {
+		[settings setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"promptBeforeOverwritingOutputFiles"] forKey:@"promptBeforeOverwritingOutputFiles"];
+	}
+	
+	// Output file naming
+	if([[NSUserDefaults standardUserDefaults] boolForKey:@"useCustomOutputFileNaming"]) {
+		NSMutableDictionary		*fileNamingFormat = [NSMutableDictionary dictionary];
+				
+		[fileNamingFormat setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"fileNamingFormat"] forKey:@"formatString"];
+		[fileNamingFormat setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"useTwoDigitTrackNumbers"] forKey:@"useTwoDigitTrackNumbers"];
+		[fileNamingFormat setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"useNamingFallback"] forKey:@"useNamingFallback"];
+		
+		[settings setValue:fileNamingFormat forKey:@"outputFileNaming"];
+	}
+	
+	// Post-processing options
+	postProcessingOptions = [NSMutableDictionary dictionary];
+	
+	[postProcessingOptions setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"addToiTunes"] forKey:@"addToiTunes"];
+	if([[NSUserDefaults standardUserDefaults] boolForKey:@"addToiTunes"]) {
+
+		[postProcessingOptions setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"addToiTunesPlaylist"] forKey:@"addToiTunesPlaylist"];
+
+		if([[NSUserDefaults standardUserDefaults] boolForKey:@"addToiTunesPlaylist"]) {
+			[postProcessingOptions setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"iTunesPlaylistName"] forKey:@"iTunesPlaylistName"];
+		}		
+	}
+		
+	applicationPaths	= [[NSUserDefaults standardUserDefaults] objectForKey:@"postProcessingApplications"];
+		
+	if(0 != [applicationPaths count]) {
+		[postProcessingOptions setValue:applicationPaths forKey:@"postProcessingApplications"];
+	}
+	
+	if(0 != [postProcessingOptions count]) {
+		[settings setValue:postProcessingOptions forKey:@"postProcessingOptions"];
+	}
+	
+	// Album art
+	if([[NSUserDefaults standardUserDefaults] boolForKey:@"saveAlbumArt"]) {
+		NSMutableDictionary		*albumArt = [NSMutableDictionary dictionary];
+		
+		[albumArt setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"albumArtFileExtension"] forKey:@"extension"];
+		[albumArt setValue:[[NSUserDefaults standardUserDefaults] objectForKey:@"albumArtFileNamingFormat"] forKey:@"formatString"];
+		
+		[settings setValue:albumArt forKey:@"albumArt"];
+	}
+	
+	return settings;
+}
+
 - (void) addFilesPanelDidEnd:(NSOpenPanel *)panel returnCode:(int)returnCode contextInfo:(void *)contextInfo
 {
 	if(NSOKButton == returnCode) {
@@ -484,47 +527,316 @@ static FileConversionController		*sharedController						= nil;
 	}
 }
 
-- (BOOL) addOneFile:(NSString *)filename atIndex:(NSUInteger)index
+- (void) mirrorLibraryPanelDidEnd:(NSOpenPanel *)panel returnCode:(int)returnCode contextInfo:(void *)contextInfo
 {
-	NSImage				*icon			= nil;
-	AudioMetadata		*metadata		= nil;
+	NSMutableDictionary		*settings;
 	
-	// Don't re-add files
-	if([_filesController containsFile:filename]) {
-		return YES;
+	if(NSOKButton != returnCode)
+		return;
+	
+	// The sheet must be gone before any alert about the output formats is shown
+	[panel orderOut:self];
+	
+	settings = [self conversionSettings];
+	if(nil == settings)
+		return;
+	
+	// The mirror owns its output files and never touches the sources
+	[settings setValue:[NSNumber numberWithBool:NO] forKey:@"convertInPlace"];
+	[settings setValue:[NSNumber numberWithBool:NO] forKey:@"deleteSourceFiles"];
+	[settings setValue:[NSNumber numberWithBool:NO] forKey:@"overwriteOutputFiles"];
+	[settings removeObjectForKey:@"promptBeforeOverwritingOutputFiles"];
+	
+	[[LibraryMirror sharedMirror] mirrorDirectory:[panel filename] settings:settings];
+}
+
+- (void) queueFile:(NSString *)filename forRequest:(NSDictionary *)request
+{
+	NSMutableDictionary		*fileRequest	= [[request mutableCopy] autorelease];
+	
+	[fileRequest setObject:filename forKey:@"filename"];
+	
+	// A directory enumeration that was stopped may still be finding files
+	@synchronized(_ingestedFiles) {
+		if([[request objectForKey:@"generation"] unsignedIntegerValue] != _ingestionGeneration) {
+			return;
+		}
+		
+		++_filesQueued;
 	}
-	// Only accept files with our extensions
-	else if(NO == [getAudioExtensions() containsObject:[[filename pathExtension] lowercaseString]]) {	
-		return NO;
+	
+	[_ingestionQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(ingestFile:) object:fileRequest] autorelease]];
+}
+
+- (void) ingestDirectory:(NSDictionary *)request
+{
+	NSAutoreleasePool		*pool				= [[NSAutoreleasePool alloc] init];
+	NSAutoreleasePool		*loopPool			= nil;
+	NSFileManager			*manager			= [[[NSFileManager alloc] init] autorelease];
+	NSArray					*allowedTypes		= getAudioExtensions();
+	NSString				*directory			= [request objectForKey:@"filename"];
+	NSDirectoryEnumerator	*enumerator			= [manager enumeratorAtPath:directory];
+	NSString				*subpath;
+	NSString				*composedPath;
+	BOOL					isDir;
+	
+	// Files are queued as they are found, so parsing starts before the enumeration completes
+	while((subpath = [enumerator nextObject])) {
+		loopPool		= [[NSAutoreleasePool alloc] init];
+		
+		if(NO == [self isCurrentIngestionRequest:request]) {
+			[loopPool release];
+			break;
+		}
+		
+		composedPath	= [directory stringByAppendingPathComponent:subpath];
+		
+		// Ignore dotfiles and files that don't have our extensions
+		if(NO == [[subpath lastPathComponent] hasPrefix:@"."] && [allowedTypes containsObject:[[subpath pathExtension] lowercaseString]]) {
+			// Ignore directories
+			if([manager fileExistsAtPath:composedPath isDirectory:&isDir] && NO == isDir) {
+				[self queueFile:composedPath forRequest:request];
+			}
+		}
+		
+		[loopPool release];
 	}
 	
-	// Get file's metadata
-	@try {
-		metadata = [AudioMetadata metadataFromFile:filename];
+	[pool release];
+}
+
+- (void) ingestFile:(NSDictionary *)request
+{
+	NSAutoreleasePool		*pool				= [[NSAutoreleasePool alloc] init];
+	NSString				*filename			= [request objectForKey:@"filename"];
+	NSDictionary			*file				= nil;
+	NSDictionary			*failure			= nil;
+	BOOL					duplicate;
+	
+	// Don't parse a file that is already being added; the name is released once the file is inserted or dropped
+	@synchronized(_ingestedFiles) {
+		duplicate = [_ingestingFilenames containsObject:filename];
+		if(NO == duplicate && [[request objectForKey:@"generation"] unsignedIntegerValue] == _ingestionGeneration) {
+			[_ingestingFilenames addObject:filename];
+		}
 	}
+	
+	if(NO == duplicate && [self isCurrentIngestionRequest:request]) {
+		@try {
+			AudioMetadata	*metadata	= [AudioMetadata metadataFromFile:filename];
+			NSString		*name		= [[[[NSFileManager alloc] init] autorelease] displayNameAtPath:filename];
+			
+			// The icon is created on the main thread when the file is inserted
+			file = [NSDictionary dictionaryWithObjects:[NSArray arrayWithObjects:filename, name, metadata, nil] forKeys:[NSArray arrayWithObjects:@"filename", @"displayName", @"metadata", nil]];
+		}
+		
+		@catch(NSException *exception) {
+			failure = [NSDictionary dictionaryWithObjectsAndKeys:filename, @"filename", [exception reason], @"reason", nil];
+		}
+	}
+	
+	@synchronized(_ingestedFiles) {
+		if([[request objectForKey:@"generation"] unsignedIntegerValue] == _ingestionGeneration) {
+			if(nil != file) {
+				[_ingestedFiles addObject:[NSDictionary dictionaryWithObjectsAndKeys:file, @"file", [request objectForKey:@"request"], @"request", [request objectForKey:@"generation"], @"generation", nil]];
+			}
+			else if(nil != failure) {
+				[_failedFiles addObject:failure];
+			}
+			
+			if(nil == file && NO == duplicate) {
+				[_ingestingFilenames removeObject:filename];
+			}
+			
+			++_filesIngested;
+		}
+	}
+	
+	[pool release];
+}
 
-	@catch(NSException *exception) {
-		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
-		[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
-		[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while opening the document \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:filename]]];
-		[alert setInformativeText:[exception reason]];
-		[alert setAlertStyle:NSWarningAlertStyle];		
-		[alert runModal];
+- (BOOL) isCurrentIngestionRequest:(NSDictionary *)request
+{
+	@synchronized(_ingestedFiles) {
+		return [[request objectForKey:@"generation"] unsignedIntegerValue] == _ingestionGeneration;
+	}
+}
+
+- (void) beginAddingFiles
+{
+	@synchronized(_ingestedFiles) {
+		_filesQueued		= 0;
+		_filesIngested		= 0;
+	}
+	
+	_filesFailed			= 0;
+	_ingestionStartTime		= CFAbsoluteTimeGetCurrent();
+	
+	// Insert the parsed files in batches; the common modes keep rows arriving during drags and live resizes
+	_ingestionTimer = [[NSTimer timerWithTimeInterval:0.25 target:self selector:@selector(processIngestedFiles:) userInfo:nil repeats:YES] retain];
+	[[NSRunLoop currentRunLoop] addTimer:_ingestionTimer forMode:NSRunLoopCommonModes];
+	
+	[self setIngestionStatus:NSLocalizedStringFromTable(@"Adding files...", @"FileConversion", @"")];
+	[self setAddingFiles:YES];
+}
+
+- (void) processIngestedFiles:(NSTimer *)timer
+{
+	NSArray					*ingestedFiles;
+	NSArray					*failedFiles;
+	NSMutableDictionary		*filesByRequest;
+	NSMutableSet			*existingFilenames;
+	NSMutableArray			*requestFiles;
+	NSNumber				*request;
+	NSUInteger				generation;
+	NSUInteger				filesQueued;
+	NSUInteger				filesIngested;
+	CFAbsoluteTime			elapsed;
+	
+	// Check for completion first, so results appended by the last operations are part of this batch
+	BOOL					finished			= (0 == [_ingestionQueue operationCount]);
+	
+	@synchronized(_ingestedFiles) {
+		ingestedFiles	= [[_ingestedFiles copy] autorelease];
+		failedFiles		= [[_failedFiles copy] autorelease];
+		generation		= _ingestionGeneration;
+		filesQueued		= _filesQueued;
+		filesIngested	= _filesIngested;
 		
-		return NO;
+		[_ingestedFiles removeAllObjects];
+		[_failedFiles removeAllObjects];
 	}
 	
-	// Get the icon for the file
-	icon = getIconForFile(filename, NSMakeSize(16, 16));
+	// Group the new files by request so each request's files are inserted with a single rearrangement
+	filesByRequest		= [NSMutableDictionary dictionary];
+	existingFilenames	= [NSMutableSet setWithArray:[[_filesController arrangedObjects] valueForKey:@"filename"]];
 	
-	if(NSNotFound == index) {
-		[_filesController addObject:[NSDictionary dictionaryWithObjects:[NSArray arrayWithObjects:filename, [[NSFileManager defaultManager] displayNameAtPath:filename], icon, metadata, nil] forKeys:[NSArray arrayWithObjects:@"filename", @"displayName", @"icon", @"metadata", nil]]];
+	for(NSDictionary *ingestedFile in ingestedFiles) {
+		NSMutableDictionary		*file		= [[[ingestedFile objectForKey:@"file"] mutableCopy] autorelease];
+		NSString				*filename	= [file objectForKey:@"filename"];
+		
+		// Don't add files from a stopped ingestion, or re-add files
+		if([[ingestedFile objectForKey:@"generation"] unsignedIntegerValue] != generation || [existingFilenames containsObject:filename]) {
+			continue;
+		}
+		
+		[existingFilenames addObject:filename];
+		
+		// AppKit images aren't safe to create on the ingestion queue
+		[file setObject:getIconForFile(filename, NSMakeSize(16, 16)) forKey:@"icon"];
+		
+		requestFiles = [filesByRequest objectForKey:[ingestedFile objectForKey:@"request"]];
+		if(nil == requestFiles) {
+			requestFiles = [NSMutableArray array];
+			[filesByRequest setObject:requestFiles forKey:[ingestedFile objectForKey:@"request"]];
+		}
+		
+		[requestFiles addObject:file];
 	}
-	else {
-		[_filesController insertObject:[NSDictionary dictionaryWithObjects:[NSArray arrayWithObjects:filename, [[NSFileManager defaultManager] displayNameAtPath:filename], icon, metadata, nil] forKeys:[NSArray arrayWithObjects:@"filename", @"displayName", @"icon", @"metadata", nil]] atArrangedObjectIndex:index];			
+	
+	for(request in [[filesByRequest allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+		NSNumber	*index		= [_insertionIndexes objectForKey:request];
+		
+		requestFiles = [filesByRequest objectForKey:request];
+		
+		if(nil == index) {
+			[_filesController addObjects:requestFiles];
+		}
+		else {
+			NSUInteger	insertionIndex	= MIN([index unsignedIntegerValue], [[_filesController arrangedObjects] count]);
+			NSUInteger	count			= [requestFiles count];
+			
+			[_filesController insertObjects:requestFiles atArrangedObjectIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(insertionIndex, count)]];
+			
+			// Later files from this request follow these ones, and other requests' rows move down
+			for(NSNumber *key in [_insertionIndexes allKeys]) {
+				NSUInteger otherIndex = [[_insertionIndexes objectForKey:key] unsignedIntegerValue];
+				
+				if([key isEqualToNumber:request]) {
+					[_insertionIndexes setObject:[NSNumber numberWithUnsignedInteger:insertionIndex + count] forKey:key];
+				}
+				else if(otherIndex >= insertionIndex) {
+					[_insertionIndexes setObject:[NSNumber numberWithUnsignedInteger:otherIndex + count] forKey:key];
+				}
+			}
+		}
+		
+		[_filesToSelect addObjectsFromArray:requestFiles];
 	}
 	
-	return YES;
+	// The list now guards against duplicates of this batch, so the files may be ingested again once removed from it
+	@synchronized(_ingestedFiles) {
+		if(generation == _ingestionGeneration) {
+			for(NSDictionary *ingestedFile in ingestedFiles) {
+				[_ingestingFilenames removeObject:[[ingestedFile objectForKey:@"file"] objectForKey:@"filename"]];
+			}
+		}
+	}
+	
+	for(NSDictionary *failure in failedFiles) {
+		[LogController logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while opening the document \"%@\".", @"Exceptions", @""), [failure objectForKey:@"filename"]]];
+		[LogController logMessage:[failure objectForKey:@"reason"]];
+		
+		// Keep the first failure for the alert shown when ingestion completes
+		if(0 == _filesFailed++) {
+			_firstFailure = [failure retain];
+		}
+	}
+	
+	elapsed = CFAbsoluteTimeGetCurrent() - _ingestionStartTime;
+	[self setIngestionStatus:[NSString stringWithFormat:NSLocalizedStringFromTable(@"%lu of %lu files (%.1f files/sec)", @"FileConversion", @""), (unsigned long)filesIngested, (unsigned long)filesQueued, (0 < elapsed ? filesIngested / elapsed : 0.0)]];
+	
+	if(finished) {
+		[self finishAddingFiles];
+	}
+}
+
+- (void) finishAddingFiles
+{
+	[_ingestionTimer invalidate];
+	[_ingestionTimer release];
+	_ingestionTimer = nil;
+	
+	if(0 != [_filesToSelect count]) {
+		[_filesController setSelectedObjects:_filesToSelect];
+	}
+	
+	[_filesToSelect removeAllObjects];
+	[_insertionIndexes removeAllObjects];
+	
+	[self setIngestionStatus:nil];
+	[self setAddingFiles:NO];
+	
+	if(0 != _filesFailed) {
+		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
+		[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
+		if(1 == _filesFailed) {
+			[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while opening the document \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[_firstFailure objectForKey:@"filename"]]]];
+			[alert setInformativeText:[_firstFailure objectForKey:@"reason"]];
+		}
+		else {
+			[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"%lu files could not be added.", @"Exceptions", @""), (unsigned long)_filesFailed]];
+			[alert setInformativeText:NSLocalizedStringFromTable(@"The reasons are listed in the log.", @"Exceptions", @"")];
+		}
+		[alert setAlertStyle:NSWarningAlertStyle];
+		
+		[_firstFailure release];
+		_firstFailure	= nil;
+		_filesFailed	= 0;
+		
+		[alert runModal];
+	}
+}
+
+- (void) setAddingFiles:(BOOL)addingFiles
+{
+	_addingFiles = addingFiles;
+}
+
+- (void) setIngestionStatus:(NSString *)ingestionStatus
+{
+	[_ingestionStatus release];
+	_ingestionStatus = [ingestionStatus copy];
 }
 
 - (void) clearFileList
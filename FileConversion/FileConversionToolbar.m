@@ -24,6 +24,8 @@
 static NSString		*EncodeToolbarItemIdentifier			= @"org.sbooth.Max.FileConversion.Toolbar.Encode";
 static NSString		*MetadataToolbarItemIdentifier			= @"org.sbooth.Max.FileConversion.Toolbar.Metadata";
 static NSString		*AlbumArtToolbarItemIdentifier			= @"org.sbooth.Max.FileConversion.Toolbar.AlbumArt";
+static NSString		*ProgressToolbarItemIdentifier			= @"org.sbooth.Max.FileConversion.Toolbar.Progress";
+static NSString		*MirrorToolbarItemIdentifier			= @"org.sbooth.Max.FileConversion.Toolbar.Mirror";
 
 @implementation FileConversionToolbar
 
@@ -88,6 +90,58 @@ static NSString		*AlbumArtToolbarItemIdentifier			= @"org.sbooth.Max.FileConvers
 		[toolbarItem setTarget:[FileConversionController sharedController]];
 		[toolbarItem setAction:@selector(toggleAlbumArt:)];
 	}
+	else if([itemIdentifier isEqualToString:MirrorToolbarItemIdentifier]) {
+		toolbarItem = [[[NSToolbarItem alloc] initWithItemIdentifier:itemIdentifier] autorelease];
+		
+		[toolbarItem setLabel: NSLocalizedStringFromTable(@"Mirror", @"FileConversion", @"")];
+		[toolbarItem setPaletteLabel: NSLocalizedStringFromTable(@"Mirror Library", @"FileConversion", @"")];
+		[toolbarItem setToolTip: NSLocalizedStringFromTable(@"Bring the converted copy of a folder up to date", @"FileConversion", @"")];
+		[toolbarItem setImage: [NSImage imageNamed:NSImageNameRefreshTemplate]];
+		
+		[toolbarItem setTarget:[FileConversionController sharedController]];
+		[toolbarItem setAction:@selector(mirrorLibrary:)];
+	}
+	else if([itemIdentifier isEqualToString:ProgressToolbarItemIdentifier]) {
+		FileConversionController	*controller		= [FileConversionController sharedController];
+		NSDictionary				*hiddenOptions	= [NSDictionary dictionaryWithObject:NSNegateBooleanTransformerName forKey:NSValueTransformerNameBindingOption];
+		NSView						*view			= [[[NSView alloc] initWithFrame:NSMakeRect(0, 0, 260, 20)] autorelease];
+		NSProgressIndicator			*spinner		= [[[NSProgressIndicator alloc] initWithFrame:NSMakeRect(0, 2, 16, 16)] autorelease];
+		NSTextField					*status			= [[[NSTextField alloc] initWithFrame:NSMakeRect(20, 2, 216, 16)] autorelease];
+		NSButton					*stop			= [[[NSButton alloc] initWithFrame:NSMakeRect(240, 2, 16, 16)] autorelease];
+		
+		[spinner setStyle:NSProgressIndicatorSpinningStyle];
+		[spinner setControlSize:NSSmallControlSize];
+		[spinner setDisplayedWhenStopped:NO];
+		[spinner bind:@"animate" toObject:controller withKeyPath:@"addingFiles" options:nil];
+		
+		[status setEditable:NO];
+		[status setBordered:NO];
+		[status setDrawsBackground:NO];
+		[status setFont:[NSFont systemFontOfSize:[NSFont smallSystemFontSize]]];
+		[[status cell] setLineBreakMode:NSLineBreakByTruncatingTail];
+		[status bind:@"value" toObject:controller withKeyPath:@"ingestionStatus" options:nil];
+		
+		[stop setButtonType:NSMomentaryChangeButton];
+		[stop setBordered:NO];
+		[stop setImage:[NSImage imageNamed:NSImageNameStopProgressFreestandingTemplate]];
+		[stop setImagePosition:NSImageOnly];
+		[stop setToolTip:NSLocalizedStringFromTable(@"Stop adding files", @"FileConversion", @"")];
+		[stop setTarget:controller];
+		[stop setAction:@selector(stopAddingFiles:)];
+		[stop bind:@"hidden" toObject:controller withKeyPath:@"addingFiles" options:hiddenOptions];
+		
+		[view addSubview:spinner];
+		[view addSubview:status];
+		[view addSubview:stop];
+		
+		toolbarItem = [[[NSToolbarItem alloc] initWithItemIdentifier:itemIdentifier] autorelease];
+		
+		[toolbarItem setLabel: NSLocalizedStringFromTable(@"Progress", @"FileConversion", @"")];
+		[toolbarItem setPaletteLabel: NSLocalizedStringFromTable(@"Progress", @"FileConversion", @"")];
+		[toolbarItem setView:view];
+		[toolbarItem setMinSize:[view frame].size];
+		[toolbarItem setMaxSize:[view frame].size];
+	}
 	else
 		toolbarItem = nil;
 	
@@ -99,6 +153,9 @@ static NSString		*AlbumArtToolbarItemIdentifier			= @"org.sbooth.Max.FileConvers
     return [NSArray arrayWithObjects:EncodeToolbarItemIdentifier, 
 			MetadataToolbarItemIdentifier, 
 			AlbumArtToolbarItemIdentifier, 
+			MirrorToolbarItemIdentifier, 
+			NSToolbarFlexibleSpaceItemIdentifier, 
+			ProgressToolbarItemIdentifier, 
 			nil];
 }
 
@@ -107,6 +164,8 @@ static NSString		*AlbumArtToolbarItemIdentifier			= @"org.sbooth.Max.FileConvers
     return [NSArray arrayWithObjects:EncodeToolbarItemIdentifier, 
 			MetadataToolbarItemIdentifier, 
 			AlbumArtToolbarItemIdentifier,
+			MirrorToolbarItemIdentifier,
+			ProgressToolbarItemIdentifier,
 			NSToolbarSeparatorItemIdentifier, 
 			NSToolbarSpaceItemIdentifier, 
 			NSToolbarFlexibleSpaceItemIdentifier,
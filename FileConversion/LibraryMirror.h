@@ -0,0 +1,47 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#import <Cocoa/Cocoa.h>
+
+@class EncoderTask;
+
+// Keeps a converted copy of a folder of audio files up to date
+// A manifest of each source file's size, modification time, audio identity and outputs is kept per folder, so
+// only new and changed files are converted, files whose audio is unchanged are retagged in place and the outputs
+// of deleted files are removed
+@interface LibraryMirror : NSObject
+{
+	NSMutableDictionary		*_manifests;
+	NSMutableSet			*_dirtyManifests;
+	NSOperationQueue		*_scanQueue;
+}
+
++ (LibraryMirror *)		sharedMirror;
+
+// Compares sourceDirectory against its manifest and queues the necessary work; settings are those passed to EncoderController
+- (void)				mirrorDirectory:(NSString *)sourceDirectory settings:(NSDictionary *)settings;
+
+// Records the output of a completed conversion started by a mirror
+- (void)				encoderTaskDidComplete:(EncoderTask *)task;
+
+// Writes any changes to disk
+- (void)				synchronize;
+
+@end
@@ -0,0 +1,511 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#import "LibraryMirror.h"
+#import "EncoderController.h"
+#import "EncoderTask.h"
+#import "AudioMetadata.h"
+#import "TranscodeCache.h"
+#import "LogController.h"
+#import "UtilityFunctions.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <CommonCrypto/CommonDigest.h>
+
+// Changes are written to disk this many seconds after the most recent one
+#define SYNCHRONIZE_DELAY		10.0
+
+// Increment whenever the archived form of the manifests changes
+#define MANIFEST_VERSION		1
+
+static LibraryMirror		*sSharedMirror			= nil;
+
+@interface LibraryMirror (Private)
+- (NSMutableDictionary *)	manifestForDirectory:(NSString *)sourceDirectory;
+- (NSString *)				manifestFilenameForDirectory:(NSString *)sourceDirectory;
+- (void)					scanDirectory:(NSDictionary *)request;
+- (void)					applyChanges:(NSDictionary *)changes;
+- (void)					removeOutputsOfEntry:(NSDictionary *)entry;
+- (void)					manifestChanged:(NSString *)sourceDirectory;
+- (void)					scheduleSynchronize;
+- (void)					applicationWillTerminate:(NSNotification *)aNotification;
+@end
+
+// The settings that determine a mirror's outputs; if any of them change every file is converted again
+static NSDictionary *
+outputSettings(NSDictionary *settings)
+{
+	NSMutableDictionary		*result		= [NSMutableDictionary dictionary];
+	
+	[result setValue:[settings objectForKey:@"encoders"] forKey:@"encoders"];
+	[result setValue:[settings objectForKey:@"outputDirectory"] forKey:@"outputDirectory"];
+	[result setValue:[settings objectForKey:@"outputFileNaming"] forKey:@"outputFileNaming"];
+	
+	return result;
+}
+
+// A file's outputs are complete when there is one for each format and none of them has been deleted
+static BOOL
+entryOutputsAreComplete(NSDictionary *entry, NSUInteger formatCount, NSFileManager *fileManager)
+{
+	NSArray			*outputs		= [entry objectForKey:@"outputs"];
+	NSDictionary	*output;
+	
+	if(formatCount != [outputs count])
+		return NO;
+	
+	for(output in outputs) {
+		if(NO == [fileManager fileExistsAtPath:[output objectForKey:@"filename"]])
+			return NO;
+	}
+	
+	return YES;
+}
+
+@implementation LibraryMirror
+
++ (LibraryMirror *) sharedMirror
+{
+	@synchronized(self) {
+		if(nil == sSharedMirror)
+			sSharedMirror = [[self alloc] init];
+	}
+	
+	return sSharedMirror;
+}
+
+- (id) init
+{
+	if((self = [super init])) {
+		_manifests			= [[NSMutableDictionary alloc] init];
+		_dirtyManifests		= [[NSMutableSet alloc] init];
+		_scanQueue			= [[NSOperationQueue alloc] init];
+		
+		// Scans are applied in the order they were requested
+		[_scanQueue setMaxConcurrentOperationCount:1];
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationWillTerminate:) name:NSApplicationWillTerminateNotification object:nil];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	
+	[_manifests release];		_manifests = nil;
+	[_dirtyManifests release];	_dirtyManifests = nil;
+	[_scanQueue release];		_scanQueue = nil;
+	
+	[super dealloc];
+}
+
+- (void) mirrorDirectory:(NSString *)sourceDirectory settings:(NSDictionary *)settings
+{
+	NSParameterAssert(nil != sourceDirectory);
+	NSParameterAssert(nil != settings);
+	
+	NSString				*directory			= [sourceDirectory stringByStandardizingPath];
+	NSMutableDictionary		*manifest			= [self manifestForDirectory:directory];
+	BOOL					settingsChanged		= (NO == [outputSettings(settings) isEqualToDictionary:[manifest objectForKey:@"outputSettings"]]);
+	NSDictionary			*request			= nil;
+	
+	// The scan works from a snapshot of the manifest; entries are replaced rather than modified, so a shallow copy is enough
+	request = [NSDictionary dictionaryWithObjectsAndKeys:
+		directory, @"sourceDirectory",
+		[[settings copy] autorelease], @"settings",
+		[[[manifest objectForKey:@"files"] copy] autorelease], @"files",
+		[NSNumber numberWithBool:settingsChanged], @"settingsChanged",
+		nil];
+	
+	[_scanQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(scanDirectory:) object:request] autorelease]];
+}
+
+- (void) encoderTaskDidComplete:(EncoderTask *)task
+{
+	NSString				*sourceDirectory	= [[[task taskInfo] settings] objectForKey:@"libraryMirror"];
+	NSMutableDictionary		*manifest			= nil;
+	NSString				*filename			= nil;
+	NSMutableDictionary		*entry				= nil;
+	NSDictionary			*format				= nil;
+	NSDictionary			*candidate			= nil;
+	NSMutableArray			*outputs			= nil;
+	NSDictionary			*output				= nil;
+	NSMutableDictionary		*newOutput			= nil;
+	
+	if(nil == sourceDirectory)
+		return;
+	
+	manifest	= [self manifestForDirectory:sourceDirectory];
+	filename	= [[[task taskInfo] inputFilenames] objectAtIndex:0];
+	entry		= [[[[manifest objectForKey:@"files"] objectForKey:filename] mutableCopy] autorelease];
+	
+	// The source was deleted by a later mirror
+	if(nil == entry)
+		return;
+	
+	for(candidate in [[manifest objectForKey:@"outputSettings"] objectForKey:@"encoders"]) {
+		if([[candidate objectForKey:@"settings"] isEqual:[task encoderSettings]]) {
+			format = candidate;
+			break;
+		}
+	}
+	
+	if(nil == format)
+		return;
+	
+	outputs = [NSMutableArray array];
+	for(output in [entry objectForKey:@"outputs"]) {
+		if(NO == [format isEqual:[output objectForKey:@"format"]])
+			[outputs addObject:output];
+	}
+	
+	newOutput = [NSMutableDictionary dictionary];
+	
+	[newOutput setObject:[task outputFilename] forKey:@"filename"];
+	[newOutput setObject:format forKey:@"format"];
+	[newOutput setValue:[task encoderSettingsString] forKey:@"settingsString"];
+	
+	[outputs addObject:newOutput];
+	[entry setObject:outputs forKey:@"outputs"];
+	
+	[[manifest objectForKey:@"files"] setObject:entry forKey:filename];
+	[self manifestChanged:sourceDirectory];
+}
+
+- (void) synchronize
+{
+	NSString		*sourceDirectory;
+	NSData			*data;
+	NSString		*directory			= [getApplicationDataDirectory() stringByAppendingPathComponent:@"Library Mirrors"];
+	BOOL			isDir;
+	
+	if(0 == [_dirtyManifests count])
+		return;
+	
+	if(NO == [[NSFileManager defaultManager] fileExistsAtPath:directory isDirectory:&isDir])
+		[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+	
+	for(sourceDirectory in _dirtyManifests) {
+		data = [NSKeyedArchiver archivedDataWithRootObject:[_manifests objectForKey:sourceDirectory]];
+		
+		if(NO == [data writeToFile:[self manifestFilenameForDirectory:sourceDirectory] atomically:YES])
+			NSLog(@"Unable to write the library mirror manifest for %@", sourceDirectory);
+	}
+	
+	[_dirtyManifests removeAllObjects];
+}
+
+@end
+
+@implementation LibraryMirror (Private)
+
+- (NSMutableDictionary *) manifestForDirectory:(NSString *)sourceDirectory
+{
+	NSMutableDictionary		*manifest		= [_manifests objectForKey:sourceDirectory];
+	NSData					*data			= nil;
+	NSDictionary			*archive		= nil;
+	
+	if(nil != manifest)
+		return manifest;
+	
+	data = [NSData dataWithContentsOfFile:[self manifestFilenameForDirectory:sourceDirectory]];
+	
+	// A manifest that can't be read is simply rebuilt, at the cost of converting every file again
+	if(nil != data) {
+		@try {
+			archive = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+		}
+		
+		@catch(NSException *exception) {
+			NSLog(@"Unable to read the library mirror manifest for %@: %@", sourceDirectory, [exception reason]);
+		}
+	}
+	
+	if(MANIFEST_VERSION == [[archive objectForKey:@"version"] intValue] && [sourceDirectory isEqualToString:[archive objectForKey:@"sourceDirectory"]]) {
+		manifest = [[archive mutableCopy] autorelease];
+		[manifest setObject:[[[archive objectForKey:@"files"] mutableCopy] autorelease] forKey:@"files"];
+	}
+	else {
+		manifest = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithInt:MANIFEST_VERSION], @"version",
+			sourceDirectory, @"sourceDirectory",
+			[NSMutableDictionary dictionary], @"files",
+			nil];
+	}
+	
+	[_manifests setObject:manifest forKey:sourceDirectory];
+	
+	return manifest;
+}
+
+// Manifests are named by the MD5 of the directory they describe
+- (NSString *) manifestFilenameForDirectory:(NSString *)sourceDirectory
+{
+	NSData				*pathData		= [sourceDirectory dataUsingEncoding:NSUTF8StringEncoding];
+	NSMutableString		*name			= [NSMutableString string];
+	unsigned char		digest			[ CC_MD5_DIGEST_LENGTH ];
+	unsigned			i;
+	
+	CC_MD5([pathData bytes], (CC_LONG)[pathData length], digest);
+	
+	for(i = 0; i < CC_MD5_DIGEST_LENGTH; ++i)
+		[name appendFormat:@"%02x", digest[i]];
+	
+	return [[getApplicationDataDirectory() stringByAppendingPathComponent:@"Library Mirrors"] stringByAppendingPathComponent:name];
+}
+
+- (void) scanDirectory:(NSDictionary *)request
+{
+	NSAutoreleasePool		*pool				= [[NSAutoreleasePool alloc] init];
+	NSAutoreleasePool		*loopPool			= nil;
+	NSFileManager			*manager			= [[[NSFileManager alloc] init] autorelease];
+	NSArray					*allowedTypes		= getAudioExtensions();
+	NSString				*directory			= [request objectForKey:@"sourceDirectory"];
+	NSDictionary			*settings			= [request objectForKey:@"settings"];
+	NSDictionary			*files				= [request objectForKey:@"files"];
+	NSUInteger				formatCount			= [[settings objectForKey:@"encoders"] count];
+	BOOL					settingsChanged		= [[request objectForKey:@"settingsChanged"] boolValue];
+	NSString				*outputDirectory	= [[settings objectForKey:@"outputDirectory"] stringByAppendingString:@"/"];
+	NSMutableSet			*found				= [NSMutableSet set];
+	NSMutableArray			*conversions		= [NSMutableArray array];
+	NSMutableArray			*retags				= [NSMutableArray array];
+	NSMutableArray			*deletions			= [NSMutableArray array];
+	NSMutableArray			*failures			= [NSMutableArray array];
+	NSUInteger				unchanged			= 0;
+	NSDirectoryEnumerator	*enumerator;
+	NSString				*subpath;
+	NSString				*filename;
+	NSDictionary			*entry;
+	NSMutableDictionary		*newEntry;
+	NSNumber				*size, *modificationTime;
+	NSString				*audioIdentifier;
+	AudioMetadata			*metadata;
+	BOOL					complete, isDir;
+	struct stat				sourceStat;
+	
+	// An unmounted volume must not look like a library whose files were all deleted
+	if(NO == [manager fileExistsAtPath:directory isDirectory:&isDir] || NO == isDir) {
+		[failures addObject:[NSDictionary dictionaryWithObjectsAndKeys:directory, @"filename", NSLocalizedStringFromTable(@"The folder could not be found.", @"Log", @""), @"reason", nil]];
+		[self performSelectorOnMainThread:@selector(applyChanges:) withObject:[NSDictionary dictionaryWithObjectsAndKeys:directory, @"sourceDirectory", failures, @"failures", nil] waitUntilDone:NO];
+		[pool release];
+		return;
+	}
+	
+	enumerator = [manager enumeratorAtPath:directory];
+	while((subpath = [enumerator nextObject])) {
+		loopPool	= [[NSAutoreleasePool alloc] init];
+		filename	= [directory stringByAppendingPathComponent:subpath];
+		
+		// Ignore dotfiles, files that don't have our extensions, directories and the mirror's own output
+		if([[subpath lastPathComponent] hasPrefix:@"."] 
+		   || NO == [allowedTypes containsObject:[[subpath pathExtension] lowercaseString]] 
+		   || [filename hasPrefix:outputDirectory]
+		   || -1 == stat([filename fileSystemRepresentation], &sourceStat) 
+		   || S_ISDIR(sourceStat.st_mode)) {
+			[loopPool release];
+			continue;
+		}
+		
+		[found addObject:filename];
+		
+		entry				= [files objectForKey:filename];
+		size				= [NSNumber numberWithLongLong:sourceStat.st_size];
+		modificationTime	= [NSNumber numberWithLong:sourceStat.st_mtime];
+		complete			= (nil != entry && NO == settingsChanged && entryOutputsAreComplete(entry, formatCount, manager));
+		
+		if(complete && [size isEqualToNumber:[entry objectForKey:@"size"]] && [modificationTime isEqualToNumber:[entry objectForKey:@"modificationTime"]]) {
+			++unchanged;
+			[loopPool release];
+			continue;
+		}
+		
+		metadata = nil;
+		
+		@try {
+			metadata = [AudioMetadata metadataFromFile:filename];
+		}
+		
+		@catch(NSException *exception) {
+			[failures addObject:[NSDictionary dictionaryWithObjectsAndKeys:filename, @"filename", [exception reason], @"reason", nil]];
+		}
+		
+		if(nil == metadata) {
+			[loopPool release];
+			continue;
+		}
+		
+		audioIdentifier		= [TranscodeCache audioIdentifierForFile:filename];
+		newEntry			= [NSMutableDictionary dictionaryWithObjectsAndKeys:size, @"size", modificationTime, @"modificationTime", nil];
+		
+		[newEntry setValue:audioIdentifier forKey:@"audioIdentifier"];
+		
+		// If the decoded audio is known to be the same, only the tags changed
+		if(complete && nil != audioIdentifier && [audioIdentifier isEqualToString:[entry objectForKey:@"audioIdentifier"]]) {
+			[newEntry setObject:[entry objectForKey:@"outputs"] forKey:@"outputs"];
+			[retags addObject:[NSDictionary dictionaryWithObjectsAndKeys:filename, @"filename", metadata, @"metadata", newEntry, @"entry", nil]];
+		}
+		else {
+			[newEntry setObject:[NSArray array] forKey:@"outputs"];
+			[conversions addObject:[NSDictionary dictionaryWithObjectsAndKeys:filename, @"filename", metadata, @"metadata", newEntry, @"entry", nil]];
+		}
+		
+		[loopPool release];
+	}
+	
+	// A file is only gone if it verifiably no longer exists; one in a folder that couldn't be listed, or that couldn't
+	// be examined, keeps its outputs until a later scan can tell
+	for(filename in files) {
+		if(NO == [found containsObject:filename] 
+		   && -1 == lstat([filename fileSystemRepresentation], &sourceStat) 
+		   && (ENOENT == errno || ENOTDIR == errno))
+			[deletions addObject:filename];
+	}
+	
+	[self performSelectorOnMainThread:@selector(applyChanges:) withObject:[NSDictionary dictionaryWithObjectsAndKeys:
+		directory, @"sourceDirectory",
+		settings, @"settings",
+		conversions, @"conversions",
+		retags, @"retags",
+		deletions, @"deletions",
+		failures, @"failures",
+		[NSNumber numberWithUnsignedInteger:unchanged], @"unchanged",
+		nil] waitUntilDone:NO];
+	
+	[pool release];
+}
+
+- (void) applyChanges:(NSDictionary *)changes
+{
+	NSString				*sourceDirectory	= [changes objectForKey:@"sourceDirectory"];
+	NSDictionary			*settings			= [changes objectForKey:@"settings"];
+	NSMutableDictionary		*manifest			= [self manifestForDirectory:sourceDirectory];
+	NSMutableDictionary		*files				= [manifest objectForKey:@"files"];
+	NSMutableDictionary		*mirrorSettings		= nil;
+	NSDictionary			*change;
+	NSDictionary			*output;
+	NSDictionary			*failure;
+	NSString				*filename;
+	
+	for(failure in [changes objectForKey:@"failures"])
+		[LogController logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Unable to mirror \"%@\": %@", @"Log", @""), [failure objectForKey:@"filename"], [failure objectForKey:@"reason"]]];
+	
+	// The scan didn't complete
+	if(nil == settings)
+		return;
+	
+	[manifest setObject:outputSettings(settings) forKey:@"outputSettings"];
+	
+	// Conversions are tagged with the mirror they belong to, so their outputs can be recorded when they complete
+	mirrorSettings = [[settings mutableCopy] autorelease];
+	[mirrorSettings setObject:sourceDirectory forKey:@"libraryMirror"];
+	
+	for(filename in [changes objectForKey:@"deletions"]) {
+		[self removeOutputsOfEntry:[files objectForKey:filename]];
+		[files removeObjectForKey:filename];
+	}
+	
+	for(change in [changes objectForKey:@"retags"]) {
+		NSMutableDictionary		*entry			= [[[change objectForKey:@"entry"] mutableCopy] autorelease];
+		NSMutableArray			*outputs		= [NSMutableArray array];
+		NSMutableDictionary		*newOutput;
+		
+		// Outputs named by their tags move along with them
+		for(output in [entry objectForKey:@"outputs"]) {
+			newOutput = [[output mutableCopy] autorelease];
+			
+			@try {
+				[newOutput setObject:[[EncoderController sharedController] retagFile:[output objectForKey:@"filename"] metadata:[change objectForKey:@"metadata"] settings:settings format:[output objectForKey:@"format"] encoderSettingsString:[output objectForKey:@"settingsString"]] forKey:@"filename"];
+			}
+			
+			@catch(NSException *exception) {
+				[LogController logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Unable to mirror \"%@\": %@", @"Log", @""), [change objectForKey:@"filename"], [exception reason]]];
+			}
+			
+			[outputs addObject:newOutput];
+		}
+		
+		[entry setObject:outputs forKey:@"outputs"];
+		[files setObject:entry forKey:[change objectForKey:@"filename"]];
+	}
+	
+	for(change in [changes objectForKey:@"conversions"]) {
+		filename = [change objectForKey:@"filename"];
+		
+		// Remove the stale outputs first, so the new ones can take their names
+		[self removeOutputsOfEntry:[files objectForKey:filename]];
+		[files setObject:[change objectForKey:@"entry"] forKey:filename];
+		
+		@try {
+			[[EncoderController sharedController] encodeFile:filename metadata:[change objectForKey:@"metadata"] settings:mirrorSettings];
+		}
+		
+		@catch(NSException *exception) {
+			[LogController logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Unable to mirror \"%@\": %@", @"Log", @""), filename, [exception reason]]];
+		}
+	}
+	
+	[LogController logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Mirrored %@: %lu files to convert, %lu retagged, %lu removed, %lu unchanged", @"Log", @""), 
+		sourceDirectory,
+		(unsigned long)[[changes objectForKey:@"conversions"] count],
+		(unsigned long)[[changes objectForKey:@"retags"] count],
+		(unsigned long)[[changes objectForKey:@"deletions"] count],
+		(unsigned long)[[changes objectForKey:@"unchanged"] unsignedIntegerValue]]];
+	
+	[self manifestChanged:sourceDirectory];
+}
+
+- (void) removeOutputsOfEntry:(NSDictionary *)entry
+{
+	NSFileManager	*fileManager	= [NSFileManager defaultManager];
+	NSDictionary	*output;
+	NSString		*filename;
+	
+	for(output in [entry objectForKey:@"outputs"]) {
+		filename = [output objectForKey:@"filename"];
+		
+		if([fileManager fileExistsAtPath:filename] && NO == [fileManager removeItemAtPath:filename error:nil])
+			[LogController logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Unable to delete \"%@\".", @"Log", @""), filename]];
+		
+		// The name is free for the re-encode that may follow
+		releaseUniqueFilename(filename);
+	}
+}
+
+- (void) manifestChanged:(NSString *)sourceDirectory
+{
+	[_dirtyManifests addObject:sourceDirectory];
+	[self scheduleSynchronize];
+}
+
+- (void) scheduleSynchronize
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronize) object:nil];
+	[self performSelector:@selector(synchronize) withObject:nil afterDelay:SYNCHRONIZE_DELAY];
+}
+
+- (void) applicationWillTerminate:(NSNotification *)aNotification
+{
+	[self synchronize];
+}
+
+@end
@@ -20,7 +20,7 @@
 
 #import <Cocoa/Cocoa.h>
 
-@interface AudioMetadata : NSObject
+@interface AudioMetadata : NSObject <NSCoding>
 {
 	NSNumber				*_trackNumber;
 	NSNumber				*_trackTotal;
@@ -45,6 +45,7 @@
 	NSNumber				*_length;
 	
 	NSImage					*_albumArt;
+	NSData					*_albumArtData;
 	
 	NSString				*_discId;
 	NSString				*_MCN;
@@ -144,6 +145,17 @@
 - (NSImage *)	albumArt;
 - (void)		setAlbumArt:(NSImage *)albumArt;
 
+// The album art exactly as it was read from the file, if it came from one
+- (NSData *)	albumArtData;
+- (void)		setAlbumArtData:(NSData *)albumArtData;
+- (NSString *)	albumArtMIMEType;
+
+// The album art in the requested format, converted at most once per image
+- (NSData *)	albumArtDataOfType:(NSBitmapImageFileType)type;
+
+// JPEG and PNG art is passed through untouched, anything else is converted to PNG
+- (NSData *)	albumArtDataForTags:(NSString **)MIMEType;
+
 - (NSString *)	playlist;
 - (void)		setPlaylist:(NSString *)playlist;
 
@@ -19,6 +19,9 @@
  */
 
 #import "AudioMetadata.h"
+#import "MetadataCache.h"
+#import "AlbumArtCache.h"
+#import "NamingScheme.h"
 
 #import "UtilityFunctions.h"
 
@@ -48,7 +51,9 @@
 #include <wavpack/wavpack.h>
 
 @interface AudioMetadata (FileMetadata)
++ (AudioMetadata *)		metadataFromUncachedFile:(NSString *)filename;
 + (AudioMetadata *)		metadataFromFLACFile:(NSString *)filename;
++ (void)				parseFLACVorbisComment:(FLAC__StreamMetadata *)block intoMetadata:(AudioMetadata *)result;
 + (AudioMetadata *)		metadataFromMP3File:(NSString *)filename;
 + (AudioMetadata *)		metadataFromMP4File:(NSString *)filename;
 + (AudioMetadata *)		metadataFromOggVorbisFile:(NSString *)filename;
@@ -73,8 +78,22 @@
 
 + (BOOL) accessInstanceVariablesDirectly { return NO; }
 
-// Attempt to parse metadata from filename
+// Attempt to parse metadata from filename, unless it hasn't changed since it was last read
 + (AudioMetadata *) metadataFromFile:(NSString *)filename
+{
+	AudioMetadata *metadata = [[MetadataCache sharedCache] metadataForFile:filename];
+	
+	if(nil == metadata) {
+		metadata = [self metadataFromUncachedFile:filename];
+		
+		if(nil != metadata)
+			[[MetadataCache sharedCache] setMetadata:metadata forFile:filename];
+	}
+	
+	return metadata;
+}
+
++ (AudioMetadata *) metadataFromUncachedFile:(NSString *)filename
 {
 	NSString *extension = [[filename pathExtension] lowercaseString];
 	
@@ -121,6 +140,47 @@
 
 #pragma mark Class
 
++ (NSSet *)		keyPathsForValuesAffectingAlbumArt				{ return [NSSet setWithObject:@"albumArtData"]; }
+
+// The properties preserved by NSCoding, which leaves out the album art
++ (NSArray *) codedKeys
+{
+	static NSArray *sCodedKeys = nil;
+	
+	@synchronized(self) {
+		if(nil == sCodedKeys)
+			sCodedKeys = [[NSArray alloc] initWithObjects:
+				@"trackNumber", @"trackTotal", @"trackTitle", @"trackArtist", @"trackComposer", @"trackDate", @"trackGenre", @"trackComment",
+				@"albumTitle", @"albumArtist", @"albumComposer", @"albumDate", @"albumGenre", @"albumComment",
+				@"compilation", @"discNumber", @"discTotal", @"length",
+				@"discId", @"MCN", @"ISRC",
+				@"musicbrainzTrackId", @"musicbrainzArtistId", @"musicbrainzAlbumId", @"musicbrainzAlbumArtistId",
+				@"playlist", nil];
+	}
+	
+	return sCodedKeys;
+}
+
+- (id) initWithCoder:(NSCoder *)decoder
+{
+	if((self = [super init])) {
+		NSString *key;
+		
+		for(key in [AudioMetadata codedKeys])
+			[self setValue:[decoder decodeObjectForKey:key] forKey:key];
+	}
+	
+	return self;
+}
+
+- (void) encodeWithCoder:(NSCoder *)encoder
+{
+	NSString *key;
+	
+	for(key in [AudioMetadata codedKeys])
+		[encoder encodeObject:[self valueForKey:key] forKey:key];
+}
+
 - (void) dealloc
 {
 	[_trackNumber release];			_trackNumber = nil;
@@ -146,6 +206,7 @@
 	[_length release];				_length = nil;
 
 	[_albumArt release];			_albumArt = nil;
+	[_albumArtData release];		_albumArtData = nil;
 	
 	[_discId release];				_discId = nil;
 	[_MCN release];					_MCN = nil;
@@ -163,111 +224,37 @@
 
 - (NSString *) replaceKeywordsInString:(NSString *)namingScheme
 {
-	NSMutableString *customPath = [[NSMutableString alloc] init];
+	NSString			*values				[ kNamingSchemeKeywordCount ];
+	
+	NSParameterAssert(nil != namingScheme);
 	
 	// Get the elements needed for the substitutions
 	NSNumber			*discNumber			= [self discNumber];
 	NSNumber			*discTotal			= [self discTotal];
-	NSString			*albumArtist		= [self albumArtist];
-	NSString			*albumTitle			= [self albumTitle];
-	NSString			*albumGenre			= [self albumGenre];
-	NSString			*albumYear			= [self albumDate];
-	NSString			*albumComposer		= [self albumComposer];
-	NSString			*albumComment		= [self albumComment];
 	NSNumber			*trackNumber		= [self trackNumber];
 	NSNumber			*trackTotal			= [self trackTotal];
-	NSString			*trackArtist		= [self trackArtist];
-	NSString			*trackTitle			= [self trackTitle];
-	NSString			*trackGenre			= [self trackGenre];
-	NSString			*trackYear			= [self trackDate];
-	NSString			*trackComposer		= [self trackComposer];
-	NSString			*trackComment		= [self trackComment];
 	
-	NSParameterAssert(nil != namingScheme);
-//		@throw [NSException exceptionWithName:@"NSObjectInaccessibleException" reason:@"The custom naming string appears to be invalid." userInfo:nil];
-	[customPath setString:namingScheme];
+	values[kNamingSchemeKeywordDiscNumber]		= (nil == discNumber ? @"" : [NSString stringWithFormat:@"%u", [discNumber intValue]]);
+	values[kNamingSchemeKeywordDiscTotal]		= (nil == discTotal ? @"" : [NSString stringWithFormat:@"%u", [discTotal intValue]]);
+	values[kNamingSchemeKeywordAlbumArtist]		= (nil == [self albumArtist] ? NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") : [self albumArtist]);
+	values[kNamingSchemeKeywordAlbumTitle]		= (nil == [self albumTitle] ? @"Unknown Disc" : [self albumTitle]);
+	values[kNamingSchemeKeywordAlbumGenre]		= (nil == [self albumGenre] ? @"Unknown Genre" : [self albumGenre]);
+	values[kNamingSchemeKeywordAlbumDate]		= (nil == [self albumDate] ? @"Unknown Date" : [self albumDate]);
+	values[kNamingSchemeKeywordAlbumComposer]	= (nil == [self albumComposer] ? @"Unknown Composer" : [self albumComposer]);
+	values[kNamingSchemeKeywordAlbumComment]	= (nil == [self albumComment] ? @"" : [self albumComment]);
+	values[kNamingSchemeKeywordTrackNumber]		= (nil == trackNumber ? @"" : [NSString stringWithFormat:@"%u", [trackNumber intValue]]);
+	values[kNamingSchemeKeywordTrackTotal]		= (nil == trackTotal ? @"" : [NSString stringWithFormat:@"%u", [trackTotal intValue]]);
+	values[kNamingSchemeKeywordTrackArtist]		= (nil == [self trackArtist] ? NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") : [self trackArtist]);
+	values[kNamingSchemeKeywordTrackTitle]		= (nil == [self trackTitle] ? NSLocalizedStringFromTable(@"Unknown Track", @"CompactDisc", @"") : [self trackTitle]);
+	values[kNamingSchemeKeywordTrackGenre]		= (nil == [self trackGenre] ? @"Unknown Genre" : [self trackGenre]);
+	values[kNamingSchemeKeywordTrackDate]		= (nil == [self trackDate] ? @"Unknown Date" : [self trackDate]);
+	values[kNamingSchemeKeywordTrackComposer]	= (nil == [self trackComposer] ? @"Unknown Composer" : [self trackComposer]);
+	values[kNamingSchemeKeywordTrackComment]	= (nil == [self trackComment] ? @"" : [self trackComment]);
 	
-	if(nil == discNumber)
-		[customPath replaceOccurrencesOfString:@"{discNumber}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{discNumber}" withString:[NSString stringWithFormat:@"%u", [discNumber intValue]] options:0 range:NSMakeRange(0, [customPath length])];					
-
-	if(nil == discTotal)
-		[customPath replaceOccurrencesOfString:@"{discTotal}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{discTotal}" withString:[NSString stringWithFormat:@"%u", [discTotal intValue]] options:0 range:NSMakeRange(0, [customPath length])];					
-
-	if(nil == albumArtist)
-		[customPath replaceOccurrencesOfString:@"{albumArtist}" withString:NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumArtist}" withString:makeStringSafeForFilename(albumArtist) options:0 range:NSMakeRange(0, [customPath length])];					
-
-	if(nil == albumTitle)
-		[customPath replaceOccurrencesOfString:@"{albumTitle}" withString:@"Unknown Disc" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumTitle}" withString:makeStringSafeForFilename(albumTitle) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == albumGenre)
-		[customPath replaceOccurrencesOfString:@"{albumGenre}" withString:@"Unknown Genre" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumGenre}" withString:makeStringSafeForFilename(albumGenre) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == albumYear)
-		[customPath replaceOccurrencesOfString:@"{albumDate}" withString:@"Unknown Date" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumDate}" withString:makeStringSafeForFilename(albumYear) options:0 range:NSMakeRange(0, [customPath length])];
+	// Not known here, so {sourceFilename} is left as written
+	values[kNamingSchemeKeywordSourceFilename]	= nil;
 	
-	if(nil == albumComposer)
-		[customPath replaceOccurrencesOfString:@"{albumComposer}" withString:@"Unknown Composer" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumComposer}" withString:makeStringSafeForFilename(albumComposer) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == albumComment)
-		[customPath replaceOccurrencesOfString:@"{albumComment}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumComment}" withString:makeStringSafeForFilename(albumComment) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackNumber)
-		[customPath replaceOccurrencesOfString:@"{trackNumber}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackNumber}" withString:[NSString stringWithFormat:@"%u", [trackNumber intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackTotal)
-		[customPath replaceOccurrencesOfString:@"{trackTotal}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackTotal}" withString:[NSString stringWithFormat:@"%u", [trackTotal intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackArtist)
-		[customPath replaceOccurrencesOfString:@"{trackArtist}" withString:NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackArtist}" withString:makeStringSafeForFilename(trackArtist) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackTitle)
-		[customPath replaceOccurrencesOfString:@"{trackTitle}" withString:NSLocalizedStringFromTable(@"Unknown Track", @"CompactDisc", @"") options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackTitle}" withString:makeStringSafeForFilename(trackTitle) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackGenre)
-		[customPath replaceOccurrencesOfString:@"{trackGenre}" withString:@"Unknown Genre" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackGenre}" withString:makeStringSafeForFilename(trackGenre) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackYear)
-		[customPath replaceOccurrencesOfString:@"{trackDate}" withString:@"Unknown Date" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackDate}" withString:makeStringSafeForFilename(trackYear) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackComposer)
-		[customPath replaceOccurrencesOfString:@"{trackComposer}" withString:@"Unknown Composer" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackComposer}" withString:makeStringSafeForFilename(trackComposer) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackComment)
-		[customPath replaceOccurrencesOfString:@"{trackComment}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackComment}" withString:makeStringSafeForFilename(trackComment) options:0 range:NSMakeRange(0, [customPath length])];
-
-	return [customPath autorelease];
+	return [[NamingScheme namingSchemeWithString:namingScheme] stringWithValues:values substitutions:nil];
 }
 
 - (NSString *) description
@@ -312,7 +299,8 @@
 			nil		== [self discNumber] &&
 			nil		== [self discTotal] &&
 			nil		== [self length] &&
-			nil		== [self albumArt] &&
+			nil		== _albumArt &&
+			nil		== [self albumArtData] &&
 			nil		== [self discId] &&
 			nil		== [self MCN] &&
 			nil		== [self ISRC] &&
@@ -347,7 +335,78 @@
 
 - (NSNumber *)	length						{ return [[_length retain] autorelease]; }
 
-- (NSImage *)	albumArt					{ return [[_albumArt retain] autorelease]; }
+- (NSImage *) albumArt
+{
+	// Art read from a file is only decoded when something needs to display it
+	@synchronized(self) {
+		if(nil == _albumArt && nil != _albumArtData)
+			_albumArt = [[NSImage alloc] initWithData:_albumArtData];
+	}
+	
+	return [[_albumArt retain] autorelease];
+}
+
+- (NSData *)	albumArtData				{ return [[_albumArtData retain] autorelease]; }
+
+- (NSString *) albumArtMIMEType
+{
+	const unsigned char		*bytes		= (const unsigned char *)[_albumArtData bytes];
+	NSUInteger				length		= [_albumArtData length];
+	
+	if(3 <= length && 0xFF == bytes[0] && 0xD8 == bytes[1] && 0xFF == bytes[2])
+		return @"image/jpeg";
+	else if(8 <= length && 0 == memcmp(bytes, "\x89PNG\r\n\x1a\n", 8))
+		return @"image/png";
+	else if(6 <= length && (0 == memcmp(bytes, "GIF87a", 6) || 0 == memcmp(bytes, "GIF89a", 6)))
+		return @"image/gif";
+	else if(2 <= length && 0 == memcmp(bytes, "BM", 2))
+		return @"image/bmp";
+	else if(4 <= length && (0 == memcmp(bytes, "II*\0", 4) || 0 == memcmp(bytes, "MM\0*", 4)))
+		return @"image/tiff";
+	
+	return nil;
+}
+
+- (NSData *) albumArtDataOfType:(NSBitmapImageFileType)type
+{
+	NSString	*MIMEType		= nil;
+	NSData		*albumArtData	= [self albumArtData];
+	
+	switch(type) {
+		case NSTIFFFileType:		MIMEType = @"image/tiff";		break;
+		case NSBMPFileType:			MIMEType = @"image/bmp";		break;
+		case NSGIFFileType:			MIMEType = @"image/gif";		break;
+		case NSJPEGFileType:		MIMEType = @"image/jpeg";		break;
+		case NSPNGFileType:			MIMEType = @"image/png";		break;
+		default:					MIMEType = nil;					break;
+	}
+	
+	if(nil != albumArtData) {
+		if([MIMEType isEqualToString:[self albumArtMIMEType]])
+			return albumArtData;
+		
+		return [[AlbumArtCache sharedCache] dataForImageData:albumArtData ofType:type];
+	}
+	else if(nil != [self albumArt])
+		return [[AlbumArtCache sharedCache] dataForImage:[self albumArt] ofType:type];
+	
+	return nil;
+}
+
+- (NSData *) albumArtDataForTags:(NSString **)MIMEType
+{
+	NSParameterAssert(NULL != MIMEType);
+	
+	NSString	*albumArtMIMEType	= [self albumArtMIMEType];
+	
+	if([albumArtMIMEType isEqualToString:@"image/jpeg"] || [albumArtMIMEType isEqualToString:@"image/png"]) {
+		*MIMEType = albumArtMIMEType;
+		return [self albumArtData];
+	}
+	
+	*MIMEType = @"image/png";
+	return [self albumArtDataOfType:NSPNGFileType];
+}
 
 - (NSString *)	MCN							{ return [[_MCN retain] autorelease]; }
 - (NSString *)	ISRC						{ return [[_ISRC retain] autorelease]; }
@@ -384,7 +443,8 @@
 
 - (void)		setLength:(NSNumber *)length					{ [_length release]; _length = [length retain]; }
 
-- (void)		setAlbumArt:(NSImage *)albumArt					{ [_albumArt release]; _albumArt = [albumArt retain]; }
+- (void)		setAlbumArt:(NSImage *)albumArt					{ [_albumArtData release]; _albumArtData = nil; [_albumArt release]; _albumArt = [albumArt retain]; }
+- (void)		setAlbumArtData:(NSData *)albumArtData			{ [_albumArt release]; _albumArt = nil; [_albumArtData release]; _albumArtData = [albumArtData retain]; }
 
 - (void)		setDiscId:(NSString *)discId					{ [_discId release]; _discId = [discId retain]; }
 - (void)		setMCN:(NSString *)MCN							{ [_MCN release]; _MCN = [MCN retain]; }
@@ -407,139 +467,151 @@
 
 + (AudioMetadata *) metadataFromFLACFile:(NSString *)filename
 {
-	unsigned						i;
-	char							*fieldName			= NULL;
-	char							*fieldValue			= NULL;
-	NSMutableDictionary				*metadataDictionary;
-	NSString						*key, *value;
-	NSImage							*picture;
-	
 	AudioMetadata *result = [[AudioMetadata alloc] init];
 
-	FLAC__Metadata_Chain *chain = FLAC__metadata_chain_new();
-	NSAssert(NULL != chain, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+	FLAC__Metadata_SimpleIterator	*iterator			= FLAC__metadata_simple_iterator_new();
+	FLAC__StreamMetadata			*block				= NULL;
+	FLAC__StreamMetadata			*picture			= NULL;
 	
-	if(NO == FLAC__metadata_chain_read(chain, [filename fileSystemRepresentation])) {
-		FLAC__metadata_chain_delete(chain);
-		return [result autorelease];
-	}
-	
-	FLAC__Metadata_Iterator *iterator = FLAC__metadata_iterator_new();
 	NSAssert(NULL != iterator, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 	
-	FLAC__metadata_iterator_init(iterator, chain);
+	// The file is opened once and the metadata blocks walked in order; only the bodies of the blocks used are read
+	// getFLACMetadataBlockTypes() isn't used here: the iterator already sees every block header, so probing first
+	// would only open the file and walk the headers a second time
+	if(NO == FLAC__metadata_simple_iterator_init(iterator, [filename fileSystemRepresentation], YES, NO)) {
+		FLAC__metadata_simple_iterator_delete(iterator);
+		return [result autorelease];
+	}
 	
 	do {
-		FLAC__StreamMetadata *block = FLAC__metadata_iterator_get_block(iterator);
-		
-		if(NULL == block)
-			break;
-		
-		switch(block->type) {					
-			case FLAC__METADATA_TYPE_VORBIS_COMMENT:				
-				metadataDictionary = [NSMutableDictionary dictionary];
+		switch(FLAC__metadata_simple_iterator_get_block_type(iterator)) {
+			case FLAC__METADATA_TYPE_STREAMINFO:
+				block = FLAC__metadata_simple_iterator_get_block(iterator);
+				if(NULL != block)
+					[result setLength:[NSNumber numberWithUnsignedLong:(block->data.stream_info.total_samples * block->data.stream_info.sample_rate)]];
+				break;
 				
-				for(i = 0; i < block->data.vorbis_comment.num_comments; ++i) {
-										
-					// Let FLAC parse the comment for us
-					if(NO == FLAC__metadata_object_vorbiscomment_entry_to_name_value_pair(block->data.vorbis_comment.comments[i], &fieldName, &fieldValue)) {
-						// Ignore malformed comments
-						continue;
-					}
-
-					key		= [[NSString alloc] initWithBytesNoCopy:fieldName length:strlen(fieldName) encoding:NSASCIIStringEncoding freeWhenDone:YES];
-					value	= [[NSString alloc] initWithBytesNoCopy:fieldValue length:strlen(fieldValue) encoding:NSUTF8StringEncoding freeWhenDone:YES];
-								
-					if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ALBUM"]])
-						[result setAlbumTitle:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ARTIST"]])
-					{
-						[result setTrackArtist:value];
-						if(nil == [result albumArtist])
-							[result setAlbumArtist:value];
-					}
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"COMPOSER"]])
-						[result setAlbumComposer:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"GENRE"]])
-						[result setAlbumGenre:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DATE"]])
-						[result setAlbumDate:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DESCRIPTION"]])
-						[result setAlbumComment:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"TITLE"]])
-						[result setTrackTitle:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"TRACKNUMBER"]])
-						[result setTrackNumber:[NSNumber numberWithInt:[value intValue]]];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"TRACKTOTAL"]])
-						 [result setTrackTotal:[NSNumber numberWithInt:[value intValue]]];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"COMPILATION"]])
-						  [result setCompilation:[NSNumber numberWithBool:(BOOL)[value intValue]]];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DISCNUMBER"]])
-						   [result setDiscNumber:[NSNumber numberWithInt:[value intValue]]];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DISCTOTAL"]])
-							[result setDiscTotal:[NSNumber numberWithInt:[value intValue]]];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ISRC"]])
-						[result setISRC:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"MCN"]])
-						[result setMCN:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ALBUMARTIST"]])
-						[result setAlbumArtist:value];					
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_TRACKID"])
-						[result setMusicbrainzTrackId:value];					
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_ALBUMID"])
-						[result setMusicbrainzAlbumId:value];					
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_ARTISTID"])
-						[result setMusicbrainzArtistId:value];					
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_ALBUMARTISTID"])
-						[result setMusicbrainzAlbumArtistId:value];					
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_DISCID"])
-						[result setDiscId:value];					
-
-					// Maintain backwards compability for the following tags
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"YEAR"] && nil == [result albumDate])
-						[result setAlbumDate:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"COMMENT"] && nil == [result albumComment])
-						[result setAlbumComment:value];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"TOTALTRACKS"] && nil == [result trackTotal])
-						 [result setTrackTotal:[NSNumber numberWithInt:[value intValue]]];
-					else if(NSOrderedSame == [key caseInsensitiveCompare:@"DISCSINSET"] && nil == [result discTotal])
-						  [result setDiscTotal:[NSNumber numberWithInt:[value intValue]]];
-					
-					[key release];
-					[value release];
-					
-					fieldName	= NULL;
-					fieldValue	= NULL;
-				}
+			case FLAC__METADATA_TYPE_VORBIS_COMMENT:
+				block = FLAC__metadata_simple_iterator_get_block(iterator);
+				if(NULL != block)
+					[self parseFLACVorbisComment:block intoMetadata:result];
 				break;
 				
 			case FLAC__METADATA_TYPE_PICTURE:
-				picture = [[NSImage alloc] initWithData:[NSData dataWithBytes:block->data.picture.data length:block->data.picture.data_length]];
-				if(nil != picture) {
-					[result setAlbumArt:picture];
-					[picture release];
+				// Prefer the front cover, but fall back to the first picture with any data
+				if(NULL != picture && FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER == picture->data.picture.type)
+					break;
+				
+				block = FLAC__metadata_simple_iterator_get_block(iterator);
+				if(NULL != block && 0 != block->data.picture.data_length && (NULL == picture || FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER == block->data.picture.type)) {
+					if(NULL != picture)
+						FLAC__metadata_object_delete(picture);
+					picture	= block;
+					block	= NULL;
 				}
 				break;
 				
-			case FLAC__METADATA_TYPE_STREAMINFO:
-				[result setLength:[NSNumber numberWithUnsignedLong:(block->data.stream_info.total_samples * block->data.stream_info.sample_rate)]];
+			default:
 				break;
-				
-			case FLAC__METADATA_TYPE_PADDING:						break;
-			case FLAC__METADATA_TYPE_APPLICATION:					break;
-			case FLAC__METADATA_TYPE_SEEKTABLE:						break;
-			case FLAC__METADATA_TYPE_CUESHEET:						break;
-			case FLAC__METADATA_TYPE_UNDEFINED:						break;
-			default:												break;
 		}
-	} while(FLAC__metadata_iterator_next(iterator));
+		
+		if(NULL != block) {
+			FLAC__metadata_object_delete(block);
+			block = NULL;
+		}
+	} while(FLAC__metadata_simple_iterator_next(iterator));
 	
-	FLAC__metadata_iterator_delete(iterator);
-	FLAC__metadata_chain_delete(chain);	
+	FLAC__metadata_simple_iterator_delete(iterator);
+	
+	if(NULL != picture) {
+		[result setAlbumArtData:[NSData dataWithBytes:picture->data.picture.data length:picture->data.picture.data_length]];
+		FLAC__metadata_object_delete(picture);
+	}
 	
 	return [result autorelease];
 }
 
++ (void) parseFLACVorbisComment:(FLAC__StreamMetadata *)block intoMetadata:(AudioMetadata *)result
+{
+	unsigned						i;
+	char							*fieldName			= NULL;
+	char							*fieldValue			= NULL;
+	NSString						*key, *value;
+	
+	for(i = 0; i < block->data.vorbis_comment.num_comments; ++i) {
+							
+		// Let FLAC parse the comment for us
+		if(NO == FLAC__metadata_object_vorbiscomment_entry_to_name_value_pair(block->data.vorbis_comment.comments[i], &fieldName, &fieldValue)) {
+			// Ignore malformed comments
+			continue;
+		}
+
+		key		= [[NSString alloc] initWithBytesNoCopy:fieldName length:strlen(fieldName) encoding:NSASCIIStringEncoding freeWhenDone:YES];
+		value	= [[NSString alloc] initWithBytesNoCopy:fieldValue length:strlen(fieldValue) encoding:NSUTF8StringEncoding freeWhenDone:YES];
+					
+		if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ALBUM"]])
+			[result setAlbumTitle:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ARTIST"]])
+		{
+			[result setTrackArtist:value];
+			if(nil == [result albumArtist])
+				[result setAlbumArtist:value];
+		}
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"COMPOSER"]])
+			[result setAlbumComposer:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"GENRE"]])
+			[result setAlbumGenre:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DATE"]])
+			[result setAlbumDate:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DESCRIPTION"]])
+			[result setAlbumComment:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"TITLE"]])
+			[result setTrackTitle:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"TRACKNUMBER"]])
+			[result setTrackNumber:[NSNumber numberWithInt:[value intValue]]];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"TRACKTOTAL"]])
+			 [result setTrackTotal:[NSNumber numberWithInt:[value intValue]]];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"COMPILATION"]])
+			  [result setCompilation:[NSNumber numberWithBool:(BOOL)[value intValue]]];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DISCNUMBER"]])
+			   [result setDiscNumber:[NSNumber numberWithInt:[value intValue]]];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"DISCTOTAL"]])
+				[result setDiscTotal:[NSNumber numberWithInt:[value intValue]]];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ISRC"]])
+			[result setISRC:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"MCN"]])
+			[result setMCN:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:[self customizeFLACTag:@"ALBUMARTIST"]])
+			[result setAlbumArtist:value];					
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_TRACKID"])
+			[result setMusicbrainzTrackId:value];					
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_ALBUMID"])
+			[result setMusicbrainzAlbumId:value];					
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_ARTISTID"])
+			[result setMusicbrainzArtistId:value];					
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_ALBUMARTISTID"])
+			[result setMusicbrainzAlbumArtistId:value];					
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"MUSICBRAINZ_DISCID"])
+			[result setDiscId:value];					
+
+		// Maintain backwards compability for the following tags
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"YEAR"] && nil == [result albumDate])
+			[result setAlbumDate:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"COMMENT"] && nil == [result albumComment])
+			[result setAlbumComment:value];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"TOTALTRACKS"] && nil == [result trackTotal])
+			 [result setTrackTotal:[NSNumber numberWithInt:[value intValue]]];
+		else if(NSOrderedSame == [key caseInsensitiveCompare:@"DISCSINSET"] && nil == [result discTotal])
+			  [result setDiscTotal:[NSNumber numberWithInt:[value intValue]]];
+		
+		[key release];
+		[value release];
+		
+		fieldName	= NULL;
+		fieldValue	= NULL;
+	}
+}
+
 + (AudioMetadata *) metadataFromMP3File:(NSString *)filename
 {
 	TagLib::MPEG::File						f						([filename fileSystemRepresentation], false);
@@ -648,7 +720,7 @@
 			frameList = id3v2tag->frameListMap()["APIC"];
 			if(NO == frameList.isEmpty() && NULL != (picture = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(frameList.front()))) {
 				TagLib::ByteVector bv = picture->picture();
-				[result setAlbumArt:[[[NSImage alloc] initWithData:[NSData dataWithBytes:bv.data() length:bv.size()]] autorelease]];
+				[result setAlbumArtData:[NSData dataWithBytes:bv.data() length:bv.size()]];
 			}
 			
 			// Extract compilation if present (iTunes TCMP tag)
@@ -776,8 +848,7 @@
 		// Album art
 		if(tags->artworkCount) {
 			MP4TagArtwork artwork = (tags->artwork)[0];
-			NSData *artworkData = [NSData dataWithBytes:artwork.data length:artwork.size];
-			[result setAlbumArt:[[[NSImage alloc] initWithData:artworkData] autorelease]];
+			[result setAlbumArtData:[NSData dataWithBytes:artwork.data length:artwork.size]];
 		}
 		
 		MP4TagsFree(tags);
@@ -1719,7 +1790,7 @@
 		frameList = f.tag()->frameListMap()["APIC"];
 		if(NO == frameList.isEmpty() && NULL != (picture = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(frameList.front()))) {
 			TagLib::ByteVector bv = picture->picture();
-			[result setAlbumArt:[[[NSImage alloc] initWithData:[NSData dataWithBytes:bv.data() length:bv.size()]] autorelease]];
+			[result setAlbumArtData:[NSData dataWithBytes:bv.data() length:bv.size()]];
 		}
 		
 		// Extract compilation if present (iTunes TCMP tag)
@@ -1874,7 +1945,7 @@
 		frameList = f.tag()->frameListMap()["APIC"];
 		if(NO == frameList.isEmpty() && NULL != (picture = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(frameList.front()))) {
 			TagLib::ByteVector bv = picture->picture();
-			[result setAlbumArt:[[[NSImage alloc] initWithData:[NSData dataWithBytes:bv.data() length:bv.size()]] autorelease]];
+			[result setAlbumArtData:[NSData dataWithBytes:bv.data() length:bv.size()]];
 		}
 		
 		// Extract compilation if present (iTunes TCMP tag)
@@ -0,0 +1,46 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+@class AudioMetadata;
+
+// An on-disk cache of the metadata read from audio files, so unchanged files need not be parsed again
+// Entries are keyed by path and are valid only while the file's size, modification time and inode are unchanged
+// Album art is stored once per distinct image, since every track of an album usually carries the same one
+// The least recently used entries are evicted once the cache grows past the metadataCacheSize default (in MB)
+@interface MetadataCache : NSObject
+{
+	NSMutableDictionary		*_entries;
+	unsigned long long		_totalSize;
+	BOOL					_dirty;
+}
+
++ (MetadataCache *)		sharedCache;
+
+// Returns a new copy of the cached metadata, or nil if the file is not cached or has changed
+- (AudioMetadata *)		metadataForFile:(NSString *)filename;
+- (void)				setMetadata:(AudioMetadata *)metadata forFile:(NSString *)filename;
+
+// Writes any changes to disk
+- (void)				synchronize;
+
+@end
@@ -0,0 +1,351 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "MetadataCache.h"
+#import "AudioMetadata.h"
+#import "UtilityFunctions.h"
+
+#include <sys/stat.h>
+#include <CommonCrypto/CommonDigest.h>
+
+// Changes are written to disk this many seconds after the most recent one
+#define SYNCHRONIZE_DELAY		10.0
+
+// Increment whenever the archived form of the entries changes
+#define CACHE_VERSION			2
+
+static MetadataCache		*sSharedCache			= nil;
+
+@interface MetadataCache (Private)
+- (NSString *)			cacheFilename;
+- (NSString *)			artworkDirectory;
+- (NSString *)			storeArtwork:(NSData *)albumArtData;
+- (unsigned long long)	sizeLimit;
+- (void)				removeEntryForFile:(NSString *)filename;
+- (void)				evictEntriesToSize:(unsigned long long)size;
+- (void)				removeUnreferencedArtwork;
+- (void)				scheduleSynchronize;
+- (void)				applicationWillTerminate:(NSNotification *)aNotification;
+@end
+
+// The properties that must match for a cache entry to be used
+static NSDictionary *
+fileIdentity(NSString *filename)
+{
+	struct stat		sourceStat;
+	
+	if(-1 == stat([filename fileSystemRepresentation], &sourceStat))
+		return nil;
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+		[NSNumber numberWithLongLong:sourceStat.st_size], @"size",
+		[NSNumber numberWithLong:sourceStat.st_mtime], @"modificationTime",
+		[NSNumber numberWithUnsignedLongLong:sourceStat.st_ino], @"inode",
+		nil];
+}
+
+@implementation MetadataCache
+
++ (MetadataCache *) sharedCache
+{
+	@synchronized(self) {
+		if(nil == sSharedCache)
+			sSharedCache = [[self alloc] init];
+	}
+	
+	return sSharedCache;
+}
+
+- (id) init
+{
+	if((self = [super init])) {
+		NSData			*data			= [NSData dataWithContentsOfFile:[self cacheFilename]];
+		NSDictionary	*archive		= nil;
+		NSEnumerator	*enumerator		= nil;
+		NSDictionary	*entry			= nil;
+		
+		// A cache that can't be read is simply rebuilt
+		if(nil != data) {
+			@try {
+				archive = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+			}
+			
+			@catch(NSException *exception) {
+				NSLog(@"Unable to read the metadata cache: %@", [exception reason]);
+			}
+		}
+		
+		if(CACHE_VERSION == [[archive objectForKey:@"version"] intValue])
+			_entries = [[archive objectForKey:@"entries"] mutableCopy];
+		
+		if(nil == _entries)
+			_entries = [[NSMutableDictionary alloc] init];
+		
+		enumerator = [_entries objectEnumerator];
+		while((entry = [enumerator nextObject]))
+			_totalSize += [[entry objectForKey:@"size"] unsignedLongLongValue];
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationWillTerminate:) name:NSApplicationWillTerminateNotification object:nil];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	
+	[_entries release];		_entries = nil;
+	
+	[super dealloc];
+}
+
+- (AudioMetadata *) metadataForFile:(NSString *)filename
+{
+	NSDictionary			*identity		= fileIdentity(filename);
+	NSMutableDictionary		*entry			= nil;
+	AudioMetadata			*metadata		= nil;
+	NSString				*artwork		= nil;
+	NSData					*albumArtData	= nil;
+	
+	@synchronized(self) {
+		entry = [[[_entries objectForKey:filename] mutableCopy] autorelease];
+		
+		if(nil == entry)
+			return nil;
+		
+		// The file has changed or is gone, so the entry will never be used again
+		if(nil == identity || NO == [identity isEqualToDictionary:[entry objectForKey:@"identity"]]) {
+			[self removeEntryForFile:filename];
+			entry = nil;
+		}
+		else {
+			[entry setObject:[NSDate date] forKey:@"lastUsed"];
+			[_entries setObject:entry forKey:filename];
+			_dirty = YES;
+		}
+	}
+	
+	[self performSelectorOnMainThread:@selector(scheduleSynchronize) withObject:nil waitUntilDone:NO];
+	
+	if(nil == entry)
+		return nil;
+	
+	// Callers are free to modify what they are given, so each lookup gets its own copy
+	metadata	= [NSKeyedUnarchiver unarchiveObjectWithData:[entry objectForKey:@"metadata"]];
+	artwork		= [entry objectForKey:@"artwork"];
+	
+	if(nil != artwork) {
+		albumArtData = [NSData dataWithContentsOfFile:[[self artworkDirectory] stringByAppendingPathComponent:artwork]];
+		
+		// The image has gone missing, so the file will have to be read again
+		if(nil == albumArtData) {
+			@synchronized(self) {
+				[self removeEntryForFile:filename];
+			}
+			return nil;
+		}
+		
+		[metadata setAlbumArtData:albumArtData];
+	}
+	
+	return metadata;
+}
+
+- (void) setMetadata:(AudioMetadata *)metadata forFile:(NSString *)filename
+{
+	NSDictionary			*identity		= fileIdentity(filename);
+	NSMutableDictionary		*entry			= nil;
+	NSData					*metadataData	= nil;
+	unsigned long long		size;
+	
+	NSParameterAssert(nil != metadata);
+	
+	if(nil == identity)
+		return;
+	
+	metadataData	= [NSKeyedArchiver archivedDataWithRootObject:metadata];
+	size			= [metadataData length] + [[metadata albumArtData] length];
+	
+	if([self sizeLimit] < size)
+		return;
+	
+	entry = [NSMutableDictionary dictionary];
+	
+	[entry setObject:identity forKey:@"identity"];
+	[entry setObject:metadataData forKey:@"metadata"];
+	[entry setObject:[NSNumber numberWithUnsignedLongLong:size] forKey:@"size"];
+	[entry setObject:[NSDate date] forKey:@"lastUsed"];
+	
+	// Unreferenced artwork is removed while the lock is held, so the image is stored under it too
+	@synchronized(self) {
+		// Without its artwork the entry would be incomplete, so leave the file uncached
+		if(nil != [metadata albumArtData]) {
+			NSString *artwork = [self storeArtwork:[metadata albumArtData]];
+			
+			if(nil == artwork)
+				return;
+			
+			[entry setObject:artwork forKey:@"artwork"];
+		}
+		
+		[self removeEntryForFile:filename];
+		
+		[_entries setObject:entry forKey:filename];
+		_totalSize += size;
+		
+		[self evictEntriesToSize:[self sizeLimit]];
+		
+		_dirty = YES;
+	}
+	
+	[self performSelectorOnMainThread:@selector(scheduleSynchronize) withObject:nil waitUntilDone:NO];
+}
+
+- (void) synchronize
+{
+	NSData		*data		= nil;
+	
+	@synchronized(self) {
+		if(NO == _dirty)
+			return;
+		
+		data	= [NSKeyedArchiver archivedDataWithRootObject:[NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithInt:CACHE_VERSION], @"version",
+			_entries, @"entries",
+			nil]];
+		_dirty	= NO;
+		
+		[self removeUnreferencedArtwork];
+	}
+	
+	if(NO == [data writeToFile:[self cacheFilename] atomically:YES])
+		NSLog(@"Unable to write the metadata cache");
+}
+
+@end
+
+@implementation MetadataCache (Private)
+
+- (NSString *)	cacheFilename			{ return [getApplicationDataDirectory() stringByAppendingPathComponent:@"Metadata Cache"]; }
+
+- (NSString *) artworkDirectory
+{
+	NSString	*directory		= [getApplicationDataDirectory() stringByAppendingPathComponent:@"Metadata Cache Artwork"];
+	BOOL		isDir;
+	
+	if(NO == [[NSFileManager defaultManager] fileExistsAtPath:directory isDirectory:&isDir])
+		[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+	
+	return directory;
+}
+
+// Images are stored as read under the MD5 of their contents, so tracks sharing a cover share the file
+- (NSString *) storeArtwork:(NSData *)imageData
+{
+	NSMutableString		*artwork;
+	NSString			*path;
+	unsigned char		digest			[ CC_MD5_DIGEST_LENGTH ];
+	unsigned			i;
+	
+	CC_MD5([imageData bytes], (CC_LONG)[imageData length], digest);
+	
+	artwork = [NSMutableString string];
+	for(i = 0; i < CC_MD5_DIGEST_LENGTH; ++i)
+		[artwork appendFormat:@"%02x", digest[i]];
+	
+	path = [[self artworkDirectory] stringByAppendingPathComponent:artwork];
+	if(NO == [[NSFileManager defaultManager] fileExistsAtPath:path] && NO == [imageData writeToFile:path atomically:YES])
+		return nil;
+	
+	return artwork;
+}
+
+- (unsigned long long) sizeLimit
+{
+	return (unsigned long long)[[NSUserDefaults standardUserDefaults] integerForKey:@"metadataCacheSize"] * 1024 * 1024;
+}
+
+// Called with the lock held; the artwork file is left for removeUnreferencedArtwork since other entries may share it
+- (void) removeEntryForFile:(NSString *)filename
+{
+	NSDictionary	*entry		= [_entries objectForKey:filename];
+	
+	if(nil == entry)
+		return;
+	
+	_totalSize -= [[entry objectForKey:@"size"] unsignedLongLongValue];
+	[_entries removeObjectForKey:filename];
+	_dirty = YES;
+}
+
+// Least recently used entries go first; called with the lock held
+- (void) evictEntriesToSize:(unsigned long long)size
+{
+	NSSortDescriptor	*sortDescriptor		= nil;
+	NSArray				*filenames			= nil;
+	NSUInteger			i;
+	
+	if(_totalSize <= size)
+		return;
+	
+	sortDescriptor	= [[[NSSortDescriptor alloc] initWithKey:@"lastUsed" ascending:YES] autorelease];
+	filenames		= [_entries keysSortedByValueUsingDescriptors:[NSArray arrayWithObject:sortDescriptor]];
+	
+	for(i = 0; i < [filenames count] && size < _totalSize; ++i)
+		[self removeEntryForFile:[filenames objectAtIndex:i]];
+}
+
+// Images no entry refers to any longer are deleted; called with the lock held
+- (void) removeUnreferencedArtwork
+{
+	NSFileManager		*fileManager		= [NSFileManager defaultManager];
+	NSString			*directory			= [self artworkDirectory];
+	NSMutableSet		*referenced			= [NSMutableSet set];
+	NSEnumerator		*enumerator			= nil;
+	NSDictionary		*entry				= nil;
+	NSString			*artwork			= nil;
+	
+	enumerator = [_entries objectEnumerator];
+	while((entry = [enumerator nextObject])) {
+		if(nil != [entry objectForKey:@"artwork"])
+			[referenced addObject:[entry objectForKey:@"artwork"]];
+	}
+	
+	enumerator = [[fileManager contentsOfDirectoryAtPath:directory error:nil] objectEnumerator];
+	while((artwork = [enumerator nextObject])) {
+		if(NO == [referenced containsObject:artwork])
+			[fileManager removeItemAtPath:[directory stringByAppendingPathComponent:artwork] error:nil];
+	}
+}
+
+- (void) scheduleSynchronize
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronize) object:nil];
+	[self performSelector:@selector(synchronize) withObject:nil afterDelay:SYNCHRONIZE_DELAY];
+}
+
+- (void) applicationWillTerminate:(NSNotification *)aNotification
+{
+	[self synchronize];
+}
+
+@end
@@ -42,6 +42,7 @@
 		[NSNumber numberWithInt:0],
 		[NSNumber numberWithInt:5],
 		/* 0 */
+		[NSNumber numberWithInt:1],
 		nil];
 	
 	keys = [NSArray arrayWithObjects:
@@ -59,6 +60,7 @@
 		@"minPartitionOrder", 
 		@"maxPartitionOrder", 
 		/* riceParameterSearchDist is deprecated */
+		@"threads",
 		nil];
 	
 	
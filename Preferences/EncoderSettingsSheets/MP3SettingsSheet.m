@@ -42,6 +42,7 @@
 		[NSNumber numberWithInt:80],
 		[NSNumber numberWithInt:LAME_VARIABLE_BITRATE_MODE_FAST],
 		[NSNumber numberWithInt:LAME_USER_PRESET_TRANSPARENT],
+		[NSNumber numberWithInt:1],
 		nil];
 	
 	keys = [NSArray arrayWithObjects:
@@ -54,6 +55,7 @@
 		@"VBRQuality", 
 		@"variableBitrateMode", 
 		@"userPreset", 
+		@"threads",
 		nil];
 	
 	
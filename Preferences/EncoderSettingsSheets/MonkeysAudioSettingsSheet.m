@@ -29,10 +29,12 @@
 	
 	objects = [NSArray arrayWithObjects:
 		[NSNumber numberWithInt:2],
+		[NSNumber numberWithInt:1],
 		nil];
 	
 	keys = [NSArray arrayWithObjects:
 		@"compressionLevel", 
+		@"threads",
 		nil];
 	
 	
@@ -36,6 +36,7 @@
 		[NSNumber numberWithDouble:16.f],
 		[NSNumber numberWithDouble:4800],
 		[NSNumber numberWithDouble:0.f],
+		[NSNumber numberWithInt:1],
 		nil];
 	
 	keys = [NSArray arrayWithObjects:
@@ -46,6 +47,7 @@
 		@"bitsPerSample",
 		@"bitrate",
 		@"noiseShaping", 
+		@"threads",
 		nil];
 	
 	
@@ -0,0 +1,52 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// Incrementally calculates the AccurateRip (v1 and v2) and CRC32 checksums for a track
+// as its CD-DA data is extracted; sectors must be supplied in order
+@interface AccurateRipChecksum : NSObject
+{
+	NSUInteger		_sampleCount;		// The total number of stereo samples in the track
+	NSUInteger		_samplesProcessed;	// The number of samples seen so far
+	NSUInteger		_checkStart;		// The first sample (1-based) included in the AccurateRip checksums
+	NSUInteger		_checkEnd;			// The last sample (1-based) included in the AccurateRip checksums
+
+	uint32_t		_checksumV1;
+	uint32_t		_checksumV2;
+	uint32_t		_crc32;
+}
+
+// firstTrack and lastTrack specify whether the track is the first or last audio track on the disc,
+// in which case the first or last five sectors are excluded from the AccurateRip checksums
+- (id)				initWithSectorCount:(NSUInteger)sectorCount firstTrack:(BOOL)firstTrack lastTrack:(BOOL)lastTrack;
+
+// Process the next sectorCount sectors of little-endian CD-DA data
+- (void)			updateWithSectors:(const void *)buffer sectorCount:(NSUInteger)sectorCount;
+
+// YES once every sector in the track has been processed
+- (BOOL)			complete;
+
+- (uint32_t)		checksumV1;
+- (uint32_t)		checksumV2;
+- (uint32_t)		crc32;
+
+@end
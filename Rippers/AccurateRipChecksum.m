@@ -0,0 +1,116 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "AccurateRipChecksum.h"
+
+#include <IOKit/storage/IOCDTypes.h>
+#include <libkern/OSByteOrder.h>
+
+// Each CD-DA sector contains 588 stereo 16-bit samples
+#define SAMPLES_PER_SECTOR		(kCDSectorSizeCDDA / 4)
+
+// AccurateRip ignores the first and last five sectors of a disc
+#define SKIPPED_SECTORS			5
+
+static uint32_t		sCRC32Table		[ 256 ];
+
+@implementation AccurateRipChecksum
+
++ (void) initialize
+{
+	uint32_t	value;
+	unsigned	i, j;
+	
+	// Build the lookup table for the standard (reflected) CRC-32 polynomial
+	for(i = 0; i < 256; ++i) {
+		value = i;
+		for(j = 0; j < 8; ++j) {
+			value = (value & 1 ? 0xEDB88320 ^ (value >> 1) : value >> 1);
+		}
+		sCRC32Table[i] = value;
+	}
+}
+
+- (id) initWithSectorCount:(NSUInteger)sectorCount firstTrack:(BOOL)firstTrack lastTrack:(BOOL)lastTrack
+{
+	if((self = [super init])) {
+		_sampleCount		= sectorCount * SAMPLES_PER_SECTOR;
+		_samplesProcessed	= 0;
+		
+		_checkStart			= (firstTrack ? SKIPPED_SECTORS * SAMPLES_PER_SECTOR : 0);
+		_checkEnd			= (lastTrack ? _sampleCount - (SKIPPED_SECTORS * SAMPLES_PER_SECTOR) : _sampleCount);
+
+		_checksumV1			= 0;
+		_checksumV2			= 0;
+		_crc32				= 0xFFFFFFFF;
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) updateWithSectors:(const void *)buffer sectorCount:(NSUInteger)sectorCount
+{
+	const uint8_t		*bytes		= (const uint8_t *)buffer;
+	const uint32_t		*samples	= (const uint32_t *)buffer;
+	NSUInteger			sampleCount	= sectorCount * SAMPLES_PER_SECTOR;
+	NSUInteger			byteCount	= sectorCount * kCDSectorSizeCDDA;
+	NSUInteger			multiplier	= _samplesProcessed + 1;
+	uint32_t			checksumV1	= _checksumV1;
+	uint32_t			checksumV2	= _checksumV2;
+	uint32_t			crc			= _crc32;
+	uint32_t			sample;
+	uint64_t			product;
+	NSUInteger			i;
+	
+	NSParameterAssert(_samplesProcessed + sampleCount <= _sampleCount);
+	
+	// Both AccurateRip checksums weight each 32-bit stereo sample by its (1-based) position in the track
+	for(i = 0; i < sampleCount; ++i, ++multiplier) {
+		if(multiplier < _checkStart || multiplier > _checkEnd) {
+			continue;
+		}
+		
+		sample		= OSSwapLittleToHostInt32(samples[i]);
+		product		= (uint64_t)sample * (uint64_t)multiplier;
+		
+		checksumV1	+= (uint32_t)product;
+		checksumV2	+= (uint32_t)(product & 0xFFFFFFFF) + (uint32_t)(product >> 32);
+	}
+	
+	for(i = 0; i < byteCount; ++i) {
+		crc = sCRC32Table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	}
+	
+	_checksumV1			= checksumV1;
+	_checksumV2			= checksumV2;
+	_crc32				= crc;
+	_samplesProcessed	+= sampleCount;
+}
+
+- (BOOL)			complete								{ return _samplesProcessed == _sampleCount; }
+
+- (uint32_t)		checksumV1								{ return _checksumV1; }
+- (uint32_t)		checksumV2								{ return _checksumV2; }
+- (uint32_t)		crc32									{ return ~_crc32; }
+
+@end
@@ -0,0 +1,54 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+#import "ChecksumDatabaseMethods.h"
+#import "Drive.h"
+
+// Checksums read from a locally stored AccurateRip response (dBAR-NNN-XXXXXXXX-XXXXXXXX-XXXXXXXX.bin)
+@interface AccurateRipDatabase : NSObject <ChecksumDatabaseMethods>
+{
+	NSUInteger		_firstTrack;
+	NSUInteger		_trackCount;
+	uint32_t		_discID1;
+	uint32_t		_discID2;
+	uint32_t		_freeDBDiscID;
+	NSMutableArray	*_entries;			// One NSDictionary (confidence, checksum) per track per submission
+}
+
+// Directory containing the AccurateRip files (~/Application Support/Max/AccurateRip/)
++ (NSString *)		defaultDirectory;
+
+// Calculates the disc identifiers from the drive's TOC and loads the matching file from directory, if present
+- (id)				initWithDrive:(Drive *)drive directory:(NSString *)directory;
+
+// The name of the file containing the checksums for the disc
+- (NSString *)		filename;
+
+// YES if any checksums were loaded
+- (BOOL)			hasChecksums;
+
+- (uint32_t)		discID1;
+- (uint32_t)		discID2;
+- (uint32_t)		freeDBDiscID;
+
+@end
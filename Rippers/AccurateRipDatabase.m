@@ -0,0 +1,220 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "AccurateRipDatabase.h"
+#import "UtilityFunctions.h"
+
+#include <libkern/OSByteOrder.h>
+
+// Sectors between the last audio track and the data track of an enhanced CD
+#define ENHANCED_CD_GAP_SECTORS		11400
+
+@interface AccurateRipDatabase (Private)
+- (void)		calculateDiscIDsForDrive:(Drive *)drive;
+- (void)		loadChecksumsFromFile:(NSString *)path;
+@end
+
+static unsigned
+digitSum(unsigned n)
+{
+	unsigned result = 0;
+	
+	while(0 < n) {
+		result	+= n % 10;
+		n		/= 10;
+	}
+	
+	return result;
+}
+
+@implementation AccurateRipDatabase
+
++ (NSString *) defaultDirectory
+{
+	return [getApplicationDataDirectory() stringByAppendingPathComponent:@"AccurateRip"];
+}
+
+- (id) initWithDrive:(Drive *)drive directory:(NSString *)directory
+{
+	NSParameterAssert(nil != drive);
+	
+	if((self = [super init])) {
+		
+		_entries = [[NSMutableArray alloc] init];
+		
+		[self calculateDiscIDsForDrive:drive];
+		
+		if(nil != directory) {
+			[self loadChecksumsFromFile:[directory stringByAppendingPathComponent:[self filename]]];
+		}
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_entries release],		_entries = nil;
+	
+	[super dealloc];
+}
+
+- (NSString *)		filename
+{
+	return [NSString stringWithFormat:@"dBAR-%03lu-%08x-%08x-%08x.bin", (unsigned long)_trackCount, _discID1, _discID2, _freeDBDiscID];
+}
+
+- (BOOL)			hasChecksums							{ return 0 != [_entries count]; }
+
+- (uint32_t)		discID1									{ return _discID1; }
+- (uint32_t)		discID2									{ return _discID2; }
+- (uint32_t)		freeDBDiscID							{ return _freeDBDiscID; }
+
+- (NSUInteger)		confidenceForTrack:(NSUInteger)track checksumV1:(uint32_t)checksumV1 checksumV2:(uint32_t)checksumV2
+{
+	NSDictionary	*entry;
+	NSUInteger		confidence		= 0;
+	NSUInteger		index			= track - _firstTrack;
+	uint32_t		checksum;
+	
+	if(track < _firstTrack || _trackCount <= index) {
+		return 0;
+	}
+	
+	for(entry in _entries) {
+		if([[entry objectForKey:@"index"] unsignedIntegerValue] != index) {
+			continue;
+		}
+
+		checksum = [[entry objectForKey:@"checksum"] unsignedIntValue];
+		if(checksum == checksumV1 || checksum == checksumV2) {
+			confidence = MAX(confidence, [[entry objectForKey:@"confidence"] unsignedIntegerValue]);
+		}
+	}
+	
+	return confidence;
+}
+
+- (NSString *)		description
+{
+	return [NSString stringWithFormat:@"{\n\tFile: %@\n\tEntries: %lu\n}", [self filename], (unsigned long)[_entries count]];
+}
+
+@end
+
+@implementation AccurateRipDatabase (Private)
+
+- (void) calculateDiscIDsForDrive:(Drive *)drive
+{
+	TrackDescriptor		*track;
+	TrackDescriptor		*nextTrack;
+	NSUInteger			firstTrack, lastTrack, lastAudioTrack;
+	NSUInteger			leadOut, discLeadOut;
+	NSUInteger			trackIndex;
+	NSUInteger			freeDBSum;
+	NSUInteger			i;
+	
+	firstTrack		= [drive firstTrackForSession:[drive firstSession]];
+	lastTrack		= [drive lastTrackForSession:[drive lastSession]];
+	discLeadOut		= [drive leadOutForSession:[drive lastSession]];
+	
+	// Data tracks at the end of the disc aren't included in the AccurateRip identifiers
+	lastAudioTrack	= lastTrack;
+	while(lastAudioTrack > firstTrack && [[drive trackNumber:lastAudioTrack] dataTrack]) {
+		--lastAudioTrack;
+	}
+
+	nextTrack		= [drive trackNumber:lastAudioTrack + 1];
+	leadOut			= (nil != nextTrack && [nextTrack dataTrack] ? [nextTrack firstSector] - ENHANCED_CD_GAP_SECTORS : discLeadOut);
+	
+	_firstTrack		= firstTrack;
+	_trackCount		= lastAudioTrack - firstTrack + 1;
+	_discID1		= 0;
+	_discID2		= 0;
+	freeDBSum		= 0;
+	
+	for(i = firstTrack; i <= lastTrack; ++i) {
+		track		= [drive trackNumber:i];
+		trackIndex	= i - firstTrack + 1;
+		
+		if(i <= lastAudioTrack) {
+			_discID1 += [track firstSector];
+			_discID2 += MAX([track firstSector], 1U) * trackIndex;
+		}
+		
+		freeDBSum += digitSum(([track firstSector] + 150) / 75);
+	}
+	
+	_discID1		+= leadOut;
+	_discID2		+= leadOut * (_trackCount + 1);
+	
+	_freeDBDiscID	= (uint32_t)(((freeDBSum % 0xFF) << 24) | ((((discLeadOut + 150) / 75) - (([[drive trackNumber:firstTrack] firstSector] + 150) / 75)) << 8) | (lastTrack - firstTrack + 1));
+}
+
+- (void) loadChecksumsFromFile:(NSString *)path
+{
+	NSData			*data;
+	const uint8_t	*bytes;
+	NSUInteger		length, offset;
+	NSUInteger		trackCount, i;
+	uint32_t		discID1, discID2, freeDBDiscID;
+	BOOL			discMatches;
+	
+	data = [NSData dataWithContentsOfFile:path options:NSMappedRead error:nil];
+	if(nil == data) {
+		return;
+	}
+	
+	bytes	= [data bytes];
+	length	= [data length];
+	offset	= 0;
+	
+	// The file is a series of responses, each a 13 byte header followed by 9 bytes per track
+	while(offset + 13 <= length) {
+		trackCount		= bytes[offset];
+		discID1			= OSReadLittleInt32(bytes, offset + 1);
+		discID2			= OSReadLittleInt32(bytes, offset + 5);
+		freeDBDiscID	= OSReadLittleInt32(bytes, offset + 9);
+		offset			+= 13;
+		
+		if(offset + (9 * trackCount) > length) {
+			break;
+		}
+		
+		discMatches		= (trackCount == _trackCount && discID1 == _discID1 && discID2 == _discID2 && freeDBDiscID == _freeDBDiscID);
+		
+		for(i = 0; i < trackCount; ++i, offset += 9) {
+			if(NO == discMatches) {
+				continue;
+			}
+			
+			[_entries addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+				[NSNumber numberWithUnsignedInteger:i], @"index",
+				[NSNumber numberWithUnsignedInteger:bytes[offset]], @"confidence",
+				[NSNumber numberWithUnsignedInt:OSReadLittleInt32(bytes, offset + 1)], @"checksum",
+				nil]];
+		}
+	}
+}
+
+@end
@@ -102,6 +102,8 @@
 			[self ripSectorRange:range toFile:extAudioFileRef];
 			_sectorsRead += [range length];
 		}
+		
+		[self logSectorsRead:_sectorsRead sinceDate:_startTime];
 	}
 	
 	@catch(StopException *exception) {
@@ -0,0 +1,57 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+#include <AudioToolbox/ExtendedAudioFile.h>
+
+// Collects interleaved 16-bit stereo audio into large page-aligned blocks which are
+// written to an ExtAudioFile on a separate thread, so the caller never blocks on I/O
+// unless every block is waiting to be written
+@interface BufferedAudioWriter : NSObject
+{
+	ExtAudioFileRef		_file;
+	
+	uint8_t				**_blocks;
+	NSUInteger			*_blockBytes;		// Bytes of audio contained in each block
+	NSUInteger			_blockCount;
+	NSUInteger			_blockSize;			// The capacity of each block in bytes
+	
+	NSUInteger			_fillIndex;			// The block currently being filled by the caller
+	NSUInteger			_flushIndex;		// The next block to be written by the writer thread
+	NSUInteger			_fullBlocks;		// Blocks waiting to be written
+	
+	NSCondition			*_condition;
+	BOOL				_finishing;
+	BOOL				_writerRunning;
+	OSStatus			_error;
+}
+
+// blockSize is rounded up to a multiple of the page size
+- (id)				initWithExtAudioFile:(ExtAudioFileRef)file blockSize:(NSUInteger)blockSize blockCount:(NSUInteger)blockCount;
+
+// Queue byteCount bytes of audio for writing; returns the first error encountered by the writer thread, if any
+- (OSStatus)		appendBytes:(const void *)buffer byteCount:(NSUInteger)byteCount;
+
+// Write any queued audio and wait for the writer thread to exit (may safely be called more than once)
+- (OSStatus)		finish;
+
+@end
@@ -0,0 +1,217 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "BufferedAudioWriter.h"
+
+#include <stdlib.h>			// valloc, free
+#include <unistd.h>			// getpagesize
+
+@interface BufferedAudioWriter (Private)
+- (void)		writerThreadEntry:(id)unused;
+@end
+
+@implementation BufferedAudioWriter
+
+- (id) initWithExtAudioFile:(ExtAudioFileRef)file blockSize:(NSUInteger)blockSize blockCount:(NSUInteger)blockCount
+{
+	NSUInteger		pageSize;
+	NSUInteger		i;
+	
+	NSParameterAssert(NULL != file);
+	NSParameterAssert(0 < blockSize);
+	NSParameterAssert(1 < blockCount);
+	
+	if((self = [super init])) {
+		
+		pageSize		= getpagesize();
+		
+		_file			= file;
+		_blockSize		= ((blockSize + pageSize - 1) / pageSize) * pageSize;
+		_blockCount		= blockCount;
+		_blocks			= calloc(_blockCount, sizeof(uint8_t *));
+		_blockBytes		= calloc(_blockCount, sizeof(NSUInteger));
+		NSAssert(NULL != _blocks && NULL != _blockBytes, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		for(i = 0; i < _blockCount; ++i) {
+			_blocks[i] = valloc(_blockSize);
+			NSAssert(NULL != _blocks[i], NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		}
+		
+		_condition		= [[NSCondition alloc] init];
+		_error			= noErr;
+		_writerRunning	= YES;
+		
+		[NSThread detachNewThreadSelector:@selector(writerThreadEntry:) toTarget:self withObject:nil];
+		
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	NSUInteger i;
+	
+	[self finish];
+	
+	for(i = 0; i < _blockCount; ++i) {
+		free(_blocks[i]);
+	}
+	
+	free(_blocks),				_blocks = NULL;
+	free(_blockBytes),			_blockBytes = NULL;
+	
+	[_condition release],		_condition = nil;
+	
+	[super dealloc];
+}
+
+- (OSStatus) appendBytes:(const void *)buffer byteCount:(NSUInteger)byteCount
+{
+	const uint8_t	*source			= (const uint8_t *)buffer;
+	NSUInteger		blockBytes;
+	NSUInteger		bytesToCopy;
+	OSStatus		result;
+	
+	[_condition lock];
+	
+	// Once the writer has failed no more blocks are accepted
+	while(0 < byteCount && noErr == _error) {
+		
+		// The writer thread never touches the block being filled, so the copy is made without the lock
+		blockBytes	= _blockBytes[_fillIndex];
+		bytesToCopy	= MIN(byteCount, _blockSize - blockBytes);
+		
+		[_condition unlock];
+		memcpy(_blocks[_fillIndex] + blockBytes, source, bytesToCopy);
+		[_condition lock];
+		
+		_blockBytes[_fillIndex]	= blockBytes + bytesToCopy;
+		source					+= bytesToCopy;
+		byteCount				-= bytesToCopy;
+		
+		if(_blockBytes[_fillIndex] < _blockSize) {
+			break;
+		}
+		
+		// Hand the full block to the writer and wait for an empty one if necessary
+		++_fullBlocks;
+		_fillIndex = (_fillIndex + 1) % _blockCount;
+		[_condition signal];
+		
+		while(_fullBlocks == _blockCount && noErr == _error) {
+			[_condition wait];
+		}
+	}
+	
+	result = _error;
+	
+	[_condition unlock];
+	
+	return result;
+}
+
+- (OSStatus) finish
+{
+	OSStatus result;
+	
+	[_condition lock];
+	
+	if(NO == _finishing) {
+		_finishing = YES;
+		
+		// Queue the partially filled block
+		if(noErr == _error && 0 < _blockBytes[_fillIndex]) {
+			++_fullBlocks;
+		}
+		
+		[_condition signal];
+	}
+	
+	while(_writerRunning) {
+		[_condition wait];
+	}
+	
+	result = _error;
+	
+	[_condition unlock];
+	
+	return result;
+}
+
+@end
+
+@implementation BufferedAudioWriter (Private)
+
+- (void) writerThreadEntry:(id)unused
+{
+	NSAutoreleasePool	*pool			= [[NSAutoreleasePool alloc] init];
+	AudioBufferList		bufferList;
+	OSStatus			err;
+	uint8_t				*block;
+	NSUInteger			byteCount;
+	
+	[_condition lock];
+	
+	for(;;) {
+		while(0 == _fullBlocks && NO == _finishing) {
+			[_condition wait];
+		}
+		
+		if(0 == _fullBlocks) {
+			break;
+		}
+
+		block		= _blocks[_flushIndex];
+		byteCount	= _blockBytes[_flushIndex];
+		
+		// Write without holding the lock so the caller can keep filling blocks
+		[_condition unlock];
+		
+		bufferList.mNumberBuffers				= 1;
+		bufferList.mBuffers[0].mData			= block;
+		bufferList.mBuffers[0].mDataByteSize	= (UInt32)byteCount;
+		bufferList.mBuffers[0].mNumberChannels	= 2;
+		
+		err = (noErr == _error ? ExtAudioFileWrite(_file, (UInt32)(byteCount / 4), &bufferList) : noErr);
+		
+		[_condition lock];
+		
+		if(noErr != err) {
+			_error = err;
+		}
+		
+		_blockBytes[_flushIndex]	= 0;
+		_flushIndex					= (_flushIndex + 1) % _blockCount;
+		--_fullBlocks;
+		
+		[_condition broadcast];
+	}
+	
+	_writerRunning = NO;
+	[_condition broadcast];
+	[_condition unlock];
+	
+	[pool release];
+}
+
+@end
@@ -0,0 +1,30 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// The protocol used by rippers to verify extracted audio against known-good checksums
+@protocol ChecksumDatabaseMethods
+
+// Returns the number of submissions agreeing with checksum (v1 or v2) for the given track, or 0 if there is no match
+- (NSUInteger)		confidenceForTrack:(NSUInteger)track checksumV1:(uint32_t)checksumV1 checksumV2:(uint32_t)checksumV2;
+
+@end
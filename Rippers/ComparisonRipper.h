@@ -22,6 +22,8 @@
 
 #import "Ripper.h"
 #import "Drive.h"
+#import "ChecksumDatabaseMethods.h"
+#import "RipMetrics.h"
 
 @interface ComparisonRipper : Ripper
 {
@@ -34,9 +36,13 @@
 	BOOL					_useHashes;
 	BOOL					_useC2;
 	
+	id <ChecksumDatabaseMethods>	_checksumDatabase;
+	
 	NSUInteger				_grandTotalSectors;
 	NSUInteger				_sectorsRead;
 	NSDate					*_startTime;
+	
+	RipMetrics				*_metrics;
 }
 
 - (id)						initWithSectors:(NSArray *)sectors deviceName:(NSString *)deviceName;
@@ -56,4 +62,8 @@
 - (BOOL)					useC2;
 - (void)					setUseC2:(BOOL)useC2;
 
+// If set, a track whose first read matches the database skips the remaining comparison passes
+- (id <ChecksumDatabaseMethods>)	checksumDatabase;
+- (void)							setChecksumDatabase:(id <ChecksumDatabaseMethods>)checksumDatabase;
+
 @end
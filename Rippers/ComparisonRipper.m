@@ -22,6 +22,8 @@
 #import "Rip.h"
 #import "SectorRange.h"
 #import "BitArray.h"
+#import "AccurateRipChecksum.h"
+#import "AccurateRipDatabase.h"
 #import "LogController.h"
 #import "StopException.h"
 #import "UtilityFunctions.h"
@@ -42,8 +44,10 @@
 #define TEMPFILE_PATTERN	"MaxXXXXXXXX" TEMPFILE_SUFFIX
 
 @interface ComparisonRipper (Private)
-- (void)		logMessage:(NSString *)message;
 - (NSString *)	createTemporaryFile;
+- (void)		deleteTemporaryFile:(NSString *)filename;
+- (NSUInteger)	trackNumberForSectorRange:(SectorRange *)range;
+- (NSUInteger)	readAudio:(int8_t *)audioBuffer errorFlags:(int8_t *)c2Buffer sectorRange:(SectorRange *)range readBuffer:(int8_t *)buffer;
 - (void)		ripSectorRange:(SectorRange *)range toFile:(ExtAudioFileRef)file;
 @end
 
@@ -81,7 +85,12 @@
 		_maximumRetries		= [[NSUserDefaults standardUserDefaults] integerForKey:@"comparisonRipperMaximumRetries"];
 		_useHashes			= [[NSUserDefaults standardUserDefaults] boolForKey:@"comparisonRipperUseHashes"];
 		_useC2				= [[NSUserDefaults standardUserDefaults] boolForKey:@"comparisonRipperUseC2"];
+		_driveOffset		= (int)[[NSUserDefaults standardUserDefaults] integerForKey:@"comparisonRipperDriveOffset"];
 
+		if([[NSUserDefaults standardUserDefaults] boolForKey:@"comparisonRipperUseAccurateRip"]) {
+			_checksumDatabase	= [[AccurateRipDatabase alloc] initWithDrive:_drive directory:[AccurateRipDatabase defaultDirectory]];
+		}
+		
 		_sectorsRead		= 0;
 		
 		// Determine the size of the track(s) we are ripping
@@ -95,7 +104,9 @@
 
 - (void) dealloc
 {	
-	[_drive release];	_drive = nil;
+	[_drive release];				_drive = nil;
+	[_checksumDatabase release];	_checksumDatabase = nil;
+	[_metrics release];				_metrics = nil;
 	
 	[super dealloc];
 }
@@ -117,11 +128,11 @@
 - (BOOL)				useC2										{ return _useC2; }
 - (void)				setUseC2:(BOOL)useC2						{ _useC2 = useC2; }
 
-- (void)				logMessage:(NSString *)message
+- (id <ChecksumDatabaseMethods>)	checksumDatabase			{ return [[_checksumDatabase retain] autorelease]; }
+- (void)				setChecksumDatabase:(id <ChecksumDatabaseMethods>)checksumDatabase
 {
-	if([self logActivity]) {
-		[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
-	}
+	[_checksumDatabase release];
+	_checksumDatabase = [checksumDatabase retain];
 }
 
 - (oneway void) ripToFile:(NSString *)filename
@@ -133,9 +144,11 @@
 	AudioStreamBasicDescription		outputASBD;
 	SectorRange						*range;
 	uint16_t						driveSpeed;
+	NSMutableDictionary				*metrics;
 	
 	// Tell our owner we are starting
 	_startTime = [NSDate date];
+	_metrics = [[RipMetrics alloc] init];
 	[[self delegate] setStartTime:_startTime];
 	[[self delegate] setStarted:YES];
 	
@@ -166,6 +179,10 @@
 		// Save the drive speed
 		driveSpeed = [_drive speed];
 		
+		if(0 != [self driveOffset]) {
+			[self logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Correcting for a read offset of %i samples", @"Log", @""), [self driveOffset]]];
+		}
+		
 		// Process each sector range
 		for(range in _sectors) {
 			[self ripSectorRange:range toFile:extAudioFileRef];
@@ -174,6 +191,7 @@
 
 		// Restore drive speed
 		[_drive setSpeed:driveSpeed];
+		[_metrics incrementSpeedChanges];
 	}
 	
 	@catch(StopException *exception) {
@@ -210,6 +228,21 @@
 		[_drive closeDevice];
 	}
 	
+	// Pass the statistics along with the settings that produced them to our owner
+	[_metrics endPhase];
+	
+	metrics = [NSMutableDictionary dictionaryWithDictionary:[_metrics dictionaryRepresentation]];
+	[metrics setObject:[self deviceName] forKey:@"deviceName"];
+	[metrics setObject:[NSNumber numberWithInt:[self driveOffset]] forKey:@"driveOffset"];
+	[metrics setObject:[NSNumber numberWithUnsignedInteger:[self requiredMatches]] forKey:@"requiredMatches"];
+	[metrics setObject:[NSNumber numberWithUnsignedInteger:[self maximumRetries]] forKey:@"maximumRetries"];
+	[metrics setObject:[NSNumber numberWithBool:[self useHashes]] forKey:@"useHashes"];
+	[metrics setObject:[NSNumber numberWithBool:[self useC2]] forKey:@"useC2"];
+	[metrics setObject:[NSNumber numberWithUnsignedInteger:_grandTotalSectors] forKey:@"sectors"];
+	[metrics setObject:[NSNumber numberWithDouble:-1.0 * [_startTime timeIntervalSinceNow]] forKey:@"seconds"];
+	
+	[[self delegate] setRipMetrics:metrics];
+	
 	[[self delegate] setEndTime:[NSDate date]];
 	[[self delegate] setCompleted:YES];	
 }
@@ -221,7 +254,6 @@
 	int8_t				*buffer				= NULL;
 	int8_t				*audioBuffer		= NULL;
 	int8_t				*c2Buffer			= NULL;
-	int8_t				*sectorAlias		= NULL;
 	
 	int8_t				sectorBuffer		[ kCDSectorSizeCDDA ];
 	unsigned			bufferLen			= 0;
@@ -245,6 +277,13 @@
 	Rip					*master				= nil;
 	Rip					*comparator			= nil;
 	NSDate				*phaseStartTime		= nil;
+	AccurateRipChecksum	*checksum			= nil;
+	NSUInteger			trackNumber			= NSNotFound;
+	TrackDescriptor		*previousTrack		= nil;
+	TrackDescriptor		*nextTrack			= nil;
+	NSUInteger			confidence			= 0;
+	BOOL				sawC2Error			= NO;
+	CFAbsoluteTime		operationStartTime;
 	BOOL				gotMatch;
 	unsigned			i, j, k;
 	unsigned			sector;
@@ -272,7 +311,8 @@
 		
 		// Allocate buffers to hold the ripped data
 		bufferLen	= [range length] <  1024 ? [range length] : 1024;
-		buffer		= calloc(bufferLen, kCDSectorSizeCDDA + kCDSectorSizeErrorFlags);
+		// (one extra sector is needed when the read offset isn't a whole number of sectors)
+		buffer		= calloc(bufferLen + 1, kCDSectorSizeCDDA + kCDSectorSizeErrorFlags);
 		audioBuffer	= calloc(bufferLen, kCDSectorSizeCDDA);
 		NSAssert(NULL != buffer, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		NSAssert(NULL != audioBuffer, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
@@ -286,6 +326,17 @@
 		sectorStatus = [[[BitArray alloc] init] autorelease];
 		[sectorStatus setBitCount:[range length]];
 		
+		// Calculate checksums during the first read if there is something to verify them against
+		trackNumber = [self trackNumberForSectorRange:range];
+		if(nil != [self checksumDatabase] && NSNotFound != trackNumber) {
+			// The first and last audio tracks are bounded by the disc's edges or by data tracks (enhanced CDs)
+			previousTrack	= [_drive trackNumber:trackNumber - 1];
+			nextTrack		= [_drive trackNumber:trackNumber + 1];
+			checksum = [[[AccurateRipChecksum alloc] initWithSectorCount:[range length]
+															  firstTrack:(nil == previousTrack || [previousTrack dataTrack])
+															   lastTrack:(nil == nextTrack || [nextTrack dataTrack])] autorelease];
+		}
+		
 		// ===============
 		// INITIAL RIPPING
 		// ===============
@@ -294,6 +345,7 @@
 		// Use maximum speed for the initial extraction
 		[self logMessage:NSLocalizedStringFromTable(@"Setting drive speed to maximum", @"Log", @"")];
 		[_drive setSpeed:kCDSpeedMax];
+		[_metrics incrementSpeedChanges];
 		
 		retries			= 0;
 		
@@ -303,10 +355,13 @@
 		phaseStartTime	= [NSDate date];
 
 		[[self delegate] setPhase:NSLocalizedStringFromTable(@"Ripping", @"General", @"")];
+		[_metrics beginPhase:@"ripping"];
 		
 		for(i = 0; i < [self requiredMatches]; ++i) {
 			// Clear the drive's cache
+			operationStartTime = CFAbsoluteTimeGetCurrent();
 			[_drive clearCache:range];
+			[_metrics addCacheClearTime:CFAbsoluteTimeGetCurrent() - operationStartTime];
 			
 			// Allocate the rip object
 			rip = [[Rip alloc] initWithSectorRange:range];
@@ -332,26 +387,15 @@
 
 				// Extract the audio from the disc
 				[self logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Ripping sectors %i - %i", @"Log", @""), [readRange firstSector], [readRange lastSector]]];				
-				sectorsRead		= [_drive readAudioAndErrorFlags:buffer sectorRange:readRange];
+				sectorsRead		= [self readAudio:audioBuffer errorFlags:c2Buffer sectorRange:readRange readBuffer:buffer];
 				
 				NSAssert(sectorCount == sectorsRead, NSLocalizedStringFromTable(@"Unable to read from the disc.", @"Log", @""));
-				
-				// Copy audio and (optionally) C2 data to their respective buffers
-				for(j = 0; j < sectorsRead; ++j) {
-					sectorAlias = buffer + (j * (kCDSectorSizeCDDA + kCDSectorSizeErrorFlags));
-					memcpy(audioBuffer + (j * kCDSectorSizeCDDA), sectorAlias, kCDSectorSizeCDDA);
-
-					if([self useC2]) {
-						memcpy(c2Buffer + (j * kCDSectorSizeErrorFlags), sectorAlias + kCDSectorSizeCDDA, kCDSectorSizeErrorFlags);
-					}
-					
-					//memcpy(q + (j * kCDSectorSizeQSubchannel), sectorAlias + kCDSectorSizeCDDA + kCDSectorSizeErrorFlags, kCDSectorSizeQSubchannel);
-				}
 
 				// Check for C2 errors
 				if([self useC2]) {
 					for(j = 0; j < kCDSectorSizeErrorFlags * sectorsRead; ++j) {
 						if(c2Buffer[j]) {
+							sawC2Error = YES;
 							for(k = 0; k < 8; ++k) {
 								if((1 << k) & c2Buffer[j]) {
 									[self logMessage:[NSString stringWithFormat:@"C2 error for sector %u", [readRange firstSector] + (8 * j) + k]];
@@ -361,15 +405,27 @@
 					}
 				}
 
-				// Place the data in the Rip object
+				// Place the data in the Rip object (hashing it if required)
+				operationStartTime = CFAbsoluteTimeGetCurrent();
 				[rip setBytes:audioBuffer forSectorRange:readRange];
+				if([self useHashes]) {
+					[_metrics addHashTime:CFAbsoluteTimeGetCurrent() - operationStartTime];
+				}
 
 				// Store C2 errors
 				if([self useC2]) {
 					[rip setErrorFlags:c2Buffer forSectorRange:readRange];
 				}
 				
+				// The data is still in memory, so checksum it now rather than re-reading the rip later
+				if(0 == i && nil != checksum) {
+					operationStartTime = CFAbsoluteTimeGetCurrent();
+					[checksum updateWithSectors:audioBuffer sectorCount:sectorsRead];
+					[_metrics addHashTime:CFAbsoluteTimeGetCurrent() - operationStartTime];
+				}
+				
 				// Housekeeping
+				[_metrics addSectors:[readRange length]];
 				sectorsRemaining	-= [readRange length];
 				sectorsToRead		-= [readRange length];
 				
@@ -393,10 +449,29 @@
 				
 				++iterations;				
 			}
+			
+			// If the first read matches a known-good checksum the remaining passes are unnecessary
+			if(0 == i && nil != checksum) {
+				[self logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Track %lu checksums: AccurateRip v1 %08X, v2 %08X, CRC32 %08X", @"Log", @""), (unsigned long)trackNumber, [checksum checksumV1], [checksum checksumV2], [checksum crc32]]];
+
+				confidence = [[self checksumDatabase] confidenceForTrack:trackNumber checksumV1:[checksum checksumV1] checksumV2:[checksum checksumV2]];
+				
+				if(0 != confidence && NO == sawC2Error) {
+					[self logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Track %lu accurately ripped (confidence %lu)", @"Log", @""), (unsigned long)trackNumber, (unsigned long)confidence]];
+					
+					// Use this rip as the master rip
+					[self deleteTemporaryFile:[masterRip filename]];
+					masterRip = [[rip retain] autorelease];
+					[rips removeObject:rip];
+
+					[sectorStatus setAllOnes];
+					break;
+				}
+			}
 		}
 		
 		// Main loop
-		for(;;) {
+		while(NO == [sectorStatus allOnes]) {
 			
 			// ===============
 			// COMPARISON LOOP
@@ -410,6 +485,10 @@
 			
 			[[self delegate] setPhase:NSLocalizedStringFromTable(@"Verifying", @"General", @"")];
 			[self logMessage:NSLocalizedStringFromTable(@"Verifying rip integrity", @"Log", @"")];
+			[_metrics beginPhase:@"verifying"];
+			[_metrics addSectors:sectorsToRead];
+			
+			operationStartTime = CFAbsoluteTimeGetCurrent();
 			
 			for(sector = [range firstSector]; sector <= [range lastSector]; ++sector) {
 				
@@ -511,6 +590,8 @@
 				--sectorsToRead;				
 			}
 			
+			[_metrics addCompareTime:CFAbsoluteTimeGetCurrent() - operationStartTime];
+			
 			// =====================
 			// TERMINATION CONDITION
 			// =====================
@@ -524,6 +605,7 @@
 				// than the number of sector matches required)
 				if([self requiredMatches] < retries) {
 					[_drive setSpeed:kCDSpeedMin];
+					[_metrics incrementSpeedChanges];
 					[self logMessage:NSLocalizedStringFromTable(@"Setting drive speed to minimum", @"Log", @"")];
 				}
 				
@@ -547,6 +629,7 @@
 			phaseStartTime	= [NSDate date];
 			
 			[[self delegate] setPhase:NSLocalizedStringFromTable(@"Re-ripping", @"General", @"")];
+			[_metrics beginPhase:@"rereading"];
 
 			for(i = 0; i < [range length]; ++i) {
 				
@@ -582,7 +665,10 @@
 				blockRange = [SectorRange sectorRangeWithFirstSector:[range sectorForIndex:i] lastSector:[range sectorForIndex:blockEnd]];
 
 				// Clear the drive's cache
+				operationStartTime = CFAbsoluteTimeGetCurrent();
 				[_drive clearCache:blockRange];
+				[_metrics addCacheClearTime:CFAbsoluteTimeGetCurrent() - operationStartTime];
+				[_metrics incrementRereadBlocks];
 				
 				// Allocate the rip object
 				rip = [[Rip alloc] initWithSectorRange:blockRange];
@@ -613,22 +699,10 @@
 					else {
 						[self logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Re-ripping sectors %i - %i", @"Log", @""), [readRange firstSector], [readRange lastSector]]];
 					}
-					sectorsRead		= [_drive readAudioAndErrorFlags:buffer sectorRange:readRange];
+					sectorsRead		= [self readAudio:audioBuffer errorFlags:c2Buffer sectorRange:readRange readBuffer:buffer];
 					
 					NSAssert(sectorCount == sectorsRead, NSLocalizedStringFromTable(@"Unable to read from the disc.", @"Log", @""));
 					
-					// Copy audio and (optionally) C2 data to their respective buffers
-					for(j = 0; j < sectorsRead; ++j) {
-						sectorAlias = buffer + (j * (kCDSectorSizeCDDA + kCDSectorSizeErrorFlags));
-						memcpy(audioBuffer + (j * kCDSectorSizeCDDA), sectorAlias, kCDSectorSizeCDDA);
-						
-						if([self useC2]) {
-							memcpy(c2Buffer + (j * kCDSectorSizeErrorFlags), sectorAlias + kCDSectorSizeCDDA, kCDSectorSizeErrorFlags);
-						}
-						
-						//memcpy(q + (j * kCDSectorSizeQSubchannel), sectorAlias + kCDSectorSizeCDDA + kCDSectorSizeErrorFlags, kCDSectorSizeQSubchannel);
-					}
-					
 					// Check for C2 errors
 					if([self useC2]) {
 						for(j = 0; j < kCDSectorSizeErrorFlags * sectorsRead; ++j) {
@@ -642,8 +716,12 @@
 						}
 					}
 					
-					// Place the data in the Rip object
+					// Place the data in the Rip object (hashing it if required)
+					operationStartTime = CFAbsoluteTimeGetCurrent();
 					[rip setBytes:audioBuffer forSectorRange:readRange];
+					if([self useHashes]) {
+						[_metrics addHashTime:CFAbsoluteTimeGetCurrent() - operationStartTime];
+					}
 					
 					// Store C2 errors
 					if([self useC2]) {
@@ -651,6 +729,7 @@
 					}
 					
 					// Housekeeping
+					[_metrics addSectors:[readRange length]];
 					sectorsRemaining -= [readRange length];
 					
 					// This loop is sufficiently slow that if the delegate is only polled every MAX_DO_POLL_FREQUENCY
@@ -694,6 +773,7 @@
 		
 		[[self delegate] setPhase:NSLocalizedStringFromTable(@"Saving", @"General", @"")];
 		[self logMessage:NSLocalizedStringFromTable(@"Generating output", @"Log", @"")];
+		[_metrics beginPhase:@"saving"];
 		
 		while(0 < sectorsRemaining) {
 			
@@ -721,6 +801,7 @@
 			NSAssert2(noErr == err, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"ExtAudioFileWrite", UTCreateStringForOSType(err));
 			
 			// Housekeeping
+			[_metrics addSectors:[readRange length]];
 			sectorsRemaining -= [readRange length];
 
 			// Distributed Object calls are expensive, so only perform them every few iterations
@@ -745,30 +826,16 @@
 	}
 	
 	@finally {
-		struct stat			sourceStat;
-		NSException			*exception;
-
 		free(buffer);
 		free(audioBuffer);
 		free(c2Buffer);
 		
 		// Delete temporary files
 		for(i = 0; i < [rips count]; ++i) {
-			rip = [rips objectAtIndex:i];
-			if(0 == stat([[rip filename] fileSystemRepresentation], &sourceStat) && -1 == unlink([[rip filename] fileSystemRepresentation])) {
-				exception = [NSException exceptionWithName:@"IOException"
-													reason:NSLocalizedStringFromTable(@"Unable to delete the temporary file.", @"Exceptions", @"")
-												  userInfo:[NSDictionary dictionaryWithObjects:[NSArray arrayWithObjects:[NSNumber numberWithInt:errno], [NSString stringWithCString:strerror(errno) encoding:NSASCIIStringEncoding], nil] forKeys:[NSArray arrayWithObjects:@"errorCode", @"errorString", nil]]];
-				NSLog(@"%@", exception);
-			}	
+			[self deleteTemporaryFile:[[rips objectAtIndex:i] filename]];
 		}
 		
-		if(0 == stat([[masterRip filename] fileSystemRepresentation], &sourceStat) && -1 == unlink([[masterRip filename] fileSystemRepresentation])) {
-			exception = [NSException exceptionWithName:@"IOException"
-												 reason:NSLocalizedStringFromTable(@"Unable to delete the temporary file.", @"Exceptions", @"") 
-											  userInfo:[NSDictionary dictionaryWithObjects:[NSArray arrayWithObjects:[NSNumber numberWithInt:errno], [NSString stringWithCString:strerror(errno) encoding:NSASCIIStringEncoding], nil] forKeys:[NSArray arrayWithObjects:@"errorCode", @"errorString", nil]]];
-			NSLog(@"%@", exception);
-		}
+		[self deleteTemporaryFile:[masterRip filename]];
 	
 //		[pool release];
 	}
@@ -819,4 +886,133 @@
 	return (nil != result ? [[result retain] autorelease] : nil);
 }
 
+- (void) deleteTemporaryFile:(NSString *)filename
+{
+	struct stat			sourceStat;
+	NSException			*exception;
+	
+	if(nil == filename) {
+		return;
+	}
+	
+	if(0 == stat([filename fileSystemRepresentation], &sourceStat) && -1 == unlink([filename fileSystemRepresentation])) {
+		exception = [NSException exceptionWithName:@"IOException"
+											reason:NSLocalizedStringFromTable(@"Unable to delete the temporary file.", @"Exceptions", @"")
+										  userInfo:[NSDictionary dictionaryWithObjects:[NSArray arrayWithObjects:[NSNumber numberWithInt:errno], [NSString stringWithCString:strerror(errno) encoding:NSASCIIStringEncoding], nil] forKeys:[NSArray arrayWithObjects:@"errorCode", @"errorString", nil]]];
+		NSLog(@"%@", exception);
+	}
+}
+
+// Reads the sectors in range, corrected for the drive's read offset, into audioBuffer (and c2Buffer, if non-NULL)
+// A positive offset of N samples means the audio for a sector starts N samples into the sector the drive reports,
+// so the read is shifted by N / 588 whole sectors and each sector is assembled from the tail of one physical
+// sector and the head of the next while de-interleaving the audio and error flags- no further copy is made
+// Sectors in the lead-in or beyond the lead-out that the drive can't reach are treated as silence
+- (NSUInteger) readAudio:(int8_t *)audioBuffer errorFlags:(int8_t *)c2Buffer sectorRange:(SectorRange *)range readBuffer:(int8_t *)buffer
+{
+	NSInteger		byteOffset			= 4 * [self driveOffset];
+	NSInteger		sectorShift			= byteOffset / kCDSectorSizeCDDA;
+	NSInteger		remainder;
+	NSInteger		firstSector, lastSector;
+	NSInteger		readFirstSector, readLastSector;
+	NSInteger		sessionFirstSector, sessionLastSector;
+	NSUInteger		session;
+	NSUInteger		blockSize			= kCDSectorSizeCDDA + kCDSectorSizeErrorFlags;
+	NSUInteger		flagRemainder;
+	NSUInteger		sectorsRead;
+	NSUInteger		i, j;
+	CFAbsoluteTime	readStartTime;
+	const int8_t	*current;
+	const int8_t	*next;
+	int8_t			*flags;
+	
+	// Round toward negative infinity so the remainder is always positive
+	if(0 > byteOffset && 0 != byteOffset % kCDSectorSizeCDDA) {
+		--sectorShift;
+	}
+	
+	remainder			= byteOffset - (sectorShift * kCDSectorSizeCDDA);
+	firstSector			= (NSInteger)[range firstSector] + sectorShift;
+	lastSector			= (NSInteger)[range lastSector] + sectorShift + (0 != remainder ? 1 : 0);
+	
+	session				= [_drive sessionContainingSectorRange:range];
+	sessionFirstSector	= (NSInteger)[_drive firstSectorForSession:session];
+	sessionLastSector	= (NSInteger)[_drive lastSectorForSession:session];
+
+	readFirstSector		= MAX(firstSector, sessionFirstSector);
+	readLastSector		= MIN(lastSector, sessionLastSector);
+	
+	// Silence for anything the drive can't be asked for
+	if(readFirstSector != firstSector || readLastSector != lastSector) {
+		bzero(buffer, (lastSector - firstSector + 1) * blockSize);
+	}
+	
+	if(readFirstSector <= readLastSector) {
+		readStartTime	= CFAbsoluteTimeGetCurrent();
+		sectorsRead		= [_drive readAudioAndErrorFlags:buffer + ((readFirstSector - firstSector) * blockSize)
+											 startSector:readFirstSector
+											 sectorCount:(readLastSector - readFirstSector + 1)];
+		[_metrics addRead:sectorsRead latency:CFAbsoluteTimeGetCurrent() - readStartTime];
+		
+		if((NSUInteger)(readLastSector - readFirstSector + 1) != sectorsRead) {
+			return 0;
+		}
+	}
+	
+	// Stitch each sector together from the physical sectors that contain it
+	flagRemainder = remainder / 8;
+	
+	for(i = 0; i < [range length]; ++i) {
+		current		= buffer + (i * blockSize);
+		next		= current + blockSize;
+		
+		memcpy(audioBuffer + (i * kCDSectorSizeCDDA), current + remainder, kCDSectorSizeCDDA - remainder);
+		if(0 != remainder) {
+			memcpy(audioBuffer + (i * kCDSectorSizeCDDA) + kCDSectorSizeCDDA - remainder, next, remainder);
+		}
+		
+		if(NULL == c2Buffer) {
+			continue;
+		}
+		
+		// Each error flag bit covers one byte of audio; when the shift splits a flag byte, 
+		// conservatively flag both of the bytes it could belong to
+		flags = c2Buffer + (i * kCDSectorSizeErrorFlags);
+		for(j = 0; j < kCDSectorSizeErrorFlags; ++j) {
+			if(flagRemainder + j < kCDSectorSizeErrorFlags) {
+				flags[j] = current[kCDSectorSizeCDDA + flagRemainder + j];
+			}
+			else {
+				flags[j] = next[kCDSectorSizeCDDA + flagRemainder + j - kCDSectorSizeErrorFlags];
+			}
+			
+			if(0 != remainder % 8) {
+				flags[j] |= (flagRemainder + j + 1 < kCDSectorSizeErrorFlags ? current[kCDSectorSizeCDDA + flagRemainder + j + 1] : next[kCDSectorSizeCDDA + flagRemainder + j + 1 - kCDSectorSizeErrorFlags]);
+			}
+		}
+	}
+	
+	return [range length];
+}
+
+- (NSUInteger) trackNumberForSectorRange:(SectorRange *)range
+{
+	NSUInteger			session;
+	NSUInteger			track;
+	
+	session = [_drive sessionContainingSectorRange:range];
+	if(NSNotFound == session) {
+		return NSNotFound;
+	}
+	
+	// Checksums are only meaningful for complete tracks
+	for(track = [_drive firstTrackForSession:session]; track <= [_drive lastTrackForSession:session]; ++track) {
+		if([_drive firstSectorForTrack:track] == [range firstSector] && [_drive lastSectorForTrack:track] == [range lastSector]) {
+			return track;
+		}
+	}
+	
+	return NSNotFound;
+}
+
 @end
@@ -24,6 +24,7 @@
 #include <cdparanoia/cdda_paranoia.h>
 
 #import "Ripper.h"
+#import "BufferedAudioWriter.h"
 
 @interface ParanoiaRipper : Ripper
 {
@@ -34,6 +34,10 @@
 #include <fcntl.h>			// open, close
 #include <paths.h>			// _PATH_DEV
 
+// Paranoia output is queued in blocks of this many sectors for the writer thread
+#define WRITE_BLOCK_SECTORS		256
+#define WRITE_BLOCK_COUNT		4
+
 // Tag values for NSPopupButton
 enum {
 	PARANOIA_LEVEL_FULL					= 0,
@@ -42,7 +46,7 @@ enum {
 
 @interface ParanoiaRipper (Private)
 - (BOOL)	logActivity;
-- (void)	ripSectorRange:(SectorRange *)range toFile:(ExtAudioFileRef)file;
+- (void)	ripSectorRange:(SectorRange *)range toWriter:(BufferedAudioWriter *)writer;
 @end
 
 // cdparanoia callback
@@ -167,6 +171,7 @@ callback(long inpos, int function, void *userdata)
 	ExtAudioFileRef					extAudioFileRef;
 	AudioStreamBasicDescription		outputASBD;
 	SectorRange						*range;
+	BufferedAudioWriter				*writer				= nil;
 	
 	@try {
 		// Tell our owner we are starting
@@ -198,10 +203,18 @@ callback(long inpos, int function, void *userdata)
 		err = ExtAudioFileWrapAudioFileID(audioFile, YES, &extAudioFileRef);
 		NSAssert2(noErr == err, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"ExtAudioFileWrapAudioFileID", UTCreateStringForOSType(err));
 		
+		// Writes happen on a separate thread so this one only waits on paranoia
+		writer = [[BufferedAudioWriter alloc] initWithExtAudioFile:extAudioFileRef blockSize:(WRITE_BLOCK_SECTORS * CD_FRAMESIZE_RAW) blockCount:WRITE_BLOCK_COUNT];
+		
 		for(range in _sectors) {
-			[self ripSectorRange:range toFile:extAudioFileRef];
+			[self ripSectorRange:range toWriter:writer];
 			_sectorsRead = [NSNumber numberWithUnsignedLong:[_sectorsRead unsignedLongValue] + [range length]];
 		}
+		
+		err = [writer finish];
+		NSAssert2(noErr == err, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"ExtAudioFileWrite", UTCreateStringForOSType(err));
+		
+		[self logSectorsRead:[_sectorsRead unsignedLongValue] sinceDate:_startTime];
 	}
 
 	@catch(StopException *exception) {
@@ -216,6 +229,10 @@ callback(long inpos, int function, void *userdata)
 	@finally {
 		NSException						*exception;
 		
+		// The writer thread must be idle before the file is closed
+		[writer finish];
+		[writer release];
+		
 		// Close the output file
 		err = ExtAudioFileDispose(extAudioFileRef);
 		if(noErr != err) {
@@ -242,7 +259,7 @@ callback(long inpos, int function, void *userdata)
 	[[self delegate] setCompleted:YES];	
 }
 
-- (void) ripSectorRange:(SectorRange *)range toFile:(ExtAudioFileRef)file
+- (void) ripSectorRange:(SectorRange *)range toWriter:(BufferedAudioWriter *)writer
 {
 	unsigned long		cursor				= [range firstSector];
 	unsigned long		lastSector			= [range lastSector];
@@ -252,8 +269,6 @@ callback(long inpos, int function, void *userdata)
 	long				where;
 	unsigned long		iterations			= 0;
 	OSStatus			err;
-	AudioBufferList		bufferList;
-	UInt32				frameCount;
 	double				percentComplete;
 	NSTimeInterval		interval;
 	unsigned			secondsRemaining;
@@ -274,16 +289,8 @@ callback(long inpos, int function, void *userdata)
 		buf = paranoia_read_limited(_paranoia, callback, self, (-1 == _maximumRetries ? 20 : _maximumRetries));
 		NSAssert(NULL != buf, NSLocalizedStringFromTable(@"The skip tolerance was exceeded.", @"Exceptions", @""));
 		
-		// Put the data in an AudioBufferList
-		bufferList.mNumberBuffers					= 1;
-		bufferList.mBuffers[0].mData				= buf;
-		bufferList.mBuffers[0].mDataByteSize		= CD_FRAMESIZE_RAW;
-		bufferList.mBuffers[0].mNumberChannels		= 2;
-		
-		frameCount									= CD_FRAMESIZE_RAW / 4;
-		
-		// Write the data
-		err = ExtAudioFileWrite(file, frameCount, &bufferList);
+		// Queue the data for writing
+		err = [writer appendBytes:buf byteCount:CD_FRAMESIZE_RAW];
 		NSAssert2(noErr == err, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"ExtAudioFileWrite", UTCreateStringForOSType(err));
 				
 		// Update status
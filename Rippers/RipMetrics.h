@@ -0,0 +1,70 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// The number of buckets in the read latency histogram; bucket i counts reads taking
+// less than 2^i milliseconds, and the last bucket counts everything slower
+#define RIP_METRICS_LATENCY_BUCKETS		14
+
+// Accumulates timing and drive statistics for a rip, broken down by phase
+// All times are wall clock seconds
+@interface RipMetrics : NSObject
+{
+	NSMutableArray		*_phases;
+	NSString			*_phase;
+	CFAbsoluteTime		_phaseStartTime;
+	NSUInteger			_phaseSectors;
+
+	NSUInteger			_readCount;
+	NSUInteger			_sectorsRead;
+	CFTimeInterval		_readTime;
+	NSUInteger			_readLatencies			[ RIP_METRICS_LATENCY_BUCKETS ];
+	
+	CFTimeInterval		_cacheClearTime;
+	CFTimeInterval		_hashTime;
+	CFTimeInterval		_compareTime;
+
+	NSUInteger			_rereadBlocks;
+	NSUInteger			_speedChanges;
+}
+
+// Phases are sequential; beginning a phase ends the current one
+- (void)			beginPhase:(NSString *)phase;
+- (void)			endPhase;
+
+// Sectors processed in the current phase
+- (void)			addSectors:(NSUInteger)sectorCount;
+
+// A single read request made to the drive
+- (void)			addRead:(NSUInteger)sectorCount latency:(CFTimeInterval)latency;
+
+- (void)			addCacheClearTime:(CFTimeInterval)time;
+- (void)			addHashTime:(CFTimeInterval)time;
+- (void)			addCompareTime:(CFTimeInterval)time;
+
+- (void)			incrementRereadBlocks;
+- (void)			incrementSpeedChanges;
+
+// Suitable for NSPropertyListSerialization
+- (NSDictionary *)	dictionaryRepresentation;
+
+@end
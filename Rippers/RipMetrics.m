@@ -0,0 +1,131 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "RipMetrics.h"
+
+@implementation RipMetrics
+
+- (id) init
+{
+	if((self = [super init])) {
+		_phases = [[NSMutableArray alloc] init];
+		return self;
+	}
+	
+	return nil;
+}
+
+- (void) dealloc
+{
+	[_phases release];		_phases = nil;
+	[_phase release];		_phase = nil;
+	
+	[super dealloc];
+}
+
+- (void) beginPhase:(NSString *)phase
+{
+	NSParameterAssert(nil != phase);
+	
+	[self endPhase];
+	
+	_phase			= [phase retain];
+	_phaseStartTime	= CFAbsoluteTimeGetCurrent();
+	_phaseSectors	= 0;
+}
+
+- (void) endPhase
+{
+	CFTimeInterval		elapsed;
+	
+	if(nil == _phase) {
+		return;
+	}
+	
+	elapsed = CFAbsoluteTimeGetCurrent() - _phaseStartTime;
+	
+	[_phases addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+		_phase, @"phase",
+		[NSNumber numberWithDouble:elapsed], @"seconds",
+		[NSNumber numberWithUnsignedInteger:_phaseSectors], @"sectors",
+		[NSNumber numberWithDouble:(0 < elapsed ? _phaseSectors / elapsed : 0)], @"sectorsPerSecond",
+		nil]];
+	
+	[_phase release],	_phase = nil;
+}
+
+- (void)			addSectors:(NSUInteger)sectorCount			{ _phaseSectors += sectorCount; }
+
+- (void) addRead:(NSUInteger)sectorCount latency:(CFTimeInterval)latency
+{
+	double		milliseconds	= 1000 * latency;
+	unsigned	bucket			= 0;
+	
+	while(bucket < RIP_METRICS_LATENCY_BUCKETS - 1 && milliseconds >= (1 << bucket)) {
+		++bucket;
+	}
+	
+	++_readLatencies[bucket];
+	++_readCount;
+	
+	_sectorsRead	+= sectorCount;
+	_readTime		+= latency;
+}
+
+- (void)			addCacheClearTime:(CFTimeInterval)time		{ _cacheClearTime += time; }
+- (void)			addHashTime:(CFTimeInterval)time			{ _hashTime += time; }
+- (void)			addCompareTime:(CFTimeInterval)time			{ _compareTime += time; }
+
+- (void)			incrementRereadBlocks						{ ++_rereadBlocks; }
+- (void)			incrementSpeedChanges						{ ++_speedChanges; }
+
+- (NSDictionary *) dictionaryRepresentation
+{
+	NSMutableArray		*histogram		= [NSMutableArray arrayWithCapacity:RIP_METRICS_LATENCY_BUCKETS];
+	NSMutableDictionary	*bucket;
+	unsigned			i;
+	
+	for(i = 0; i < RIP_METRICS_LATENCY_BUCKETS; ++i) {
+		bucket = [NSMutableDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:_readLatencies[i]] forKey:@"reads"];
+		
+		// The last bucket has no upper bound
+		if(RIP_METRICS_LATENCY_BUCKETS - 1 != i) {
+			[bucket setObject:[NSNumber numberWithUnsignedInt:(1 << i)] forKey:@"lessThanMilliseconds"];
+		}
+		
+		[histogram addObject:bucket];
+	}
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+		[[_phases copy] autorelease], @"phases",
+		[NSNumber numberWithUnsignedInteger:_readCount], @"reads",
+		[NSNumber numberWithUnsignedInteger:_sectorsRead], @"sectorsRead",
+		[NSNumber numberWithDouble:_readTime], @"readSeconds",
+		histogram, @"readLatency",
+		[NSNumber numberWithDouble:_cacheClearTime], @"cacheClearSeconds",
+		[NSNumber numberWithDouble:_hashTime], @"hashSeconds",
+		[NSNumber numberWithDouble:_compareTime], @"compareSeconds",
+		[NSNumber numberWithUnsignedInteger:_rereadBlocks], @"rereadBlocks",
+		[NSNumber numberWithUnsignedInteger:_speedChanges], @"speedChanges",
+		nil];
+}
+
+@end
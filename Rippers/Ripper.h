@@ -39,4 +39,9 @@
 - (BOOL)					logActivity;
 - (void)					setLogActivity:(BOOL)logActivity;
 
+- (void)					logMessage:(NSString *)message;
+
+// Log the extraction rate, so the ripping modes can be compared on the same drive
+- (void)					logSectorsRead:(NSUInteger)sectorsRead sinceDate:(NSDate *)startTime;
+
 @end
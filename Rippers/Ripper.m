@@ -21,6 +21,7 @@
 #import "Ripper.h"
 #import "RipperTask.h"
 #import "SectorRange.h"
+#import "LogController.h"
 
 @implementation Ripper
 
@@ -82,6 +83,24 @@
 - (BOOL)				logActivity									{ return _logActivity; }
 - (void)				setLogActivity:(BOOL)logActivity			{ _logActivity = logActivity; }
 
+- (void)				logMessage:(NSString *)message
+{
+	if([self logActivity]) {
+		[[LogController sharedController] performSelectorOnMainThread:@selector(logMessage:) withObject:message waitUntilDone:NO];
+	}
+}
+
+- (void)				logSectorsRead:(NSUInteger)sectorsRead sinceDate:(NSDate *)startTime
+{
+	NSTimeInterval		interval		= -1.0 * [startTime timeIntervalSinceNow];
+	
+	if(0 >= interval) {
+		return;
+	}
+	
+	[self logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"%@: %lu sectors in %.2f seconds (%.1f sectors/sec)", @"Log", @""), NSStringFromClass([self class]), (unsigned long)sectorsRead, interval, sectorsRead / interval]];
+}
+
 - (NSString *)			deviceName									{ return [[_deviceName retain] autorelease]; }
 
 - (void)					setDelegate:(id <RipperTaskMethods>)delegate	{ _delegate = delegate; }
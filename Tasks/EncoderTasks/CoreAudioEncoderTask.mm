@@ -24,6 +24,7 @@
 #import "LogController.h"
 #import "UtilityFunctions.h"
 #import "Genres.h"
+#import "GaplessUtilities.h"
 
 #include <AudioToolbox/AudioFile.h>
 #include <AudioToolbox/AudioFormat.h>
@@ -42,6 +43,7 @@
 
 @interface CoreAudioEncoderTask (Private)
 -(void) writeMPEG4Tags;
+-(void) addMetadataToMPEG4Tags:(const MP4Tags *)tags;
 -(void) writeAIFFTags;
 -(void) writeWAVETags;
 @end
@@ -235,6 +237,68 @@
 -(void) writeMPEG4Tags
 {
 	MP4FileHandle			mp4FileHandle;
+	AudioMetadata			*metadata				= [[self taskInfo] metadata];
+	NSDictionary			*streamInfo				= [self encodedStreamInfo];
+	NSDate					*startTime				= [NSDate date];
+	NSDictionary			*attributes				= nil;
+	unsigned long long		fileSize				= 0;
+	NSString				*tempFilename			= NULL;
+
+	// Open the file for modification
+	// Tags, gapless information and the bitrate atom are all stored when the file is closed, in a single update of the moov atom
+	mp4FileHandle = MP4Modify([[self outputFilename] fileSystemRepresentation], MP4_DETAILS_ERROR, 0);
+	NSAssert(MP4_INVALID_FILE_HANDLE != mp4FileHandle, NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
+	
+	if(nil != metadata && NO == [metadata isEmpty]) {
+		const MP4Tags *tags = MP4TagsAlloc();
+		if(NULL != tags) {
+			// The existing items aren't fetched; storing replaces them all, so retagging doesn't duplicate artwork or keep removed fields
+			[self addMetadataToMPEG4Tags:tags];
+			MP4TagsStore(tags, mp4FileHandle);
+			MP4TagsFree(tags);
+		}
+	}
+	
+	if(nil != [streamInfo objectForKey:@"totalFrames"])
+		addMPEG4AACGaplessInformationAtom(mp4FileHandle, [[streamInfo objectForKey:@"totalFrames"] longLongValue]);
+	
+	if(nil != [streamInfo objectForKey:@"bitrate"])
+		addMPEG4AACBitrateInformationAtom(mp4FileHandle, [[streamInfo objectForKey:@"bitrate"] unsignedLongValue], [[streamInfo objectForKey:@"bitrateMode"] intValue]);
+	
+	// Save our changes
+	MP4Close(mp4FileHandle);	
+
+	// MP4Optimize copies the entire file
+	attributes	= [[NSFileManager defaultManager] fileAttributesAtPath:[self outputFilename] traverseLink:YES];
+	fileSize	= [[attributes objectForKey:NSFileSize] unsignedLongLongValue];
+	
+	// Optimize the atoms so the MP4 files will play on shared iTunes libraries
+	// mp4v2 creates a temp file in ., so use a custom file and manually rename it	
+	tempFilename = generateTemporaryFilename([[[self taskInfo] settings] objectForKey:@"temporaryDirectory"], [self fileExtension]);
+	
+	if(MP4Optimize([[self outputFilename] fileSystemRepresentation], [tempFilename fileSystemRepresentation], 0)) {
+		NSFileManager	*fileManager	= [NSFileManager defaultManager];
+		
+		// Delete the existing output file
+		if([fileManager removeFileAtPath:[self outputFilename] handler:nil]) {
+			if(NO == [fileManager movePath:tempFilename toPath:[self outputFilename] handler:nil]) {
+				[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Warning: the file %@ was lost.", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
+			}
+		}
+		else {
+			[[LogController sharedController] logMessage:NSLocalizedStringFromTable(@"Unable to delete the output file.", @"Exceptions", @"")];
+		}
+	}
+	else {
+		[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Unable to optimize file: %@", @"General", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
+	}
+	
+	if([[NSUserDefaults standardUserDefaults] boolForKey:@"enableEncoderLogging"])
+		[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"%@: finalized %@ in %.2f seconds (%qu bytes rewritten)", @"Log", @""), NSStringFromClass([self class]), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]], -1.0 * [startTime timeIntervalSinceNow], fileSize]];
+}
+
+-(void) addMetadataToMPEG4Tags:(const MP4Tags *)tags
+{
 	AudioMetadata			*metadata				= [[self taskInfo] metadata];
 	NSString				*bundleVersion			= nil;
 	NSString				*versionString			= nil;
@@ -252,22 +316,8 @@
 	NSString				*comment				= nil;
 	NSString				*trackComment			= nil;
 	NSNumber				*compilation			= nil;
-	NSImage					*albumArt				= nil;
+	NSString				*mimeType				= nil;
 	NSData					*data					= nil;
-	NSString				*tempFilename			= NULL;
-
-	// Open the file for modification
-	mp4FileHandle = MP4Modify([[self outputFilename] fileSystemRepresentation], MP4_DETAILS_ERROR, 0);
-	NSAssert(MP4_INVALID_FILE_HANDLE != mp4FileHandle, NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
-	
-	// Read the tags
-	const MP4Tags *tags = MP4TagsAlloc();
-	if(NULL == tags) {
-		MP4Close(mp4FileHandle);		
-		return;
-	}
-	
-	MP4TagsFetch(tags, mp4FileHandle);
 
 	// Album title
 	album = [metadata albumTitle];
@@ -359,14 +409,12 @@
 	}
 	
 	// Album art
-	albumArt = [metadata albumArt];
-	if(nil != albumArt) {
-		data = getPNGDataForImage(albumArt);
-
+	data = [metadata albumArtDataForTags:&mimeType];
+	if(nil != data) {
 		MP4TagArtwork artwork;
 		artwork.data = (void *)[data bytes];
 		artwork.size = [data length];
-		artwork.type = MP4_ART_PNG;
+		artwork.type = ([mimeType isEqualToString:@"image/jpeg"] ? MP4_ART_JPEG : MP4_ART_PNG);
 		
 		MP4TagsAddArtwork(tags, &artwork);
 	}
@@ -378,32 +426,6 @@
 
 	// TODO: Should this be set to the user's name?
 	MP4TagsSetEncodedBy(tags, [versionString UTF8String]);
-
-	// Save our changes
-	MP4TagsStore(tags, mp4FileHandle);
-	MP4TagsFree(tags);
-	MP4Close(mp4FileHandle);	
-
-	// Optimize the atoms so the MP4 files will play on shared iTunes libraries
-	// mp4v2 creates a temp file in ., so use a custom file and manually rename it	
-	tempFilename = generateTemporaryFilename([[[self taskInfo] settings] objectForKey:@"temporaryDirectory"], [self fileExtension]);
-	
-	if(MP4Optimize([[self outputFilename] fileSystemRepresentation], [tempFilename fileSystemRepresentation], 0)) {
-		NSFileManager	*fileManager	= [NSFileManager defaultManager];
-		
-		// Delete the existing output file
-		if([fileManager removeFileAtPath:[self outputFilename] handler:nil]) {
-			if(NO == [fileManager movePath:tempFilename toPath:[self outputFilename] handler:nil]) {
-				[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Warning: the file %@ was lost.", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
-			}
-		}
-		else {
-			[[LogController sharedController] logMessage:NSLocalizedStringFromTable(@"Unable to delete the output file.", @"Exceptions", @"")];
-		}
-	}
-	else {
-		[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"Unable to optimize file: %@", @"General", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
-	}
 }
 
 -(void) writeAIFFTags
@@ -425,7 +447,8 @@
 	NSNumber									*length						= nil;
 	TagLib::ID3v2::TextIdentificationFrame		*frame						= NULL;
 	TagLib::ID3v2::AttachedPictureFrame			*pictureFrame				= NULL;
-	NSImage										*albumArt					= nil;
+	TagLib::ID3v2::FrameList					frames;
+	NSString									*mimeType					= nil;
 	NSData										*data						= nil;
 	TagLib::RIFF::AIFF::File					f							([[self outputFilename] fileSystemRepresentation], false);
 	NSString									*bundleVersion				= nil;
@@ -442,6 +465,11 @@
 	
 	NSAssert(f.isValid(), NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
 	
+	// Start from an empty tag, so retagging doesn't duplicate frames or keep fields removed from the metadata
+	frames = f.tag()->frameList();
+	for(TagLib::ID3v2::FrameList::Iterator it = frames.begin(); it != frames.end(); ++it)
+		f.tag()->removeFrame(*it);
+	
 	// Use UTF-8 as the default encoding
 	(TagLib::ID3v2::FrameFactory::instance())->setDefaultTextEncoding(TagLib::String::UTF8);
 	
@@ -589,13 +617,12 @@
 	}
 	
 	// Album art
-	albumArt = [metadata albumArt];
-	if(nil != albumArt) {
-		data			= getPNGDataForImage(albumArt); 
+	data = [metadata albumArtDataForTags:&mimeType];
+	if(nil != data) {
 		pictureFrame	= new TagLib::ID3v2::AttachedPictureFrame();
 		NSAssert(NULL != pictureFrame, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		pictureFrame->setMimeType(TagLib::String("image/png", TagLib::String::Latin1));
+		pictureFrame->setMimeType(TagLib::String([mimeType UTF8String], TagLib::String::Latin1));
 		pictureFrame->setPicture(TagLib::ByteVector((const char *)[data bytes], [data length]));
 		f.tag()->addFrame(pictureFrame);
 	}
@@ -715,7 +742,8 @@
 	NSNumber									*length						= nil;
 	TagLib::ID3v2::TextIdentificationFrame		*frame						= NULL;
 	TagLib::ID3v2::AttachedPictureFrame			*pictureFrame				= NULL;
-	NSImage										*albumArt					= nil;
+	TagLib::ID3v2::FrameList					frames;
+	NSString									*mimeType					= nil;
 	NSData										*data						= nil;
 	TagLib::RIFF::WAV::File						f							([[self outputFilename] fileSystemRepresentation], false);
 	NSString									*bundleVersion				= nil;
@@ -732,6 +760,11 @@
 	
 	NSAssert(f.isValid(), NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
 	
+	// Start from an empty tag, so retagging doesn't duplicate frames or keep fields removed from the metadata
+	frames = f.tag()->frameList();
+	for(TagLib::ID3v2::FrameList::Iterator it = frames.begin(); it != frames.end(); ++it)
+		f.tag()->removeFrame(*it);
+	
 	// Use UTF-8 as the default encoding
 	(TagLib::ID3v2::FrameFactory::instance())->setDefaultTextEncoding(TagLib::String::UTF8);
 	
@@ -879,13 +912,12 @@
 	}
 	
 	// Album art
-	albumArt = [metadata albumArt];
-	if(nil != albumArt) {
-		data			= getPNGDataForImage(albumArt); 
+	data = [metadata albumArtDataForTags:&mimeType];
+	if(nil != data) {
 		pictureFrame	= new TagLib::ID3v2::AttachedPictureFrame();
 		NSAssert(NULL != pictureFrame, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		pictureFrame->setMimeType(TagLib::String("image/png", TagLib::String::Latin1));
+		pictureFrame->setMimeType(TagLib::String([mimeType UTF8String], TagLib::String::Latin1));
 		pictureFrame->setPicture(TagLib::ByteVector((const char *)[data bytes], [data length]));
 		f.tag()->addFrame(pictureFrame);
 	}
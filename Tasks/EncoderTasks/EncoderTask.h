@@ -31,14 +31,25 @@
 	id <EncoderMethods>		_encoder;
 	NSDictionary			*_encoderSettings;
 	NSString				*_encoderSettingsString;
+	BOOL					_tagsWrittenToStream;
+	NSDictionary			*_encodedStreamInfo;
+	NSString				*_transcodeCacheKey;
+	BOOL					_restoredFromTranscodeCache;
 }
 
 - (NSString *)		outputFormatName;
 - (NSString *)		fileExtension;
 
+// The output filename without its extension, as named by the task's settings and metadata
+- (NSString *)		outputBasename;
+
 - (void)			encoderReady:(id)anObject;
 
 - (NSString *)		encoderSettingsString;
+- (NSDictionary *)	encodedStreamInfo;
+
+// Writes this task's tags to a file it encoded earlier, without encoding it again
+- (void)			writeTagsToFile:(NSString *)filename encoderSettingsString:(NSString *)encoderSettingsString;
 @end
 
 @interface EncoderTask (CueSheetAdditions)
@@ -20,18 +20,30 @@
 
 #import "EncoderTask.h"
 
+#import "Encoder.h"
 #import "EncoderMethods.h"
 #import "EncoderController.h"
 #import "LogController.h"
 #import "Track.h"
+#import "NamingScheme.h"
+#import "TranscodeCache.h"
 
 #import "UtilityFunctions.h"
 
 @interface EncoderTask (Private)
+- (NSDictionary *)	tagsWithSettingsString:(NSString *)settingsString;
 - (void)			writeTags;
 
 - (void)			touchOutputFile;
 
+- (void)			startEncoder;
+- (void)			completeEncode;
+
+- (NSString *)		transcodeCacheKey;
+- (BOOL)			restoreFromTranscodeCache;
+- (void)			transcodeCacheDidRestoreEncode:(NSDictionary *)entry;
+- (void)			transcodeCacheDidStoreEncode:(id)unused;
+
 - (NSString *)		generateStandardBasenameUsingMetadata:(AudioMetadata *)metadata;
 - (NSString *)		generateCustomBasenameUsingMetadata:(AudioMetadata *)metadata settings:(NSDictionary *)settings substitutions:(NSDictionary *)substitutions;
 @end
@@ -84,6 +96,8 @@ enum {
 	[_connection release];				_connection = nil;
 	[_encoderSettings release];			_encoderSettings = nil;
 	[_encoderSettingsString release];	_encoderSettingsString = nil;
+	[_encodedStreamInfo release];		_encodedStreamInfo = nil;
+	[_transcodeCacheKey release];		_transcodeCacheKey = nil;
 
 	[super dealloc];
 }
@@ -105,6 +119,32 @@ enum {
 
 - (NSString *)		encoderSettingsString				{ return _encoderSettingsString; }
 
+- (NSDictionary *)	streamTagsWithSettingsString:(NSString *)settingsString
+{
+	NSDictionary	*tags		= nil;
+	
+	if(nil != [[self taskInfo] metadata] && NO == [[[self taskInfo] metadata] isEmpty])
+		tags = [self tagsWithSettingsString:settingsString];
+	
+	return tags;
+}
+
+- (void)			setTagsWrittenToStream:(BOOL)tagsWrittenToStream	{ _tagsWrittenToStream = tagsWrittenToStream; }
+
+- (NSDictionary *)	encodedStreamInfo					{ return [[_encodedStreamInfo retain] autorelease]; }
+- (void)			setEncodedStreamInfo:(NSDictionary *)encodedStreamInfo 	{ [_encodedStreamInfo release]; _encodedStreamInfo = [encodedStreamInfo retain]; }
+
+- (void)			writeTagsToFile:(NSString *)filename encoderSettingsString:(NSString *)encoderSettingsString
+{
+	NSParameterAssert(nil != filename);
+	
+	[_encoderSettingsString release];
+	_encoderSettingsString = [encoderSettingsString retain];
+	
+	[self setOutputFilename:filename];
+	[self writeTags];
+}
+
 - (void)			encoderReady:(id)anObject
 {
 	_encoder = [(NSObject*) anObject retain];
@@ -112,12 +152,9 @@ enum {
 	[anObject encodeToFile:[self outputFilename]];
 }
 
-- (void)			run
+- (NSString *)		outputBasename
 {
 	NSString				*basename;
-	NSPort					*port1				= [NSPort port];
-	NSPort					*port2				= [NSPort port];
-	NSArray					*portArray			= nil;
 	
 	// Encode in place?
 	if(nil == [[self taskInfo] inputTracks] && [[[[self taskInfo] settings] objectForKey:@"convertInPlace"] boolValue])
@@ -127,18 +164,12 @@ enum {
 		basename = [NSString stringWithFormat:@"%@/%@",
 			[[[[self taskInfo] settings] objectForKey:@"outputDirectory"] stringByExpandingTildeInPath],
 			[[[[self taskInfo] inputFilenameAtInputFileIndex] lastPathComponent] stringByDeletingPathExtension] ];
-
-		// Create the directory hierarchy if required
-		createDirectoryStructure(basename);
 	}
 	// Use the standard file naming format
 	else if(nil == [[[self taskInfo] settings] objectForKey:@"outputFileNaming"]) {
 		basename = [NSString stringWithFormat:@"%@/%@",
 			[[[[self taskInfo] settings] objectForKey:@"outputDirectory"] stringByExpandingTildeInPath],
 			[self generateStandardBasenameUsingMetadata:[[self taskInfo] metadata]] ];
-
-		// Create the directory hierarchy if required
-		createDirectoryStructure(basename);
 	}
 	// Use a custom file naming format
 	else {
@@ -150,10 +181,18 @@ enum {
 		basename = [NSString stringWithFormat:@"%@/%@",
 			[[[[self taskInfo] settings] objectForKey:@"outputDirectory"] stringByExpandingTildeInPath],
 			[self generateCustomBasenameUsingMetadata:[[self taskInfo] metadata] settings:outputFileNaming substitutions:substitutions] ];
+	}
+	
+	return basename;
+}
 
-		// Create the directory hierarchy if required
+- (void)			run
+{
+	NSString				*basename			= [self outputBasename];
+	
+	// Create the directory hierarchy if required
+	if(NO == (nil == [[self taskInfo] inputTracks] && [[[[self taskInfo] settings] objectForKey:@"convertInPlace"] boolValue]))
 		createDirectoryStructure(basename);
-	}
 	
 	// Check if output file exists and delete if requested as long as the output and input files are not the same
 	if([[NSFileManager defaultManager] fileExistsAtPath:[NSString stringWithFormat:@"%@.%@", basename, [self fileExtension]]] 
@@ -182,6 +221,7 @@ enum {
 				case NSAlertSecondButtonReturn:				
 					alertResult		= [[NSFileManager defaultManager] removeFileAtPath:filename handler:nil];
 					NSAssert(YES == alertResult, NSLocalizedStringFromTable(@"Unable to delete the output file.", @"Exceptions", @"") );
+					releaseUniqueFilename(filename);
 					break;
 
 				case NSAlertThirdButtonReturn:
@@ -193,6 +233,7 @@ enum {
 		else {
 			alertResult = [[NSFileManager defaultManager] removeFileAtPath:filename handler:nil];
 			NSAssert(YES == alertResult, NSLocalizedStringFromTable(@"Unable to delete the output file.", @"Exceptions", @"") );
+			releaseUniqueFilename(filename);
 		}
 	}
 
@@ -201,7 +242,7 @@ enum {
 	[self touchOutputFile];
 	
 	// Save album art if desired
-	if(nil != [[[self taskInfo] settings] objectForKey:@"albumArt"] && nil != [[[self taskInfo] metadata] albumArt]) {
+	if(nil != [[[self taskInfo] settings] objectForKey:@"albumArt"] && (nil != [[[self taskInfo] metadata] albumArtData] || nil != [[[self taskInfo] metadata] albumArt])) {
 		NSBitmapImageFileType	fileType;
 		NSString				*extension;		
 		
@@ -220,7 +261,7 @@ enum {
 		if(nil == namingScheme)
 			namingScheme = @"cover";
 		
-		NSData		*bitmapData			= getBitmapDataForImage([[[self taskInfo] metadata] albumArt], fileType);
+		NSData		*bitmapData			= [[[self taskInfo] metadata] albumArtDataOfType:fileType];
 		NSString	*bitmapBasename		= [[[self outputFilename] stringByDeletingLastPathComponent] stringByAppendingPathComponent:[[[self taskInfo] metadata] replaceKeywordsInString:makeStringSafeForFilename(namingScheme)]];
 		//bitmapFilename		= generateUniqueFilename(bitmapBasename, extension);
 		NSString	*bitmapFilename		= [bitmapBasename stringByAppendingPathExtension:extension];
@@ -231,13 +272,13 @@ enum {
 		}
 	}
 	
-	_connection = [[NSConnection alloc] initWithReceivePort:port1 sendPort:port2];
-	[_connection setRootObject:self];
-
-	portArray = [NSArray arrayWithObjects:port2, port1, nil];
+	// Reuse the audio from an identical earlier conversion, if one is cached
+	_transcodeCacheKey = [[self transcodeCacheKey] retain];
+	if(nil != _transcodeCacheKey && [self restoreFromTranscodeCache])
+		return;
 	
 	[super setStarted:YES];
-	[NSThread detachNewThreadSelector:@selector(connectWithPorts:) toTarget:_encoderClass withObject:portArray];
+	[self startEncoder];
 }
 
 - (void) setTaskInfo:(TaskInfo *)taskInfo
@@ -303,7 +344,8 @@ enum {
 	}
 
 	// Before severing the connection to the encoder, grab the settings string for tagging purposes
-	_encoderSettingsString		= [[_encoder settingsString] retain];
+	if(NO == _restoredFromTranscodeCache)
+		_encoderSettingsString		= [[_encoder settingsString] retain];
 	
 	// Once we're complete, clean up the encoder and invalidate the connection
 	[(NSObject *)_encoder release],		_encoder = nil;
@@ -319,103 +361,14 @@ enum {
 	}
  */
 	
-	@try {
-
-		// Tag file, if we have metadata
-		if(nil != [[self taskInfo] metadata] && NO == [[[self taskInfo] metadata] isEmpty]) {
-			[self writeTags];
-		}
-		
-		// Run post-processing tasks
-		if(nil != [[[self taskInfo] settings] objectForKey:@"postProcessingOptions"]) {
-			NSDictionary		*postProcessingOptions;
-			NSArray				*applications;
-			unsigned			i;
-
-			postProcessingOptions	= [[[self taskInfo] settings] objectForKey:@"postProcessingOptions"];
-			applications			= [postProcessingOptions objectForKey:@"postProcessingApplications"];
-
-			for(i = 0; i < [applications count]; ++i) {
-				[[NSWorkspace sharedWorkspace] openFile:[self outputFilename] withApplication:[applications objectAtIndex:i] andDeactivate:NO];
-			}
-			
-			if([[postProcessingOptions objectForKey:@"addToiTunes"] boolValue]) {
-				AudioMetadata	*metadata		= [[self taskInfo] metadata];
-				NSString		*playlist		= [postProcessingOptions objectForKey:@"iTunesPlaylistName"];
-
-				// Set up the iTunes playlist
-				if([[postProcessingOptions objectForKey:@"addToiTunesPlaylist"] boolValue] && nil != playlist) {
-					// Flesh out specifiers
-					playlist = [metadata replaceKeywordsInString:playlist];
-					
-					// Set the playlist in the metadata
-					[metadata setPlaylist:playlist];
-				}
-
-				// Add to iTunes
-				if([self formatIsValidForiTunes]) {
-					addFileToiTunesLibrary([self outputFilename], metadata);
-				}				
-			}
-		}
-	}
-	
-	@catch(NSException *exception) {
-		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
-		[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
-		[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while tagging the file \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
-		[alert setInformativeText:[exception reason]];
-		[alert setAlertStyle:NSWarningAlertStyle];		
-		[alert runModal];
-	}
-	
-	@try {
-		[super setCompleted:YES];
-		
-		// Delete input file if requested
-		if(nil == [[self taskInfo] inputTracks] && [[[[self taskInfo] settings] objectForKey:@"deleteSourceFiles"] boolValue]) {
-			NSArray			*filenames		= [[self taskInfo] inputFilenames];
-			unsigned		i;
-			BOOL			result;
-			
-			for(i = 0; i < [filenames count]; ++i) {
-				result = [[NSFileManager defaultManager] removeFileAtPath:[filenames objectAtIndex:i] handler:nil];
-				NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to delete the input file.", @"Exceptions", @""));
-			}
-		}
-
-		// Generate cue sheet
-		if(nil != [[self taskInfo] inputTracks] && [[[[self taskInfo] settings] objectForKey:@"generateCueSheet"] boolValue]) {
-			if([self formatIsValidForCueSheet]) {
-				[self generateCueSheet];
-			}
-			/*else {
-				@throw [FileFormatNotSupportedException exceptionWithReason:NSLocalizedStringFromTable(@"Cue sheets are not supported for this output format.", @"Exceptions", @"")
-																   userInfo:[NSDictionary dictionaryWithObject:[self outputFormat] forKey:@"fileFormat"]];
-			}*/
-		}
-
-		// Mark tracks as complete
-		if(nil != [[self taskInfo] inputTracks]) {
-			NSArray			*tracks		= [[self taskInfo] inputTracks];
-			unsigned		i;
-			
-			for(i = 0; i < [tracks count]; ++i) {
-				[[tracks objectAtIndex:i] encodeCompleted];
-			}
-		}
-			
-		[[EncoderController sharedController] encoderTaskDidComplete:self];
+	// Keep a copy of the untagged audio for later conversions of the same file with the same settings
+	// The copy is made off the main thread, and the file is tagged once it is done
+	if(nil != _transcodeCacheKey && NO == _restoredFromTranscodeCache && NO == _tagsWrittenToStream) {
+		[[TranscodeCache sharedCache] storeEncodeOfFile:[self outputFilename] forKey:_transcodeCacheKey settingsString:_encoderSettingsString streamInfo:_encodedStreamInfo target:self selector:@selector(transcodeCacheDidStoreEncode:)];
+		return;
 	}
 	
-	@catch(NSException *exception) {
-		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
-		[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
-		[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while encoding the file \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
-		[alert setInformativeText:[exception reason]];
-		[alert setAlertStyle:NSWarningAlertStyle];		
-		[alert runModal];
-	}
+	[self completeEncode];
 }
 
 - (void) stop
@@ -472,6 +425,7 @@ enum {
 
 		// Create the file (don't overwrite)
 		fd = open([cueSheetFilename fileSystemRepresentation], O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		releaseUniqueFilename(cueSheetFilename);
 		NSAssert(-1 != fd, NSLocalizedStringFromTable(@"Unable to create the cue sheet.", @"Exceptions", @""));
 		
 		// REM
@@ -567,6 +521,7 @@ enum {
 
 @implementation EncoderTask (Private)
 
+- (NSDictionary *)	tagsWithSettingsString:(NSString *)settingsString		{ return nil; }
 - (void)			writeTags							{}
 
 - (void) touchOutputFile
@@ -574,14 +529,229 @@ enum {
 	NSNumber		*permissions	= [NSNumber numberWithUnsignedLong:S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH];
 	NSDictionary	*attributes		= [NSDictionary dictionaryWithObject:permissions forKey:NSFilePosixPermissions];	
 	BOOL			result			= [[NSFileManager defaultManager] createFileAtPath:[self outputFilename] contents:nil attributes:attributes];
+	
+	// Once the file exists (or couldn't be created) the name no longer needs reserving
+	releaseUniqueFilename([self outputFilename]);
 	NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));	
 }
 
+- (void) startEncoder
+{
+	NSPort					*port1				= [NSPort port];
+	NSPort					*port2				= [NSPort port];
+	NSArray					*portArray			= nil;
+	
+	_connection = [[NSConnection alloc] initWithReceivePort:port1 sendPort:port2];
+	[_connection setRootObject:self];
+
+	portArray = [NSArray arrayWithObjects:port2, port1, nil];
+	
+	[NSThread detachNewThreadSelector:@selector(connectWithPorts:) toTarget:_encoderClass withObject:portArray];
+}
+
+- (void) completeEncode
+{
+	@try {
+		// Tag file, if we have metadata and the encoder didn't already write it, or if the encoder left stream info to store
+		if((nil != [[self taskInfo] metadata] && NO == [[[self taskInfo] metadata] isEmpty] && NO == _tagsWrittenToStream) || nil != _encodedStreamInfo) {
+			[self writeTags];
+		}
+		
+		// Run post-processing tasks
+		if(nil != [[[self taskInfo] settings] objectForKey:@"postProcessingOptions"]) {
+			NSDictionary		*postProcessingOptions;
+			NSArray				*applications;
+			unsigned			i;
+
+			postProcessingOptions	= [[[self taskInfo] settings] objectForKey:@"postProcessingOptions"];
+			applications			= [postProcessingOptions objectForKey:@"postProcessingApplications"];
+
+			for(i = 0; i < [applications count]; ++i) {
+				[[NSWorkspace sharedWorkspace] openFile:[self outputFilename] withApplication:[applications objectAtIndex:i] andDeactivate:NO];
+			}
+			
+			if([[postProcessingOptions objectForKey:@"addToiTunes"] boolValue]) {
+				AudioMetadata	*metadata		= [[self taskInfo] metadata];
+				NSString		*playlist		= [postProcessingOptions objectForKey:@"iTunesPlaylistName"];
+
+				// Set up the iTunes playlist
+				if([[postProcessingOptions objectForKey:@"addToiTunesPlaylist"] boolValue] && nil != playlist) {
+					// Flesh out specifiers
+					playlist = [metadata replaceKeywordsInString:playlist];
+					
+					// Set the playlist in the metadata
+					[metadata setPlaylist:playlist];
+				}
+
+				// Add to iTunes
+				if([self formatIsValidForiTunes]) {
+					addFileToiTunesLibrary([self outputFilename], metadata);
+				}				
+			}
+		}
+	}
+	
+	@catch(NSException *exception) {
+		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
+		[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
+		[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while tagging the file \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
+		[alert setInformativeText:[exception reason]];
+		[alert setAlertStyle:NSWarningAlertStyle];		
+		[alert runModal];
+	}
+	
+	@try {
+		[super setCompleted:YES];
+		
+		// Delete input file if requested
+		if(nil == [[self taskInfo] inputTracks] && [[[[self taskInfo] settings] objectForKey:@"deleteSourceFiles"] boolValue]) {
+			NSArray			*filenames		= [[self taskInfo] inputFilenames];
+			unsigned		i;
+			BOOL			result;
+			
+			for(i = 0; i < [filenames count]; ++i) {
+				result = [[NSFileManager defaultManager] removeFileAtPath:[filenames objectAtIndex:i] handler:nil];
+				NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to delete the input file.", @"Exceptions", @""));
+			}
+		}
+
+		// Generate cue sheet
+		if(nil != [[self taskInfo] inputTracks] && [[[[self taskInfo] settings] objectForKey:@"generateCueSheet"] boolValue]) {
+			if([self formatIsValidForCueSheet]) {
+				[self generateCueSheet];
+			}
+			/*else {
+				@throw [FileFormatNotSupportedException exceptionWithReason:NSLocalizedStringFromTable(@"Cue sheets are not supported for this output format.", @"Exceptions", @"")
+																   userInfo:[NSDictionary dictionaryWithObject:[self outputFormat] forKey:@"fileFormat"]];
+			}*/
+		}
+
+		// Mark tracks as complete
+		if(nil != [[self taskInfo] inputTracks]) {
+			NSArray			*tracks		= [[self taskInfo] inputTracks];
+			unsigned		i;
+			
+			for(i = 0; i < [tracks count]; ++i) {
+				[[tracks objectAtIndex:i] encodeCompleted];
+			}
+		}
+			
+		[[EncoderController sharedController] encoderTaskDidComplete:self];
+	}
+	
+	@catch(NSException *exception) {
+		NSAlert *alert = [[[NSAlert alloc] init] autorelease];
+		[alert addButtonWithTitle:NSLocalizedStringFromTable(@"OK", @"General", @"")];
+		[alert setMessageText:[NSString stringWithFormat:NSLocalizedStringFromTable(@"An error occurred while encoding the file \"%@\".", @"Exceptions", @""), [[NSFileManager defaultManager] displayNameAtPath:[self outputFilename]]]];
+		[alert setInformativeText:[exception reason]];
+		[alert setAlertStyle:NSWarningAlertStyle];		
+		[alert runModal];
+	}
+}
+
+// Identifies the audio this task will encode and how, or returns nil if the result can't be cached
+- (NSString *) transcodeCacheKey
+{
+	NSDictionary		*settings			= [self encoderSettings];
+	NSDictionary		*framesToConvert	= [[[self taskInfo] settings] valueForKey:@"framesToConvert"];
+	NSString			*audioIdentifier	= nil;
+	NSString			*libraryVersion		= nil;
+	NSMutableString		*key				= nil;
+	NSEnumerator		*enumerator			= nil;
+	NSString			*settingName		= nil;
+	
+	if(NO == [[NSUserDefaults standardUserDefaults] boolForKey:@"useTranscodeCache"])
+		return nil;
+	
+	// Ripped tracks are encoded from temporary files, so only single input files are cached
+	if(nil != [[self taskInfo] inputTracks] || 1 != [[[self taskInfo] inputFilenames] count])
+		return nil;
+	
+	audioIdentifier = [TranscodeCache audioIdentifierForFile:[[self taskInfo] inputFilenameAtInputFileIndex]];
+	if(nil == audioIdentifier)
+		return nil;
+	
+	// A different version of the encoder may produce different output from the same settings
+	libraryVersion = [_encoderClass libraryVersion];
+	if(nil == libraryVersion)
+		return nil;
+	
+	key = [NSMutableString stringWithFormat:@"%@ %@ (%@) %@", audioIdentifier, NSStringFromClass(_encoderClass), libraryVersion, [self fileExtension]];
+	
+	if(nil != framesToConvert)
+		[key appendFormat:@" frames=%@+%@", [framesToConvert valueForKey:@"startingFrame"], [framesToConvert valueForKey:@"frameCount"]];
+	
+	// The encoder's settings string isn't available until it has started, so use the settings it is built from
+	enumerator = [[[settings allKeys] sortedArrayUsingSelector:@selector(compare:)] objectEnumerator];
+	while((settingName = [enumerator nextObject]))
+		[key appendFormat:@" %@=%@", settingName, [settings objectForKey:settingName]];
+	
+	return key;
+}
+
+- (BOOL) restoreFromTranscodeCache
+{
+	TranscodeCache		*cache		= [TranscodeCache sharedCache];
+	
+	if(NO == [cache restoreEncodeForKey:_transcodeCacheKey toFile:[self outputFilename] target:self selector:@selector(transcodeCacheDidRestoreEncode:)]) {
+		if([[NSUserDefaults standardUserDefaults] boolForKey:@"enableEncoderLogging"])
+			[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"%@: transcode cache %@ (%lu hits, %lu misses)", @"Log", @""), 
+				[self description], 
+				NSLocalizedStringFromTable(@"miss", @"Log", @""), 
+				(unsigned long)[cache hits], 
+				(unsigned long)[cache misses]]];
+		
+		return NO;
+	}
+	
+	// The cached file is copied off the main thread; until then the task is running but the controller isn't told
+	[self setStartTime:[NSDate date]];
+	[super setStarted:YES];
+	
+	return YES;
+}
+
+- (void) transcodeCacheDidRestoreEncode:(NSDictionary *)entry
+{
+	TranscodeCache		*cache		= [TranscodeCache sharedCache];
+	
+	if([[NSUserDefaults standardUserDefaults] boolForKey:@"enableEncoderLogging"])
+		[[LogController sharedController] logMessage:[NSString stringWithFormat:NSLocalizedStringFromTable(@"%@: transcode cache %@ (%lu hits, %lu misses)", @"Log", @""), 
+			[self description], 
+			(nil != entry ? NSLocalizedStringFromTable(@"hit", @"Log", @"") : NSLocalizedStringFromTable(@"miss", @"Log", @"")), 
+			(unsigned long)[cache hits], 
+			(unsigned long)[cache misses]]];
+	
+	if([self shouldStop]) {
+		[self setStopped:YES];
+		return;
+	}
+	
+	// The cached file has gone missing, so encode as usual
+	if(nil == entry) {
+		[self startEncoder];
+		return;
+	}
+	
+	_restoredFromTranscodeCache		= YES;
+	_encoderSettingsString			= [[entry objectForKey:@"settingsString"] retain];
+	[self setEncodedStreamInfo:[entry objectForKey:@"streamInfo"]];
+	
+	[self setStarted:YES];
+	[self setEndTime:[NSDate date]];
+	[self setCompleted:YES];
+}
+
+- (void) transcodeCacheDidStoreEncode:(id)unused
+{
+	[self completeEncode];
+}
+
 - (NSString *) generateCustomBasenameUsingMetadata:(AudioMetadata *)metadata settings:(NSDictionary *)settings substitutions:(NSDictionary *)substitutions
 {
-	NSString			*basename			= nil;
-	NSMutableString		*customPath			= [NSMutableString stringWithCapacity:100];
 	NSString			*customNamingScheme = [settings objectForKey:@"formatString"];
+	NSString			*numberFormat		= ([[settings objectForKey:@"useTwoDigitTrackNumbers"] boolValue] ? @"%02u" : @"%u");
+	NSString			*values				[ kNamingSchemeKeywordCount ];
 	
 	// Get the elements needed to build the pathname
 	NSNumber			*discNumber			= [metadata discNumber];
@@ -618,114 +788,27 @@ enum {
 	
 	if(nil == customNamingScheme)
 		@throw [NSException exceptionWithName:@"NSObjectInaccessibleException" reason:@"The custom naming string appears to be invalid." userInfo:nil];
-	else
-		[customPath setString:customNamingScheme];
-	
-	if(nil == discNumber)
-		[customPath replaceOccurrencesOfString:@"{discNumber}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{discNumber}" withString:[NSString stringWithFormat:@"%u", [discNumber intValue]] options:0 range:NSMakeRange(0, [customPath length])];					
-
-	if(nil == discTotal)
-		[customPath replaceOccurrencesOfString:@"{discTotal}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{discTotal}" withString:[NSString stringWithFormat:@"%u", [discTotal intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == albumArtist)
-		[customPath replaceOccurrencesOfString:@"{albumArtist}" withString:NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumArtist}" withString:makeStringSafeForFilename(albumArtist) options:0 range:NSMakeRange(0, [customPath length])];					
-
-	if(nil == albumTitle)
-		[customPath replaceOccurrencesOfString:@"{albumTitle}" withString:@"Unknown Disc" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumTitle}" withString:makeStringSafeForFilename(albumTitle) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == albumGenre)
-		[customPath replaceOccurrencesOfString:@"{albumGenre}" withString:@"Unknown Genre" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumGenre}" withString:makeStringSafeForFilename(albumGenre) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == albumYear)
-		[customPath replaceOccurrencesOfString:@"{albumDate}" withString:@"Unknown Year" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumDate}" withString:[NSString stringWithFormat:@"%u", [albumYear intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == albumComposer)
-		[customPath replaceOccurrencesOfString:@"{albumComposer}" withString:@"Unknown Composer" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumComposer}" withString:makeStringSafeForFilename(albumComposer) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == albumComment)
-		[customPath replaceOccurrencesOfString:@"{albumComment}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{albumComment}" withString:makeStringSafeForFilename(albumComment) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == trackNumber)
-		[customPath replaceOccurrencesOfString:@"{trackNumber}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else {
-		if([[settings objectForKey:@"useTwoDigitTrackNumbers"] boolValue])
-			[customPath replaceOccurrencesOfString:@"{trackNumber}" withString:[NSString stringWithFormat:@"%02u", [trackNumber intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-		else
-			[customPath replaceOccurrencesOfString:@"{trackNumber}" withString:[NSString stringWithFormat:@"%u", [trackNumber intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-	}
 	
-	if(nil == trackTotal)
-		[customPath replaceOccurrencesOfString:@"{trackTotal}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else {
-		if([[settings objectForKey:@"useTwoDigitTrackNumbers"] boolValue])
-			[customPath replaceOccurrencesOfString:@"{trackTotal}" withString:[NSString stringWithFormat:@"%02u", [trackTotal intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-		else
-			[customPath replaceOccurrencesOfString:@"{trackTotal}" withString:[NSString stringWithFormat:@"%u", [trackTotal intValue]] options:0 range:NSMakeRange(0, [customPath length])];
-	}
-	
-	if(nil == trackArtist)
-		[customPath replaceOccurrencesOfString:@"{trackArtist}" withString:NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackArtist}" withString:makeStringSafeForFilename(trackArtist) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == trackTitle)
-		[customPath replaceOccurrencesOfString:@"{trackTitle}" withString:NSLocalizedStringFromTable(@"Unknown Track", @"CompactDisc", @"") options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackTitle}" withString:makeStringSafeForFilename(trackTitle) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == trackGenre)
-		[customPath replaceOccurrencesOfString:@"{trackGenre}" withString:@"Unknown Genre" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackGenre}" withString:makeStringSafeForFilename(trackGenre) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == trackYear)
-		[customPath replaceOccurrencesOfString:@"{trackDate}" withString:@"Unknown Year" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackDate}" withString:makeStringSafeForFilename(trackYear) options:0 range:NSMakeRange(0, [customPath length])];
-
-	if(nil == trackComposer)
-		[customPath replaceOccurrencesOfString:@"{trackComposer}" withString:@"Unknown Composer" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackComposer}" withString:makeStringSafeForFilename(trackComposer) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == trackComment)
-		[customPath replaceOccurrencesOfString:@"{trackComment}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{trackComment}" withString:makeStringSafeForFilename(trackComment) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	if(nil == sourceFilename)
-		[customPath replaceOccurrencesOfString:@"{sourceFilename}" withString:@"" options:0 range:NSMakeRange(0, [customPath length])];
-	else
-		[customPath replaceOccurrencesOfString:@"{sourceFilename}" withString:makeStringSafeForFilename(sourceFilename) options:0 range:NSMakeRange(0, [customPath length])];
-	
-	// Perform additional substitutions as necessary
-	if(nil != substitutions) {
-		NSEnumerator	*enumerator			= [substitutions keyEnumerator];
-		id				key;
-		
-		while((key = [enumerator nextObject]))
-			[customPath replaceOccurrencesOfString:[NSString stringWithFormat:@"{%@}", key] withString:makeStringSafeForFilename([substitutions valueForKey:key]) options:0 range:NSMakeRange(0, [customPath length])];
-	}
-	
-	basename = customPath;
-
-	return [[basename retain] autorelease];
+	values[kNamingSchemeKeywordDiscNumber]		= (nil == discNumber ? @"" : [NSString stringWithFormat:@"%u", [discNumber intValue]]);
+	values[kNamingSchemeKeywordDiscTotal]		= (nil == discTotal ? @"" : [NSString stringWithFormat:@"%u", [discTotal intValue]]);
+	values[kNamingSchemeKeywordAlbumArtist]		= (nil == albumArtist ? NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") : albumArtist);
+	values[kNamingSchemeKeywordAlbumTitle]		= (nil == albumTitle ? @"Unknown Disc" : albumTitle);
+	values[kNamingSchemeKeywordAlbumGenre]		= (nil == albumGenre ? @"Unknown Genre" : albumGenre);
+	values[kNamingSchemeKeywordAlbumDate]		= (nil == albumYear ? @"Unknown Year" : [NSString stringWithFormat:@"%u", [albumYear intValue]]);
+	values[kNamingSchemeKeywordAlbumComposer]	= (nil == albumComposer ? @"Unknown Composer" : albumComposer);
+	values[kNamingSchemeKeywordAlbumComment]	= (nil == albumComment ? @"" : albumComment);
+	values[kNamingSchemeKeywordTrackNumber]		= (nil == trackNumber ? @"" : [NSString stringWithFormat:numberFormat, [trackNumber intValue]]);
+	values[kNamingSchemeKeywordTrackTotal]		= (nil == trackTotal ? @"" : [NSString stringWithFormat:numberFormat, [trackTotal intValue]]);
+	values[kNamingSchemeKeywordTrackArtist]		= (nil == trackArtist ? NSLocalizedStringFromTable(@"Unknown Artist", @"CompactDisc", @"") : trackArtist);
+	values[kNamingSchemeKeywordTrackTitle]		= (nil == trackTitle ? NSLocalizedStringFromTable(@"Unknown Track", @"CompactDisc", @"") : trackTitle);
+	values[kNamingSchemeKeywordTrackGenre]		= (nil == trackGenre ? @"Unknown Genre" : trackGenre);
+	values[kNamingSchemeKeywordTrackDate]		= (nil == trackYear ? @"Unknown Year" : trackYear);
+	values[kNamingSchemeKeywordTrackComposer]	= (nil == trackComposer ? @"Unknown Composer" : trackComposer);
+	values[kNamingSchemeKeywordTrackComment]	= (nil == trackComment ? @"" : trackComment);
+	values[kNamingSchemeKeywordSourceFilename]	= (nil == sourceFilename ? @"" : sourceFilename);
+	
+	// The scheme is parsed once, and the path rendered and made safe for the filesystem in a single pass
+	return [[NamingScheme namingSchemeWithString:customNamingScheme] stringWithValues:values substitutions:substitutions];
 }
 
 - (NSString *) generateStandardBasenameUsingMetadata:(AudioMetadata *)metadata
@@ -26,4 +26,13 @@
 - (NSDictionary *)	encoderSettings;
 - (void)			setEncoderSettings:(NSDictionary *)encoderSettings;
 
+// Tags for an encoder to write into the stream as it creates it; nil means the finished file will be tagged instead
+- (bycopy NSDictionary *)	streamTagsWithSettingsString:(NSString *)settingsString;
+
+// Called once the tags returned by streamTagsWithSettingsString: are in the output file
+- (void)					setTagsWrittenToStream:(BOOL)tagsWrittenToStream;
+
+// Properties of the encoded stream (such as its frame count or bitrate) to be stored in the finished file along with its tags
+- (void)					setEncodedStreamInfo:(bycopy NSDictionary *)encodedStreamInfo;
+
 @end
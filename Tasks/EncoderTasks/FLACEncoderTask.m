@@ -41,13 +41,11 @@
 	return nil;
 }
 
-- (void) writeTags
+- (NSDictionary *) tagsWithSettingsString:(NSString *)settingsString
 {
 	AudioMetadata								*metadata					= [[self taskInfo] metadata];
-	FLAC__Metadata_Chain						*chain						= NULL;
-	FLAC__Metadata_Iterator						*iterator					= NULL;
-	FLAC__StreamMetadata						*block						= NULL;
-	FLAC__bool									result;
+	NSMutableArray								*comments					= [NSMutableArray array];
+	NSMutableDictionary							*tags						= [NSMutableDictionary dictionary];
 	NSString									*bundleVersion				= nil;
 	NSString									*versionString				= nil;
 	NSNumber									*trackNumber				= nil;
@@ -70,7 +68,153 @@
 	NSString									*musicbrainzArtistId		= nil;
 	NSString									*musicbrainzAlbumArtistId	= nil;
 	NSString									*musicbrainzDiscId			= nil;
+	NSString									*mimeType					= nil;
+	NSData										*imageData					= nil;
+
+	// Album title
+	album = [metadata albumTitle];
+	if(nil != album)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"ALBUM"], album]];
+	
+	// Artist
+	artist = [metadata trackArtist];
+	if(nil == artist)
+		artist = [metadata albumArtist];
+	if(nil != artist)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"ARTIST"], artist]];
+
+	// Composer
+	composer = [metadata trackComposer];
+	if(nil == composer)
+		composer = [metadata albumComposer];
+	if(nil != composer)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"COMPOSER"], composer]];
+	
+	// Genre
+	genre = [metadata trackGenre];
+	if(nil == genre)
+		genre = [metadata albumGenre];
+	if(nil != genre)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"GENRE"], genre]];
+	
+	// Year
+	year = [metadata trackDate];
+	if(nil == year)
+		year = [metadata albumDate];
+	if(nil != year)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"DATE"], year]];
+	
+	// Comment
+	comment			= [metadata albumComment];
+	trackComment	= [metadata trackComment];
+	if(nil != trackComment)
+		comment = (nil == comment ? trackComment : [NSString stringWithFormat:@"%@\n%@", trackComment, comment]);
+	if([[[[self taskInfo] settings] objectForKey:@"saveSettingsInComment"] boolValue])
+		comment = (nil == comment ? settingsString : [comment stringByAppendingString:[NSString stringWithFormat:@"\n%@", settingsString]]);
+	if(nil != comment)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"DESCRIPTION"], comment]];
+	
+	// Track title
+	title = [metadata trackTitle];
+	if(nil != title)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"TITLE"], title]];
+	
+	// Track number
+	trackNumber = [metadata trackNumber];
+	if(nil != trackNumber)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"TRACKNUMBER"], trackNumber]];
+
+	// Total tracks
+	trackTotal = [metadata trackTotal];
+	if(nil != trackTotal)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"TRACKTOTAL"], trackTotal]];
+
+	// Compilation
+	compilation = [metadata compilation];
+	if(nil != compilation)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"COMPILATION"], compilation]];
+	
+	// Disc number
+	discNumber = [metadata discNumber];
+	if(nil != discNumber)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"DISCNUMBER"], discNumber]];
+	
+	// Discs in set
+	discTotal = [metadata discTotal];
+	if(nil != discTotal)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"DISCTOTAL"], discTotal]];
+	
+	// ISRC
+	isrc = [metadata ISRC];
+	if(nil != isrc)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"ISRC"], isrc]];
+
+	// MCN
+	mcn = [metadata MCN];
+	if(nil != mcn)
+		[comments addObject:[NSString stringWithFormat:@"%@=%@", [AudioMetadata customizeFLACTag:@"MCN"], mcn]];
+	
+	// MusicBrainz Track Id
+	musicbrainzTrackId = [metadata musicbrainzTrackId];
+	if(nil != musicbrainzTrackId)
+		[comments addObject:[NSString stringWithFormat:@"MUSICBRAINZ_TRACKID=%@", musicbrainzTrackId]];
+
+	// MusicBrainz Album Id
+	musicbrainzAlbumId = [metadata musicbrainzAlbumId];
+	if(nil != musicbrainzAlbumId)
+		[comments addObject:[NSString stringWithFormat:@"MUSICBRAINZ_ALBUMID=%@", musicbrainzAlbumId]];
+	
+	// MusicBrainz Artist Id
+	musicbrainzArtistId = [metadata musicbrainzArtistId];
+	if(nil != musicbrainzArtistId)
+		[comments addObject:[NSString stringWithFormat:@"MUSICBRAINZ_ARTISTID=%@", musicbrainzArtistId]];
+	
+	// MusicBrainz Album Artist Id
+	musicbrainzAlbumArtistId = [metadata musicbrainzAlbumArtistId];
+	if(nil != musicbrainzAlbumArtistId)
+		[comments addObject:[NSString stringWithFormat:@"MUSICBRAINZ_ALBUMARTISTID=%@", musicbrainzAlbumArtistId]];
+	
+	// MusicBrainz Disc Id
+	musicbrainzDiscId = [metadata discId];
+	if(nil != musicbrainzDiscId)
+		[comments addObject:[NSString stringWithFormat:@"MUSICBRAINZ_DISCID=%@", musicbrainzDiscId]];
+
+	// Encoded by
+	bundleVersion = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"];
+	versionString = [NSString stringWithFormat:@"Max %@", bundleVersion];
+	[comments addObject:[NSString stringWithFormat:@"ENCODER=%@", versionString]];
 
+	// Encoder settings
+	[comments addObject:[NSString stringWithFormat:@"ENCODING=%@", settingsString]];
+	
+	[tags setObject:comments forKey:@"comments"];
+	
+	// Add album art if present, passing JPEG and PNG through as they were read
+	imageData = [metadata albumArtDataForTags:&mimeType];
+	if(nil != imageData) {
+		NSBitmapImageRep	*bitmapRep		= [NSBitmapImageRep imageRepWithData:imageData];
+		
+		[tags setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+			mimeType, @"mimeType",
+			imageData, @"data",
+			[NSNumber numberWithUnsignedInt:[bitmapRep pixelsWide]], @"width",
+			[NSNumber numberWithUnsignedInt:[bitmapRep pixelsHigh]], @"height",
+			[NSNumber numberWithUnsignedInt:[bitmapRep bitsPerPixel]], @"depth",
+			nil] forKey:@"picture"];
+	}
+	
+	return tags;
+}
+
+// Used only when the encoder didn't write the tags as it created the file
+- (void) writeTags
+{
+	NSDictionary								*tags						= [self tagsWithSettingsString:[self encoderSettingsString]];
+	FLAC__Metadata_Chain						*chain						= NULL;
+	FLAC__Metadata_Iterator						*iterator					= NULL;
+	FLAC__StreamMetadata						*block						= NULL;
+	FLAC__bool									result;
+	FLAC__MetadataType							blockType;
 	
 	@try  {
 		chain = FLAC__metadata_chain_new();
@@ -84,213 +228,37 @@
 		iterator = FLAC__metadata_iterator_new();
 		NSAssert(NULL != iterator, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
+		// Remove any existing comment and picture blocks, leaving the iterator on the last block
 		FLAC__metadata_iterator_init(iterator, chain);
-
-		// Seek to the vorbis comment block if it exists
-		while(FLAC__METADATA_TYPE_VORBIS_COMMENT != FLAC__metadata_iterator_get_block_type(iterator)) {
+		for(;;) {
+			blockType = FLAC__metadata_iterator_get_block_type(iterator);
+			
+			if(FLAC__METADATA_TYPE_VORBIS_COMMENT == blockType || FLAC__METADATA_TYPE_PICTURE == blockType) {
+				result = FLAC__metadata_iterator_delete_block(iterator, NO);
+				NSAssert1(YES == result, @"FLAC__metadata_chain_status: %i", FLAC__metadata_chain_status(chain));
+			}
+			
 			if(NO == FLAC__metadata_iterator_next(iterator))
 				break; // Already at end
 		}
 		
-		// If there isn't a vorbis comment block add one
-		if(FLAC__METADATA_TYPE_VORBIS_COMMENT != FLAC__metadata_iterator_get_block_type(iterator)) {
-
-			// The padding block will be the last block if it exists; add the comment block before it
-			if(FLAC__METADATA_TYPE_PADDING == FLAC__metadata_iterator_get_block_type(iterator)) {
-				FLAC__metadata_iterator_prev(iterator);
-			}
-			
-			block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
-			NSAssert(NULL != block, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		// The padding block will be the last block if it exists; add the new blocks before it
+		if(FLAC__METADATA_TYPE_PADDING == FLAC__metadata_iterator_get_block_type(iterator))
+			FLAC__metadata_iterator_prev(iterator);
+		
+		if(nil != [tags objectForKey:@"picture"]) {
+			block = createPictureBlock([tags objectForKey:@"picture"]);
 			
-			// Add our metadata
 			result = FLAC__metadata_iterator_insert_block_after(iterator, block);
 			NSAssert1(YES == result, @"FLAC__metadata_chain_status: %i", FLAC__metadata_chain_status(chain));
+			
+			FLAC__metadata_iterator_prev(iterator);
 		}
-		else
-			block = FLAC__metadata_iterator_get_block(iterator);
-
-		// Album title
-		album = [metadata albumTitle];
-		if(nil != album)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"ALBUM"], album);
-		
-		// Artist
-		artist = [metadata trackArtist];
-		if(nil == artist)
-			artist = [metadata albumArtist];
-		if(nil != artist)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"ARTIST"], artist);
-
-		// Composer
-		composer = [metadata trackComposer];
-		if(nil == composer)
-			composer = [metadata albumComposer];
-		if(nil != composer)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"COMPOSER"], composer);
-		
-		// Genre
-		genre = [metadata trackGenre];
-		if(nil == genre)
-			genre = [metadata albumGenre];
-		if(nil != genre)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"GENRE"], genre);
-		
-		// Year
-		year = [metadata trackDate];
-		if(nil == year)
-			year = [metadata albumDate];
-		if(nil != year)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"DATE"], year);
-		
-		// Comment
-		comment			= [metadata albumComment];
-		trackComment	= [metadata trackComment];
-		if(nil != trackComment)
-			comment = (nil == comment ? trackComment : [NSString stringWithFormat:@"%@\n%@", trackComment, comment]);
-		if([[[[self taskInfo] settings] objectForKey:@"saveSettingsInComment"] boolValue])
-			comment = (nil == comment ? [self encoderSettingsString] : [comment stringByAppendingString:[NSString stringWithFormat:@"\n%@", [self encoderSettingsString]]]);
-		if(nil != comment)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"DESCRIPTION"], comment);
-		
-		// Track title
-		title = [metadata trackTitle];
-		if(nil != title)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"TITLE"], title);
-		
-		// Track number
-		trackNumber = [metadata trackNumber];
-		if(nil != trackNumber)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"TRACKNUMBER"], [trackNumber stringValue]);
-
-		// Total tracks
-		trackTotal = [metadata trackTotal];
-		if(nil != trackTotal)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"TRACKTOTAL"], [trackTotal stringValue]);
-
-		// Compilation
-		compilation = [metadata compilation];
-		if(nil != compilation)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"COMPILATION"], [compilation stringValue]);
-		
-		// Disc number
-		discNumber = [metadata discNumber];
-		if(nil != discNumber)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"DISCNUMBER"], [discNumber stringValue]);
-		
-		// Discs in set
-		discTotal = [metadata discTotal];
-		if(nil != discTotal)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"DISCTOTAL"], [discTotal stringValue]);
-		
-		// ISRC
-		isrc = [metadata ISRC];
-		if(nil != isrc)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"ISRC"], isrc);
-
-		// MCN
-		mcn = [metadata MCN];
-		if(nil != mcn)
-			addVorbisComment(block, [AudioMetadata customizeFLACTag:@"MCN"], mcn);
-		
-		// MusicBrainz Track Id
-		musicbrainzTrackId = [metadata musicbrainzTrackId];
-		if(nil != musicbrainzTrackId)
-			addVorbisComment(block, @"MUSICBRAINZ_TRACKID", musicbrainzTrackId);
-
-		// MusicBrainz Album Id
-		musicbrainzAlbumId = [metadata musicbrainzAlbumId];
-		if(nil != musicbrainzAlbumId)
-			addVorbisComment(block, @"MUSICBRAINZ_ALBUMID", musicbrainzAlbumId);
 		
-		// MusicBrainz Artist Id
-		musicbrainzArtistId = [metadata musicbrainzArtistId];
-		if(nil != musicbrainzArtistId)
-			addVorbisComment(block, @"MUSICBRAINZ_ARTISTID", musicbrainzArtistId);
+		block = createVorbisCommentBlock([tags objectForKey:@"comments"]);
 		
-		// MusicBrainz Album Artist Id
-		musicbrainzAlbumArtistId = [metadata musicbrainzAlbumArtistId];
-		if(nil != musicbrainzAlbumArtistId)
-			addVorbisComment(block, @"MUSICBRAINZ_ALBUMARTISTID", musicbrainzAlbumArtistId);
-		
-		// MusicBrainz Disc Id
-		musicbrainzDiscId = [metadata discId];
-		if(nil != musicbrainzDiscId)
-			addVorbisComment(block, @"MUSICBRAINZ_DISCID", musicbrainzDiscId);
-
-		// Encoded by
-		bundleVersion = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"];
-		versionString = [NSString stringWithFormat:@"Max %@", bundleVersion];
-		addVorbisComment(block, @"ENCODER", versionString);
-
-		// Encoder settings
-		addVorbisComment(block, @"ENCODING", [self encoderSettingsString]);
-		
-		// Add album art if present
-		if(nil != [metadata albumArt]) {
-			
-			FLAC__metadata_iterator_init(iterator, chain);
-			
-			// Seek to the picture block if it exists
-			while(FLAC__METADATA_TYPE_PICTURE != FLAC__metadata_iterator_get_block_type(iterator)) {
-				if(NO == FLAC__metadata_iterator_next(iterator))
-					break; // Already at end
-			}
-			
-			// If there isn't a picture block add one
-			if(FLAC__METADATA_TYPE_PICTURE != FLAC__metadata_iterator_get_block_type(iterator)) {
-								
-				block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PICTURE);
-				NSAssert(NULL != block, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
-				
-				// Add our metadata
-				result = FLAC__metadata_iterator_insert_block_after(iterator, block);
-				NSAssert1(YES == result, @"FLAC__metadata_chain_status: %i", FLAC__metadata_chain_status(chain));
-			}
-			else
-				block = FLAC__metadata_iterator_get_block(iterator);
-			
-			NSImage				*image						= [metadata albumArt];
-			NSEnumerator		*enumerator					= nil;
-			NSImageRep			*currentRepresentation		= nil;
-			NSBitmapImageRep	*bitmapRep					= nil;
-			NSData				*imageData					= nil;
-			const char			*errorDescription;
-			NSSize				size;
-			
-			enumerator = [[image representations] objectEnumerator];
-			while((currentRepresentation = [enumerator nextObject])) {
-				if([currentRepresentation isKindOfClass:[NSBitmapImageRep class]]) {
-					bitmapRep = (NSBitmapImageRep *)currentRepresentation;
-				}
-			}
-			
-			// Create a bitmap representation if one doesn't exist
-			if(nil == bitmapRep) {
-				size = [image size];
-				[image lockFocus];
-				bitmapRep = [[[NSBitmapImageRep alloc] initWithFocusedViewRect:NSMakeRect(0, 0, size.width, size.height)] autorelease];
-				[image unlockFocus];
-			}
-			
-			imageData	= [bitmapRep representationUsingType:NSPNGFileType properties:@{}];
-			
-			// Add the image data to the metadata block
- 			block->data.picture.type		= FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER;
-
-			result = FLAC__metadata_object_picture_set_mime_type(block, "image/png", YES);
-			NSAssert1(YES == result, @"FLAC__metadata_object_picture_set_mime_type: %i", FLAC__metadata_chain_status(chain));
-
-			result = FLAC__metadata_object_picture_set_data(block, [imageData bytes], [imageData length], YES);
-			NSAssert1(YES == result, @"FLAC__metadata_object_picture_set_data: %i", FLAC__metadata_chain_status(chain));
-
- 			block->data.picture.width		= [bitmapRep size].width;
- 			block->data.picture.height		= [bitmapRep size].height;
- 			block->data.picture.depth		= [bitmapRep bitsPerPixel];			
-
-			result = FLAC__metadata_object_picture_is_legal(block, &errorDescription);
-			NSAssert1(YES == result, @"FLAC__metadata_object_picture_is_legal: %s", errorDescription);
-		}
+		result = FLAC__metadata_iterator_insert_block_after(iterator, block);
+		NSAssert1(YES == result, @"FLAC__metadata_chain_status: %i", FLAC__metadata_chain_status(chain));
 		
 		// Sort the chain
 		FLAC__metadata_chain_sort_padding(chain);
@@ -135,7 +135,8 @@
 	NSNumber									*length						= nil;
 	TagLib::ID3v2::TextIdentificationFrame		*frame						= NULL;
 	TagLib::ID3v2::AttachedPictureFrame			*pictureFrame				= NULL;
-	NSImage										*albumArt					= nil;
+	TagLib::ID3v2::FrameList					frames;
+	NSString									*mimeType					= nil;
 	NSData										*data						= nil;
 	TagLib::RIFF::AIFF::File					f							([[self outputFilename] fileSystemRepresentation], false);
 	NSString									*bundleVersion				= nil;
@@ -152,6 +153,11 @@
 	
 	NSAssert(f.isValid(), NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
 	
+	// Start from an empty tag, so retagging doesn't duplicate frames or keep fields removed from the metadata
+	frames = f.tag()->frameList();
+	for(TagLib::ID3v2::FrameList::Iterator it = frames.begin(); it != frames.end(); ++it)
+		f.tag()->removeFrame(*it);
+	
 	// Use UTF-8 as the default encoding
 	(TagLib::ID3v2::FrameFactory::instance())->setDefaultTextEncoding(TagLib::String::UTF8);
 	
@@ -299,13 +305,12 @@
 	}
 	
 	// Album art
-	albumArt = [metadata albumArt];
-	if(nil != albumArt) {
-		data			= getPNGDataForImage(albumArt); 
+	data = [metadata albumArtDataForTags:&mimeType];
+	if(nil != data) {
 		pictureFrame	= new TagLib::ID3v2::AttachedPictureFrame();
 		NSAssert(NULL != pictureFrame, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		pictureFrame->setMimeType(TagLib::String("image/png", TagLib::String::Latin1));
+		pictureFrame->setMimeType(TagLib::String([mimeType UTF8String], TagLib::String::Latin1));
 		pictureFrame->setPicture(TagLib::ByteVector((const char *)[data bytes], [data length]));
 		f.tag()->addFrame(pictureFrame);
 	}
@@ -425,7 +430,8 @@
 	NSNumber									*length						= nil;
 	TagLib::ID3v2::TextIdentificationFrame		*frame						= NULL;
 	TagLib::ID3v2::AttachedPictureFrame			*pictureFrame				= NULL;
-	NSImage										*albumArt					= nil;
+	TagLib::ID3v2::FrameList					frames;
+	NSString									*mimeType					= nil;
 	NSData										*data						= nil;
 	TagLib::RIFF::WAV::File						f							([[self outputFilename] fileSystemRepresentation], false);
 	NSString									*bundleVersion				= nil;
@@ -442,6 +448,11 @@
 	
 	NSAssert(f.isValid(), NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
 	
+	// Start from an empty tag, so retagging doesn't duplicate frames or keep fields removed from the metadata
+	frames = f.tag()->frameList();
+	for(TagLib::ID3v2::FrameList::Iterator it = frames.begin(); it != frames.end(); ++it)
+		f.tag()->removeFrame(*it);
+	
 	// Use UTF-8 as the default encoding
 	(TagLib::ID3v2::FrameFactory::instance())->setDefaultTextEncoding(TagLib::String::UTF8);
 	
@@ -589,13 +600,12 @@
 	}
 	
 	// Album art
-	albumArt = [metadata albumArt];
-	if(nil != albumArt) {
-		data			= getPNGDataForImage(albumArt); 
+	data = [metadata albumArtDataForTags:&mimeType];
+	if(nil != data) {
 		pictureFrame	= new TagLib::ID3v2::AttachedPictureFrame();
 		NSAssert(NULL != pictureFrame, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 		
-		pictureFrame->setMimeType(TagLib::String("image/png", TagLib::String::Latin1));
+		pictureFrame->setMimeType(TagLib::String([mimeType UTF8String], TagLib::String::Latin1));
 		pictureFrame->setPicture(TagLib::ByteVector((const char *)[data bytes], [data length]));
 		f.tag()->addFrame(pictureFrame);
 	}
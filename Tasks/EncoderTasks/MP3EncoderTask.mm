@@ -66,7 +66,8 @@
 	NSNumber									*length						= nil;
 	TagLib::ID3v2::TextIdentificationFrame		*frame						= NULL;
 	TagLib::ID3v2::AttachedPictureFrame			*pictureFrame				= NULL;
-	NSImage										*albumArt					= nil;
+	TagLib::ID3v2::FrameList					frames;
+	NSString									*mimeType					= nil;
 	NSData										*data						= nil;
 	TagLib::MPEG::File							f							([[self outputFilename] fileSystemRepresentation], false);
 	NSString									*bundleVersion				= nil;
@@ -83,6 +84,13 @@
 	
 	NSAssert(f.isValid(), NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
 
+	// Start from empty tags, so retagging doesn't duplicate frames or keep fields removed from the metadata
+	f.strip(TagLib::MPEG::File::ID3v1 | TagLib::MPEG::File::APE);
+	
+	frames = f.ID3v2Tag()->frameList();
+	for(TagLib::ID3v2::FrameList::Iterator it = frames.begin(); it != frames.end(); ++it)
+		f.ID3v2Tag()->removeFrame(*it);
+
 	// Use UTF-8 as the default encoding
 	(TagLib::ID3v2::FrameFactory::instance())->setDefaultTextEncoding(TagLib::String::UTF8);
 	
@@ -235,13 +243,12 @@
 	}
 	
 	// Album art
-	albumArt = [metadata albumArt];
-	if(nil != albumArt) {
-		data			= getPNGDataForImage(albumArt); 
+	data = [metadata albumArtDataForTags:&mimeType];
+	if(nil != data) {
 		pictureFrame	= new TagLib::ID3v2::AttachedPictureFrame();
 		NSAssert(NULL != pictureFrame, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
 
-		pictureFrame->setMimeType(TagLib::String("image/png", TagLib::String::Latin1));
+		pictureFrame->setMimeType(TagLib::String([mimeType UTF8String], TagLib::String::Latin1));
 		pictureFrame->setPicture(TagLib::ByteVector((const char *)[data bytes], [data length]));
 		f.ID3v2Tag()->addFrame(pictureFrame);
 	}
@@ -72,6 +72,9 @@
 
 		f = new CAPETag(chars);
 		NSAssert(NULL != f, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+		
+		// Start from an empty tag, so retagging doesn't keep fields removed from the metadata
+		f->ClearFields();
 
 		// Album title
 		album = [metadata albumTitle];
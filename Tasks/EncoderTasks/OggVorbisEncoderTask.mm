@@ -64,9 +64,15 @@
 	NSString									*musicbrainzDiscId			= nil;
 	NSString									*bundleVersion, *versionString;
 	TagLib::Ogg::Vorbis::File					f						([[self outputFilename] fileSystemRepresentation], false);
+	TagLib::Ogg::FieldListMap					fields;
 
 	NSAssert(f.isValid(), NSLocalizedStringFromTable(@"Unable to open the output file for tagging.", @"Exceptions", @""));
 
+	// Start from an empty comment, so retagging doesn't keep fields removed from the metadata
+	fields = f.tag()->fieldListMap();
+	for(TagLib::Ogg::FieldListMap::Iterator it = fields.begin(); it != fields.end(); ++it)
+		f.tag()->removeField(it->first);
+	
 	// Album title
 	album = [metadata albumTitle];
 	if(nil != album)
@@ -0,0 +1,57 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#import <Cocoa/Cocoa.h>
+
+// An on-disk cache of encoded audio, so converting the same audio with the same settings again only requires tagging a copy
+// Entries are keyed by a description of the source audio and the encoder settings, and the least recently used are evicted
+// once the cache grows beyond the transcodeCacheSize default (in megabytes)
+// The cache is only used from the main thread, but files are copied in and out on a serial queue of its own
+@interface TranscodeCache : NSObject
+{
+	NSMutableDictionary		*_entries;
+	NSOperationQueue		*_fileQueue;
+	unsigned long long		_totalSize;
+	NSUInteger				_hits;
+	NSUInteger				_misses;
+	BOOL					_dirty;
+}
+
++ (TranscodeCache *)	sharedCache;
+
+// Returns a string identifying the decoded audio in filename, or nil if it can't be determined without decoding the file
+// Only FLAC files, whose STREAMINFO block carries the MD5 of the decoded audio, are currently identifiable
++ (NSString *)			audioIdentifierForFile:(NSString *)filename;
+
+// Returns NO on a miss; otherwise copies the cached encode for key to filename and then sends selector to target
+// with the entry's settingsString and streamInfo, or with nil if the cached file could not be copied
+- (BOOL)				restoreEncodeForKey:(NSString *)key toFile:(NSString *)filename target:(id)target selector:(SEL)selector;
+
+// Stores a copy of the untagged encode in filename and then sends selector to target with nil
+// filename must not be modified until then
+- (void)				storeEncodeOfFile:(NSString *)filename forKey:(NSString *)key settingsString:(NSString *)settingsString streamInfo:(NSDictionary *)streamInfo target:(id)target selector:(SEL)selector;
+
+- (NSUInteger)			hits;
+- (NSUInteger)			misses;
+
+// Writes any changes to disk
+- (void)				synchronize;
+
+@end
@@ -0,0 +1,417 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#import "TranscodeCache.h"
+#import "UtilityFunctions.h"
+
+#include <CommonCrypto/CommonDigest.h>
+
+// Changes are written to disk this many seconds after the most recent one
+#define SYNCHRONIZE_DELAY		10.0
+
+// Increment whenever the archived form of the entries changes
+#define CACHE_VERSION			1
+
+static TranscodeCache		*sSharedCache			= nil;
+
+@interface TranscodeCache (Private)
+- (NSString *)			cacheFilename;
+- (NSString *)			cacheDirectory;
+- (unsigned long long)	sizeLimit;
+- (void)				removeEntryNamed:(NSString *)name;
+- (void)				evictEntriesToSize:(unsigned long long)size;
+- (void)				queueCopy:(NSMutableDictionary *)request;
+- (void)				copyFile:(NSMutableDictionary *)request;
+- (void)				removeFile:(NSString *)path;
+- (void)				didRestoreEncode:(NSDictionary *)request;
+- (void)				didStoreEncode:(NSDictionary *)request;
+- (void)				scheduleSynchronize;
+- (void)				applicationWillTerminate:(NSNotification *)aNotification;
+@end
+
+// Keys are long, so entries and their files are named by the MD5 of the key
+static NSString *
+entryNameForKey(NSString *key)
+{
+	NSData				*keyData		= [key dataUsingEncoding:NSUTF8StringEncoding];
+	NSMutableString		*name			= [NSMutableString string];
+	unsigned char		digest			[ CC_MD5_DIGEST_LENGTH ];
+	unsigned			i;
+	
+	CC_MD5([keyData bytes], (CC_LONG)[keyData length], digest);
+	
+	for(i = 0; i < CC_MD5_DIGEST_LENGTH; ++i)
+		[name appendFormat:@"%02x", digest[i]];
+	
+	return name;
+}
+
+@implementation TranscodeCache
+
++ (TranscodeCache *) sharedCache
+{
+	@synchronized(self) {
+		if(nil == sSharedCache)
+			sSharedCache = [[self alloc] init];
+	}
+	
+	return sSharedCache;
+}
+
++ (NSString *) audioIdentifierForFile:(NSString *)filename
+{
+	NSParameterAssert(nil != filename);
+	
+	FLAC__StreamMetadata	streamInfo;
+	NSMutableString			*identifier;
+	BOOL					haveMD5			= NO;
+	unsigned				i;
+	
+	if(0 == (kFLACMetadataBlockStreamInfo & getFLACMetadataBlockTypes(filename)))
+		return nil;
+	
+	if(NO == FLAC__metadata_get_streaminfo([filename fileSystemRepresentation], &streamInfo))
+		return nil;
+	
+	identifier = [NSMutableString stringWithString:@"flac:"];
+	for(i = 0; i < 16; ++i) {
+		[identifier appendFormat:@"%02x", streamInfo.data.stream_info.md5sum[i]];
+		haveMD5 |= (0 != streamInfo.data.stream_info.md5sum[i]);
+	}
+	
+	// Encoders that don't compute the MD5 leave it zeroed
+	if(NO == haveMD5)
+		return nil;
+	
+	[identifier appendFormat:@":%u:%u:%u:%qu", 
+		streamInfo.data.stream_info.sample_rate, 
+		streamInfo.data.stream_info.channels, 
+		streamInfo.data.stream_info.bits_per_sample, 
+		streamInfo.data.stream_info.total_samples];
+	
+	return identifier;
+}
+
+- (id) init
+{
+	if((self = [super init])) {
+		NSData			*data			= [NSData dataWithContentsOfFile:[self cacheFilename]];
+		NSDictionary	*archive		= nil;
+		NSEnumerator	*enumerator		= nil;
+		NSDictionary	*entry			= nil;
+		
+		// A cache that can't be read is simply rebuilt
+		if(nil != data) {
+			@try {
+				archive = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+			}
+			
+			@catch(NSException *exception) {
+				NSLog(@"Unable to read the transcode cache: %@", [exception reason]);
+			}
+		}
+		
+		if(CACHE_VERSION == [[archive objectForKey:@"version"] intValue]) {
+			_entries	= [[archive objectForKey:@"entries"] mutableCopy];
+			_hits		= [[archive objectForKey:@"hits"] unsignedIntegerValue];
+			_misses		= [[archive objectForKey:@"misses"] unsignedIntegerValue];
+		}
+		
+		if(nil == _entries)
+			_entries = [[NSMutableDictionary alloc] init];
+		
+		// Copies and removals run in the order they were requested, so a file is never removed while being copied
+		_fileQueue = [[NSOperationQueue alloc] init];
+		[_fileQueue setMaxConcurrentOperationCount:1];
+		
+		enumerator = [_entries objectEnumerator];
+		while((entry = [enumerator nextObject]))
+			_totalSize += [[entry objectForKey:@"size"] unsignedLongLongValue];
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationWillTerminate:) name:NSApplicationWillTerminateNotification object:nil];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	
+	[_entries release];		_entries = nil;
+	[_fileQueue release];	_fileQueue = nil;
+	
+	[super dealloc];
+}
+
+- (BOOL) restoreEncodeForKey:(NSString *)key toFile:(NSString *)filename target:(id)target selector:(SEL)selector
+{
+	NSParameterAssert(nil != key);
+	NSParameterAssert(nil != filename);
+	NSParameterAssert(nil != target);
+	
+	NSString				*name			= entryNameForKey(key);
+	NSDictionary			*entry			= [_entries objectForKey:name];
+	NSMutableDictionary		*request		= nil;
+	
+	if(nil == entry || NO == [key isEqualToString:[entry objectForKey:@"key"]]) {
+		++_misses;
+		_dirty = YES;
+		[self scheduleSynchronize];
+		return NO;
+	}
+	
+	request = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+		name, @"name",
+		entry, @"entry",
+		[[self cacheDirectory] stringByAppendingPathComponent:[entry objectForKey:@"file"]], @"source",
+		filename, @"destination",
+		target, @"target",
+		NSStringFromSelector(selector), @"selector",
+		NSStringFromSelector(@selector(didRestoreEncode:)), @"completion",
+		nil];
+	
+	[self queueCopy:request];
+	
+	return YES;
+}
+
+- (void) storeEncodeOfFile:(NSString *)filename forKey:(NSString *)key settingsString:(NSString *)settingsString streamInfo:(NSDictionary *)streamInfo target:(id)target selector:(SEL)selector
+{
+	NSParameterAssert(nil != filename);
+	NSParameterAssert(nil != key);
+	NSParameterAssert(nil != target);
+	
+	NSString				*name			= entryNameForKey(key);
+	NSString				*file			= [name stringByAppendingPathExtension:[filename pathExtension]];
+	NSDictionary			*attributes		= [[NSFileManager defaultManager] fileAttributesAtPath:filename traverseLink:YES];
+	unsigned long long		size			= [[attributes objectForKey:NSFileSize] unsignedLongLongValue];
+	NSMutableDictionary		*entry			= nil;
+	NSMutableDictionary		*request		= nil;
+	
+	entry = [NSMutableDictionary dictionary];
+	
+	[entry setObject:key forKey:@"key"];
+	[entry setObject:file forKey:@"file"];
+	[entry setObject:[NSNumber numberWithUnsignedLongLong:size] forKey:@"size"];
+	
+	if(nil != settingsString)
+		[entry setObject:settingsString forKey:@"settingsString"];
+	if(nil != streamInfo)
+		[entry setObject:streamInfo forKey:@"streamInfo"];
+	
+	request = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+		name, @"name",
+		entry, @"entry",
+		filename, @"source",
+		[[self cacheDirectory] stringByAppendingPathComponent:file], @"destination",
+		target, @"target",
+		NSStringFromSelector(selector), @"selector",
+		NSStringFromSelector(@selector(didStoreEncode:)), @"completion",
+		nil];
+	
+	// Nothing is copied, but the caller still hears back once control returns to the run loop
+	if(nil == attributes || [self sizeLimit] < size) {
+		[request setObject:[NSNumber numberWithBool:NO] forKey:@"result"];
+		[self performSelector:@selector(didStoreEncode:) withObject:request afterDelay:0];
+		return;
+	}
+	
+	[self removeEntryNamed:name];
+	[self queueCopy:request];
+}
+
+- (NSUInteger)		hits						{ return _hits; }
+- (NSUInteger)		misses						{ return _misses; }
+
+- (void) synchronize
+{
+	NSData		*data		= nil;
+	
+	if(NO == _dirty)
+		return;
+	
+	data	= [NSKeyedArchiver archivedDataWithRootObject:[NSDictionary dictionaryWithObjectsAndKeys:
+		[NSNumber numberWithInt:CACHE_VERSION], @"version",
+		_entries, @"entries",
+		[NSNumber numberWithUnsignedInteger:_hits], @"hits",
+		[NSNumber numberWithUnsignedInteger:_misses], @"misses",
+		nil]];
+	_dirty	= NO;
+	
+	if(NO == [data writeToFile:[self cacheFilename] atomically:YES])
+		NSLog(@"Unable to write the transcode cache");
+}
+
+@end
+
+@implementation TranscodeCache (Private)
+
+- (NSString *)	cacheFilename			{ return [getApplicationDataDirectory() stringByAppendingPathComponent:@"Transcode Cache"]; }
+
+- (NSString *) cacheDirectory
+{
+	NSString	*directory		= [getApplicationDataDirectory() stringByAppendingPathComponent:@"Transcode Cache Files"];
+	BOOL		isDir;
+	
+	if(NO == [[NSFileManager defaultManager] fileExistsAtPath:directory isDirectory:&isDir])
+		[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+	
+	return directory;
+}
+
+- (unsigned long long) sizeLimit
+{
+	return (unsigned long long)[[NSUserDefaults standardUserDefaults] integerForKey:@"transcodeCacheSize"] * 1024 * 1024;
+}
+
+- (void) removeEntryNamed:(NSString *)name
+{
+	NSDictionary	*entry		= [_entries objectForKey:name];
+	
+	if(nil == entry)
+		return;
+	
+	[_fileQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(removeFile:) object:[[self cacheDirectory] stringByAppendingPathComponent:[entry objectForKey:@"file"]]] autorelease]];
+	
+	_totalSize -= [[entry objectForKey:@"size"] unsignedLongLongValue];
+	[_entries removeObjectForKey:name];
+	_dirty = YES;
+}
+
+// Least recently used entries go first
+- (void) evictEntriesToSize:(unsigned long long)size
+{
+	NSSortDescriptor	*sortDescriptor		= nil;
+	NSArray				*entries			= nil;
+	NSUInteger			i;
+	
+	if(_totalSize <= size)
+		return;
+	
+	sortDescriptor	= [[[NSSortDescriptor alloc] initWithKey:@"lastUsed" ascending:YES] autorelease];
+	entries			= [[_entries allValues] sortedArrayUsingDescriptors:[NSArray arrayWithObject:sortDescriptor]];
+	
+	for(i = 0; i < [entries count] && size < _totalSize; ++i)
+		[self removeEntryNamed:entryNameForKey([[entries objectAtIndex:i] objectForKey:@"key"])];
+}
+
+- (void) queueCopy:(NSMutableDictionary *)request
+{
+	[_fileQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(copyFile:) object:request] autorelease]];
+}
+
+// Runs on the file queue; the result is handed back to the main thread, where the entries are kept
+- (void) copyFile:(NSMutableDictionary *)request
+{
+	NSAutoreleasePool		*pool				= [[NSAutoreleasePool alloc] init];
+	NSFileManager			*fileManager		= [[[NSFileManager alloc] init] autorelease];
+	NSString				*destination		= [request objectForKey:@"destination"];
+	BOOL					result;
+	
+	// The destination is either the placeholder for the output file or a stale cache file, and must be replaced
+	if([fileManager fileExistsAtPath:destination])
+		[fileManager removeItemAtPath:destination error:nil];
+	
+	// Don't leave a partial copy behind
+	result = [fileManager copyItemAtPath:[request objectForKey:@"source"] toPath:destination error:nil];
+	if(NO == result && [fileManager fileExistsAtPath:destination])
+		[fileManager removeItemAtPath:destination error:nil];
+	
+	[request setObject:[NSNumber numberWithBool:result] forKey:@"result"];
+	
+	[self performSelectorOnMainThread:NSSelectorFromString([request objectForKey:@"completion"]) withObject:request waitUntilDone:NO];
+	
+	[pool release];
+}
+
+// Runs on the file queue
+- (void) removeFile:(NSString *)path
+{
+	NSAutoreleasePool		*pool				= [[NSAutoreleasePool alloc] init];
+	
+	[[[[NSFileManager alloc] init] autorelease] removeItemAtPath:path error:nil];
+	
+	[pool release];
+}
+
+- (void) didRestoreEncode:(NSDictionary *)request
+{
+	NSString				*name			= [request objectForKey:@"name"];
+	NSMutableDictionary		*entry			= nil;
+	
+	// The cached file has gone missing
+	if(NO == [[request objectForKey:@"result"] boolValue]) {
+		if([_entries objectForKey:name] == [request objectForKey:@"entry"])
+			[self removeEntryNamed:name];
+		++_misses;
+	}
+	else {
+		entry = [[[request objectForKey:@"entry"] mutableCopy] autorelease];
+		[entry setObject:[NSDate date] forKey:@"lastUsed"];
+		
+		// The entry may have been evicted or replaced during the copy
+		if([_entries objectForKey:name] == [request objectForKey:@"entry"])
+			[_entries setObject:entry forKey:name];
+		++_hits;
+	}
+	
+	_dirty = YES;
+	[self scheduleSynchronize];
+	
+	[[request objectForKey:@"target"] performSelector:NSSelectorFromString([request objectForKey:@"selector"]) withObject:entry];
+}
+
+- (void) didStoreEncode:(NSDictionary *)request
+{
+	NSString				*name			= [request objectForKey:@"name"];
+	NSMutableDictionary		*entry			= [request objectForKey:@"entry"];
+	NSDictionary			*existing		= [_entries objectForKey:name];
+	
+	if([[request objectForKey:@"result"] boolValue]) {
+		// Another encode with the same key finished first and its file was just overwritten
+		if(nil != existing)
+			_totalSize -= [[existing objectForKey:@"size"] unsignedLongLongValue];
+		
+		[entry setObject:[NSDate date] forKey:@"lastUsed"];
+		[_entries setObject:entry forKey:name];
+		_totalSize += [[entry objectForKey:@"size"] unsignedLongLongValue];
+		
+		[self evictEntriesToSize:[self sizeLimit]];
+		
+		_dirty = YES;
+		[self scheduleSynchronize];
+	}
+	
+	[[request objectForKey:@"target"] performSelector:NSSelectorFromString([request objectForKey:@"selector"]) withObject:nil];
+}
+
+- (void) scheduleSynchronize
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronize) object:nil];
+	[self performSelector:@selector(synchronize) withObject:nil afterDelay:SYNCHRONIZE_DELAY];
+}
+
+- (void) applicationWillTerminate:(NSNotification *)aNotification
+{
+	[self synchronize];
+}
+
+@end
@@ -59,11 +59,16 @@
 	NSString									*bundleVersion;
     WavpackContext								*wpc					= NULL;
 	char										error [80];
+	char										item [256];
 	int											result;
 		
 	wpc = WavpackOpenFileInput([[self outputFilename] fileSystemRepresentation], error, OPEN_EDIT_TAGS, 0);
 	NSAssert(NULL != wpc, NSLocalizedStringFromTable(@"Unable to open the output file.", @"Exceptions", @""));
 	
+	// Start from an empty tag, so retagging doesn't keep items removed from the metadata
+	while(0 < WavpackGetNumTagItems(wpc) && 0 < WavpackGetTagItemIndexed(wpc, 0, item, sizeof(item)) && WavpackDeleteTagItem(wpc, item))
+		;
+	
 	// Album title
 	album = [metadata albumTitle];
 	if(nil != album)
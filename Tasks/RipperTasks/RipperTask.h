@@ -31,6 +31,7 @@
 	NSArray					*_tracks;
 	NSMutableArray			*_sectors;
 	NSString				*_deviceName;
+	NSDictionary			*_ripMetrics;
 }
 
 - (id)				initWithTracks:(NSArray *)tracks;
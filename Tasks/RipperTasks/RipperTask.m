@@ -28,6 +28,7 @@
 
 @interface RipperTask (Private)
 - (void)	touchOutputFile;
+- (void)	saveRipMetrics;
 @end
 
 @implementation RipperTask
@@ -71,6 +72,7 @@
 	[_sectors release],		_sectors = nil;	
 	[_tracks release],		_tracks = nil;	
 	[_phase release],		_phase = nil;
+	[_ripMetrics release],	_ripMetrics = nil;
 	
 	[super dealloc];
 }
@@ -83,6 +85,9 @@
 - (NSString *)			phase									{ return [[_phase retain] autorelease]; }
 - (void)				setPhase:(NSString *)phase				{ [_phase release]; _phase = [phase retain]; }
 
+- (NSDictionary *)		ripMetrics								{ return [[_ripMetrics retain] autorelease]; }
+- (void)				setRipMetrics:(NSDictionary *)ripMetrics	{ [_ripMetrics release]; _ripMetrics = [ripMetrics copy]; }
+
 - (void) run
 {
 	NSPort			*port1			= [NSPort port];
@@ -144,6 +149,10 @@
 		[track setRipInProgress:NO];
 	}
 	
+	if(nil != [self ripMetrics]) {
+		[self saveRipMetrics];
+	}
+	
 	[[RipperController sharedController] ripperTaskDidComplete:self];
 }
 
@@ -195,4 +204,39 @@
 	NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to create the output file.", @"Exceptions", @""));	
 }
 
+// Metrics are written as XML property lists, one file per rip
+// The log is only kept in the log window (and saved wherever the user chooses), so there is no rip log file
+// to put them beside; they go in the application data directory instead, named by disc ID, first track and start time
+- (void) saveRipMetrics
+{
+	NSMutableDictionary		*metrics		= [NSMutableDictionary dictionaryWithDictionary:[self ripMetrics]];
+	NSString				*directory		= [getApplicationDataDirectory() stringByAppendingPathComponent:@"Rip Metrics"];
+	NSString				*discID			= [[[[self objectInTracksAtIndex:0] document] disc] discID];
+	NSDateFormatter			*formatter		= [[[NSDateFormatter alloc] init] autorelease];
+	NSString				*filename;
+	NSData					*data;
+	NSString				*error			= nil;
+
+	[formatter setDateFormat:@"yyyyMMdd-HHmmss"];
+	
+	[metrics setValue:discID forKey:@"discID"];
+	[metrics setValue:[_tracks valueForKey:@"number"] forKey:@"tracks"];
+	[metrics setValue:[[self startTime] description] forKey:@"startTime"];
+	
+	filename	= [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%@-%02lu-%@.plist", (nil != discID ? discID : @"unknown"), (unsigned long)[[self objectInTracksAtIndex:0] number], [formatter stringFromDate:[self startTime]]]];
+	data		= [NSPropertyListSerialization dataFromPropertyList:metrics format:NSPropertyListXMLFormat_v1_0 errorDescription:&error];
+	
+	// Failing to save the metrics shouldn't affect the rip
+	if(nil == data) {
+		NSLog(@"Unable to serialize rip metrics: %@", [error autorelease]);
+		return;
+	}
+	
+	validateAndCreateDirectory(directory);
+	
+	if(NO == [data writeToFile:filename atomically:YES]) {
+		NSLog(@"Unable to save rip metrics to %@", filename);
+	}
+}
+
 @end
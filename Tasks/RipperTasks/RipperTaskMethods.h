@@ -26,4 +26,8 @@
 - (NSString *)		phase;
 - (void)			setPhase:(NSString *)phase;
 
+// Timing and drive statistics gathered by the ripper, if it collects them
+- (NSDictionary *)	ripMetrics;
+- (void)			setRipMetrics:(bycopy NSDictionary *)ripMetrics;
+
 @end
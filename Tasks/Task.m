@@ -19,6 +19,7 @@
  */
 
 #import "Task.h"
+#import "UtilityFunctions.h"
 
 @interface Task (Private)
 - (void)		deleteOutputFile;
@@ -118,6 +119,7 @@
 	if([[NSFileManager defaultManager] fileExistsAtPath:[self outputFilename]]) {
 		BOOL			result			= [[NSFileManager defaultManager] removeItemAtPath:[self outputFilename] error:nil];
 		NSAssert(YES == result, NSLocalizedStringFromTable(@"Unable to delete the output file.", @"Exceptions", @"") );
+		releaseUniqueFilename([self outputFilename]);
 	}
 }
 
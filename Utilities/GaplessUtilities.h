@@ -20,18 +20,21 @@
 
 #import <Cocoa/Cocoa.h>
 
+#include <mp4v2/mp4v2.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 		
 	// Add the appropriate iTunSMPB atom for AAC gapless playback in iTunes
-	void addMPEG4AACGaplessInformationAtom(NSString		*filename, 
-										   SInt64		totalFrames);
+	// The atom is written when file is closed, along with any other changes
+	void addMPEG4AACGaplessInformationAtom(MP4FileHandle	file, 
+										   SInt64			totalFrames);
 
 	// Add the appropriate Encoding Params atom for AAC accurate bitrate in iTunes
-	void addMPEG4AACBitrateInformationAtom(NSString		*filename, 
-										   UInt32		bitrate,
-										   int			bitrateMode);
+	void addMPEG4AACBitrateInformationAtom(MP4FileHandle	file, 
+										   UInt32			bitrate,
+										   int				bitrateMode);
 	
 #ifdef __cplusplus
 }
@@ -20,16 +20,10 @@
 
 #import "GaplessUtilities.h"
 
-#include <mp4v2/mp4v2.h>
-
 void 
-addMPEG4AACGaplessInformationAtom(NSString *filename, SInt64 totalFrames)
+addMPEG4AACGaplessInformationAtom(MP4FileHandle file, SInt64 totalFrames)
 {
-	NSCParameterAssert(nil != filename);
-	
-	MP4FileHandle file = MP4Modify([filename fileSystemRepresentation], MP4_DETAILS_ERROR, 0);
-	if(file == MP4_INVALID_FILE_HANDLE)
-		return;
+	NSCParameterAssert(MP4_INVALID_FILE_HANDLE != file);
 
 	MP4ItmfItem *smpb = MP4ItmfItemAlloc("----", 1);
 	smpb->mean = strdup("com.apple.iTunes");
@@ -53,18 +47,12 @@ addMPEG4AACGaplessInformationAtom(NSString *filename, SInt64 totalFrames)
 	// Add to mp4 file
 	MP4ItmfAddItem(file, smpb);	
 	MP4ItmfItemFree(smpb);
-	
-	MP4Close(file);
 }
 
 void 
-addMPEG4AACBitrateInformationAtom(NSString *filename, UInt32 bitrate, int bitrateMode)
+addMPEG4AACBitrateInformationAtom(MP4FileHandle file, UInt32 bitrate, int bitrateMode)
 {
-	NSCParameterAssert(nil != filename);
-	
-	MP4FileHandle file = MP4Modify([filename fileSystemRepresentation], MP4_DETAILS_ERROR, 0);
-	if(file == MP4_INVALID_FILE_HANDLE)
-		return;
+	NSCParameterAssert(MP4_INVALID_FILE_HANDLE != file);
 	
 	MP4ItmfItem *smpb = MP4ItmfItemAlloc("----", 1);
 	smpb->mean = strdup("com.apple.iTunes");
@@ -108,6 +96,4 @@ addMPEG4AACBitrateInformationAtom(NSString *filename, UInt32 bitrate, int bitrat
 	// Add to mp4 file
 	MP4ItmfAddItem(file, smpb);	
 	MP4ItmfItemFree(smpb);
-	
-	MP4Close(file);
 }
@@ -0,0 +1,68 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+// The {keywords} a naming scheme may contain
+enum {
+	kNamingSchemeKeywordDiscNumber			= 0,
+	kNamingSchemeKeywordDiscTotal			= 1,
+	kNamingSchemeKeywordAlbumArtist			= 2,
+	kNamingSchemeKeywordAlbumTitle			= 3,
+	kNamingSchemeKeywordAlbumGenre			= 4,
+	kNamingSchemeKeywordAlbumDate			= 5,
+	kNamingSchemeKeywordAlbumComposer		= 6,
+	kNamingSchemeKeywordAlbumComment		= 7,
+	kNamingSchemeKeywordTrackNumber			= 8,
+	kNamingSchemeKeywordTrackTotal			= 9,
+	kNamingSchemeKeywordTrackArtist			= 10,
+	kNamingSchemeKeywordTrackTitle			= 11,
+	kNamingSchemeKeywordTrackGenre			= 12,
+	kNamingSchemeKeywordTrackDate			= 13,
+	kNamingSchemeKeywordTrackComposer		= 14,
+	kNamingSchemeKeywordTrackComment		= 15,
+	kNamingSchemeKeywordSourceFilename		= 16,
+	
+	kNamingSchemeKeywordCount				= 17
+};
+typedef NSUInteger NamingSchemeKeyword;
+
+// A naming scheme such as "{albumArtist}/{albumTitle}/{trackNumber} {trackTitle}" parsed into
+// alternating runs of literal text and keywords, so a path is produced in a single pass
+@interface NamingScheme : NSObject
+{
+	NSString		*_scheme;
+	NSArray			*_tokens;
+}
+
+// Parsed schemes are kept, since the same few are used for every file
++ (NamingScheme *)	namingSchemeWithString:(NSString *)scheme;
+
+- (id)				initWithString:(NSString *)scheme;
+
+- (NSString *)		scheme;
+
+// values holds kNamingSchemeKeywordCount entries; keywords whose value is nil are left as written
+// Keywords that aren't standard are looked up in substitutions
+// Every substituted value is made safe for use as a filename
+- (NSString *)		stringWithValues:(NSString * const *)values substitutions:(NSDictionary *)substitutions;
+
+@end
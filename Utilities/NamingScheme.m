@@ -0,0 +1,186 @@
+/*
+ *  $Id$
+ *
+ *  Copyright (C) 2005 - 2007 Stephen F. Booth <me@sbooth.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#import "NamingScheme.h"
+#import "UtilityFunctions.h"
+
+static NSMutableDictionary		*sNamingSchemes				= nil;
+static NSCharacterSet			*sUnsafeCharacters			= nil;
+
+// Indexed by NamingSchemeKeyword
+static NSString * const sKeywords [ kNamingSchemeKeywordCount ] = {
+	@"discNumber", @"discTotal",
+	@"albumArtist", @"albumTitle", @"albumGenre", @"albumDate", @"albumComposer", @"albumComment",
+	@"trackNumber", @"trackTotal", @"trackArtist", @"trackTitle", @"trackGenre", @"trackDate", @"trackComposer", @"trackComment",
+	@"sourceFilename"
+};
+
+// Equivalent to appending makeStringSafeForFilename(string), without a copy in the common case
+static void
+appendStringSafeForFilename(NSMutableString *result, NSString *string)
+{
+	if(NSNotFound == [string rangeOfCharacterFromSet:sUnsafeCharacters].location)
+		[result appendString:string];
+	else
+		[result appendString:makeStringSafeForFilename(string)];
+}
+
+@implementation NamingScheme
+
++ (void) initialize
+{
+	if([NamingScheme class] == self) {
+		sNamingSchemes		= [[NSMutableDictionary alloc] init];
+		sUnsafeCharacters	= [[NSCharacterSet characterSetWithCharactersInString:@"\"\\/<>?:*|"] retain];
+	}
+}
+
++ (NamingScheme *) namingSchemeWithString:(NSString *)scheme
+{
+	NSParameterAssert(nil != scheme);
+	
+	NamingScheme *namingScheme = nil;
+	
+	@synchronized(self) {
+		namingScheme = [sNamingSchemes objectForKey:scheme];
+		if(nil == namingScheme) {
+			namingScheme = [[NamingScheme alloc] initWithString:scheme];
+			[sNamingSchemes setObject:namingScheme forKey:scheme];
+			[namingScheme release];
+		}
+		
+		[[namingScheme retain] autorelease];
+	}
+	
+	return namingScheme;
+}
+
+- (id) initWithString:(NSString *)scheme
+{
+	NSParameterAssert(nil != scheme);
+	
+	if((self = [super init])) {
+		NSMutableArray		*tokens			= [NSMutableArray array];
+		NSMutableString		*literal		= [NSMutableString string];
+		NSUInteger			length			= [scheme length];
+		NSUInteger			location		= 0;
+		NSRange				open, close;
+		NSString			*keyword;
+		NamingSchemeKeyword	i;
+		
+		_scheme = [scheme copy];
+		
+		// Literal text is stored as an NSString, standard keywords as an NSNumber and other keywords as a one-element NSArray
+		while(location < length) {
+			open = [scheme rangeOfString:@"{" options:NSLiteralSearch range:NSMakeRange(location, length - location)];
+			if(NSNotFound == open.location) {
+				[literal appendString:[scheme substringFromIndex:location]];
+				break;
+			}
+			
+			close = [scheme rangeOfString:@"}" options:NSLiteralSearch range:NSMakeRange(open.location + 1, length - open.location - 1)];
+			if(NSNotFound == close.location) {
+				[literal appendString:[scheme substringFromIndex:location]];
+				break;
+			}
+			
+			[literal appendString:[scheme substringWithRange:NSMakeRange(location, open.location - location)]];
+			
+			keyword		= [scheme substringWithRange:NSMakeRange(open.location + 1, close.location - open.location - 1)];
+			location	= NSMaxRange(close);
+			
+			// A stray '{' is literal text
+			if(0 == [keyword length] || NSNotFound != [keyword rangeOfString:@"{"].location) {
+				[literal appendString:@"{"];
+				location = open.location + 1;
+				continue;
+			}
+			
+			if(0 != [literal length]) {
+				[tokens addObject:[[literal copy] autorelease]];
+				[literal setString:@""];
+			}
+			
+			for(i = 0; i < kNamingSchemeKeywordCount; ++i) {
+				if([keyword isEqualToString:sKeywords[i]])
+					break;
+			}
+			
+			if(kNamingSchemeKeywordCount != i)
+				[tokens addObject:[NSNumber numberWithUnsignedInteger:i]];
+			else
+				[tokens addObject:[NSArray arrayWithObject:keyword]];
+		}
+		
+		if(0 != [literal length])
+			[tokens addObject:[[literal copy] autorelease]];
+		
+		_tokens = [tokens copy];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_scheme release];		_scheme = nil;
+	[_tokens release];		_tokens = nil;
+	
+	[super dealloc];
+}
+
+- (NSString *)		scheme							{ return [[_scheme retain] autorelease]; }
+
+- (NSString *) stringWithValues:(NSString * const *)values substitutions:(NSDictionary *)substitutions
+{
+	NSParameterAssert(NULL != values);
+	
+	NSMutableString		*result		= [NSMutableString stringWithCapacity:2 * [_scheme length]];
+	NSString			*value;
+	NSString			*keyword;
+	id					token;
+	
+	for(token in _tokens) {
+		if([token isKindOfClass:[NSString class]])
+			[result appendString:token];
+		else if([token isKindOfClass:[NSNumber class]]) {
+			value = values[[token unsignedIntegerValue]];
+			
+			if(nil != value)
+				appendStringSafeForFilename(result, value);
+			else
+				[result appendFormat:@"{%@}", sKeywords[[token unsignedIntegerValue]]];
+		}
+		else {
+			keyword		= [token objectAtIndex:0];
+			value		= [substitutions valueForKey:keyword];
+			
+			if(nil != value)
+				appendStringSafeForFilename(result, value);
+			else
+				[result appendFormat:@"{%@}", keyword];
+		}
+	}
+	
+	return [[result copy] autorelease];
+}
+
+@end
@@ -38,6 +38,18 @@ enum OggStreamType {
 };
 typedef enum OggStreamType OggStreamType;
 
+// Metadata blocks present in a FLAC file; bit n corresponds to FLAC__MetadataType n
+enum {
+	kFLACMetadataBlockStreamInfo		= 1 << FLAC__METADATA_TYPE_STREAMINFO,
+	kFLACMetadataBlockPadding			= 1 << FLAC__METADATA_TYPE_PADDING,
+	kFLACMetadataBlockApplication		= 1 << FLAC__METADATA_TYPE_APPLICATION,
+	kFLACMetadataBlockSeekTable			= 1 << FLAC__METADATA_TYPE_SEEKTABLE,
+	kFLACMetadataBlockVorbisComment		= 1 << FLAC__METADATA_TYPE_VORBIS_COMMENT,
+	kFLACMetadataBlockCueSheet			= 1 << FLAC__METADATA_TYPE_CUESHEET,
+	kFLACMetadataBlockPicture			= 1 << FLAC__METADATA_TYPE_PICTURE
+};
+typedef uint32_t FLACMetadataBlockTypes;
+
 	
 // Get data directory (~/Application Support/Max/)
 NSString * getApplicationDataDirectory();
@@ -52,6 +64,9 @@ NSString * makeStringSafeForFilename(NSString *string);
 NSString * generateUniqueFilename(NSString *basename, 
 								  NSString *extension);
 
+// Release the name generateUniqueFilename returned, once the file has been created or deleted
+void releaseUniqueFilename(NSString *filename);
+
 // Create path if it does not exist; throw an exception if it exists and is a file
 void validateAndCreateDirectory(NSString *path);
 
@@ -72,9 +87,17 @@ void addVorbisComment(FLAC__StreamMetadata		*block,
 					  NSString					*key,
 					  NSString					*value);
 
+// Create FLAC metadata blocks from tags in the form passed to encoders (an array of "NAME=value" strings, 
+// and a dictionary describing a front cover image); the caller owns the returned block
+FLAC__StreamMetadata * createVorbisCommentBlock(NSArray *comments);
+FLAC__StreamMetadata * createPictureBlock(NSDictionary *picture);
+
 // Determine the type of audio contained in an ogg stream
 OggStreamType oggStreamType(NSString *filename);
 
+// Determine the type of audio contained in an ogg stream from the first bytes of the file
+OggStreamType oggStreamTypeForHeader(const uint8_t *header, NSUInteger length);
+
 // Convert an NSImage to PNG data
 NSData * getPNGDataForImage(NSImage *image);
 
@@ -96,6 +119,15 @@ NSString * generateTemporaryFilename(NSString *directory,
 
 // Returns YES if the file at pathname contains an embedded cue sheet
 BOOL fileContainsEmbeddedCueSheet(NSString *pathname);
+
+// Returns the number of threads an encoder may split a single file across: the larger of the format's "threads"
+// setting and the encoderThreadsPerFile default, limited to the number of cores
+unsigned getEncoderThreadCount(NSDictionary *settings);
+
+// Returns the types of metadata blocks in the FLAC file at pathname, or 0 if it is not a FLAC file
+// Only the block headers are read, so this is much cheaper than reading a metadata chain
+// Callers that go on to read block bodies should walk the blocks with a FLAC__Metadata_SimpleIterator instead
+FLACMetadataBlockTypes getFLACMetadataBlockTypes(NSString *pathname);
 	
 #ifdef __cplusplus
 }
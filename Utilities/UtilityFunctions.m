@@ -26,6 +26,10 @@
 #include <Security/AuthSession.h>
 
 #include <sys/param.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
 
 #include <sndfile/sndfile.h>
 #include <ogg/ogg.h>
@@ -38,6 +42,78 @@ static NSArray				*sAudioExtensions		= nil;
 static NSArray				*sLibsndfileExtensions	= nil;
 static NSArray				*sBuiltinExtensions		= nil;
 
+// Output directory listings used by generateUniqueFilename, keyed by directory
+static NSMutableDictionary	*sDirectoryIndexes		= nil;
+static pthread_mutex_t		sDirectoryIndexesMutex	= PTHREAD_MUTEX_INITIALIZER;
+
+// A listing is reread after this many seconds, so changes made by others are eventually noticed
+#define DIRECTORY_INDEX_LIFETIME		30.0
+
+// Names handed out but possibly not yet created survive a reread for this many seconds
+#define RESERVATION_LIFETIME			5.0
+
+// Names are compared decomposed, and case-insensitively unless the volume is case-sensitive
+static NSString *
+directoryIndexKeyForFilename(NSString *filename, BOOL caseSensitive)
+{
+	NSString *key = [filename decomposedStringWithCanonicalMapping];
+	return (caseSensitive ? key : [key lowercaseString]);
+}
+
+// Returns the index for directory, reading the directory once if the index is missing or old
+// Must be called with sDirectoryIndexesMutex locked
+static NSMutableDictionary *
+directoryIndexForDirectory(NSString *directory)
+{
+	NSMutableDictionary		*index			= [sDirectoryIndexes objectForKey:directory];
+	NSMutableSet			*names			= nil;
+	NSMutableDictionary		*reservations	= nil;
+	NSString				*name			= nil;
+	NSString				*key			= nil;
+	DIR						*dir			= NULL;
+	struct dirent			*entry			= NULL;
+	BOOL					caseSensitive;
+	
+	if(nil != index && DIRECTORY_INDEX_LIFETIME > -[[index objectForKey:@"date"] timeIntervalSinceNow])
+		return index;
+	
+	dir = opendir([directory fileSystemRepresentation]);
+	if(NULL == dir)
+		return nil;
+	
+	caseSensitive = (1 == fpathconf(dirfd(dir), _PC_CASE_SENSITIVE));
+	
+	names = [NSMutableSet set];
+	while((entry = readdir(dir))) {
+		name = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:entry->d_name length:entry->d_namlen];
+		if(nil != name)
+			[names addObject:directoryIndexKeyForFilename(name, caseSensitive)];
+	}
+	closedir(dir);
+	
+	// Reservations whose files now exist are covered by the listing
+	reservations = [NSMutableDictionary dictionary];
+	for(key in [index objectForKey:@"reservations"]) {
+		NSDate *date = [[index objectForKey:@"reservations"] objectForKey:key];
+		if(NO == [names containsObject:key] && RESERVATION_LIFETIME > -[date timeIntervalSinceNow])
+			[reservations setObject:date forKey:key];
+	}
+	
+	index = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+		names, @"names",
+		reservations, @"reservations",
+		[NSNumber numberWithBool:caseSensitive], @"caseSensitive",
+		[NSDate date], @"date",
+		nil];
+	
+	if(nil == sDirectoryIndexes)
+		sDirectoryIndexes = [[NSMutableDictionary alloc] init];
+	
+	[sDirectoryIndexes setObject:index forKey:directory];
+	
+	return index;
+}
+
 NSString *
 getApplicationDataDirectory()
 {
@@ -66,8 +142,10 @@ getApplicationDataDirectory()
 void 
 createDirectoryStructure(NSString *path)
 {
-	NSString		*pathPart;
-	NSArray			*pathComponents		= [path pathComponents];
+	NSString			*pathPart;
+	NSArray				*pathComponents		= [path pathComponents];
+	NSMutableArray		*directories		= [NSMutableArray array];
+	BOOL				isDir;
 	
 	if(1 < [pathComponents count]) {
 		NSUInteger		directoryCount		= [pathComponents count] - 1;
@@ -79,17 +157,26 @@ createDirectoryStructure(NSString *path)
 		else {
 			pathPart = [pathComponents objectAtIndex:0];
 		}		
-		validateAndCreateDirectory(pathPart);
+		[directories addObject:pathPart];
 		
 		// Iterate through all the components
 		for(NSUInteger i = 1; i < directoryCount - 1; ++i) {
 			pathPart = [NSString stringWithFormat:@"%@/%@", pathPart, makeStringSafeForFilename([pathComponents objectAtIndex:i])];				
-			validateAndCreateDirectory(pathPart);
+			[directories addObject:pathPart];
 		}
 		
 		// Ignore trailing '/'
 		if(NO == [[pathComponents objectAtIndex:directoryCount - 1] isEqualToString:@"/"]) {
 			pathPart = [NSString stringWithFormat:@"%@/%@", pathPart, makeStringSafeForFilename([pathComponents objectAtIndex:directoryCount - 1])];
+			[directories addObject:pathPart];
+		}
+		
+		// Usually the output directory already exists, and one stat is enough to tell
+		if([[NSFileManager defaultManager] fileExistsAtPath:[directories lastObject] isDirectory:&isDir] && isDir) {
+			return;
+		}
+		
+		for(pathPart in directories) {
 			validateAndCreateDirectory(pathPart);
 		}
 	}
@@ -117,21 +204,100 @@ NSString *
 generateUniqueFilename(NSString *basename, NSString *extension)
 {
 	NSFileManager		*manager			= [NSFileManager defaultManager];
-	unsigned			num					= 1;
-	NSString			*result;
+	NSString			*directory			= [basename stringByDeletingLastPathComponent];
+	NSString			*name				= [basename lastPathComponent];
+	NSMutableDictionary	*index;
+	NSMutableSet		*names;
+	NSMutableDictionary	*reservations;
+	NSString			*candidate;
+	NSString			*candidatePath;
+	NSString			*key;
+	BOOL				caseSensitive;
+	unsigned			num					= 0;
+	NSString			*result				= nil;
+	
+	// Names are chosen from a listing of the directory instead of probing name-1, name-2, ... one at a time.
+	// Handing out each name under the lock also keeps concurrent tasks from choosing the same one.
+	pthread_mutex_lock(&sDirectoryIndexesMutex);
+	
+	index = directoryIndexForDirectory(directory);
+	if(nil != index) {
+		names			= [index objectForKey:@"names"];
+		reservations	= [index objectForKey:@"reservations"];
+		caseSensitive	= [[index objectForKey:@"caseSensitive"] boolValue];
+		
+		for(;; ++num) {
+			if(0 == num)
+				candidate = [NSString stringWithFormat:@"%@.%@", name, extension];
+			else
+				candidate = [NSString stringWithFormat:@"%@-%u.%@", name, num, extension];
+			
+			candidatePath	= [directory stringByAppendingPathComponent:candidate];
+			key				= directoryIndexKeyForFilename(candidate, caseSensitive);
+			
+			if(nil != [reservations objectForKey:key])
+				continue;
+			
+			// The unadorned name is the one most likely to have been deleted since the listing, e.g. when overwriting
+			if([names containsObject:key]) {
+				if(0 != num || [manager fileExistsAtPath:candidatePath])
+					continue;
+				[names removeObject:key];
+			}
+			// The listing may predate files created by others
+			else if([manager fileExistsAtPath:candidatePath]) {
+				[names addObject:key];
+				continue;
+			}
+			
+			[reservations setObject:[NSDate date] forKey:key];
+			result = candidatePath;
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&sDirectoryIndexesMutex);
+	
+	if(nil != result)
+		return [[result retain] autorelease];
 	
+	// The directory couldn't be read, so fall back to probing
 	result = [NSString stringWithFormat:@"%@.%@", basename, extension];
-	for(;;) {
+	for(num = 1;; ++num) {
 		if(NO == [manager fileExistsAtPath:result]) {
 			break;
 		}
 		result = [NSString stringWithFormat:@"%@-%u.%@", basename, num, extension];
-		++num;
 	}
 	
 	return [[result retain] autorelease];
 }
 
+void
+releaseUniqueFilename(NSString *filename)
+{
+	NSMutableDictionary	*index;
+	NSString			*key;
+	
+	pthread_mutex_lock(&sDirectoryIndexesMutex);
+	
+	// Only an index that has already been read can hold a reservation
+	index = [sDirectoryIndexes objectForKey:[filename stringByDeletingLastPathComponent]];
+	if(nil != index) {
+		key = directoryIndexKeyForFilename([filename lastPathComponent], [[index objectForKey:@"caseSensitive"] boolValue]);
+		
+		[[index objectForKey:@"reservations"] removeObjectForKey:key];
+		
+		// Record whether the file was created or deleted, so the name is handed out again only if it is free
+		if([[NSFileManager defaultManager] fileExistsAtPath:filename])
+			[[index objectForKey:@"names"] addObject:key];
+		else
+			[[index objectForKey:@"names"] removeObject:key];
+	}
+	
+	pthread_mutex_unlock(&sDirectoryIndexesMutex);
+}
+
 void
 validateAndCreateDirectory(NSString *path)
 {
@@ -238,6 +404,58 @@ addVorbisComment(FLAC__StreamMetadata		*block,
 	NSCAssert1(YES == result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"FLAC__metadata_object_vorbiscomment_append_comment");	
 }
 
+FLAC__StreamMetadata *
+createVorbisCommentBlock(NSArray *comments)
+{
+	FLAC__StreamMetadata						*block;
+	FLAC__StreamMetadata_VorbisComment_Entry	entry;
+	FLAC__bool									result;
+	NSString									*comment;
+	
+	block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
+	NSCAssert(NULL != block, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+	
+	for(comment in comments) {
+		entry.entry		= (FLAC__byte *)[comment UTF8String];
+		entry.length	= (FLAC__uint32)strlen((const char *)entry.entry);
+		
+		result = FLAC__metadata_object_vorbiscomment_append_comment(block, entry, YES);
+		NSCAssert1(YES == result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"FLAC__metadata_object_vorbiscomment_append_comment");	
+	}
+	
+	return block;
+}
+
+FLAC__StreamMetadata *
+createPictureBlock(NSDictionary *picture)
+{
+	FLAC__StreamMetadata		*block;
+	FLAC__bool					result;
+	NSData						*data;
+	const char					*errorDescription;
+	
+	block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PICTURE);
+	NSCAssert(NULL != block, NSLocalizedStringFromTable(@"Unable to allocate memory.", @"Exceptions", @""));
+	
+	data						= [picture objectForKey:@"data"];
+	block->data.picture.type	= FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER;
+	
+	result = FLAC__metadata_object_picture_set_mime_type(block, (char *)[[picture objectForKey:@"mimeType"] UTF8String], YES);
+	NSCAssert1(YES == result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"FLAC__metadata_object_picture_set_mime_type");
+	
+	result = FLAC__metadata_object_picture_set_data(block, (FLAC__byte *)[data bytes], (FLAC__uint32)[data length], YES);
+	NSCAssert1(YES == result, NSLocalizedStringFromTable(@"The call to %@ failed.", @"Exceptions", @""), @"FLAC__metadata_object_picture_set_data");
+	
+	block->data.picture.width	= [[picture objectForKey:@"width"] unsignedIntValue];
+	block->data.picture.height	= [[picture objectForKey:@"height"] unsignedIntValue];
+	block->data.picture.depth	= [[picture objectForKey:@"depth"] unsignedIntValue];
+	
+	result = FLAC__metadata_object_picture_is_legal(block, &errorDescription);
+	NSCAssert1(YES == result, @"FLAC__metadata_object_picture_is_legal: %s", errorDescription);
+	
+	return block;
+}
+
 OggStreamType 
 oggStreamType(NSString *filename)
 {
@@ -346,6 +564,42 @@ oggStreamType(NSString *filename)
 	return streamType;
 }
 
+OggStreamType
+oggStreamTypeForHeader(const uint8_t *header, NSUInteger length)
+{
+	const uint8_t		*packet;
+	NSUInteger			segmentCount, packetLength, i;
+	
+	// The first page must start the stream
+	if(27 > length || 0 != memcmp(header, "OggS", 4) || 0 != header[4] || 0 == (0x02 & header[5]))
+		return kOggStreamTypeInvalid;
+	
+	segmentCount = header[26];
+	if(27 + segmentCount > length)
+		return kOggStreamTypeInvalid;
+	
+	// The first packet follows the segment table
+	packetLength = 0;
+	for(i = 0; i < segmentCount; ++i) {
+		packetLength += header[27 + i];
+		if(255 > header[27 + i])
+			break;
+	}
+	
+	packet = header + 27 + segmentCount;
+	if(27 + segmentCount + packetLength > length)
+		packetLength = length - (27 + segmentCount);
+	
+	if(7 <= packetLength && 0x01 == packet[0] && 0 == memcmp(packet + 1, "vorbis", 6))
+		return kOggStreamTypeVorbis;
+	else if(8 <= packetLength && 0 == memcmp(packet, "Speex   ", 8))
+		return kOggStreamTypeSpeex;
+	else if(9 <= packetLength && 0x7F == packet[0] && 0 == memcmp(packet + 1, "FLAC", 4))
+		return kOggStreamTypeFLAC;
+	
+	return kOggStreamTypeUnknown;
+}
+
 NSData *
 getPNGDataForImage(NSImage *image)
 {
@@ -529,45 +783,64 @@ fileContainsEmbeddedCueSheet(NSString *pathname)
 	if(NO == [[[pathname pathExtension] lowercaseString] isEqualToString:@"flac"])
 		return NO;
 	
-	FLAC__Metadata_Chain		*chain		= NULL;
-	FLAC__Metadata_Iterator		*iterator	= NULL;
-	FLAC__StreamMetadata		*block		= NULL;
-	BOOL						found		= NO;
+	return (0 != (kFLACMetadataBlockCueSheet & getFLACMetadataBlockTypes(pathname)));
+}
+
+unsigned
+getEncoderThreadCount(NSDictionary *settings)
+{
+	unsigned	threads		= [[settings objectForKey:@"threads"] unsignedIntValue];
 	
-	chain = FLAC__metadata_chain_new();
-	NSCAssert(NULL != chain, @"Unable to allocate memory.");
+	// Parallel encoding must be requested explicitly, for one format or for all of them
+	threads = MAX(threads, (unsigned)MAX(0, [[NSUserDefaults standardUserDefaults] integerForKey:@"encoderThreadsPerFile"]));
 	
-	if(NO == FLAC__metadata_chain_read(chain, [pathname fileSystemRepresentation])) {		
-		FLAC__metadata_chain_delete(chain);
-		return NO;
-	}
+	return MAX(1U, MIN(threads, (unsigned)[[NSProcessInfo processInfo] activeProcessorCount]));
+}
+
+FLACMetadataBlockTypes
+getFLACMetadataBlockTypes(NSString *pathname)
+{
+	NSCParameterAssert(nil != pathname);
 	
-	iterator = FLAC__metadata_iterator_new();
-	NSCAssert(NULL != iterator, @"Unable to allocate memory.");
+	FLACMetadataBlockTypes		blockTypes		= 0;
+	unsigned char				buf [10];
+	off_t						offset			= 0;
+	BOOL						lastBlock		= NO;
+	int							fd;
+	
+	fd = open([pathname fileSystemRepresentation], O_RDONLY);
+	if(-1 == fd)
+		return 0;
+	
+	// Skip an ID3v2 tag, if present; its size is a syncsafe integer that excludes the header and footer
+	if(10 == pread(fd, buf, 10, 0) && 'I' == buf[0] && 'D' == buf[1] && '3' == buf[2]) {
+		offset = 10 + ((buf[6] & 0x7F) << 21 | (buf[7] & 0x7F) << 14 | (buf[8] & 0x7F) << 7 | (buf[9] & 0x7F));
+		if(0x10 & buf[5])
+			offset += 10;
+	}
 	
-	FLAC__metadata_iterator_init(iterator, chain);
+	if(4 != pread(fd, buf, 4, offset) || 0 != memcmp(buf, "fLaC", 4)) {
+		close(fd);
+		return 0;
+	}
+	offset += 4;
 	
-	do {
-		block = FLAC__metadata_iterator_get_block(iterator);
-		
-		if(NULL == block)
+	// Each metadata block header is 1 bit last-block flag, 7 bits type and 24 bits length
+	while(NO == lastBlock) {
+		if(4 != pread(fd, buf, 4, offset)) {
+			blockTypes = 0;
 			break;
-		
-		switch(block->type) {					
-			case FLAC__METADATA_TYPE_STREAMINFO:					break;
-			case FLAC__METADATA_TYPE_CUESHEET:		found = YES;	break;
-			case FLAC__METADATA_TYPE_VORBIS_COMMENT:				break;
-			case FLAC__METADATA_TYPE_PICTURE:						break;
-			case FLAC__METADATA_TYPE_PADDING:						break;
-			case FLAC__METADATA_TYPE_APPLICATION:					break;
-			case FLAC__METADATA_TYPE_SEEKTABLE:						break;
-			case FLAC__METADATA_TYPE_UNDEFINED:						break;
-			default:												break;
 		}
-	} while(FLAC__metadata_iterator_next(iterator));
+		
+		lastBlock	= (0x80 & buf[0] ? YES : NO);
+		offset		+= 4 + (buf[1] << 16 | buf[2] << 8 | buf[3]);
+		
+		if(FLAC__METADATA_TYPE_UNDEFINED > (0x7F & buf[0]))
+			blockTypes |= 1 << (0x7F & buf[0]);
+	}
 	
-	FLAC__metadata_iterator_delete(iterator);
-	FLAC__metadata_chain_delete(chain);
+	close(fd);
 	
-	return found;
+	// A valid stream always begins with STREAMINFO
+	return (kFLACMetadataBlockStreamInfo & blockTypes ? blockTypes : 0);
 }